@@ -20,7 +20,9 @@ LOCAL_SRC_FILES := \
 	src/lock.c \
 	src/mus2mid.c \
 	src/patches.c \
+	src/cache.c \
 	src/reverb.c \
+	src/mix_kernels.c \
 	src/sample.c \
 	src/sf2.c \
 	src/mafm.c \
@@ -29,9 +29,11 @@ pub fn build(b: *std.Build) void {
         "src/lock.c",
         "src/wildmidi_lib.c",
         "src/reverb.c",
+        "src/mix_kernels.c",
         "src/gus_pat.c",
         "src/internal_midi.c",
         "src/patches.c",
+        "src/cache.c",
         "src/f_xmidi.c",
         "src/f_mus.c",
         "src/f_hmp.c",
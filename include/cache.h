@@ -0,0 +1,36 @@
+/*
+ * cache.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+struct _mdi;
+struct _WM_Context;
+
+extern int _WM_CacheSet(const char *dir, uint32_t max_kb);
+extern void _WM_CachePatchSet(struct _WM_Context *ctx);
+extern struct _mdi *_WM_CacheLoad(struct _WM_Context *ctx, const uint8_t *data,
+                                  uint32_t size, uint8_t probe);
+extern void _WM_CacheStore(struct _mdi *mdi, const uint8_t *data, uint32_t size);
+
+#endif /* __CACHE_H */
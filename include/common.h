@@ -31,15 +31,42 @@
 #endif
 #define MEM_CHUNK 8192
 
-extern int16_t _WM_MasterVolume;
-extern uint16_t _WM_SampleRate;
-extern uint16_t _WM_MixerOptions;
+struct _patch;
+struct _hndl;
 
-extern float _WM_reverb_room_width;  /* = 16.875f; */
-extern float _WM_reverb_room_length; /* = 22.5f;   */
+/*
+ * A synthesizer context: everything WildMidi_Init() used to keep in globals,
+ * the config's patch set, the output rate and the mixer options, so that
+ * several can be in use at once. Every song holds on to the one it was
+ * opened in (mdi->ctx). The legacy API runs on a default one.
+ */
+struct _WM_Context {
+    uint16_t sample_rate;
+    uint16_t mixer_options;
+    uint16_t max_voices;
+    int16_t master_volume;
+
+    float reverb_room_width;  /* = 16.875f; */
+    float reverb_room_length; /* = 22.5f;   */
+
+    float reverb_listen_posx; /* = 8.4375f; */
+    float reverb_listen_posy; /* = 16.875f; */
+
+    int fix_release;
+    int auto_amp;
+    int auto_amp_with_amp;
+
+    struct _patch *patch[128];
+    void *sf2;                /* the soundfont, a tsf (sf2.c) */
+    uint8_t *op2_bank;        /* the GENMIDI FM bank (synth.c) */
+
+    void * (*buffer_file)(const char *, uint32_t *);
+    void   (*free_buffer_file)(void*);
 
-extern float _WM_reverb_listen_posx; /* = 8.4375f; */
-extern float _WM_reverb_listen_posy; /* = 16.875f; */
+    int lock;                 /* guards handles */
+    struct _hndl *handles;    /* the songs open in it */
+    uint32_t patch_set;       /* identifies the patch set to the cache */
+};
 
 extern void _cvt_reset_options (void);
 extern uint16_t _cvt_get_option (uint16_t tag);
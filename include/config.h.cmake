@@ -65,6 +65,9 @@
 /* define this to enable Yamaha MA-series FM synthesis for SMAF files */
 #cmakedefine WILDMIDI_MAFM 1
 
+/* define this to load a song's patches on worker threads */
+#cmakedefine WILDMIDI_THREADS 1
+
 /* Define if you have the <stdint.h> header file. */
 #cmakedefine HAVE_STDINT_H
 
@@ -24,6 +24,8 @@
 #ifndef __HMI_H
 #define __HMI_H
 
-extern struct _mdi *_WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size);
+extern struct _mdi *_WM_ParseNewHmi(struct _WM_Context *ctx,
+                                    const uint8_t *hmi_data, uint32_t hmi_size,
+                                    uint8_t probe);
 
 #endif /* __HMI_H */
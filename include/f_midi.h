@@ -24,7 +24,15 @@
 #ifndef __MIDI_H
 #define __MIDI_H
 
-extern struct _mdi *_WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size);
+extern struct _mdi *_WM_ParseNewMidi(struct _WM_Context *ctx,
+                                    const uint8_t *midi_data, uint32_t midi_size,
+                                     uint8_t probe);
 extern int _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize);
+/* a song opened with WM_MO_STREAM is parsed as it is played */
+extern int _WM_StreamMidi(struct _mdi *mdi, uint32_t sample, uint32_t tick);
+extern void _WM_StreamMidiAhead(struct _mdi *mdi, uint32_t sample);
+extern void _WM_StreamMidiStore(struct _mdi *mdi);
+extern uint32_t _WM_StreamMidiLength(struct _mdi *mdi);
+extern void _WM_FreeMidiStream(struct _mdi *mdi);
 
 #endif /* __MIDI_H */
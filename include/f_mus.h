@@ -24,6 +24,8 @@
 #ifndef __MUS_WM_H
 #define __MUS_WM_H
 
-extern struct _mdi *_WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size);
+extern struct _mdi *_WM_ParseNewMus(struct _WM_Context *ctx,
+                                    const uint8_t *mus_data, uint32_t mus_size,
+                                    uint8_t probe);
 
 #endif /* __MUS_WM_H */
@@ -24,6 +24,8 @@
 #ifndef __F_SMAF_H
 #define __F_SMAF_H
 
-extern struct _mdi *_WM_ParseNewSmaf(const uint8_t *smaf_data, uint32_t smaf_size);
+extern struct _mdi *_WM_ParseNewSmaf(struct _WM_Context *ctx,
+                                    const uint8_t *smaf_data, uint32_t smaf_size,
+                                     uint8_t probe);
 
 #endif /* __F_SMAF_H */
@@ -69,7 +69,9 @@ static float env_time_table[] = {
 };
 #endif /* !_WILDMIDI_LIB_C */
 
-extern struct _sample * _WM_load_gus_pat (const char *filename, int _fix_release);
+struct _WM_Context;
+
+extern struct _sample * _WM_load_gus_pat (struct _WM_Context *ctx, const char *filename);
 
 #endif /* __GUS_PAT_H */
 
@@ -44,6 +44,9 @@
 #define VIB_DEPTH_DEFAULT 50   /* cents at full wheel */
 #define VIB_DEPTH_MAX    600   /* clamp, same ceiling as TiMidity++ */
 
+/* voices a handle's pool grows by at a time */
+#define WM_VOICE_CHUNK   32
+
 struct _channel {
     uint8_t bank;
     struct _patch *patch;
@@ -65,6 +68,8 @@ struct _channel {
     int16_t mod_depth_range; /* RPN 5, vibrato depth at full wheel, in cents */
 };
 
+/* what an event handler is given: its event's channel, and its value or,
+   for text events, its string */
 struct _event_data {
     uint8_t channel;
     union Data {
@@ -73,36 +78,43 @@ struct _event_data {
     } data;
 };
 
+/*
+ * A voice. The fields the mixer reads on every block come first, so that on
+ * 64 bit hosts they share one cache line; the rest are only touched by
+ * MIDI events.
+ */
 struct _note {
-    uint16_t noteid;
-    uint8_t velocity;
-    struct _patch *patch;
-    struct _sample *sample;
     uint32_t sample_pos;
     uint32_t sample_inc;
-    int32_t env_inc;
-    uint8_t env;
     int32_t env_level;
-    uint8_t modes;
-    uint8_t hold;
-    uint8_t active;
-    struct _note *replay;
-    struct _note *next;
+    int32_t env_inc;
     uint32_t left_mix_volume;
     uint32_t right_mix_volume;
+    struct _sample *sample;
+    struct _note *next;
+    uint16_t noteid;
+    uint8_t env;
+    uint8_t modes;
     uint8_t is_off;
-    uint8_t ignore_chan_events;
+    uint8_t hold;
     /* Vibrato LFO. When vib_depth is zero the mixers skip all LFO work and
        sample_inc stays the plain unmodulated increment. */
-    int32_t vib_depth;    /* pitch swing at full LFO travel, in cents */
     uint16_t vib_phase;   /* 0..VIB_PHASE_MASK, wraps freely */
     uint16_t vib_inc;     /* phase advance per LFO update block */
+    int32_t vib_depth;    /* pitch swing at full LFO travel, in cents */
+    struct _note *replay;
+
+    struct _note *prev;
+    struct _patch *patch;
+    uint16_t voice;       /* index in the voice pool, see _WM_AllocNote() */
+    uint8_t velocity;
+    uint8_t ignore_chan_events;
 };
 
 struct _mdi;
 
+/* The opcodes of the event list, see _WM_do_event() */
 enum _event_type {
-    ev_null = -1,
     ev_midi_divisions,
     ev_note_off,
     ev_note_on,
@@ -147,33 +159,118 @@ enum _event_type {
     ev_meta_instrumentname,
     ev_meta_lyric,
     ev_meta_marker,
-    ev_meta_cuepoint
+    ev_meta_cuepoint,
+    ev_null = 0xff              /* ends the list */
 };
 
+/*
+ * An entry in the event list, packed to 12 bytes as long songs hold
+ * millions of them. Text events keep their string in mdi->event_text,
+ * value being its offset.
+ */
 struct _event {
-    enum _event_type evtype;
-    void (*do_event)(struct _mdi *mdi, struct _event_data *data);
-    struct _event_data event_data;
+    uint8_t evtype;             /* enum _event_type */
+    uint8_t channel;
+    uint32_t value;
     uint32_t samples_to_next;
-    uint32_t samples_to_next_fixed;
+};
+
+/*
+ * Song state just before events[event] runs, recorded as playback or a
+ * seek first passes that point; see _WM_Checkpoint(). The GUS notes are
+ * kept only where the caller had them at their true state, so that
+ * WildMidi_AccurateSeek() can pick them up from there.
+ */
+struct _checkpoint {
+    uint32_t event;
+    uint32_t sample;        /* song position of that event */
+    char *lyric;
+    struct _channel channel[16];
+    void *synth_state;      /* SF2 or FM synth channel state, or NULL */
+    /* copies of the playing notes, oldest first, each one with a pending
+       replay followed by it; NULL if not kept */
+    struct _note *notes;
+    uint32_t note_count;
+    uint32_t vib_block_count;   /* where the notes' vibrato LFO ticks */
+};
+
+/* seconds of song between checkpoints */
+#define WM_CHECKPOINT_SECS 30
+
+/*
+ * A tempo or time signature change, as the parser met it. Each carries the
+ * song's whole timing state from there on, so a lookup needs only the last
+ * change at or before the tick or sample it is after.
+ */
+struct _tempo_change {
+    uint32_t tick;
+    uint32_t sample;        /* song position of tick */
+    uint32_t tempo;         /* microseconds per quarter note */
+    uint32_t bar_tick;      /* where the time signature took effect ... */
+    uint32_t bar;           /* ... and the bar it started, from 0 */
+    uint8_t numerator;      /* time signature, beats per bar ... */
+    uint8_t denominator;    /* ... and the beat as a power of 2: 2 is 1/4 */
+};
+
+/*
+ * A control call on a song that found the renderer holding its lock; see
+ * WM_SendCmd(). seq says whose turn the slot is: the poster whose position
+ * it equals, or the reader once it is one past.
+ */
+#define WM_CMD_QUEUE 16 /* a power of 2 */
+
+struct _cmd {
+    uint32_t seq;
+    uint16_t type;
+    uint16_t arg[2];
 };
 
 struct _mdi {
     int lock;
+    uint32_t lock_waiting;  /* callers of WM_LockSong() waiting on it */
+    struct _WM_Context *ctx; /* the context the song was opened in */
+    /* control calls waiting to be applied by whoever holds the lock,
+       cmd_head posted by any thread, cmd_tail moved on under the lock and
+       checked by whoever lets go of it */
+    struct _cmd cmd[WM_CMD_QUEUE];
+    uint32_t cmd_head;
+    uint32_t cmd_tail;
     uint32_t samples_to_mix;
     struct _event *events;
     struct _event *current_event;
     uint32_t event_count;
     uint32_t events_size; /* try to stay optimally ahead to prevent reallocs */
+    char *event_text;       /* the text events' strings, end to end */
+    uint32_t event_text_len;
+    uint32_t event_text_size;
     struct _WM_Info extra_info;
     struct _WM_Info *tmp_info;
     uint16_t midi_master_vol;
     struct _channel channel[16];
+    /* the playing notes, oldest first; see _WM_AddNote() */
     struct _note *note;
-    struct _note note_table[2][16][128];
+    struct _note *note_tail;
+    /* the voices in use: the playing notes and the replays waiting on them */
+    uint32_t note_count;
+    /* the voice pool, grown WM_VOICE_CHUNK voices at a time as polyphony
+       needs them, and its unused voices linked through next */
+    struct _note **voice_chunk;
+    uint16_t voice_chunks;
+    struct _note *free_note;
+    /* the playing note of each channel and key, as its voice + 1, 0 if
+       none. A retriggered key's new note waits in that note's replay. */
+    uint16_t key_note[16][128];
 
     struct _patch **patches;
     uint32_t patch_count;
+    /* where in the song each patch was first found, in samples; for a
+       streamed song, the patches up to patches_ready are in and those up
+       to patches_ahead are being loaded on the worker pool by patch_jobs
+       loads; see _WM_load_patches_ahead() */
+    uint32_t *patch_due;
+    uint32_t patches_ready;
+    uint32_t patches_ahead;
+    uint32_t patch_jobs;
     int16_t amp;
 
     int32_t *mix_buffer;
@@ -187,6 +284,23 @@ struct _mdi {
     double dyn_vol_to_reach;
 
     uint8_t is_type2;
+    /* parsed for WildMidi_Probe(): no patches, synths or reverb */
+    uint8_t probe;
+
+    /* tempo and time signature changes, in song order; parse_tick is the
+       song position in ticks while it is parsed */
+    struct _tempo_change *tempo_map;
+    uint32_t tempo_map_count;
+    uint32_t tempo_map_size;
+    uint32_t divisions;
+    uint32_t parse_tick;
+
+    /* the parse of a song opened with WM_MO_STREAM, while there is more of
+       it to read, and then the file, until it is stored in the cache; see
+       _WM_StreamMidi() */
+    void *stream;
+    uint8_t *stream_file;
+    uint32_t stream_file_size;
 
     /* counts output samples toward the next vibrato LFO update; kept on the
        mdi so LFO phase stays continuous across output buffer boundaries */
@@ -194,6 +308,12 @@ struct _mdi {
 
     char *lyric;
 
+    /* seek checkpoints, in song order */
+    struct _checkpoint *checkpoints;
+    uint32_t checkpoint_count;
+    uint32_t checkpoints_size;
+    uint32_t checkpoint_next;   /* current_sample the next one is due at */
+
     void *sf2_synth; /* per-mdi TinySoundFont instance, NULL unless a soundfont is loaded */
     void *mafm_synth; /* per-mdi Yamaha FM instance, NULL unless a SMAF file carries custom voices */
 };
@@ -273,6 +393,9 @@ extern int _WM_midi_setup_tempo(struct _mdi *mdi, uint32_t setting);
  * Only non-standard midi event or non-track event setup functions need to be here
  */
 extern int _WM_midi_setup_divisions(struct _mdi *mdi, uint32_t divisions);
+extern uint32_t _WM_TickToSample(struct _mdi *mdi, uint32_t tick);
+extern uint32_t _WM_SampleToTick(struct _mdi *mdi, uint32_t sample);
+extern void _WM_TickToBarBeat(struct _mdi *mdi, uint32_t tick, struct _WM_BarBeat *pos);
 
 /* ===================== */
 
@@ -280,15 +403,26 @@ extern int _WM_midi_setup_divisions(struct _mdi *mdi, uint32_t divisions);
  * All other declarations
  */
 
-extern struct _mdi * _WM_initMDI(void);
+extern struct _mdi * _WM_initMDI(struct _WM_Context *ctx, uint8_t probe);
 extern void _WM_freeMDI(struct _mdi *mdi);
 extern uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t inlen, uint8_t running_event);
 extern void _WM_ResetToStart(struct _mdi *mdi);
+extern void _WM_do_event(struct _mdi *mdi, const struct _event *event);
+extern void _WM_Checkpoint(struct _mdi *mdi, struct _event *event, int notes);
+extern struct _event *_WM_RestoreCheckpoint(struct _mdi *mdi, uint32_t sample,
+                                            uint32_t event, int notes);
 extern void _WM_do_pan_adjust(struct _mdi *mdi, uint8_t ch);
 extern void _WM_do_note_off_extra(struct _note *nte);
+extern void _WM_CapVoices(struct _mdi *mdi);
+extern struct _note *_WM_AllocNote(struct _mdi *mdi);
+extern void _WM_FreeNote(struct _mdi *mdi, struct _note *nte);
+extern void _WM_AddNote(struct _mdi *mdi, struct _note *nte);
+extern void _WM_RemoveNote(struct _mdi *mdi, struct _note *nte);
+extern void _WM_ReplaceNote(struct _mdi *mdi, struct _note *nte, struct _note *with);
+extern void _WM_ClearNotes(struct _mdi *mdi);
 /* extern void _WM_DynamicVolumeAdjust(struct _mdi *mdi, int32_t *tmp_buffer, uint32_t buffer_used);*/
 extern void _WM_AdjustChannelVolumes(struct _mdi *mdi, uint8_t ch);
-extern float _WM_GetSamplesPerTick(uint32_t divisions, uint32_t tempo);
+extern float _WM_GetSamplesPerTick(uint16_t rate, uint32_t divisions, uint32_t tempo);
 
 #endif /* __INTERNAL_MIDI_H */
 
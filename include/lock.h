@@ -26,11 +26,46 @@
 #define __LOCK_H
 
 extern void _WM_Lock (int * wmlock);
+extern int _WM_TryLock (int * wmlock);
 extern void _WM_Unlock (int *wmlock);
+extern void _WM_AtomicWait (uint32_t *value, uint32_t busy);
 
 #if defined WM_NO_LOCK
 #define _WM_Lock(p) do {} while (0)
+#define _WM_TryLock(p) 1
 #define _WM_Unlock(p) do {} while (0)
+#define _WM_AtomicWait(p, v) do {} while (0)
 #endif
 
+/* loads acquire, stores release, and a swap that happens does both */
+extern uint32_t _WM_AtomicLoad (uint32_t *value);
+extern void _WM_AtomicStore (uint32_t *value, uint32_t set);
+extern int _WM_AtomicSwap (uint32_t *value, uint32_t expect, uint32_t set);
+extern void _WM_AtomicFence (void);
+/* the same for a pointer, and an exchange that hands back the old one */
+extern void *_WM_AtomicLoadPtr (void **value);
+extern void *_WM_AtomicExchangePtr (void **value, void *set);
+
+/* worker threads, where the build has them. Without, the caller does
+   all the work alone. */
+#ifdef WILDMIDI_THREADS
+extern void _WM_ThreadLock (void);
+extern void _WM_ThreadUnlock (void);
+extern unsigned int _WM_CPUCount (void);
+extern void _WM_RunThreads (void (*func)(void *), void *arg, unsigned int threads);
+extern void _WM_PoolRun (void (*func)(void *), void *arg, unsigned int threads);
+extern int _WM_PoolPost (void (*func)(void *), void *arg);
+extern void _WM_PoolStop (void);
+#else
+#define _WM_ThreadLock() do {} while (0)
+#define _WM_ThreadUnlock() do {} while (0)
+#define _WM_CPUCount() 1
+#define _WM_RunThreads(func, arg, threads) ((void) (threads), (func)(arg))
+#define _WM_PoolRun(func, arg, threads) ((void) (threads), (func)(arg))
+#define _WM_PoolPost(func, arg) ((void) (func), (void) (arg), 0)
+#define _WM_PoolStop() do {} while (0)
+#endif
+
+extern uint64_t _WM_Clock (void);
+
 #endif /* __LOCK_H */
@@ -46,6 +46,11 @@ void *_WM_MAFM_NewSynth(const uint8_t *smaf, uint32_t size, uint16_t rate);
 void  _WM_MAFM_FreeSynth(void *synth);
 void  _WM_MAFM_Reset(void *synth);
 
+/* Channel state for seek checkpoints.  SaveState returns a malloc()ed copy,
+ * or NULL; LoadState resets the synth to it. */
+void *_WM_MAFM_SaveState(void *synth);
+void  _WM_MAFM_LoadState(void *synth, const void *state);
+
 /* Translate a WildMIDI event to the synth. */
 void  _WM_MAFM_Event(void *synth, struct _mdi *mdi, struct _event *event);
 
@@ -57,7 +62,9 @@ int   _WM_MAFM_ActiveVoices(void *synth);
  * keys off would otherwise ring until the caller's cut-off. */
 void  _WM_MAFM_ReleaseAll(void *synth);
 
-/* Render stereo frames into the 32-bit mix buffer (accumulates). */
-void  _WM_MAFM_Render(void *synth, int32_t *out, uint32_t frames);
+/* Render stereo frames into the 32-bit mix buffer (accumulates).  With a
+ * nonzero stride, channel c goes to out + c * stride and sound owned by no
+ * channel (ATR one-shots) to out + 16 * stride. */
+void  _WM_MAFM_Render(void *synth, int32_t *out, uint32_t stride, uint32_t frames);
 
 #endif /* __MAFM_H */
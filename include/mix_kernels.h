@@ -0,0 +1,78 @@
+/*
+ * mix_kernels.h -- SIMD inner loops for the GUS mixers
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MIX_KERNELS_H
+#define __MIX_KERNELS_H
+
+/*
+ * State of a straight-line run: one note mixed over a stretch of frames
+ * with no loop, end or envelope checks. sample_pos and env_level are stepped
+ * by the kernel and hold the state for the next frame on return.
+ */
+struct _WM_VoiceRun {
+    const int16_t *data;
+    const int32_t *env_amp;     /* env_level >> 12 to amplitude, max 1024 */
+    uint32_t sample_pos;
+    uint32_t sample_inc;
+    int32_t env_level;
+    int32_t env_inc;
+    int32_t left_vol;
+    int32_t right_vol;
+    /* sinc only: Q14 coefficients, sinc_taps for each 1 << 10 phase. The
+       window of sinc_taps samples starting sinc_taps / 2 - 1 before the
+       sample position must lie inside data for every frame of the run. */
+    const int16_t *sinc_coef;
+    int sinc_taps;              /* 4, 8, 16 or 32 */
+};
+
+struct _WM_MixKernels {
+    const char *name;
+    /* add count interleaved stereo frames of the run to out, linear
+       interpolation */
+    void (*linear)(struct _WM_VoiceRun *run, int32_t *out, uint32_t count);
+    /* dot product of taps samples with taps gauss coefficients */
+    double (*gauss)(const int16_t *sptr, const double *gptr, int taps);
+    /* as linear, with windowed sinc interpolation */
+    void (*sinc)(struct _WM_VoiceRun *run, int32_t *out, uint32_t count);
+    /* clamp samples int32 mix values to 16 bits and store them as
+       native-endian signed 16 bit pcm */
+    void (*pack_s16)(const int32_t *in, int8_t *out, uint32_t samples);
+    /* the same clamp, scaled to the full 32 bit range */
+    void (*pack_s32)(const int32_t *in, int32_t *out, uint32_t samples);
+    /* no clamp: 32768 becomes 1.0 */
+    void (*pack_f32)(const int32_t *in, float *out, uint32_t samples);
+    /* add the int32 mix times gain to out, truncating, no clamp */
+    void (*mix_s32)(const int32_t *in, int32_t *out, uint32_t samples, float gain);
+    /* add it to out at pack_f32's scale times gain */
+    void (*mix_f32)(const int32_t *in, float *out, uint32_t samples, float gain);
+};
+
+/* the kernels picked for this CPU by _WM_InitMixKernels() */
+extern const struct _WM_MixKernels *_WM_mix;
+
+extern void _WM_InitMixKernels(void);
+/* index 0 is the portable C set; returns NULL past the last set this
+   build and CPU can run */
+extern const struct _WM_MixKernels *_WM_GetMixKernels(int index);
+
+#endif /* __MIX_KERNELS_H */
@@ -77,7 +77,7 @@ extern "C" {
  * first OPL3_Reset instead of compiling in wf_rom.h, trading read-only
  * data for zero-initialized RAM. The table data is identical either way.
  * The first OPL3_Reset in the process must not run concurrently with
- * another reset. */
+ * another reset; the library does one up front (see synth.c). */
 #ifndef OPL_WF_TABLE_RUNTIME
 #define OPL_WF_TABLE_RUNTIME 0
 #endif
@@ -33,9 +33,14 @@ struct _env {
 struct _sample;
 struct _mdi;
 
+/* patch->loaded, read and set atomically once songs are open */
+#define WM_PATCH_UNLOADED 0
+#define WM_PATCH_LOADED   1 /* or tried, and found wanting */
+#define WM_PATCH_LOADING  2 /* claimed by a loader, which is at it */
+
 struct _patch {
     uint16_t patchid;
-    uint8_t loaded;
+    uint32_t loaded;
     char *filename;
     int16_t amp;
     uint8_t keep;
@@ -47,11 +52,14 @@ struct _patch {
     struct _patch *next;
 };
 
-extern struct _patch *_WM_patch[128];
-
 extern int _WM_patch_lock;
+extern unsigned int _WM_load_threads;
 
 extern struct _patch *_WM_get_patch_data(struct _mdi *mdi, uint16_t patchid);
 extern void _WM_load_patch(struct _mdi *mdi, uint16_t patchid);
+extern void _WM_load_patches(struct _mdi *mdi);
+extern void _WM_load_patches_ahead(struct _mdi *mdi);
+extern void _WM_load_patches_due(struct _mdi *mdi, uint32_t sample);
+extern void _WM_load_patches_wait(struct _mdi *mdi);
 
 #endif /* __PATCHES_H */
@@ -41,6 +41,7 @@
 
 struct _patch;
 struct _mdi;
+struct _WM_Context;
 
 struct _sample {
     uint32_t data_length;
@@ -64,12 +65,8 @@ struct _sample {
     uint16_t scale_factor;
 };
 
-extern int _WM_fix_release;
-extern int _WM_auto_amp;
-extern int _WM_auto_amp_with_amp;
-
 extern struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq);
-extern int _WM_load_sample(struct _patch *sample_patch);
+extern int _WM_load_sample(struct _WM_Context *ctx, struct _patch *sample_patch);
 extern uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note);
 
 #endif /* __SAMPLE_H */
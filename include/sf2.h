@@ -26,27 +26,34 @@
 
 struct _mdi;
 struct _event;
+struct _WM_Context;
 
 /* returns 1 if the buffer looks like a RIFF sfbk (SoundFont2) file */
 extern int _WM_SF2_Magic(const uint8_t *data, uint32_t size);
 
-/* load/free the global soundfont instance */
-extern int _WM_SF2_Load(const uint8_t *data, uint32_t size);
-extern void _WM_SF2_Unload(void);
-extern int _WM_SF2_Active(void);
+/* load/free a context's soundfont instance */
+extern int _WM_SF2_Load(struct _WM_Context *ctx, const uint8_t *data, uint32_t size);
+extern void _WM_SF2_Unload(struct _WM_Context *ctx);
+extern int _WM_SF2_Active(struct _WM_Context *ctx);
 
 /* per-mdi synth instances (voices private, sample data shared) */
-extern void *_WM_SF2_NewSynth(uint16_t rate);
+extern void *_WM_SF2_NewSynth(struct _WM_Context *ctx);
 extern void _WM_SF2_FreeSynth(void *synth);
 extern void _WM_SF2_Reset(void *synth);
 
+/* channel state for seek checkpoints: SaveState returns a malloc()ed copy,
+   or NULL; LoadState resets the synth to it */
+extern void *_WM_SF2_SaveState(void *synth);
+extern void _WM_SF2_LoadState(void *synth, const void *state);
+
 /* translate a wildmidi event to the synth */
 extern void _WM_SF2_Event(void *synth, struct _mdi *mdi, struct _event *event);
 
 /* returns nonzero while notes are still sounding (release tails) */
 extern int _WM_SF2_ActiveVoices(void *synth);
 
-/* render stereo frames into the 32bit mix buffer */
-extern void _WM_SF2_Render(void *synth, int32_t *out, uint32_t frames);
+/* render stereo frames into the 32bit mix buffer; with a nonzero stride,
+   channel c goes to out + c * stride instead */
+extern void _WM_SF2_Render(void *synth, int32_t *out, uint32_t stride, uint32_t frames);
 
 #endif /* __SF2_H */
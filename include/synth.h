@@ -21,20 +21,21 @@
 #define WM_OPL3_CONFIG "@opl3"
 
 struct _sample;
+struct _WM_Context;
 
 /* Fabricate a _sample chain for the given (possibly-drum) patch id.
-   Uses the current _WM_SampleRate. Returns NULL on OOM. */
-extern struct _sample *_WM_synth_patch(uint16_t patchid);
+   Uses the context's sample rate and bank. Returns NULL on OOM. */
+extern struct _sample *_WM_synth_patch(struct _WM_Context *ctx, uint16_t patchid);
 
-/* Populate _WM_patch[] with 128 tonal + GM drum entries, all with
+/* Populate ctx->patch[] with 128 tonal + GM drum entries, all with
    filename==NULL so _WM_load_sample routes them to _WM_synth_patch. */
-extern int _WM_opl3_init_patches(void);
+extern int _WM_opl3_init_patches(struct _WM_Context *ctx);
 
 /* GENMIDI (.op2) FM instrument bank support: when a bank is loaded, the
    OPL3 synth renders its register data instead of the built-in table.
    DMXOPL (MIT) is a known-good GM bank in this format. */
 extern int _WM_OP2_Magic(const uint8_t *data, uint32_t size);
-extern int _WM_OP2_Load(const uint8_t *data, uint32_t size);
-extern void _WM_OP2_Unload(void);
+extern int _WM_OP2_Load(struct _WM_Context *ctx, const uint8_t *data, uint32_t size);
+extern void _WM_OP2_Unload(struct _WM_Context *ctx);
 
 #endif /* __SYNTH_H */
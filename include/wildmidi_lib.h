@@ -38,6 +38,12 @@
 #define WM_MO_ENHANCED_RESAMPLING 0x0002
 #define WM_MO_REVERB            0x0004
 #define WM_MO_LOOP              0x0008
+#define WM_MO_SINC_RESAMPLING   0x0070  /* field: one of WM_MO_SINC_n, or 0 */
+#define WM_MO_SINC_4            0x0010
+#define WM_MO_SINC_8            0x0020
+#define WM_MO_SINC_16           0x0030
+#define WM_MO_SINC_32           0x0040
+#define WM_MO_STREAM            0x0800
 #define WM_MO_SAVEASTYPE0       0x1000
 #define WM_MO_ROUNDTEMPO        0x2000
 #define WM_MO_STRIPSILENCE      0x4000
@@ -50,6 +56,29 @@
 /* for WildMidi_GetString */
 #define WM_GS_VERSION           0x0001
 
+/* what WildMidi_GetErrorCode returns: the kind of the calling thread's
+   last error */
+#define WM_ERR_NONE             0   /* no error */
+#define WM_ERR_MEM              1   /* out of memory */
+#define WM_ERR_STAT             2   /* a file couldn't be stat'd */
+#define WM_ERR_LOAD             3   /* a file couldn't be loaded */
+#define WM_ERR_OPEN             4   /* a file couldn't be opened */
+#define WM_ERR_READ             5   /* a file couldn't be read */
+#define WM_ERR_INVALID          6   /* invalid or unsupported file format */
+#define WM_ERR_CORUPT           7   /* file corrupt */
+#define WM_ERR_NOT_INIT         8   /* the library isn't initialized */
+#define WM_ERR_INVALID_ARG      9   /* invalid argument */
+#define WM_ERR_ALR_INIT         10  /* the library is already initialized */
+#define WM_ERR_NOT_MIDI         11  /* not a midi file */
+#define WM_ERR_LONGFIL          12  /* file unusually long */
+#define WM_ERR_NOT_HMP          13  /* not an hmp file */
+#define WM_ERR_NOT_HMI          14  /* not an hmi file */
+#define WM_ERR_CONVERT          15  /* conversion failed */
+#define WM_ERR_NOT_MUS          16  /* not a mus file */
+#define WM_ERR_NOT_XMI          17  /* not an xmi file */
+#define WM_ERR_NOT_SMAF         18  /* not a smaf file */
+#define WM_ERR_OTHER            19  /* anything else: see the message */
+
 /* set our symbol export visibility */
 #if defined _WIN32 || defined __CYGWIN__
   /* ========== NOTE TO WINDOWS DEVELOPERS:
@@ -94,10 +123,44 @@ struct _WM_Info {
     uint32_t approx_total_samples;
     uint16_t mixer_options;
     uint32_t total_midi_time;
+    /* GUS patch voices: the cap (0 for none), the most that have played at
+       once, and how many were cut to stay under the cap */
+    uint16_t max_voices;
+    uint16_t peak_voices;
+    uint32_t stolen_voices;
+    /* wall clock microseconds WildMidi_Open() or WildMidi_OpenBuffer()
+       took, patch loading included */
+    uint32_t open_time;
+};
+
+/* what WildMidi_Probe() finds out about a song without loading it; the
+   strings are the caller's to free() */
+struct _WM_ProbeInfo {
+    char *copyright;                /* NULL if none */
+    char *track_names;              /* one per line, NULL if none */
+    uint32_t approx_total_samples;
+    uint32_t total_midi_time;       /* in milliseconds */
+    uint16_t songs;                 /* type 2 files' songs, else 1 */
+};
+
+/* where a tick falls in the bars and beats of a song, from
+   WildMidi_GetBarBeat(); counts are from 0 */
+struct _WM_BarBeat {
+    uint32_t bar;
+    uint32_t beat;                  /* in the bar */
+    uint32_t tick;                  /* in the beat */
+    uint32_t tempo;                 /* microseconds per quarter note */
+    uint16_t divisions;             /* ticks per quarter note */
+    uint16_t numerator;             /* time signature: beats per bar ... */
+    uint16_t denominator;           /* ... of this note value, 4 for 1/4 */
 };
 
 typedef void midi;
 
+/* a synthesizer with its own patch set, rate and options, see
+   WildMidi_NewContext() */
+typedef struct _WM_Context WildMidi_Context;
+
 typedef void * (*_WM_VIO_Allocate)(const char *, uint32_t *);
 typedef void   (*_WM_VIO_Free)(void *);
 
@@ -126,21 +189,44 @@ WM_SYMBOL int WildMidi_InitVIO(struct _WM_VIO * callbacks, const char *config_fi
 WM_SYMBOL int WildMidi_MasterVolume (uint8_t master_volume);
 WM_SYMBOL midi * WildMidi_Open (const char *midifile);
 WM_SYMBOL midi * WildMidi_OpenBuffer (const uint8_t *midibuffer, uint32_t size);
+WM_SYMBOL int WildMidi_Probe (const uint8_t *midibuffer, uint32_t size, struct _WM_ProbeInfo *info);
+WM_SYMBOL WildMidi_Context * WildMidi_NewContext (const char *config_file, uint16_t rate, uint16_t mixer_options);
+WM_SYMBOL WildMidi_Context * WildMidi_NewContextVIO (struct _WM_VIO * callbacks, const char *config_file, uint16_t rate, uint16_t mixer_options);
+WM_SYMBOL int WildMidi_FreeContext (WildMidi_Context *context);
+WM_SYMBOL int WildMidi_MasterVolumeCtx (WildMidi_Context *context, uint8_t master_volume);
+WM_SYMBOL midi * WildMidi_OpenCtx (WildMidi_Context *context, const char *midifile);
+WM_SYMBOL midi * WildMidi_OpenBufferCtx (WildMidi_Context *context, const uint8_t *midibuffer, uint32_t size);
+WM_SYMBOL int WildMidi_ProbeCtx (WildMidi_Context *context, const uint8_t *midibuffer, uint32_t size, struct _WM_ProbeInfo *info);
 WM_SYMBOL int WildMidi_GetMidiOutput (midi *handle, int8_t **buffer, uint32_t *size);
 WM_SYMBOL int WildMidi_GetOutput (midi *handle, int8_t *buffer, uint32_t size);
+WM_SYMBOL int WildMidi_GetOutputS32 (midi *handle, int32_t *buffer, uint32_t size);
+WM_SYMBOL int WildMidi_GetOutputFloat (midi *handle, float *buffer, uint32_t size);
+WM_SYMBOL int WildMidi_MixOutputS32 (midi *handle, int32_t *buffer, uint32_t size, float gain);
+WM_SYMBOL int WildMidi_MixOutputFloat (midi *handle, float *buffer, uint32_t size, float gain);
+WM_SYMBOL int WildMidi_GetOutputStems (midi *handle, float **stems, float *master, uint32_t size);
+WM_SYMBOL int WildMidi_RenderBatch (midi **handles, int8_t **buffers, const uint32_t *sizes,
+                                    uint32_t count, int *results, uint32_t *usecs);
+WM_SYMBOL int WildMidi_SetBatchThreads (uint16_t threads);
 WM_SYMBOL int WildMidi_SetOption (midi *handle, uint16_t options, uint16_t setting);
+WM_SYMBOL int WildMidi_SetMaxVoices (midi *handle, uint16_t max_voices);
 WM_SYMBOL int WildMidi_SetCvtOption (uint16_t tag, uint16_t setting);
+WM_SYMBOL int WildMidi_SetCache (const char *dir, uint32_t max_kb);
 WM_SYMBOL int WildMidi_ConvertToMidi (const char *file, uint8_t **out, uint32_t *size);
 WM_SYMBOL int WildMidi_ConvertBufferToMidi (const uint8_t *in, uint32_t insize,
                                             uint8_t **out, uint32_t *size);
 WM_SYMBOL struct _WM_Info * WildMidi_GetInfo (midi * handle);
 WM_SYMBOL int WildMidi_FastSeek (midi * handle, unsigned long int *sample_pos);
+WM_SYMBOL int WildMidi_AccurateSeek (midi * handle, unsigned long int *sample_pos);
 WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong);
+WM_SYMBOL int WildMidi_TickToSample (midi * handle, uint32_t tick, uint32_t *sample);
+WM_SYMBOL int WildMidi_SampleToTick (midi * handle, uint32_t sample, uint32_t *tick);
+WM_SYMBOL int WildMidi_GetBarBeat (midi * handle, uint32_t tick, struct _WM_BarBeat *pos);
 WM_SYMBOL int WildMidi_Close (midi * handle);
 WM_SYMBOL int WildMidi_Shutdown (void);
 WM_SYMBOL char * WildMidi_GetLyric (midi * handle);
 
 WM_SYMBOL char * WildMidi_GetError (void);
+WM_SYMBOL int WildMidi_GetErrorCode (void);
 WM_SYMBOL void WildMidi_ClearError (void);
 
 
@@ -24,32 +24,27 @@
 #ifndef __WM_ERROR_H
 #define __WM_ERROR_H
 
-enum {
-    WM_ERR_NONE = 0,
-    WM_ERR_MEM,
-    WM_ERR_STAT,
-    WM_ERR_LOAD,
-    WM_ERR_OPEN,
-    WM_ERR_READ,
-    WM_ERR_INVALID,
-    WM_ERR_CORUPT,
-    WM_ERR_NOT_INIT,
-    WM_ERR_INVALID_ARG,
-    WM_ERR_ALR_INIT,
-    WM_ERR_NOT_MIDI,
-    WM_ERR_LONGFIL,
-    WM_ERR_NOT_HMP,
-    WM_ERR_NOT_HMI,
-    WM_ERR_CONVERT,
-    WM_ERR_NOT_MUS,
-    WM_ERR_NOT_XMI,
-    WM_ERR_NOT_SMAF,
+/* the WM_ERR_ codes are public, see wildmidi_lib.h. A custom message or
+   an unknown code is reported as WM_ERR_OTHER. */
+#include "wildmidi_lib.h"
 
-    WM_ERR_MAX
+#define WM_ERR_MAX WM_ERR_OTHER
+
+#define WM_ERROR_LEN 255
+
+/*
+ * The last error a thread reported: its WM_ERR_ code, WM_ERR_NONE if there
+ * is none, and its message. count goes up with every report, so that a
+ * caller can tell whether something it ran reported one.
+ */
+struct _WM_Error {
+    int code;
+    unsigned int count;
+    char string[WM_ERROR_LEN + 1];
 };
 
-extern char * _WM_Global_ErrorS;
-extern int _WM_Global_ErrorI;
+/* the calling thread's, see wm_error.c */
+extern struct _WM_Error *_WM_ThreadError(void);
 
 /* This is for https://github.com/Mindwerks/wildmidi/pull/243
  * Change to 0 if you really want to see -Wpedantic warnings. */
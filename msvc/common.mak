@@ -11,7 +11,7 @@ PLAYER  = wildmidi.exe
 LIBS_DLL=
 LIBS_PLY= $(IMPNAME) winmm.lib
 
-DLL_OBJ = wm_error.obj file_io.obj lock.obj wildmidi_lib.obj reverb.obj gus_pat.obj f_xmidi.obj f_mus.obj f_hmp.obj f_midi.obj f_hmi.obj f_smaf.obj mus2mid.obj xmi2mid.obj hmp2mid.obj hmi2mid.obj smaf2mid.obj internal_midi.obj patches.obj sample.obj sf2.obj mafm.obj ma_fm_core.obj smaf_voice.obj yamaha_adpcm.obj synth.obj opl3.obj
+DLL_OBJ = wm_error.obj file_io.obj lock.obj wildmidi_lib.obj reverb.obj mix_kernels.obj gus_pat.obj f_xmidi.obj f_mus.obj f_hmp.obj f_midi.obj f_hmi.obj f_smaf.obj mus2mid.obj xmi2mid.obj hmp2mid.obj hmi2mid.obj smaf2mid.obj internal_midi.obj patches.obj cache.obj sample.obj sf2.obj mafm.obj ma_fm_core.obj smaf_voice.obj yamaha_adpcm.obj synth.obj opl3.obj
 PLY_OBJ = wm_tty.obj playlist.obj msleep.obj getopt_long.obj out_none.obj out_wave.obj out_win32mm.obj wildmidi.obj
 # out_openal.obj
 
@@ -33,6 +33,8 @@ wildmidi_lib.obj: ..\src\wildmidi_lib.c
 	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
 reverb.obj: ..\src\reverb.c
 	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
+mix_kernels.obj: ..\src\mix_kernels.c
+	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
 gus_pat.obj: ..\src\gus_pat.c
 	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
 f_xmidi.obj: ..\src\f_xmidi.c
@@ -61,6 +63,8 @@ internal_midi.obj: ..\src\internal_midi.c
 	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
 patches.obj: ..\src\patches.c
 	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
+cache.obj: ..\src\cache.c
+	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
 sample.obj: ..\src\sample.c
 	$(CC) $(DLL_FLAGS) $(INCLUDES) -c -Fo$@ $?
 sf2.obj: ..\src\sf2.c
@@ -0,0 +1,869 @@
+/*
+ * cache.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the process id, to tell apart temporary files of programs sharing a
+   cache directory; and where there is a way to list that directory, the
+   sweep for entries the index lost, see cache_sweep() */
+#if defined(_WIN32)
+#include <windows.h>
+#define WM_CACHE_PID() ((unsigned long) GetCurrentProcessId())
+#define WM_CACHE_HAVE_DIRSCAN 1
+#elif defined(WILDMIDI_AMIGA)
+#include <proto/exec.h>
+#define WM_CACHE_PID() ((unsigned long) FindTask(NULL))
+#elif defined(__OS2__) || defined(__EMX__)
+#include <process.h>
+#define WM_CACHE_PID() ((unsigned long) getpid())
+#else
+#include <unistd.h>
+#define WM_CACHE_PID() ((unsigned long) getpid())
+#if defined(__DJGPP__) || defined(__unix) || defined(__unix__) || \
+    defined(__APPLE__)
+#include <dirent.h>
+#define WM_CACHE_HAVE_DIRSCAN 1
+#define WM_CACHE_USE_DIRENT 1
+#endif
+#endif
+
+#include "common.h"
+#include "wildmidi_lib.h"
+#include "wm_error.h"
+#include "internal_midi.h"
+#include "lock.h"
+#include "patches.h"
+#include "reverb.h"
+#include "cache.h"
+
+/*
+ * A cache entry holds what a parser leaves in an mdi, so that opening the
+ * same song again can skip the parser. It is laid out as
+ *
+ *   struct _cache_header
+ *   the events, event_count of struct _event
+ *   the tempo map, tempo_count of struct _tempo_change
+ *   the patch ids, patch_count of uint16_t
+ *   the event text, text_len bytes
+ *   the copyright, copyright_len bytes without its terminator
+ *
+ * with each section starting on an 8 byte boundary, all in the host's own
+ * layout, so that an entry can be read or mapped straight into place. The
+ * events are written field by field with their padding zeroed, so that
+ * the same song always makes the same entry. The
+ * header names the library version, struct sizes and byte order that
+ * wrote it, and an entry from any other build is a miss.
+ *
+ * Entries are named after a hash of their key, 8 hex digits so that DOS
+ * can hold them too. The index lists them by last use, oldest first, for
+ * keeping the cache under its size limit. Files are written under names
+ * of the writing process's id first, so that programs sharing the
+ * directory never write into each other's; one index write can still
+ * lose another's entries, and those are swept out when the cache is set.
+ */
+
+#define WM_CACHE_VERSION 2
+#define WM_CACHE_INDEX "wildmidi.idx"
+#define WM_CACHE_INDEX_TMP "wix"    /* after the process id */
+
+/* the mixer options the parsers look at */
+#define WM_CACHE_OPTIONS (WM_MO_ROUNDTEMPO | WM_MO_STRIPSILENCE)
+
+/* what an entry was made from: a song is only taken from an entry made
+   from the same bytes, at the same rate and options, with the same
+   patches defined and the same converter options its parser reads */
+struct _cache_key {
+    uint32_t song_size;
+    uint32_t song_hash[2];
+    uint32_t rate;
+    uint32_t options;
+    uint32_t patch_set;
+    uint32_t frequency;         /* WM_CO_FREQUENCY, for a MUS song */
+};
+
+/* the sections follow it, so it is kept to a multiple of 8 bytes */
+struct _cache_header {
+    char magic[8];              /* "WMCACHE" */
+    uint32_t version;           /* WM_CACHE_VERSION */
+    uint32_t byte_order;        /* 0x01020304, as the writer stored it */
+    uint32_t lib_version;       /* LIBWILDMIDI_VERSION */
+    uint16_t event_bytes;       /* sizeof(struct _event) */
+    uint16_t tempo_bytes;       /* sizeof(struct _tempo_change) */
+    struct _cache_key key;
+    uint32_t event_count;
+    uint32_t tempo_count;
+    uint32_t patch_count;
+    uint32_t text_len;
+    uint32_t copyright_len;
+    uint32_t divisions;
+    uint32_t approx_total_samples;
+    uint32_t is_type2;
+    uint32_t checksum;          /* of the sections, see cache_checksum() */
+};
+
+/* where each section starts, from the top of the entry */
+struct _cache_layout {
+    uint32_t events;
+    uint32_t tempo;
+    uint32_t patches;
+    uint32_t text;
+    uint32_t copyright;
+    uint32_t size;              /* of the whole entry */
+};
+
+/* an index line: an entry and its size in bytes */
+struct _cache_entry {
+    uint32_t name;
+    uint32_t size;
+};
+
+/* cache_lock covers these, and the index: entries are read and written
+   outside it, under the names it hands out */
+static int cache_lock = 0;
+static char *cache_dir = NULL;
+static uint32_t cache_max_kb = 0;
+static uint32_t cache_dir_gen = 0;  /* counts changes of cache_dir */
+static uint32_t cache_writes = 0;   /* tells writers' temporary files apart */
+
+/* entries read since the index was last written, oldest first: noting
+   each use as it comes would rewrite the index on every open */
+#define WM_CACHE_USES 32
+static struct _cache_entry cache_used[WM_CACHE_USES];
+static uint32_t cache_uses = 0;
+
+/*
+ * MurmurHash3's 32 bit hash, h being the seed. Fast enough that hashing a
+ * song costs far less than parsing it.
+ */
+static uint32_t cache_hash(const void *data, uint32_t len, uint32_t h) {
+    const uint8_t *p = (const uint8_t *) data;
+    uint32_t i, j, k;
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        memcpy(&k, &p[i], 4);
+        k *= 0xcc9e2d51;
+        k = (k << 15) | (k >> 17);
+        k *= 0x1b873593;
+        h ^= k;
+        h = (h << 13) | (h >> 19);
+        h = h * 5 + 0xe6546b64;
+    }
+    if (len & 3) {
+        k = 0;
+        for (j = len; j > i; j--) {
+            k = (k << 8) | p[j - 1];
+        }
+        k *= 0xcc9e2d51;
+        k = (k << 15) | (k >> 17);
+        k *= 0x1b873593;
+        h ^= k;
+    }
+    h ^= len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return (h);
+}
+
+#define WM_CACHE_ALIGN(x) (((x) + 7) & ~((uint64_t) 7))
+
+/* Where the header's sections go. Returns -1 if they don't fit in an
+   entry. */
+static int cache_layout(const struct _cache_header *hdr,
+                        struct _cache_layout *layout) {
+    uint64_t off = sizeof(struct _cache_header);
+
+    layout->events = (uint32_t) off;
+    off = WM_CACHE_ALIGN(off + (uint64_t) hdr->event_count * sizeof(struct _event));
+    layout->tempo = (uint32_t) off;
+    off = WM_CACHE_ALIGN(off + (uint64_t) hdr->tempo_count * sizeof(struct _tempo_change));
+    layout->patches = (uint32_t) off;
+    off = WM_CACHE_ALIGN(off + (uint64_t) hdr->patch_count * sizeof(uint16_t));
+    layout->text = (uint32_t) off;
+    off = WM_CACHE_ALIGN(off + hdr->text_len);
+    layout->copyright = (uint32_t) off;
+    off += hdr->copyright_len;
+    if (off > 0x7fffffff) {
+        return (-1);
+    }
+    layout->size = (uint32_t) off;
+    return (0);
+}
+
+/* The sections' checksum, each one hashed on from the last. The padding
+   between them is left out. */
+static uint32_t cache_checksum(const struct _cache_header *hdr,
+                               const void *events, const void *tempo,
+                               const void *patches, const void *text,
+                               const void *copyright) {
+    uint32_t h = WM_CACHE_VERSION;
+
+    h = cache_hash(events, hdr->event_count * sizeof(struct _event), h);
+    h = cache_hash(tempo, hdr->tempo_count * sizeof(struct _tempo_change), h);
+    h = cache_hash(patches, hdr->patch_count * sizeof(uint16_t), h);
+    h = cache_hash(text, hdr->text_len, h);
+    return (cache_hash(copyright, hdr->copyright_len, h));
+}
+
+static void cache_key(struct _cache_key *key, const struct _WM_Context *ctx,
+                      const uint8_t *data, uint32_t size) {
+    memset(key, 0, sizeof(struct _cache_key));
+    key->song_size = size;
+    key->song_hash[0] = cache_hash(data, size, 0);
+    key->song_hash[1] = cache_hash(data, size, 0x5bd1e995);
+    key->rate = ctx->sample_rate;
+    key->options = ctx->mixer_options & WM_CACHE_OPTIONS;
+    key->patch_set = ctx->patch_set;
+    if ((size >= 4) && (memcmp(data, "MUS\x1a", 4) == 0)) {
+        /* the MUS parser times the song by it */
+        key->frequency = _cvt_get_option(WM_CO_FREQUENCY);
+    }
+}
+
+/* name in the cache directory, NULL if out of memory */
+static char *cache_path(const char *name) {
+    size_t len = strlen(cache_dir);
+    char *path = (char *) malloc(len + strlen(name) + 2);
+
+    if (path == NULL) {
+        return (NULL);
+    }
+    memcpy(path, cache_dir, len);
+    if ((cache_dir[len - 1] != '/') && (cache_dir[len - 1] != '\\')
+        && (cache_dir[len - 1] != ':')) {
+        path[len++] = '/';
+    }
+    strcpy(&path[len], name);
+    return (path);
+}
+
+static char *cache_entry_path(uint32_t name, const char *ext) {
+    char file[16];
+
+    sprintf(file, "%08lx.%s", (unsigned long) name, ext);
+    return (cache_path(file));
+}
+
+/* moves from over to, which a plain rename() won't do everywhere */
+static int cache_replace(const char *from, const char *to) {
+    if (rename(from, to) == 0) {
+        return (0);
+    }
+    remove(to);
+    return (rename(from, to));
+}
+
+/* The index, oldest use first, as *count entries. NULL if there is none. */
+static struct _cache_entry *cache_read_index(uint32_t *count) {
+    struct _cache_entry *entries = NULL;
+    struct _cache_entry *grown;
+    unsigned long name, size;
+    uint32_t entries_size = 0;
+    char *path;
+    FILE *f;
+
+    *count = 0;
+    if ((path = cache_path(WM_CACHE_INDEX)) == NULL) {
+        return (NULL);
+    }
+    f = fopen(path, "r");
+    free(path);
+    if (f == NULL) {
+        return (NULL);
+    }
+    while (fscanf(f, "%lx %lu", &name, &size) == 2) {
+        if (*count == entries_size) {
+            entries_size = entries_size ? entries_size * 2 : 64;
+            grown = (struct _cache_entry *) realloc(entries,
+                                 entries_size * sizeof(struct _cache_entry));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+        entries[*count].name = (uint32_t) name;
+        entries[*count].size = (uint32_t) size;
+        (*count)++;
+    }
+    fclose(f);
+    return (entries);
+}
+
+/*
+ * Note uses entries' uses, oldest first, moving each to the newest end of
+ * the index, or with none just check the limit. Then drop the least
+ * recently used entries until the cache fits its limit again. Under
+ * cache_lock.
+ */
+static void cache_update(const struct _cache_entry *use, uint32_t uses) {
+    struct _cache_entry *entries;
+    struct _cache_entry *grown;
+    uint64_t total = 0;
+    uint64_t limit = (uint64_t) cache_max_kb * 1024;
+    uint32_t count, first = 0, i, j = 0, k;
+    char *path = NULL, *tmp_path = NULL;
+    FILE *f;
+    int ok;
+
+    entries = cache_read_index(&count);
+    if (uses != 0) {
+        grown = (struct _cache_entry *) realloc(entries,
+                                 (count + uses) * sizeof(struct _cache_entry));
+        if (grown == NULL) {
+            free(entries);
+            return;
+        }
+        entries = grown;
+        for (i = 0; i < count; i++) {
+            for (k = 0; (k < uses) && (entries[i].name != use[k].name); k++);
+            if (k == uses) {
+                entries[j++] = entries[i];
+            }
+        }
+        for (k = 0; k < uses; k++) {
+            /* an entry used again later goes in where that use does */
+            for (i = k + 1; (i < uses) && (use[i].name != use[k].name); i++);
+            if (i == uses) {
+                entries[j++] = use[k];
+            }
+        }
+        count = j;
+    }
+    for (i = 0; i < count; i++) {
+        total += entries[i].size;
+    }
+    while ((cache_max_kb != 0) && (total > limit) && (first < count)) {
+        if ((path = cache_entry_path(entries[first].name, "wmc")) != NULL) {
+            remove(path);
+            free(path);
+        }
+        total -= entries[first].size;
+        first++;
+    }
+    if ((uses == 0) && (first == 0)) {
+        free(entries);
+        return;
+    }
+
+    path = cache_path(WM_CACHE_INDEX);
+    tmp_path = cache_entry_path((uint32_t) WM_CACHE_PID(), WM_CACHE_INDEX_TMP);
+    if ((path != NULL) && (tmp_path != NULL)
+        && ((f = fopen(tmp_path, "w")) != NULL)) {
+        ok = 1;
+        for (i = first; i < count; i++) {
+            if (fprintf(f, "%08lx %lu\n", (unsigned long) entries[i].name,
+                        (unsigned long) entries[i].size) < 0) {
+                ok = 0;
+            }
+        }
+        if (fclose(f) != 0) {
+            ok = 0;
+        }
+        if (!ok || (cache_replace(tmp_path, path) != 0)) {
+            remove(tmp_path);
+        }
+    }
+    free(path);
+    free(tmp_path);
+    free(entries);
+}
+
+/* Note the context's patch set for its songs' keys: which patch a song's
+   patch ids find depends only on which ids the config defines. */
+void _WM_CachePatchSet(struct _WM_Context *ctx) {
+    struct _patch *patch;
+    uint32_t patch_set = 0;
+    int i;
+
+    for (i = 0; i < 128; i++) {
+        for (patch = ctx->patch[i]; patch != NULL; patch = patch->next) {
+            patch_set = cache_hash(&patch->patchid, sizeof(patch->patchid),
+                                   patch_set);
+        }
+    }
+    ctx->patch_set = patch_set;
+}
+
+#ifdef WM_CACHE_HAVE_DIRSCAN
+static int cache_entry_cmp(const void *a, const void *b) {
+    uint32_t x = ((const struct _cache_entry *) a)->name;
+    uint32_t y = ((const struct _cache_entry *) b)->name;
+
+    return ((x > y) - (x < y));
+}
+
+/* Remove file from the cache directory if it is an entry, by its name,
+   that the count entries, in name order, don't list. */
+static void cache_sweep_file(const char *file,
+                             const struct _cache_entry *entries,
+                             uint32_t count) {
+    struct _cache_entry entry;
+    char *path;
+    int i;
+
+    if ((strlen(file) != 12) || (file[8] != '.')
+        || (tolower((unsigned char) file[9]) != 'w')
+        || (tolower((unsigned char) file[10]) != 'm')
+        || (tolower((unsigned char) file[11]) != 'c')) {
+        return;
+    }
+    for (i = 0; i < 8; i++) {
+        if (!isxdigit((unsigned char) file[i])) {
+            return;
+        }
+    }
+    entry.name = (uint32_t) strtoul(file, NULL, 16);
+    if ((count != 0) && (bsearch(&entry, entries, count,
+                                 sizeof(struct _cache_entry),
+                                 cache_entry_cmp) != NULL)) {
+        return;
+    }
+    if ((path = cache_path(file)) != NULL) {
+        remove(path);
+        free(path);
+    }
+}
+
+/*
+ * Remove the entries the index doesn't list. Programs sharing the
+ * directory each rewrite the whole index, so one can drop another's new
+ * entry, which would then never be removed to keep the size limit. An
+ * entry written just now, before its program notes it in the index, can
+ * go too, but that only costs the next open a parse. Under cache_lock.
+ */
+static void cache_sweep(void) {
+    struct _cache_entry *entries;
+    uint32_t count;
+#ifdef WM_CACHE_USE_DIRENT
+    DIR *dh;
+    struct dirent *ent;
+#else
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+    char *pattern;
+#endif
+
+    entries = cache_read_index(&count);
+    if (count != 0) {
+        qsort(entries, count, sizeof(struct _cache_entry), cache_entry_cmp);
+    }
+#ifdef WM_CACHE_USE_DIRENT
+    if ((dh = opendir(cache_dir)) != NULL) {
+        while ((ent = readdir(dh)) != NULL) {
+            cache_sweep_file(ent->d_name, entries, count);
+        }
+        closedir(dh);
+    }
+#else
+    if ((pattern = cache_path("*.wmc")) != NULL) {
+        h = FindFirstFileA(pattern, &fd);
+        free(pattern);
+        if (h != INVALID_HANDLE_VALUE) {
+            do {
+                cache_sweep_file(fd.cFileName, entries, count);
+            } while (FindNextFileA(h, &fd));
+            FindClose(h);
+        }
+    }
+#endif
+    free(entries);
+}
+#endif
+
+/* Keep songs in dir, at most max_kb of them (0 for no limit), or with
+   dir NULL stop. */
+int _WM_CacheSet(const char *dir, uint32_t max_kb) {
+    char *new_dir = NULL;
+
+    if (dir != NULL) {
+        if (dir[0] == '\0') {
+            _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(empty cache directory)", 0);
+            return (-1);
+        }
+        new_dir = (char *) malloc(strlen(dir) + 1);
+        if (new_dir == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            return (-1);
+        }
+        strcpy(new_dir, dir);
+    }
+
+    _WM_Lock(&cache_lock);
+    if ((cache_dir != NULL) && (cache_uses != 0)) {
+        cache_update(cache_used, cache_uses);
+    }
+    cache_uses = 0;
+    free(cache_dir);
+    cache_dir = new_dir;
+    cache_max_kb = max_kb;
+    cache_dir_gen++;
+    if (cache_dir != NULL) {
+        cache_update(NULL, 0);
+#ifdef WM_CACHE_HAVE_DIRSCAN
+        cache_sweep();
+#endif
+    }
+    _WM_Unlock(&cache_lock);
+    return (0);
+}
+
+/* The path of entry name in the cache directory as it is now, and in
+   *gen which directory that is. With tmp_path, also a file of this
+   writer's own to write the entry in first, named after the process and
+   its count of writes. NULL if there is no directory, or no memory. */
+static char *cache_name(uint32_t name, char **tmp_path, uint32_t *gen) {
+    char *path = NULL;
+    char ext[4];
+
+    _WM_Lock(&cache_lock);
+    if (cache_dir != NULL) {
+        path = cache_entry_path(name, "wmc");
+        *gen = cache_dir_gen;
+        if (tmp_path != NULL) {
+            sprintf(ext, "w%02lx", (unsigned long) (cache_writes++ & 0xff));
+            if ((*tmp_path = cache_entry_path((uint32_t) WM_CACHE_PID(),
+                                              ext)) == NULL) {
+                free(path);
+                path = NULL;
+            }
+        }
+    }
+    _WM_Unlock(&cache_lock);
+    return (path);
+}
+
+/* Note a use of an entry in directory gen, for the index to take in with
+   the next few. */
+static void cache_note_use(const struct _cache_entry *use, uint32_t gen) {
+    _WM_Lock(&cache_lock);
+    if (gen == cache_dir_gen) {
+        cache_used[cache_uses++] = *use;
+        if (cache_uses == WM_CACHE_USES) {
+            cache_update(cache_used, cache_uses);
+            cache_uses = 0;
+        }
+    }
+    _WM_Unlock(&cache_lock);
+}
+
+/* writes len bytes and then pads to the next section */
+static int cache_write(FILE *f, const void *data, uint32_t len) {
+    static const uint8_t pad[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    if ((len != 0) && (fwrite(data, 1, len, f) != len)) {
+        return (-1);
+    }
+    if ((len & 7) && (fwrite(pad, 1, 8 - (len & 7), f) != 8 - (len & 7))) {
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ * Look for the song in data in the cache, and if it is there build its mdi
+ * as the parser would have left it. Returns NULL on a miss. An entry that
+ * fails its checks is removed, for the parse that follows to replace. The
+ * cache lock is only taken to name the entry and note its use.
+ */
+struct _mdi *_WM_CacheLoad(struct _WM_Context *ctx, const uint8_t *data,
+                           uint32_t size, uint8_t probe) {
+    struct _cache_header hdr;
+    struct _cache_key key;
+    struct _cache_layout layout;
+    struct _cache_entry use;
+    struct _mdi *mdi = NULL;
+    struct _event *events = NULL;
+    uint8_t *rest = NULL;
+    uint8_t pad[8];
+    uint16_t patchid;
+    const uint8_t *text;
+    const struct _tempo_change *tempo;
+    uint32_t event_len, rest_len, i;
+    char *path = NULL;
+    FILE *f = NULL;
+    uint32_t gen = 0;
+    int bad = 0;
+
+    cache_key(&key, ctx, data, size);
+    use.name = cache_hash(&key, sizeof(key), 0);
+    if (((path = cache_name(use.name, NULL, &gen)) == NULL)
+        || ((f = fopen(path, "rb")) == NULL)) {
+        goto _end;
+    }
+
+    bad = 1;
+    if ((fread(&hdr, sizeof(hdr), 1, f) != 1)
+        || (memcmp(hdr.magic, "WMCACHE", 8) != 0)
+        || (hdr.version != WM_CACHE_VERSION)
+        || (hdr.byte_order != 0x01020304)
+        || (hdr.lib_version != LIBWILDMIDI_VERSION)
+        || (hdr.event_bytes != sizeof(struct _event))
+        || (hdr.tempo_bytes != sizeof(struct _tempo_change))
+        || (memcmp(&hdr.key, &key, sizeof(key)) != 0)
+        || (hdr.divisions == 0)
+        || (cache_layout(&hdr, &layout) < 0)) {
+        goto _end;
+    }
+
+    /* the events are read straight into the list the mdi will keep, and
+       the rest, far smaller, copied out of one buffer */
+    event_len = hdr.event_count * sizeof(struct _event);
+    rest_len = layout.size - layout.tempo;
+    events = (struct _event *) malloc(event_len + sizeof(struct _event));
+    rest = (uint8_t *) malloc(rest_len ? rest_len : 1);
+    if ((events == NULL) || (rest == NULL)) {
+        bad = 0;
+        goto _end;
+    }
+    if ((fread(events, 1, event_len, f) != event_len)
+        || (fread(pad, 1, layout.tempo - layout.events - event_len, f)
+            != layout.tempo - layout.events - event_len)
+        || (fread(rest, 1, rest_len, f) != rest_len)
+        || (fgetc(f) != EOF)) {
+        goto _end;
+    }
+    fclose(f);
+    f = NULL;
+
+    tempo = (const struct _tempo_change *) rest;
+    text = &rest[layout.text - layout.tempo];
+    if (cache_checksum(&hdr, events, tempo, &rest[layout.patches - layout.tempo],
+                       text, &rest[layout.copyright - layout.tempo])
+        != hdr.checksum) {
+        goto _end;
+    }
+    /* the playback code trusts what the parsers give it, so check what
+       it indexes with */
+    if ((hdr.text_len != 0) && (text[hdr.text_len - 1] != '\0')) {
+        goto _end;
+    }
+    for (i = 0; i < hdr.event_count; i++) {
+        if ((events[i].evtype > ev_meta_cuepoint) || (events[i].channel > 15)) {
+            goto _end;
+        }
+        if ((events[i].evtype >= ev_meta_text)
+            && (events[i].value >= hdr.text_len)) {
+            goto _end;
+        }
+    }
+    for (i = 0; i < hdr.tempo_count; i++) {
+        if ((tempo[i].numerator == 0) || (tempo[i].denominator > 15)) {
+            goto _end;
+        }
+    }
+    bad = 0;
+
+    mdi = _WM_initMDI(ctx, probe);
+    free(mdi->events);
+    mdi->events = events;
+    events = NULL;
+    mdi->events_size = hdr.event_count + 1;
+    mdi->event_count = hdr.event_count;
+    mdi->current_event = mdi->events;
+    mdi->divisions = hdr.divisions;
+    mdi->extra_info.approx_total_samples = hdr.approx_total_samples;
+    mdi->is_type2 = (uint8_t) hdr.is_type2;
+    if (hdr.text_len != 0) {
+        if ((mdi->event_text = (char *) malloc(hdr.text_len)) == NULL) {
+            goto _fail;
+        }
+        memcpy(mdi->event_text, text, hdr.text_len);
+        mdi->event_text_len = hdr.text_len;
+        mdi->event_text_size = hdr.text_len;
+    }
+    if (hdr.tempo_count != 0) {
+        mdi->tempo_map = (struct _tempo_change *) malloc(hdr.tempo_count
+                                                * sizeof(struct _tempo_change));
+        if (mdi->tempo_map == NULL) {
+            goto _fail;
+        }
+        memcpy(mdi->tempo_map, tempo, hdr.tempo_count * sizeof(struct _tempo_change));
+        mdi->tempo_map_count = hdr.tempo_count;
+        mdi->tempo_map_size = hdr.tempo_count;
+    }
+    if (hdr.copyright_len != 0) {
+        if ((mdi->extra_info.copyright = (char *) malloc(hdr.copyright_len + 1)) == NULL) {
+            goto _fail;
+        }
+        memcpy(mdi->extra_info.copyright, &rest[layout.copyright - layout.tempo],
+               hdr.copyright_len);
+        mdi->extra_info.copyright[hdr.copyright_len] = '\0';
+    }
+    for (i = 0; i < hdr.patch_count; i++) {
+        memcpy(&patchid, &rest[layout.patches - layout.tempo + i * sizeof(uint16_t)],
+               sizeof(uint16_t));
+        _WM_load_patch(mdi, patchid);
+    }
+    if ((!probe) && ((mdi->reverb = _WM_init_reverb(ctx->sample_rate, ctx->reverb_room_width, ctx->reverb_room_length, ctx->reverb_listen_posx, ctx->reverb_listen_posy)) == NULL)) {
+        goto _fail;
+    }
+    _WM_ResetToStart(mdi);
+
+    use.size = layout.size;
+    cache_note_use(&use, gen);
+    goto _end;
+
+_fail:
+    _WM_freeMDI(mdi);
+    mdi = NULL;
+
+_end:
+    if (f != NULL) {
+        fclose(f);
+    }
+    if (bad) {
+        remove(path);
+    }
+    free(path);
+    free(events);
+    free(rest);
+    return (mdi);
+}
+
+/* The events as an entry holds them: the fields copied into zeroed
+   records, leaving none of the list's padding. NULL if out of memory. */
+static struct _event *cache_pack_events(const struct _mdi *mdi) {
+    struct _event *events;
+    uint32_t i;
+
+    events = (struct _event *) calloc(mdi->event_count ? mdi->event_count : 1,
+                                      sizeof(struct _event));
+    if (events == NULL) {
+        return (NULL);
+    }
+    for (i = 0; i < mdi->event_count; i++) {
+        events[i].evtype = mdi->events[i].evtype;
+        events[i].channel = mdi->events[i].channel;
+        events[i].value = mdi->events[i].value;
+        events[i].samples_to_next = mdi->events[i].samples_to_next;
+    }
+    return (events);
+}
+
+/*
+ * Keep a freshly parsed song, from data, for the next time it is opened.
+ * The patches are kept as the ids they were found by, which the key's
+ * patch set makes sure find the same patches again. Nothing is reported
+ * if the entry can't be written: the cache only ever saves time.
+ */
+void _WM_CacheStore(struct _mdi *mdi, const uint8_t *data, uint32_t size) {
+    struct _cache_header hdr;
+    struct _cache_layout layout;
+    struct _cache_entry use;
+    struct _event *events = NULL;
+    uint16_t *patchids = NULL;
+    const char *copyright = mdi->extra_info.copyright;
+    char *path = NULL, *tmp_path = NULL;
+    FILE *f;
+    uint32_t gen, i;
+    int ok;
+
+    if (mdi->probe) {
+        /* no patches were collected */
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "WMCACHE", 8);
+    hdr.version = WM_CACHE_VERSION;
+    hdr.byte_order = 0x01020304;
+    hdr.lib_version = LIBWILDMIDI_VERSION;
+    hdr.event_bytes = sizeof(struct _event);
+    hdr.tempo_bytes = sizeof(struct _tempo_change);
+    cache_key(&hdr.key, mdi->ctx, data, size);
+    hdr.event_count = mdi->event_count;
+    hdr.tempo_count = mdi->tempo_map_count;
+    hdr.patch_count = mdi->patch_count;
+    hdr.text_len = mdi->event_text_len;
+    hdr.copyright_len = (copyright != NULL) ? (uint32_t) strlen(copyright) : 0;
+    hdr.divisions = mdi->divisions;
+    hdr.approx_total_samples = mdi->extra_info.approx_total_samples;
+    hdr.is_type2 = mdi->is_type2;
+    if (cache_layout(&hdr, &layout) < 0) {
+        goto _end;
+    }
+    if (hdr.patch_count != 0) {
+        patchids = (uint16_t *) malloc(hdr.patch_count * sizeof(uint16_t));
+        if (patchids == NULL) {
+            goto _end;
+        }
+        for (i = 0; i < hdr.patch_count; i++) {
+            patchids[i] = mdi->patches[i]->patchid;
+        }
+    }
+    if ((events = cache_pack_events(mdi)) == NULL) {
+        goto _end;
+    }
+    hdr.checksum = cache_checksum(&hdr, events, mdi->tempo_map, patchids,
+                                  mdi->event_text, copyright);
+
+    /* written aside and then moved into place, so that a reader never sees
+       half an entry */
+    use.name = cache_hash(&hdr.key, sizeof(hdr.key), 0);
+    use.size = layout.size;
+    if (((path = cache_name(use.name, &tmp_path, &gen)) == NULL)
+        || ((f = fopen(tmp_path, "wb")) == NULL)) {
+        goto _end;
+    }
+    ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1)
+        && (cache_write(f, events, hdr.event_count * sizeof(struct _event)) == 0)
+        && (cache_write(f, mdi->tempo_map, hdr.tempo_count * sizeof(struct _tempo_change)) == 0)
+        && (cache_write(f, patchids, hdr.patch_count * sizeof(uint16_t)) == 0)
+        && (cache_write(f, mdi->event_text, hdr.text_len) == 0)
+        && ((hdr.copyright_len == 0)
+            || (fwrite(copyright, 1, hdr.copyright_len, f) == hdr.copyright_len));
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    if (!ok || (cache_replace(tmp_path, path) != 0)) {
+        remove(tmp_path);
+        goto _end;
+    }
+
+    /* the index takes it in with any uses still waiting, unless the
+       directory went away meanwhile */
+    _WM_Lock(&cache_lock);
+    if (gen == cache_dir_gen) {
+        cache_used[cache_uses++] = use;
+        cache_update(cache_used, cache_uses);
+        cache_uses = 0;
+    } else {
+        remove(path);
+    }
+    _WM_Unlock(&cache_lock);
+
+_end:
+    free(path);
+    free(tmp_path);
+    free(events);
+    free(patchids);
+}
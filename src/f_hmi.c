@@ -39,7 +39,8 @@
  Turns hmp file data into an event stream
  */
 struct _mdi *
-_WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
+_WM_ParseNewHmi(struct _WM_Context *ctx, const uint8_t *hmi_data,
+                uint32_t hmi_size, uint8_t probe) {
     uint32_t hmi_tmp = 0;
     const uint8_t *hmi_base = hmi_data;
     const uint8_t *data_end = hmi_data + hmi_size;
@@ -54,6 +55,7 @@ _WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
     const uint8_t *hmi_addr = NULL;
     uint32_t *hmi_track_header_length = NULL;
     struct _mdi *hmi_mdi = NULL;
+    uint8_t parsed = 0;
     float tempo_f =  5000000.0f;
     uint32_t *hmi_track_end = NULL;
     uint8_t hmi_tracks_ended = 0;
@@ -107,16 +109,16 @@ _WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
         return NULL;
     }
 
-    hmi_mdi = _WM_initMDI();
+    hmi_mdi = _WM_initMDI(ctx, probe);
 
     _WM_midi_setup_divisions(hmi_mdi, hmi_division);
 
-    if ((_WM_MixerOptions & WM_MO_ROUNDTEMPO)) {
+    if ((ctx->mixer_options & WM_MO_ROUNDTEMPO)) {
         tempo_f = (float) (60000000 / hmi_bpm) + 0.5f;
     } else {
         tempo_f = (float) (60000000 / hmi_bpm);
     }
-    samples_per_delta_f = _WM_GetSamplesPerTick(hmi_division, (uint32_t)tempo_f);
+    samples_per_delta_f = _WM_GetSamplesPerTick(ctx->sample_rate, hmi_division, (uint32_t)tempo_f);
 
     _WM_midi_setup_tempo(hmi_mdi, (uint32_t)tempo_f);
 
@@ -231,6 +233,7 @@ _WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
 
     hmi_mdi->events[hmi_mdi->event_count - 1].samples_to_next += sample_count;
     hmi_mdi->extra_info.approx_total_samples += sample_count;
+    hmi_mdi->parse_tick += smallest_delta;
 
     while (hmi_tracks_ended < hmi_track_cnt) {
         smallest_delta = 0;
@@ -416,9 +419,10 @@ _WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
 
         hmi_mdi->events[hmi_mdi->event_count - 1].samples_to_next += sample_count;
         hmi_mdi->extra_info.approx_total_samples += sample_count;
+        hmi_mdi->parse_tick += smallest_delta;
     }
 
-    if ((hmi_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((!probe) && ((hmi_mdi->reverb = _WM_init_reverb(ctx->sample_rate, ctx->reverb_room_width, ctx->reverb_room_length, ctx->reverb_listen_posx, ctx->reverb_listen_posy)) == NULL)) {
         _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
         goto _hmi_end;
     }
@@ -429,6 +433,7 @@ _WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
     hmi_mdi->note = NULL;
 
     _WM_ResetToStart(hmi_mdi);
+    parsed = 1;
 
 _hmi_end:
     free(hmi_track_offset);
@@ -438,7 +443,7 @@ _hmi_end:
     free(note);
     free(hmi_running_event);
 
-    if (hmi_mdi->reverb) return (hmi_mdi);
+    if (parsed) return (hmi_mdi);
     _WM_freeMDI(hmi_mdi);
     return NULL;
 }
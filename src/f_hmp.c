@@ -39,7 +39,8 @@
  Turns hmp file data into an event stream
  */
 struct _mdi *
-_WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
+_WM_ParseNewHmp(struct _WM_Context *ctx, const uint8_t *hmp_data,
+                uint32_t hmp_size, uint8_t probe) {
     uint8_t is_hmp2 = 0;
     uint32_t zero_cnt = 0;
     uint32_t i = 0;
@@ -51,6 +52,7 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
     uint32_t hmp_song_time = 0;
     const uint8_t *data_end;
     struct _mdi *hmp_mdi;
+    uint8_t parsed = 0;
     const uint8_t **hmp_chunk;
     uint32_t *chunk_length;
     uint32_t *chunk_ofs;
@@ -156,13 +158,13 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
     }
 
     /* Slow but needed for accuracy */
-    if ((_WM_MixerOptions & WM_MO_ROUNDTEMPO)) {
+    if ((ctx->mixer_options & WM_MO_ROUNDTEMPO)) {
         tempo_f = (float) (60000000 / hmp_bpm) + 0.5f;
     } else {
         tempo_f = (float) (60000000 / hmp_bpm);
     }
 
-    samples_per_delta_f = _WM_GetSamplesPerTick(hmp_divisions, (uint32_t) tempo_f);
+    samples_per_delta_f = _WM_GetSamplesPerTick(ctx->sample_rate, hmp_divisions, (uint32_t) tempo_f);
 
     /* DEBUG */
     /* fprintf(stderr, "DEBUG: Samples Per Delta Tick: %f\r\n",samples_per_delta_f); */
@@ -187,7 +189,7 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
         hmp_size -= 712;
     }
 
-    hmp_mdi = _WM_initMDI();
+    hmp_mdi = _WM_initMDI(ctx, probe);
 
     _WM_midi_setup_divisions(hmp_mdi, hmp_divisions);
     _WM_midi_setup_tempo(hmp_mdi, (uint32_t)tempo_f);
@@ -298,6 +300,7 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
 
     hmp_mdi->events[hmp_mdi->event_count - 1].samples_to_next += sample_count;
     hmp_mdi->extra_info.approx_total_samples += sample_count;
+    hmp_mdi->parse_tick += smallest_delta;
 
     while (end_of_chunks < hmp_chunks) {
         smallest_delta = 0;
@@ -404,12 +407,13 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
 
         hmp_mdi->events[hmp_mdi->event_count - 1].samples_to_next += sample_count;
         hmp_mdi->extra_info.approx_total_samples += sample_count;
+        hmp_mdi->parse_tick += smallest_delta;
 
         /* DEBUG */
         /* fprintf(stderr,"DEBUG: Sample Count %u\r\n",sample_count); */
     }
 
-    if ((hmp_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((!probe) && ((hmp_mdi->reverb = _WM_init_reverb(ctx->sample_rate, ctx->reverb_room_width, ctx->reverb_room_length, ctx->reverb_listen_posx, ctx->reverb_listen_posy)) == NULL)) {
         _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
         goto _hmp_end;
     }
@@ -420,6 +424,7 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
     hmp_mdi->note = NULL;
 
     _WM_ResetToStart(hmp_mdi);
+    parsed = 1;
 
 _hmp_end:
     free((void*)hmp_chunk);
@@ -427,7 +432,7 @@ _hmp_end:
     free(chunk_delta);
     free(chunk_ofs);
     free(chunk_end);
-    if (hmp_mdi->reverb) return (hmp_mdi);
+    if (parsed) return (hmp_mdi);
     _WM_freeMDI(hmp_mdi);
     return NULL;
 }
@@ -23,6 +23,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,22 +34,330 @@
 #include "f_midi.h"
 #include "wildmidi_lib.h"
 #include "internal_midi.h"
+#include "patches.h"
 #include "reverb.h"
 #include "sample.h"
+#include "cache.h"
+#include "lock.h"
 
 /* Smallest float that does NOT fit in a uint32_t (2^32); used to reject an
  * out-of-range sample count before the float->uint32 conversion. */
 #define WM_TWO_TO_32_F 4294967296.0f
 
+/*
+ * The type 1 merge keeps the unfinished tracks in a min-heap, ordered on the
+ * absolute tick of each track's next event and then on track number, so the
+ * tracks due on the same tick are still read in file order. Sifts the track
+ * at pos down to its place.
+ */
+static void track_heap_down(uint32_t *heap, uint32_t count,
+                            const uint64_t *track_tick, uint32_t pos) {
+    uint32_t track = heap[pos];
+    uint32_t child;
+
+    while ((child = pos * 2 + 1) < count) {
+        if ((child + 1 < count)
+            && ((track_tick[heap[child + 1]] < track_tick[heap[child]])
+                || ((track_tick[heap[child + 1]] == track_tick[heap[child]])
+                    && (heap[child + 1] < heap[child])))) {
+            child++;
+        }
+        if ((track_tick[track] < track_tick[heap[child]])
+            || ((track_tick[track] == track_tick[heap[child]])
+                && (track < heap[child]))) {
+            break;
+        }
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = track;
+}
+
+/*
+ * How far the parse of a standard MIDI file has got. A full parse runs to
+ * the end in one go. A streamed one (WM_MO_STREAM) is kept on the mdi and
+ * read on a window of events at a time as playback nears the end of what
+ * is parsed.
+ */
+struct _midi_parse {
+    uint8_t *data;              /* streaming: a copy of the whole file */
+    uint32_t data_size;
+    uint32_t midi_type;
+    uint32_t no_tracks;
+    uint32_t end_of_tracks;
+    uint32_t divisions;
+    float samples_per_delta_f;
+    float sample_remainder;
+    const uint8_t **tracks;
+    uint32_t *track_size;
+    uint32_t *track_delta;
+    uint64_t *track_tick;
+    uint32_t *track_heap;
+    uint32_t heap_count;
+    uint64_t tick;
+    uint8_t *track_end;
+    uint8_t *running_event;
+    uint32_t track;             /* type 0 & 2: the track being read */
+    uint32_t track_bytes;       /* in all the tracks, for the length guess */
+    /* streaming: the parser's channel state, kept apart from playback's */
+    struct _channel channel[16];
+};
+
+/* events parsed at a time when streaming */
+#define WM_STREAM_EVENTS 16384
+
+/* seconds the render path parses ahead of what it plays, for the patches
+   it finds to load meanwhile */
+#define WM_STREAM_AHEAD 2
+
+static void midi_parse_free(struct _midi_parse *p) {
+    if (p == NULL) return;
+    free(p->data);
+    free(p->track_end);
+    free(p->track_delta);
+    free(p->track_tick);
+    free(p->track_heap);
+    free(p->running_event);
+    free((void*)p->tracks);
+    free(p->track_size);
+    free(p);
+}
+
+/*
+ * Read events on until every track is done or, at the next place the
+ * parse can stop at, mdi holds until events. Returns 1 when the tracks are
+ * all read, 0 if there is more to come, -1 on error.
+ */
+static int midi_parse_events(struct _mdi *mdi, struct _midi_parse *p,
+                             uint32_t until) {
+    int ret = -1;
+    const uint8_t **tracks = p->tracks;
+    uint32_t *track_size = p->track_size;
+    uint32_t *track_delta = p->track_delta;
+    uint64_t *track_tick = p->track_tick;
+    uint32_t *track_heap = p->track_heap;
+    uint8_t *track_end = p->track_end;
+    uint8_t *running_event = p->running_event;
+    uint32_t midi_type = p->midi_type;
+    uint32_t no_tracks = p->no_tracks;
+    uint32_t end_of_tracks = p->end_of_tracks;
+    uint32_t heap_count = p->heap_count;
+    uint32_t divisions = p->divisions;
+    uint32_t tempo;
+    float samples_per_delta_f = p->samples_per_delta_f;
+    float sample_remainder = p->sample_remainder;
+    uint64_t tick = p->tick;
+    uint32_t i = p->track;
+
+    uint32_t sample_count = 0;
+    float sample_count_f = 0;
+    uint32_t smallest_delta = track_delta[i];
+    uint32_t setup_ret = 0;
+
+    /*
+     * Handle type 0 & 2 the same, but type 1 differently
+     */
+    if (midi_type == 1) {
+        /* Type 1 */
+        while (end_of_tracks != no_tracks) {
+            if (mdi->event_count >= until) {
+                ret = 0;
+                goto _end;
+            }
+            while ((heap_count) && (track_tick[track_heap[0]] == tick)) {
+                i = track_heap[0];
+                track_delta[i] = 0;
+                do {
+                    if (tracks[i][0] > 0x7f) {
+                        if (tracks[i][0] < 0xf0) {
+                            /* Events 0x80 - 0xef set running event */
+                            running_event[i] = tracks[i][0];
+                        } else if ((tracks[i][0] == 0xf0) || (tracks[i][0] == 0xf7)) {
+                            /* Sysex resets running event */
+                            running_event[i] = 0;
+                        } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x2f) && (tracks[i][2] == 0x00)) {
+                            /* End of Track */
+                            end_of_tracks++;
+                            /*
+                             * Since the events are 'flattened' into a single track, only keep the final
+                             * end-of-track event to prevent premature looping.
+                             */
+                            if (end_of_tracks == no_tracks) {
+                                setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
+                                if (setup_ret == 0) {
+                                    goto _end;
+                                }
+                            }
+                            track_end[i] = 1;
+                            tracks[i] += 3;
+                            track_size[i] -= 3;
+                            /* the track leaves the heap */
+                            track_heap[0] = track_heap[--heap_count];
+                            goto NEXT_TRACK;
+                        } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x51) && (tracks[i][2] == 0x03)) {
+                            /* Tempo */
+                            tempo = (tracks[i][3] << 16) + (tracks[i][4] << 8)+ tracks[i][5];
+                            if (!tempo)
+                                tempo = 500000;
+
+                            samples_per_delta_f = _WM_GetSamplesPerTick(mdi->ctx->sample_rate, divisions, tempo);
+                        }
+                    }
+                    setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
+                    if (setup_ret == 0) {
+                        goto _end;
+                    }
+                    tracks[i] += setup_ret;
+                    track_size[i] -= setup_ret;
+
+                    if (*tracks[i] > 0x7f) {
+                        do {
+                            if (!track_size[i]) break;
+                            track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
+                            tracks[i]++;
+                            track_size[i]--;
+                        } while (*tracks[i] > 0x7f);
+                    }
+                    if (!track_size[i]) {
+                        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
+                        goto _end;
+                    }
+                    track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
+                    tracks[i]++;
+                    track_size[i]--;
+                } while (!track_delta[i]);
+                track_tick[i] = tick + track_delta[i];
+            NEXT_TRACK:
+                if (heap_count) {
+                    track_heap_down(track_heap, heap_count, track_tick, 0);
+                }
+            }
+
+            smallest_delta = 0;
+            if (heap_count) {
+                smallest_delta = (uint32_t)(track_tick[track_heap[0]] - tick);
+                tick = track_tick[track_heap[0]];
+            }
+            if ((float)smallest_delta >= (float)0x7fffffff / samples_per_delta_f) {
+                /* DEBUG */
+                /* fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n", */
+                /*        samples_per_delta_f, smallest_delta); */
+                _WM_GLOBAL_ERROR(WM_ERR_CORUPT, NULL, 0);
+                goto _end;
+            }
+            sample_count_f = (((float) smallest_delta * samples_per_delta_f)
+                              + sample_remainder);
+            if (sample_count_f < 0.0f || sample_count_f >= WM_TWO_TO_32_F) { _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "sample count out of range", 0); goto _end; } sample_count = (uint32_t) sample_count_f;
+            sample_remainder = sample_count_f - (float) sample_count;
+
+            mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
+            mdi->extra_info.approx_total_samples += sample_count;
+            mdi->parse_tick += smallest_delta;
+        }
+    } else {
+        /* Type 0 & 2 */
+        for (; i < no_tracks; i++) {
+            while (track_end[i] == 0) {
+                if (mdi->event_count >= until) {
+                    ret = 0;
+                    goto _end;
+                }
+                setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
+                if (setup_ret == 0) {
+                    goto _end;
+                }
+                if (tracks[i][0] > 0x7f) {
+                    if (tracks[i][0] < 0xf0) {
+                        /* Events 0x80 - 0xef set running event */
+                        running_event[i] = tracks[i][0];
+                    } else if ((tracks[i][0] == 0xf0) || (tracks[i][0] == 0xf7)) {
+                        /* Sysex resets running event */
+                        running_event[i] = 0;
+                    } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x2f) && (tracks[i][2] == 0x00)) {
+                        /* End of Track */
+                        track_end[i] = 1;
+                        goto NEXT_TRACK2;
+                    } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x51) && (tracks[i][2] == 0x03)) {
+                        /* Tempo */
+                        tempo = (tracks[i][3] << 16) + (tracks[i][4] << 8)+ tracks[i][5];
+                        if (!tempo)
+                            tempo = 500000;
+
+                        samples_per_delta_f = _WM_GetSamplesPerTick(mdi->ctx->sample_rate, divisions, tempo);
+                    }
+                }
+                tracks[i] += setup_ret;
+                track_size[i] -= setup_ret;
+
+                track_delta[i] = 0;
+                if (*tracks[i] > 0x7f) {
+                    do {
+                        if (!track_size[i]) break;
+                        track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
+                        tracks[i]++;
+                        track_size[i]--;
+                    } while (*tracks[i] > 0x7f);
+                }
+                if (!track_size[i]) {
+                    if (midi_type != 0) {
+                        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
+                        goto _end;
+                    } else {
+                        track_end[i] = 1;
+                        goto NEXT_TRACK2;
+                    }
+                }
+                track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
+                tracks[i]++;
+                track_size[i]--;
+
+                if ((float)smallest_delta >= (float)0x7fffffff / samples_per_delta_f) {
+                    /* DEBUG */
+                    /* fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n", */
+                    /*        samples_per_delta_f, smallest_delta); */
+                    _WM_GLOBAL_ERROR(WM_ERR_CORUPT, NULL, 0);
+                    goto _end;
+                }
+                sample_count_f = (((float) track_delta[i] * samples_per_delta_f)
+                                  + sample_remainder);
+                if (sample_count_f < 0.0f || sample_count_f >= WM_TWO_TO_32_F) { _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "sample count out of range", 0); goto _end; } sample_count = (uint32_t) sample_count_f;
+                sample_remainder = sample_count_f - (float) sample_count;
+                mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
+                mdi->extra_info.approx_total_samples += sample_count;
+                mdi->parse_tick += track_delta[i];
+            NEXT_TRACK2:
+                smallest_delta = track_delta[i]; /* Added just to keep Xcode happy */
+                WMIDI_UNUSED(smallest_delta); /* Added to just keep clang happy */
+            }
+        }
+    }
+    ret = 1;
+
+_end:
+    p->end_of_tracks = end_of_tracks;
+    p->heap_count = heap_count;
+    p->samples_per_delta_f = samples_per_delta_f;
+    p->sample_remainder = sample_remainder;
+    p->tick = tick;
+    p->track = i;
+    return (ret);
+}
+
 struct _mdi *
-_WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
+_WM_ParseNewMidi(struct _WM_Context *ctx, const uint8_t *midi_data,
+                 uint32_t midi_size, uint8_t probe) {
     struct _mdi *mdi;
+    struct _midi_parse *p;
+    const uint8_t *file_data = midi_data;
+    uint32_t file_size = midi_size;
+    uint8_t parsed = 0;
+    /* silence is stripped from both ends, so that needs the whole song */
+    uint8_t stream = ((!probe) && (ctx->mixer_options & WM_MO_STREAM)
+                      && !(ctx->mixer_options & WM_MO_STRIPSILENCE));
+    int ret;
 
     uint32_t tmp_val;
     uint32_t midi_type;
-    const uint8_t **tracks;
-    uint32_t *track_size;
-    uint32_t end_of_tracks = 0;
     uint32_t no_tracks;
     uint32_t i;
     uint32_t divisions = 96;
@@ -58,14 +367,8 @@ _WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
     uint32_t sample_count = 0;
     float sample_count_f = 0;
     float sample_remainder = 0;
-    uint8_t *sysex_store = NULL;
 
-    uint32_t *track_delta;
-    uint8_t *track_end;
     uint32_t smallest_delta = 0;
-    uint32_t subtract_delta = 0;
-    uint8_t *running_event;
-    uint32_t setup_ret = 0;
 
     if (midi_size < 14) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
@@ -144,16 +447,45 @@ _WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
         return (NULL);
     }
 
-    samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
+    samples_per_delta_f = _WM_GetSamplesPerTick(ctx->sample_rate, divisions, tempo);
 
-    mdi = _WM_initMDI();
+    mdi = _WM_initMDI(ctx, probe);
     _WM_midi_setup_divisions(mdi,divisions);
 
-    tracks = (const uint8_t **) malloc(sizeof(uint8_t *) * no_tracks);
-    track_size = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
-    track_delta = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
-    track_end = (uint8_t *) malloc(sizeof(uint8_t) * no_tracks);
-    running_event = (uint8_t *) malloc(sizeof(uint8_t) * no_tracks);
+    p = (struct _midi_parse *) calloc(1, sizeof(struct _midi_parse));
+    if (p == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+        _WM_freeMDI(mdi);
+        return (NULL);
+    }
+    p->midi_type = midi_type;
+    p->no_tracks = no_tracks;
+    p->divisions = divisions;
+    p->tracks = (const uint8_t **) malloc(sizeof(uint8_t *) * no_tracks);
+    p->track_size = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
+    p->track_delta = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
+    p->track_tick = (uint64_t *) malloc(sizeof(uint64_t) * no_tracks);
+    p->track_heap = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
+    p->track_end = (uint8_t *) malloc(sizeof(uint8_t) * no_tracks);
+    p->running_event = (uint8_t *) malloc(sizeof(uint8_t) * no_tracks);
+
+    /* type 2 songs are played one after another and seeked between by
+       SongSeek(), so they are always parsed whole */
+    if (midi_type == 2) {
+        mdi->is_type2 = 1;
+        stream = 0;
+    }
+    if (stream) {
+        /* the caller's buffer only lasts the open, so the parse keeps its own */
+        p->data = (uint8_t *) malloc(file_size);
+        if (p->data == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            goto _end;
+        }
+        memcpy(p->data, file_data, file_size);
+        p->data_size = file_size;
+        midi_data = p->data + (midi_data - file_data);
+    }
 
     smallest_delta = 0x7fffffff;
     for (i = 0; i < no_tracks; i++) {
@@ -203,33 +535,34 @@ _WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
                 }
             }
         }
-        tracks[i] = midi_data;
-        track_size[i] = tmp_val;
+        p->tracks[i] = midi_data;
+        p->track_size[i] = tmp_val;
+        p->track_bytes += tmp_val;
         midi_data += tmp_val;
         midi_size -= tmp_val;
-        track_end[i] = 0;
-        running_event[i] = 0;
-        track_delta[i] = 0;
-
-        while (*tracks[i] > 0x7F) {
-            track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-            tracks[i]++;
-            track_size[i]--;
+        p->track_end[i] = 0;
+        p->running_event[i] = 0;
+        p->track_delta[i] = 0;
+
+        while (*p->tracks[i] > 0x7F) {
+            p->track_delta[i] = (p->track_delta[i] << 7) + (*p->tracks[i] & 0x7F);
+            p->tracks[i]++;
+            p->track_size[i]--;
         }
-        track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-        tracks[i]++;
-        track_size[i]--;
+        p->track_delta[i] = (p->track_delta[i] << 7) + (*p->tracks[i] & 0x7F);
+        p->tracks[i]++;
+        p->track_size[i]--;
 
         if (midi_type == 1 ) {
-            if (track_delta[i] < smallest_delta) {
-                smallest_delta = track_delta[i];
+            if (p->track_delta[i] < smallest_delta) {
+                smallest_delta = p->track_delta[i];
             }
         } else {
             /*
              * Type 0 & 2 midi only needs delta from 1st track
              * for initial sample calculations.
              */
-            if (i == 0) smallest_delta = track_delta[i];
+            if (i == 0) smallest_delta = p->track_delta[i];
         }
     }
 
@@ -248,193 +581,41 @@ _WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
         goto _end;
     }
 
-    subtract_delta = smallest_delta;
     sample_count_f = (((float) smallest_delta * samples_per_delta_f) + sample_remainder);
     if (sample_count_f < 0.0f || sample_count_f >= WM_TWO_TO_32_F) { _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "sample count out of range", 0); goto _end; } sample_count = (uint32_t) sample_count_f;
     sample_remainder = sample_count_f - (float) sample_count;
 
     mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
     mdi->extra_info.approx_total_samples += sample_count;
+    mdi->parse_tick += smallest_delta;
 
-    /*
-     * Handle type 0 & 2 the same, but type 1 differently
-     */
+    p->samples_per_delta_f = samples_per_delta_f;
     if (midi_type == 1) {
-        /* Type 1 */
-        while (end_of_tracks != no_tracks) {
-            smallest_delta = 0;
-            for (i = 0; i < no_tracks; i++) {
-                if (track_end[i])
-                    continue;
-                if (track_delta[i]) {
-                    track_delta[i] -= subtract_delta;
-                    if (track_delta[i]) {
-                        if (!smallest_delta || (smallest_delta > track_delta[i])) {
-                            smallest_delta = track_delta[i];
-                        }
-                        continue;
-                    }
-                }
-                do {
-                    if (tracks[i][0] > 0x7f) {
-                        if (tracks[i][0] < 0xf0) {
-                            /* Events 0x80 - 0xef set running event */
-                            running_event[i] = tracks[i][0];
-                        } else if ((tracks[i][0] == 0xf0) || (tracks[i][0] == 0xf7)) {
-                            /* Sysex resets running event */
-                            running_event[i] = 0;
-                        } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x2f) && (tracks[i][2] == 0x00)) {
-                            /* End of Track */
-                            end_of_tracks++;
-                            /*
-                             * Since the events are 'flattened' into a single track, only keep the final
-                             * end-of-track event to prevent premature looping.
-                             */
-                            if (end_of_tracks == no_tracks) {
-                                setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
-                                if (setup_ret == 0) {
-                                    goto _end;
-                                }
-                            }
-                            track_end[i] = 1;
-                            tracks[i] += 3;
-                            track_size[i] -= 3;
-                            goto NEXT_TRACK;
-                        } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x51) && (tracks[i][2] == 0x03)) {
-                            /* Tempo */
-                            tempo = (tracks[i][3] << 16) + (tracks[i][4] << 8)+ tracks[i][5];
-                            if (!tempo)
-                                tempo = 500000;
-
-                            samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
-                        }
-                    }
-                    setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
-                    if (setup_ret == 0) {
-                        goto _end;
-                    }
-                    tracks[i] += setup_ret;
-                    track_size[i] -= setup_ret;
-
-                    if (*tracks[i] > 0x7f) {
-                        do {
-                            if (!track_size[i]) break;
-                            track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                            tracks[i]++;
-                            track_size[i]--;
-                        } while (*tracks[i] > 0x7f);
-                    }
-                    if (!track_size[i]) {
-                        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
-                        goto _end;
-                    }
-                    track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                    tracks[i]++;
-                    track_size[i]--;
-                } while (!track_delta[i]);
-                if ((!smallest_delta) || (smallest_delta > track_delta[i])) {
-                    smallest_delta = track_delta[i];
-                }
-            NEXT_TRACK: continue;
-            }
-
-            if ((float)smallest_delta >= (float)0x7fffffff / samples_per_delta_f) {
-                /* DEBUG */
-                /* fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n", */
-                /*        samples_per_delta_f, smallest_delta); */
-                _WM_GLOBAL_ERROR(WM_ERR_CORUPT, NULL, 0);
-                goto _end;
-            }
-            subtract_delta = smallest_delta;
-            sample_count_f = (((float) smallest_delta * samples_per_delta_f)
-                              + sample_remainder);
-            if (sample_count_f < 0.0f || sample_count_f >= WM_TWO_TO_32_F) { _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "sample count out of range", 0); goto _end; } sample_count = (uint32_t) sample_count_f;
-            sample_remainder = sample_count_f - (float) sample_count;
-
-            mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
-            mdi->extra_info.approx_total_samples += sample_count;
+        for (i = 0; i < no_tracks; i++) {
+            p->track_tick[i] = p->track_delta[i];
+            p->track_heap[i] = i;
         }
-    } else {
-        /* Type 0 & 2 */
-        if (midi_type == 2) {
-            mdi->is_type2 = 1;
+        p->heap_count = no_tracks;
+        for (i = no_tracks / 2; i-- > 0; ) {
+            track_heap_down(p->track_heap, p->heap_count, p->track_tick, i);
         }
-        sample_remainder = 0;
-        for (i = 0; i < no_tracks; i++) {
-            running_event[i] = 0;
-            do {
-                setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
-                if (setup_ret == 0) {
-                    goto _end;
-                }
-                if (tracks[i][0] > 0x7f) {
-                    if (tracks[i][0] < 0xf0) {
-                        /* Events 0x80 - 0xef set running event */
-                        running_event[i] = tracks[i][0];
-                    } else if ((tracks[i][0] == 0xf0) || (tracks[i][0] == 0xf7)) {
-                        /* Sysex resets running event */
-                        running_event[i] = 0;
-                    } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x2f) && (tracks[i][2] == 0x00)) {
-                        /* End of Track */
-                        track_end[i] = 1;
-                        goto NEXT_TRACK2;
-                    } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x51) && (tracks[i][2] == 0x03)) {
-                        /* Tempo */
-                        tempo = (tracks[i][3] << 16) + (tracks[i][4] << 8)+ tracks[i][5];
-                        if (!tempo)
-                            tempo = 500000;
-
-                        samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
-                    }
-                }
-                tracks[i] += setup_ret;
-                track_size[i] -= setup_ret;
-
-                track_delta[i] = 0;
-                if (*tracks[i] > 0x7f) {
-                    do {
-                        if (!track_size[i]) break;
-                        track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                        tracks[i]++;
-                        track_size[i]--;
-                    } while (*tracks[i] > 0x7f);
-                }
-                if (!track_size[i]) {
-                    if (midi_type != 0) {
-                        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
-                        goto _end;
-                    } else {
-                        track_end[i] = 1;
-                        goto NEXT_TRACK2;
-                    }
-                }
-                track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                tracks[i]++;
-                track_size[i]--;
+        p->tick = smallest_delta;
+        p->sample_remainder = sample_remainder;
+    }
 
-                if ((float)smallest_delta >= (float)0x7fffffff / samples_per_delta_f) {
-                    /* DEBUG */
-                    /* fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n", */
-                    /*        samples_per_delta_f, smallest_delta); */
-                    _WM_GLOBAL_ERROR(WM_ERR_CORUPT, NULL, 0);
-                    goto _end;
-                }
-                sample_count_f = (((float) track_delta[i] * samples_per_delta_f)
-                                  + sample_remainder);
-                if (sample_count_f < 0.0f || sample_count_f >= WM_TWO_TO_32_F) { _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "sample count out of range", 0); goto _end; } sample_count = (uint32_t) sample_count_f;
-                sample_remainder = sample_count_f - (float) sample_count;
-                mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
-                mdi->extra_info.approx_total_samples += sample_count;
-            NEXT_TRACK2:
-                smallest_delta = track_delta[i]; /* Added just to keep Xcode happy */
-                WMIDI_UNUSED(smallest_delta); /* Added to just keep clang happy */
-            } while (track_end[i] == 0);
-        }
+    ret = midi_parse_events(mdi, p, (stream) ? WM_STREAM_EVENTS : UINT32_MAX);
+    if (ret < 0) {
+        goto _end;
+    }
+    if (ret == 0) {
+        memcpy(p->channel, mdi->channel, sizeof(p->channel));
+        mdi->stream = p;
     }
 
-    if ((mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width,
-            _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy))
-          == NULL) {
+    if ((!probe)
+        && ((mdi->reverb = _WM_init_reverb(ctx->sample_rate, ctx->reverb_room_width,
+                 ctx->reverb_room_length, ctx->reverb_listen_posx, ctx->reverb_listen_posy))
+            == NULL)) {
         _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
         goto _end;
     }
@@ -445,18 +626,164 @@ _WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
     mdi->note = NULL;
 
     _WM_ResetToStart(mdi);
+    parsed = 1;
 
-_end:   free(sysex_store);
-    free(track_end);
-    free(track_delta);
-    free(running_event);
-    free((void*)tracks);
-    free(track_size);
-    if (mdi->reverb) return (mdi);
+_end:
+    if (mdi->stream == NULL) {
+        midi_parse_free(p);
+    }
+    if (parsed) return (mdi);
     _WM_freeMDI(mdi);
     return (NULL);
 }
 
+/* whether a streamed song has more to parse before it is known past
+   sample and tick */
+static int stream_due(struct _mdi *mdi, uint32_t sample, uint32_t tick) {
+    return ((mdi->stream != NULL)
+            && ((mdi->extra_info.approx_total_samples <= sample)
+                || (mdi->parse_tick <= tick)));
+}
+
+/*
+ * Parse a streamed song on by a window of events. The parser's channel
+ * state stands in for playback's meanwhile, and whatever the window moves
+ * (the event list, and the text the lyrics point into) is followed. A
+ * file that turns out to be corrupt part way ends there, with the error
+ * set. One that is read to its end is kept in stream_file for the cache.
+ */
+static void stream_window(struct _mdi *mdi) {
+    struct _midi_parse *p = (struct _midi_parse *) mdi->stream;
+    struct _channel channel[16];
+    uint32_t current;
+    uintptr_t text;
+    char *lyric;
+    uint32_t i;
+    int ret;
+
+    current = (uint32_t)(mdi->current_event - mdi->events);
+    text = (uintptr_t) mdi->event_text;
+
+    memcpy(channel, mdi->channel, sizeof(channel));
+    memcpy(mdi->channel, p->channel, sizeof(channel));
+    ret = midi_parse_events(mdi, p, mdi->event_count + WM_STREAM_EVENTS);
+    memcpy(p->channel, mdi->channel, sizeof(channel));
+    memcpy(mdi->channel, channel, sizeof(channel));
+
+    mdi->current_event = &mdi->events[current];
+    if ((text) && ((uintptr_t) mdi->event_text != text)) {
+        /* WildMidi_GetLyric() takes it without the lock */
+        lyric = (char *) _WM_AtomicExchangePtr((void **) &mdi->lyric, NULL);
+        if (lyric) {
+            _WM_AtomicExchangePtr((void **) &mdi->lyric,
+                                  mdi->event_text + ((uintptr_t) lyric - text));
+        }
+        for (i = 0; i < mdi->checkpoint_count; i++) {
+            if (mdi->checkpoints[i].lyric) {
+                mdi->checkpoints[i].lyric = mdi->event_text
+                    + ((uintptr_t) mdi->checkpoints[i].lyric - text);
+            }
+        }
+    }
+    /* the parse keeps a slot free past the last event */
+    mdi->events[mdi->event_count].evtype = ev_null;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = 0;
+    mdi->events[mdi->event_count].samples_to_next = 0;
+
+    if (ret != 0) {
+        if (ret > 0) {
+            /* _WM_StreamMidiStore() takes it without the lock */
+            mdi->stream_file_size = p->data_size;
+            _WM_AtomicExchangePtr((void **) &mdi->stream_file, p->data);
+            p->data = NULL;
+        }
+        midi_parse_free(p);
+        mdi->stream = NULL;
+    }
+}
+
+/* Parse a streamed song on until it is known past sample and tick, or to
+   its end. */
+static void stream_midi(struct _mdi *mdi, uint32_t sample, uint32_t tick) {
+    while (stream_due(mdi, sample, tick)) {
+        stream_window(mdi);
+    }
+}
+
+/*
+ * Parse a streamed song on by one window of events, for a control call
+ * that lets the song's lock go between windows: returns 1 if it did, 0
+ * once the song is known past sample and tick, or to its end. The patches
+ * found start loading on the worker pool; a song read to its end waits
+ * for _WM_StreamMidiStore().
+ */
+int _WM_StreamMidi(struct _mdi *mdi, uint32_t sample, uint32_t tick) {
+    if (!stream_due(mdi, sample, tick)) {
+        return (0);
+    }
+    stream_window(mdi);
+    _WM_load_patches_ahead(mdi);
+    return (1);
+}
+
+/*
+ * Parse a streamed song on for WM_Render(), which is to do no file work.
+ * The parse runs WM_STREAM_AHEAD seconds past sample, and the patches it
+ * finds are loaded on the worker pool meanwhile, so that only those a
+ * note up to sample may play have to be in now. The cache waits for a
+ * control call, or the close.
+ */
+void _WM_StreamMidiAhead(struct _mdi *mdi, uint32_t sample) {
+    uint32_t ahead = mdi->ctx->sample_rate * WM_STREAM_AHEAD;
+
+    stream_midi(mdi, (sample < UINT32_MAX - ahead) ? sample + ahead : UINT32_MAX, 0);
+    _WM_load_patches_ahead(mdi);
+    _WM_load_patches_due(mdi, sample);
+}
+
+/*
+ * Keep a streamed song that has been read to its end in the cache. Once
+ * it is, nothing changes what the cache reads of the song, so this needs
+ * no lock: whichever caller takes the file writes it.
+ */
+void _WM_StreamMidiStore(struct _mdi *mdi) {
+    uint8_t *file = (uint8_t *) _WM_AtomicExchangePtr((void **) &mdi->stream_file,
+                                                      NULL);
+
+    if (file != NULL) {
+        _WM_CacheStore(mdi, file, mdi->stream_file_size);
+        free(file);
+    }
+}
+
+/*
+ * A streamed song's length, guessed from how far through its tracks the
+ * parse has got; never less than what is parsed.
+ */
+uint32_t _WM_StreamMidiLength(struct _mdi *mdi) {
+    struct _midi_parse *p = (struct _midi_parse *) mdi->stream;
+    uint32_t parsed = mdi->extra_info.approx_total_samples;
+    uint32_t left = 0;
+    uint64_t length;
+    uint32_t i;
+
+    if (p == NULL) return (parsed);
+    for (i = 0; i < p->no_tracks; i++) {
+        left += p->track_size[i];
+    }
+    if (left >= p->track_bytes) return (parsed);
+    length = (uint64_t) parsed * p->track_bytes / (p->track_bytes - left);
+    return ((length > 0xffffffff) ? 0xffffffff : (uint32_t) length);
+}
+
+void _WM_FreeMidiStream(struct _mdi *mdi) {
+    midi_parse_free((struct _midi_parse *) mdi->stream);
+    mdi->stream = NULL;
+    free(mdi->stream_file);
+    mdi->stream_file = NULL;
+}
+
 /*
  Convert WildMIDI's MDI events into a type 0 MIDI file.
 
@@ -493,7 +820,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
         return -1;
     }
 
-    samples_per_tick = _WM_GetSamplesPerTick(divisions, tempo);
+    samples_per_tick = _WM_GetSamplesPerTick(mdi->ctx->sample_rate, divisions, tempo);
 
     /*
      Note: This isn't accurate but will allow enough space for
@@ -510,7 +837,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
     (*out)[5] = 0x00;
     (*out)[6] = 0x00;
     (*out)[7] = 0x06;
-    if ((!(_WM_MixerOptions & WM_MO_SAVEASTYPE0)) && (mdi->is_type2)) {
+    if ((!(mdi->ctx->mixer_options & WM_MO_SAVEASTYPE0)) && (mdi->is_type2)) {
         /* Type 2 */
         (*out)[8] = 0x00;
         (*out)[9] = 0x02;
@@ -536,270 +863,270 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
         switch (event->evtype) {
         case ev_midi_divisions:
             /* DEBUG */
-            /* fprintf(stderr,"Division: %u\r\n",event->event_data.data); */
-            divisions = event->event_data.data.value;
+            /* fprintf(stderr,"Division: %u\r\n",event->value); */
+            divisions = event->value;
             (*out)[12] = (divisions >> 8) & 0xff;
             (*out)[13] = divisions & 0xff;
-            samples_per_tick = _WM_GetSamplesPerTick(divisions, tempo);
+            samples_per_tick = _WM_GetSamplesPerTick(mdi->ctx->sample_rate, divisions, tempo);
             break;
         case ev_note_off:
             /* DEBUG */
-            /* fprintf(stderr,"Note Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0x80 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0x80 | event->event_data.channel;
+            /* fprintf(stderr,"Note Off: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0x80 | event->channel)) {
+                (*out)[out_ofs++] = 0x80 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_note_on:
             /* DEBUG */
-            /* fprintf(stderr,"Note On: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0x90 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0x90 | event->event_data.channel;
+            /* fprintf(stderr,"Note On: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0x90 | event->channel)) {
+                (*out)[out_ofs++] = 0x90 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_aftertouch:
             /* DEBUG */
-            /* fprintf(stderr,"Aftertouch: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xa0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xa0 | event->event_data.channel;
+            /* fprintf(stderr,"Aftertouch: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xa0 | event->channel)) {
+                (*out)[out_ofs++] = 0xa0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_bank_select:
             /* DEBUG */
-            /* fprintf(stderr,"Control Bank Select: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Bank Select: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 0;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_modulation:
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 1;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_data_entry_course:
             /* DEBUG */
-            /* fprintf(stderr,"Control Data Entry Course: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Data Entry Course: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 6;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_volume:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Volume: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Volume: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 7;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_balance:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Balance: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Balance: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 8;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_pan:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Pan: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Pan: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 10;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_expression:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Expression: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Expression: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 11;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_data_entry_fine:
             /* DEBUG */
-            /* fprintf(stderr,"Control Data Entry Fine: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Data Entry Fine: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 38;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_hold:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Hold: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Hold: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 64;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_data_increment:
             /* DEBUG */
-            /* fprintf(stderr,"Control Data Increment: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Data Increment: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 96;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_data_decrement:
             /* DEBUG */
-            /* fprintf(stderr,"Control Data Decrement: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Data Decrement: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 97;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_non_registered_param_fine:
             /* DEBUG */
-            /* fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 98;
-            (*out)[out_ofs++] = event->event_data.data.value & 0x7f;
+            (*out)[out_ofs++] = event->value & 0x7f;
             break;
         case ev_control_non_registered_param_course:
             /* DEBUG */
-            /* fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 99;
-            (*out)[out_ofs++] = (event->event_data.data.value >> 7) & 0x7f;
+            (*out)[out_ofs++] = (event->value >> 7) & 0x7f;
             break;
         case ev_control_registered_param_fine:
             /* DEBUG */
-            /* fprintf(stderr,"Control Registered Param Fine: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Registered Param Fine: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 100;
-            (*out)[out_ofs++] = event->event_data.data.value & 0x7f;
+            (*out)[out_ofs++] = event->value & 0x7f;
             break;
         case ev_control_registered_param_course:
             /* DEBUG */
-            /* fprintf(stderr,"Control Registered Param Course: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Registered Param Course: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 101;
-            (*out)[out_ofs++] = (event->event_data.data.value >> 7) & 0x7f;
+            (*out)[out_ofs++] = (event->value >> 7) & 0x7f;
             break;
         case ev_control_channel_sound_off:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Sound Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Sound Off: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 120;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_controllers_off:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Controllers Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Controllers Off: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 121;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_channel_notes_off:
             /* DEBUG */
-            /* fprintf(stderr,"Control Channel Notes Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Channel Notes Off: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 123;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_control_dummy:
             /* DEBUG */
-            /* fprintf(stderr,"Control Dummy Event: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            /* fprintf(stderr,"Control Dummy Event: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_patch:
             /* DEBUG */
-            /* fprintf(stderr,"Patch: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xc0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xc0 | event->event_data.channel;
+            /* fprintf(stderr,"Patch: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xc0 | event->channel)) {
+                (*out)[out_ofs++] = 0xc0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_channel_pressure:
             /* DEBUG */
-            /* fprintf(stderr,"Channel Pressure: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xd0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xd0 | event->event_data.channel;
+            /* fprintf(stderr,"Channel Pressure: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xd0 | event->channel)) {
+                (*out)[out_ofs++] = 0xd0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->value & 0xff;
             break;
         case ev_pitch:
             /* DEBUG */
-            /* fprintf(stderr,"Pitch: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
-            if (running_event != (0xe0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xe0 | event->event_data.channel;
+            /* fprintf(stderr,"Pitch: %u %.4x\r\n",event->channel, event->value); */
+            if (running_event != (0xe0 | event->channel)) {
+                (*out)[out_ofs++] = 0xe0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = event->event_data.data.value & 0x7f;
-            (*out)[out_ofs++] = (event->event_data.data.value >> 7) & 0x7f;
+            (*out)[out_ofs++] = event->value & 0x7f;
+            (*out)[out_ofs++] = (event->value >> 7) & 0x7f;
             break;
         case ev_sysex_roland_drum_track: {
             /* DEBUG */
-            /* fprintf(stderr,"Sysex Roland Drum Track: %u %.4x\r\n",event->event_data.channel, event->event_data.data); */
+            /* fprintf(stderr,"Sysex Roland Drum Track: %u %.4x\r\n",event->channel, event->value); */
             uint8_t foo[] = {0xf0, 0x09, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x15, 0x00, 0xf7};
-            uint8_t foo_ch = event->event_data.channel;
+            uint8_t foo_ch = event->channel;
             if (foo_ch == 9) {
                 foo_ch = 0;
             } else if (foo_ch < 9) {
                 foo_ch++;
             }
             foo[7] = 0x10 | foo_ch;
-            foo[9] = event->event_data.data.value;
+            foo[9] = event->value;
             memcpy(&((*out)[out_ofs]),foo,11);
             out_ofs += 11;
             running_event = 0;
@@ -831,7 +1158,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
         case ev_meta_endoftrack:
             /* DEBUG */
             /* fprintf(stderr,"End Of Track\r\n"); */
-            if ((!(_WM_MixerOptions & WM_MO_SAVEASTYPE0)) && (mdi->is_type2)) {
+            if ((!(mdi->ctx->mixer_options & WM_MO_SAVEASTYPE0)) && (mdi->is_type2)) {
                 /* Write end of track marker */
                 (*out)[out_ofs++] = 0xff;
                 (*out)[out_ofs++] = 0x2f;
@@ -860,10 +1187,10 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             goto NEXT_EVENT;
         case ev_meta_tempo:
             /* DEBUG */
-            /* fprintf(stderr,"Tempo: %u\r\n",event->event_data.data); */
-            tempo = event->event_data.data.value & 0xffffff;
+            /* fprintf(stderr,"Tempo: %u\r\n",event->value); */
+            tempo = event->value & 0xffffff;
 
-            samples_per_tick = _WM_GetSamplesPerTick(divisions, tempo);
+            samples_per_tick = _WM_GetSamplesPerTick(mdi->ctx->sample_rate, divisions, tempo);
 
             /* DEBUG */
             /* fprintf(stderr,"\rDEBUG: div %i, tempo %i, bpm %f, pps %f, spd %f\r\n", divisions, tempo, bpm_f, pulses_per_second_f, samples_per_delta_f); */
@@ -877,63 +1204,63 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             break;
         case ev_meta_timesignature:
             /* DEBUG */
-            /* fprintf(stderr,"Time Signature: %x\r\n",event->event_data.data); */
+            /* fprintf(stderr,"Time Signature: %x\r\n",event->value); */
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x58;
             (*out)[out_ofs++] = 0x04;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff000000) >> 24;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff0000) >> 16;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->value & 0xff000000) >> 24;
+            (*out)[out_ofs++] = (event->value & 0xff0000) >> 16;
+            (*out)[out_ofs++] = (event->value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->value & 0xff);
             break;
         case ev_meta_keysignature:
             /* DEBUG */
-            /* fprintf(stderr,"Key Signature: %x\r\n",event->event_data.data); */
+            /* fprintf(stderr,"Key Signature: %x\r\n",event->value); */
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x59;
             (*out)[out_ofs++] = 0x02;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->value & 0xff);
             break;
         case ev_meta_sequenceno:
             /* DEBUG */
-            /* fprintf(stderr,"Sequence Number: %x\r\n",event->event_data.data); */
+            /* fprintf(stderr,"Sequence Number: %x\r\n",event->value); */
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x00;
             (*out)[out_ofs++] = 0x02;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->value & 0xff);
             break;
         case ev_meta_channelprefix:
             /* DEBUG */
-            /* fprintf(stderr,"Channel Prefix: %x\r\n",event->event_data.data); */
+            /* fprintf(stderr,"Channel Prefix: %x\r\n",event->value); */
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x20;
             (*out)[out_ofs++] = 0x01;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->value & 0xff);
             break;
         case ev_meta_portprefix:
             /* DEBUG */
-            /* fprintf(stderr,"Port Prefix: %x\r\n",event->event_data.data); */
+            /* fprintf(stderr,"Port Prefix: %x\r\n",event->value); */
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x21;
             (*out)[out_ofs++] = 0x01;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->value & 0xff);
             break;
         case ev_meta_smpteoffset:
             /* DEBUG */
-            /* fprintf(stderr,"SMPTE Offset: %x\r\n",event->event_data.data); */
+            /* fprintf(stderr,"SMPTE Offset: %x\r\n",event->value); */
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x54;
             (*out)[out_ofs++] = 0x05;
             /*
              Remember because of the 5 bytes we stored it a little hacky.
              */
-            (*out)[out_ofs++] = (event->event_data.channel & 0xff);
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff000000) >> 24;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff0000) >> 16;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->channel & 0xff);
+            (*out)[out_ofs++] = (event->value & 0xff000000) >> 24;
+            (*out)[out_ofs++] = (event->value & 0xff0000) >> 16;
+            (*out)[out_ofs++] = (event->value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->value & 0xff);
             break;
 
         case ev_meta_text:
@@ -977,7 +1304,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             (*out)[out_ofs++] = 0x07;
 
             _WRITE_TEXT:
-            value = (uint32_t) strlen(event->event_data.data.string);
+            value = (uint32_t) strlen(&mdi->event_text[event->value]);
             if (value > 0x0fffffff)
                 (*out)[out_ofs++] = (((value >> 28) &0x7f) | 0x80);
             if (value > 0x1fffff)
@@ -988,13 +1315,13 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
                 (*out)[out_ofs++] = (((value >> 7) & 0x7f) | 0x80);
             (*out)[out_ofs++] = (value & 0x7f);
 
-            memcpy(&(*out)[out_ofs], event->event_data.data.string, value);
+            memcpy(&(*out)[out_ofs], &mdi->event_text[event->value], value);
             out_ofs += value;
             break;
 
         default:
             /* DEBUG */
-            /* fprintf(stderr,"Unknown Event %.2x %.4x\n",event->event_data.channel, event->event_data.data.value); */
+            /* fprintf(stderr,"Unknown Event %.2x %.4x\n",event->channel, event->value); */
             event++;
             continue;
         }
@@ -1018,7 +1345,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
         event++;
     } while (event->evtype != ev_null);
 
-    if ((_WM_MixerOptions & WM_MO_SAVEASTYPE0) || (!mdi->is_type2)) {
+    if ((mdi->ctx->mixer_options & WM_MO_SAVEASTYPE0) || (!mdi->is_type2)) {
         /* Write end of track marker */
         (*out)[out_ofs++] = 0xff;
         (*out)[out_ofs++] = 0x2f;
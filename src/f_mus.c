@@ -45,7 +45,8 @@
  Turns mus file data into an event stream.
  */
 struct _mdi *
-_WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size) {
+_WM_ParseNewMus(struct _WM_Context *ctx, const uint8_t *mus_data,
+                uint32_t mus_size, uint8_t probe) {
     uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
     uint32_t mus_song_ofs = 0;
     uint32_t mus_song_len = 0;
@@ -56,6 +57,7 @@ _WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size) {
     uint16_t * mus_mid_instr = NULL;
     uint16_t mus_instr_cnt = 0;
     struct _mdi *mus_mdi;
+    uint8_t parsed = 0;
     uint32_t mus_divisions = 60;
     float tempo_f = 0;
     uint16_t mus_freq = 0;
@@ -127,16 +129,16 @@ _WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size) {
     mus_freq = _cvt_get_option(WM_CO_FREQUENCY);
     if (mus_freq == 0) mus_freq = 140;
 
-    if ((_WM_MixerOptions & WM_MO_ROUNDTEMPO)) {
+    if ((ctx->mixer_options & WM_MO_ROUNDTEMPO)) {
         tempo_f = (float) (60000000 / mus_freq) + 0.5f;
     } else {
         tempo_f = (float) (60000000 / mus_freq);
     }
 
-    samples_per_tick_f = _WM_GetSamplesPerTick(mus_divisions, (uint32_t)tempo_f);
+    samples_per_tick_f = _WM_GetSamplesPerTick(ctx->sample_rate, mus_divisions, (uint32_t)tempo_f);
 
     /* initialise the mdi structure */
-    mus_mdi = _WM_initMDI();
+    mus_mdi = _WM_initMDI(ctx, probe);
     _WM_midi_setup_divisions(mus_mdi, mus_divisions);
     _WM_midi_setup_tempo(mus_mdi, (uint32_t)tempo_f);
 
@@ -358,12 +360,13 @@ _WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size) {
 
         mus_mdi->events[mus_mdi->event_count - 1].samples_to_next = sample_count;
         mus_mdi->extra_info.approx_total_samples += sample_count;
+        mus_mdi->parse_tick += mus_ticks;
 
     } while (mus_data_ofs < mus_size);
 
 _mus_end_of_song:
     /* Finalise mdi structure */
-    if ((mus_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((!probe) && ((mus_mdi->reverb = _WM_init_reverb(ctx->sample_rate, ctx->reverb_room_width, ctx->reverb_room_length, ctx->reverb_listen_posx, ctx->reverb_listen_posy)) == NULL)) {
         _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
         goto _mus_end;
     }
@@ -374,10 +377,11 @@ _mus_end_of_song:
     mus_mdi->note = NULL;
 
     _WM_ResetToStart(mus_mdi);
+    parsed = 1;
 
 _mus_end:
     free(mus_mid_instr);
-    if (mus_mdi->reverb) return (mus_mdi);
+    if (parsed) return (mus_mdi);
     _WM_freeMDI(mus_mdi);
     return NULL;
 }
@@ -47,7 +47,8 @@
 #include "mafm.h"
 #endif
 
-struct _mdi *_WM_ParseNewSmaf(const uint8_t *smaf_data, uint32_t smaf_size) {
+struct _mdi *_WM_ParseNewSmaf(struct _WM_Context *ctx, const uint8_t *smaf_data,
+                               uint32_t smaf_size, uint8_t probe) {
     struct _mdi *smaf_mdi = NULL;
     uint8_t *smf_data = NULL;
     uint32_t smf_size = 0;
@@ -57,7 +58,7 @@ struct _mdi *_WM_ParseNewSmaf(const uint8_t *smaf_data, uint32_t smaf_size) {
         return NULL;
     }
 
-    smaf_mdi = _WM_ParseNewMidi(smf_data, smf_size);
+    smaf_mdi = _WM_ParseNewMidi(ctx, smf_data, smf_size, probe);
     free(smf_data);
 
 #ifdef WILDMIDI_MAFM
@@ -66,9 +67,10 @@ struct _mdi *_WM_ParseNewSmaf(const uint8_t *smaf_data, uint32_t smaf_size) {
      * approximation.  The note/timing stream still comes from smaf2midi above;
      * the FM synth only replaces the sound generation.  Files with no custom
      * voices keep the plain GM path. */
-    if (smaf_mdi != NULL && _WM_MAFM_HasCustomVoices(smaf_data, smaf_size)) {
+    if (smaf_mdi != NULL && !probe
+        && _WM_MAFM_HasCustomVoices(smaf_data, smaf_size)) {
         smaf_mdi->mafm_synth = _WM_MAFM_NewSynth(smaf_data, smaf_size,
-                                                 _WM_SampleRate);
+                                                 ctx->sample_rate);
     }
 #endif
 
@@ -36,8 +36,10 @@
 #include "f_xmidi.h"
 
 
-struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
+struct _mdi *_WM_ParseNewXmi(struct _WM_Context *ctx, const uint8_t *xmi_data,
+                             uint32_t xmi_size, uint8_t probe) {
     struct _mdi *xmi_mdi = NULL;
+    uint8_t parsed = 0;
     uint32_t xmi_tmpdata = 0;
     uint8_t xmi_formcnt = 0;
     uint32_t xmi_catlen = 0;
@@ -140,11 +142,11 @@ struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
     xmi_data += 4;
     xmi_size -= 4;
 
-    xmi_mdi = _WM_initMDI();
+    xmi_mdi = _WM_initMDI(ctx, probe);
     _WM_midi_setup_divisions(xmi_mdi, xmi_divisions);
     _WM_midi_setup_tempo(xmi_mdi, xmi_tempo);
 
-    xmi_samples_per_delta_f = _WM_GetSamplesPerTick(xmi_divisions, xmi_tempo);
+    xmi_samples_per_delta_f = _WM_GetSamplesPerTick(ctx->sample_rate, xmi_divisions, xmi_tempo);
 
     xmi_notelen = (uint32_t *) malloc(sizeof(uint32_t) * 16 * 128);
     memset(xmi_notelen, 0, (sizeof(uint32_t) * 16 * 128));
@@ -289,6 +291,7 @@ struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
 
                             xmi_mdi->events[xmi_mdi->event_count - 1].samples_to_next += xmi_sample_count;
                             xmi_mdi->extra_info.approx_total_samples += xmi_sample_count;
+                            xmi_mdi->parse_tick += xmi_tmpdata;
 
                             xmi_lowestdelta = 0;
 
@@ -406,7 +409,7 @@ struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
     }
 
     /* Finalise mdi structure */
-    if ((xmi_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((!probe) && ((xmi_mdi->reverb = _WM_init_reverb(ctx->sample_rate, ctx->reverb_room_width, ctx->reverb_room_length, ctx->reverb_listen_posx, ctx->reverb_listen_posy)) == NULL)) {
         _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
         goto _xmi_end;
     }
@@ -419,10 +422,11 @@ struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
         xmi_mdi->is_type2 = 1;
     }
     _WM_ResetToStart(xmi_mdi);
+    parsed = 1;
 
 _xmi_end:
     if (xmi_notelen) free(xmi_notelen);
-    if (xmi_mdi->reverb) return (xmi_mdi);
+    if (parsed) return (xmi_mdi);
     _WM_freeMDI(xmi_mdi);
     return NULL;
 }
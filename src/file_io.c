@@ -76,8 +76,6 @@
 
 #include "wm_error.h"
 #include "file_io.h"
-void* (*_WM_BufferFile)(const char *, uint32_t *) = _WM_BufferFileImpl;
-void  (*_WM_FreeBufferFile)(void*)                = _WM_FreeBufferFileImpl;
 
 #ifdef WILDMIDI_AMIGA
 static long AMIGA_filesize (const char *path) {
@@ -693,7 +693,7 @@ static int convert_16urp(uint8_t *data, struct _sample *gus_sample) {
 
 /* sample loading */
 
-struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
+struct _sample * _WM_load_gus_pat(struct _WM_Context *ctx, const char *filename) {
     uint8_t *gus_patch;
     uint32_t gus_size;
     uint32_t gus_ptr;
@@ -723,32 +723,30 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
     };
     uint32_t tmp_loop;
 
-    WMIDI_UNUSED(fix_release);
-
     SAMPLE_CONVERT_DEBUG(_WM_FUNCTION); SAMPLE_CONVERT_DEBUG(filename);
 
-    if ((gus_patch = (uint8_t *) _WM_BufferFile(filename, &gus_size)) == NULL) {
+    if ((gus_patch = (uint8_t *) ctx->buffer_file(filename, &gus_size)) == NULL) {
         return NULL;
     }
     if (gus_size < 239) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        ctx->free_buffer_file(gus_patch);
         return NULL;
     }
     if (memcmp(gus_patch, "GF1PATCH110\0ID#000002", 22)
             && memcmp(gus_patch, "GF1PATCH100\0ID#000002", 22)) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        ctx->free_buffer_file(gus_patch);
         return NULL;
     }
     if (gus_patch[82] > 1) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        ctx->free_buffer_file(gus_patch);
         return NULL;
     }
     if (gus_patch[151] > 1) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        ctx->free_buffer_file(gus_patch);
         return NULL;
     }
 
@@ -768,7 +766,7 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         }
         if (gus_sample == NULL) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_FreeBufferFile(gus_patch);
+            ctx->free_buffer_file(gus_patch);
             return NULL;
         }
 
@@ -779,7 +777,7 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
          * be past the buffer on any iteration. */
         if (gus_ptr > gus_size || gus_size - gus_ptr < 96) {
             _WM_GLOBAL_ERROR(WM_ERR_CORUPT, filename, 0);
-            _WM_FreeBufferFile(gus_patch);
+            ctx->free_buffer_file(gus_patch);
             return NULL;
         }
 
@@ -853,7 +851,7 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
             || gus_sample->loop_end > gus_sample->data_length
             || gus_sample->data_length > (UINT32_MAX >> 10)) {
             _WM_GLOBAL_ERROR(WM_ERR_CORUPT, filename, 0);
-            _WM_FreeBufferFile(gus_patch);
+            ctx->free_buffer_file(gus_patch);
             return NULL;
         }
 
@@ -882,26 +880,26 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
                 gus_sample->env_target[i] = 16448 * gus_patch[gus_ptr + 43 + i];
                 GUSPAT_INT_DEBUG("Envelope Level",gus_patch[gus_ptr+43+i]); GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[env_rate]);
                 gus_sample->env_rate[i] = (int32_t) (4194303.0f
-                        / ((float) _WM_SampleRate * env_time_table[env_rate]));
+                        / ((float) ctx->sample_rate * env_time_table[env_rate]));
                 GUSPAT_INT_DEBUG("Envelope Rate",gus_sample->env_rate[i]); GUSPAT_INT_DEBUG("GUSPAT Rate",env_rate);
                 if (gus_sample->env_rate[i] == 0) {
                     _WM_DEBUG_MSG("%s: Warning: found invalid envelope(%u) rate setting in %s. Using %f instead.",
                                   _WM_FUNCTION, i, filename, env_time_table[63]);
                     gus_sample->env_rate[i] = (int32_t) (4194303.0f
-                            / ((float) _WM_SampleRate * env_time_table[63]));
+                            / ((float) ctx->sample_rate * env_time_table[63]));
                     GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[63]);
                 }
             } else {
                 gus_sample->env_target[i] = 4194303;
                 gus_sample->env_rate[i] = (int32_t) (4194303.0f
-                        / ((float) _WM_SampleRate * env_time_table[63]));
+                        / ((float) ctx->sample_rate * env_time_table[63]));
                 GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[63]);
             }
         }
 
         gus_sample->env_target[6] = 0;
         gus_sample->env_rate[6] = (int32_t) (4194303.0f
-                / ((float) _WM_SampleRate * env_time_table[63]));
+                / ((float) ctx->sample_rate * env_time_table[63]));
 
         gus_ptr += 96;
         tmp_cnt = gus_sample->data_length;
@@ -909,7 +907,7 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         if (do_convert[(((gus_sample->modes & 0x18) >> 1)
                 | (gus_sample->modes & 0x03))](&gus_patch[gus_ptr], gus_sample)
                 == -1) {
-            _WM_FreeBufferFile(gus_patch);
+            ctx->free_buffer_file(gus_patch);
             return NULL;
         }
 
@@ -936,7 +934,7 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
             gus_sample->note_off_decay = (uint32_t)samples_f;
 
         } else {
-            gus_sample->note_off_decay = gus_sample->data_length * _WM_SampleRate / gus_sample->rate;
+            gus_sample->note_off_decay = gus_sample->data_length * ctx->sample_rate / gus_sample->rate;
         }
 
         gus_ptr += tmp_cnt;
@@ -948,6 +946,6 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         gus_sample->data_length = gus_sample->data_length << 10;
         no_of_samples--;
     }
-    _WM_FreeBufferFile(gus_patch);
+    ctx->free_buffer_file(gus_patch);
     return first_gus_sample;
 }
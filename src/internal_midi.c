@@ -40,6 +40,7 @@
 #include "wildmidi_lib.h"
 #include "patches.h"
 #include "internal_midi.h"
+#include "f_midi.h"
 #ifdef WILDMIDI_SF2
 #include "sf2.h"
 #endif
@@ -420,10 +421,10 @@ void _WM_DynamicVolumeAdjust(struct _mdi *mdi, int32_t *tmp_buffer, uint32_t buf
             if (volume != volume_to_reach) {
                 if (volume_to_reach == MAX_DYN_VOL) {
                     /* if we want normal volume then adjust to it slower */
-                    volume_adjust = (volume_to_reach - volume) / ((double)_WM_SampleRate * 0.1);
+                    volume_adjust = (volume_to_reach - volume) / ((double)mdi->ctx->sample_rate * 0.1);
                 } else {
                     /* if we want to clamp the volume then adjust quickly */
-                    volume_adjust = (volume_to_reach - volume) / ((double)_WM_SampleRate * 0.0001);
+                    volume_adjust = (volume_to_reach - volume) / ((double)mdi->ctx->sample_rate * 0.0001);
                 }
             }
         }
@@ -497,7 +498,7 @@ void _WM_AdjustNoteVolumes(struct _mdi *mdi, uint8_t ch, struct _note *nte) {
      FIXME: Still needs tuning. Clipping heard at a value of 3.75
      */
 #define VOL_DIVISOR 4.0
-    volume_adj = ((double)_WM_MasterVolume / 1024.0) / VOL_DIVISOR;
+    volume_adj = ((double)mdi->ctx->master_volume / 1024.0) / VOL_DIVISOR;
 
     MIDI_EVENT_DEBUG(_WM_FUNCTION,ch, 0);
 
@@ -545,7 +546,7 @@ void _WM_AdjustChannelVolumes(struct _mdi *mdi, uint8_t ch) {
     }
 }
 
-float _WM_GetSamplesPerTick(uint32_t divisions, uint32_t tempo) {
+float _WM_GetSamplesPerTick(uint16_t rate, uint32_t divisions, uint32_t tempo) {
     float microseconds_per_tick;
     float secs_per_tick;
     float samples_per_tick;
@@ -553,16 +554,18 @@ float _WM_GetSamplesPerTick(uint32_t divisions, uint32_t tempo) {
     /* Slow but needed for accuracy */
     microseconds_per_tick = (float) tempo / (float) divisions;
     secs_per_tick = microseconds_per_tick / 1000000.0f;
-    samples_per_tick = _WM_SampleRate * secs_per_tick;
+    samples_per_tick = rate * secs_per_tick;
 
     return (samples_per_tick);
 }
 
 /* returns 0 on success, -1 if the pool couldn't be grown. Callers must abort
-   their write on -1, since events[event_count] is not valid to touch */
+   their write on -1, since events[event_count] is not valid to touch. The
+   pool doubles, so a long song is copied a handful of times while loading
+   rather than once every MEM_CHUNK events */
 static int _WM_CheckEventMemoryPool(struct _mdi *mdi) {
     if ((mdi->event_count + 1) >= mdi->events_size) {
-        uint32_t new_size = mdi->events_size + MEM_CHUNK;
+        uint32_t new_size = mdi->events_size * 2;
         size_t bytes = (size_t)new_size * sizeof(struct _event);
         struct _event *new_events;
         /* refuse on uint32_t wrap or size_t overflow on the byte-size math
@@ -583,6 +586,134 @@ static int _WM_CheckEventMemoryPool(struct _mdi *mdi) {
     return (0);
 }
 
+/*
+ * Voices come from a per-handle pool that grows WM_VOICE_CHUNK voices at a
+ * time, so a handle holds about as many as the song ever plays at once. A
+ * chunk never moves once allocated, keeping note pointers valid. Returns
+ * NULL if the pool can't grow.
+ */
+struct _note *_WM_AllocNote(struct _mdi *mdi) {
+    struct _note *nte = mdi->free_note;
+    struct _note **chunks;
+    uint16_t i;
+
+    if (nte == NULL) {
+        if (mdi->voice_chunks >= (0xFFFF / WM_VOICE_CHUNK))
+            return (NULL);
+        chunks = (struct _note **) realloc(mdi->voice_chunk,
+                     (mdi->voice_chunks + 1) * sizeof(struct _note *));
+        if (chunks == NULL)
+            return (NULL);
+        mdi->voice_chunk = chunks;
+        nte = (struct _note *) calloc(WM_VOICE_CHUNK, sizeof(struct _note));
+        if (nte == NULL)
+            return (NULL);
+        chunks[mdi->voice_chunks] = nte;
+        for (i = 0; i < WM_VOICE_CHUNK; i++) {
+            nte[i].voice = mdi->voice_chunks * WM_VOICE_CHUNK + i;
+            nte[i].next = (i + 1 < WM_VOICE_CHUNK) ? &nte[i + 1] : NULL;
+        }
+        mdi->voice_chunks++;
+    }
+    mdi->free_note = nte->next;
+    nte->next = NULL;
+    nte->replay = NULL;
+    return (nte);
+}
+
+/*
+ * Return a voice, and any replay waiting on it, to the pool. A replay is
+ * counted in note_count from the note on that set it up, so freeing one
+ * takes it off; the note's own voice is left to the caller.
+ */
+void _WM_FreeNote(struct _mdi *mdi, struct _note *nte) {
+    if (nte->replay) {
+        nte->replay->next = mdi->free_note;
+        mdi->free_note = nte->replay;
+        nte->replay = NULL;
+        mdi->note_count--;
+    }
+    nte->next = mdi->free_note;
+    mdi->free_note = nte;
+}
+
+/* the playing note of a channel's key, or NULL */
+static inline struct _note *key_note(struct _mdi *mdi, uint8_t ch, uint8_t key) {
+    uint16_t voice = mdi->key_note[ch][key];
+
+    if (!voice)
+        return (NULL);
+    voice--;
+    return (&mdi->voice_chunk[voice / WM_VOICE_CHUNK][voice % WM_VOICE_CHUNK]);
+}
+
+/*
+ * The playing notes form a doubly linked list in start order, from
+ * mdi->note to mdi->note_tail, so starting and ending a note takes the same
+ * time however many play. A note is in the list exactly while key_note
+ * holds it; nte->noteid must be set before adding it.
+ */
+void _WM_AddNote(struct _mdi *mdi, struct _note *nte) {
+    nte->prev = mdi->note_tail;
+    nte->next = NULL;
+    if (mdi->note_tail)
+        mdi->note_tail->next = nte;
+    else
+        mdi->note = nte;
+    mdi->note_tail = nte;
+    mdi->note_count++;
+    mdi->key_note[nte->noteid >> 8][nte->noteid & 0x7f] = nte->voice + 1;
+}
+
+/* Unlink a note and free it, with its replay. */
+void _WM_RemoveNote(struct _mdi *mdi, struct _note *nte) {
+    if (nte->prev)
+        nte->prev->next = nte->next;
+    else
+        mdi->note = nte->next;
+    if (nte->next)
+        nte->next->prev = nte->prev;
+    else
+        mdi->note_tail = nte->prev;
+    mdi->note_count--;
+    mdi->key_note[nte->noteid >> 8][nte->noteid & 0x7f] = 0;
+    _WM_FreeNote(mdi, nte);
+}
+
+/* with, nte's replay, takes nte's place in the list; nte is freed */
+void _WM_ReplaceNote(struct _mdi *mdi, struct _note *nte, struct _note *with) {
+    with->prev = nte->prev;
+    with->next = nte->next;
+    if (nte->prev)
+        nte->prev->next = with;
+    else
+        mdi->note = with;
+    if (nte->next)
+        nte->next->prev = with;
+    else
+        mdi->note_tail = with;
+    mdi->key_note[with->noteid >> 8][with->noteid & 0x7f] = with->voice + 1;
+    nte->replay = NULL;
+    mdi->note_count--;
+    _WM_FreeNote(mdi, nte);
+}
+
+/* Silence every note at once, dropping any pending replays. */
+void _WM_ClearNotes(struct _mdi *mdi) {
+    struct _note *nte = mdi->note;
+    struct _note *next;
+
+    while (nte) {
+        next = nte->next;
+        mdi->key_note[nte->noteid >> 8][nte->noteid & 0x7f] = 0;
+        _WM_FreeNote(mdi, nte);
+        nte = next;
+    }
+    mdi->note = NULL;
+    mdi->note_tail = NULL;
+    mdi->note_count = 0;
+}
+
 void _WM_do_note_off_extra(struct _note *nte) {
 
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, 0);
@@ -634,12 +765,9 @@ void _WM_do_note_off(struct _mdi *mdi, struct _event_data *data) {
 
     MIDI_EVENT_DEBUG(_WM_FUNCTION,ch, data->data.value);
 
-    nte = &mdi->note_table[0][ch][(data->data.value >> 8)];
-    if (!nte->active) {
-        nte = &mdi->note_table[1][ch][(data->data.value >> 8)];
-        if (!nte->active) {
-            return;
-        }
+    nte = key_note(mdi, ch, (data->data.value >> 8));
+    if (nte == NULL) {
+        return;
     }
 
     if ((mdi->channel[ch].isdrum) && (!(nte->modes & SAMPLE_LOOP))) {
@@ -684,7 +812,7 @@ static inline uint32_t get_inc_detune(struct _mdi *mdi, struct _note *nte,
         note_f = 12700;
     }
     freq = _WM_freq_table[(note_f % 1200)] >> (10 - (note_f / 1200));
-    return (((freq / ((_WM_SampleRate * 100) / 1024)) * 1024
+    return (((freq / ((mdi->ctx->sample_rate * 100) / 1024)) * 1024
              / nte->sample->inc_div));
 }
 
@@ -734,7 +862,7 @@ static void set_note_vibrato(struct _mdi *mdi, struct _note *nte) {
        to nearest so the LFO rate stays accurate at any sample rate */
     nte->vib_inc = (uint16_t)((((uint32_t)VIB_RATE_HZ * VIB_BLOCK
                                 * (VIB_PHASE_MASK + 1))
-                               + (_WM_SampleRate / 2)) / _WM_SampleRate);
+                               + (mdi->ctx->sample_rate / 2)) / mdi->ctx->sample_rate);
     if (nte->vib_inc == 0)
         nte->vib_inc = 1;
 }
@@ -784,10 +912,73 @@ static void set_channel_vibrato(struct _mdi *mdi, uint8_t ch) {
     }
 }
 
+/*
+ * Steal rank of a playing note under the voice cap, lowest first: notes
+ * already in release, then held ones, with drum channels only after every
+ * other note. Notes waiting on a retrigger go last of all, as cutting them
+ * drops the retriggered note too.
+ */
+static int steal_rank(struct _mdi *mdi, const struct _note *nte) {
+    int rank = 0;
+
+    if (nte->modes & SAMPLE_ENVELOPE) {
+        if ((nte->env < 3) || (nte->hold & HOLD_OFF))
+            rank = 1;
+    } else if (nte->modes & SAMPLE_LOOP) {
+        rank = 1;
+    }
+    if (mdi->channel[nte->noteid >> 8].isdrum)
+        rank += 2;
+    if (nte->replay)
+        rank += 4;
+    return (rank);
+}
+
+/*
+ * Cut count voices, sparing keep, to bring mdi back under its voice cap.
+ * Each cut takes the playing note of the lowest steal_rank(), the quietest
+ * within that and the oldest on a tie, as the note list is in start order,
+ * along with any replay waiting on it. Returns the number of voices cut.
+ */
+static uint32_t steal_voices(struct _mdi *mdi, struct _note *keep, uint32_t count) {
+    struct _note *nte, *victim;
+    uint32_t stolen = 0;
+    double level, victim_level = 0.0;
+    int rank, victim_rank = 0;
+
+    while (stolen < count) {
+        victim = NULL;
+        for (nte = mdi->note; nte != NULL; nte = nte->next) {
+            if (nte == keep)
+                continue;
+            rank = steal_rank(mdi, nte);
+            level = (double)nte->env_level
+                    * (nte->left_mix_volume + nte->right_mix_volume);
+            if ((victim == NULL) || (rank < victim_rank)
+                || ((rank == victim_rank) && (level < victim_level))) {
+                victim = nte;
+                victim_rank = rank;
+                victim_level = level;
+            }
+        }
+        if (victim == NULL)
+            break;
+        stolen += (victim->replay) ? 2 : 1;
+        _WM_RemoveNote(mdi, victim);
+    }
+    mdi->extra_info.stolen_voices += stolen;
+    return (stolen);
+}
+
+/* Cut notes, as for a note on, until mdi is within its voice cap. */
+void _WM_CapVoices(struct _mdi *mdi) {
+    if ((mdi->extra_info.max_voices)
+        && (mdi->note_count > mdi->extra_info.max_voices))
+        steal_voices(mdi, NULL, mdi->note_count - mdi->extra_info.max_voices);
+}
+
 void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data) {
-    struct _note *nte;
-    struct _note *prev_nte;
-    struct _note *nte_array;
+    struct _note *nte, *playing;
     uint32_t freq = 0;
     struct _patch *patch;
     struct _sample *sample;
@@ -827,41 +1018,50 @@ void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data) {
         return;
     }
 
-    nte = &mdi->note_table[0][ch][note];
+    nte = key_note(mdi, ch, note);
 
-    if (nte->active) {
+    if (nte) {
         if ((nte->modes & SAMPLE_ENVELOPE) && (nte->env < 3)
             && (!(nte->hold & HOLD_OFF)))
             return;
-        nte->replay = &mdi->note_table[1][ch][note];
+        /* the new note waits in replay while this one fades out, see
+           gus_mix_note() */
+        if (nte->replay == NULL) {
+            nte->replay = _WM_AllocNote(mdi);
+            if (nte->replay == NULL)
+                return;
+            /* a voice of its own while the old note fades */
+            mdi->note_count++;
+        }
         nte->env = 6;
         nte->env_inc = -nte->sample->env_rate[6];
+        playing = nte;
         nte = nte->replay;
     } else {
-        if (mdi->note_table[1][ch][note].active) {
-            if ((nte->modes & SAMPLE_ENVELOPE) && (nte->env < 3)
-                && (!(nte->hold & HOLD_OFF)))
-                return;
-            mdi->note_table[1][ch][note].replay = nte;
-            mdi->note_table[1][ch][note].env = 6;
-            mdi->note_table[1][ch][note].env_inc =
-            -mdi->note_table[1][ch][note].sample->env_rate[6];
-        } else {
-            nte_array = mdi->note;
-            if (nte_array == NULL) {
-                mdi->note = nte;
-            } else {
-                do {
-                    prev_nte = nte_array;
-                    nte_array = nte_array->next;
-                } while (nte_array);
-                prev_nte->next = nte;
-            }
-            nte->active = 1;
-            nte->next = NULL;
-        }
+        /* out of memory for a voice: drop the note */
+        nte = _WM_AllocNote(mdi);
+        if (nte == NULL)
+            return;
+        nte->noteid = (ch << 8) | note;
+        _WM_AddNote(mdi, nte);
+        playing = nte;
     }
     nte->noteid = (ch << 8) | note;
+    if ((mdi->extra_info.max_voices)
+        && (mdi->note_count > mdi->extra_info.max_voices)) {
+        steal_voices(mdi, playing,
+                     mdi->note_count - mdi->extra_info.max_voices);
+        /* with nothing else to cut, the old note stops without its fade */
+        if ((playing != nte)
+            && (mdi->note_count > mdi->extra_info.max_voices)) {
+            _WM_ReplaceNote(mdi, playing, nte);
+            mdi->extra_info.stolen_voices++;
+        }
+    }
+    if (mdi->note_count > mdi->extra_info.peak_voices) {
+        mdi->extra_info.peak_voices = (uint16_t)((mdi->note_count > 0xFFFF)
+                                                 ? 0xFFFF : mdi->note_count);
+    }
     nte->patch = patch;
     nte->sample = sample;
     nte->sample_pos = 0;
@@ -885,12 +1085,9 @@ void _WM_do_aftertouch(struct _mdi *mdi, struct _event_data *data) {
 
     MIDI_EVENT_DEBUG(_WM_FUNCTION,ch, data->data.value);
 
-    nte = &mdi->note_table[0][ch][(data->data.value >> 8)];
-    if (!nte->active) {
-        nte = &mdi->note_table[1][ch][(data->data.value >> 8)];
-        if (!nte->active) {
-            return;
-        }
+    nte = key_note(mdi, ch, (data->data.value >> 8));
+    if (nte == NULL) {
+        return;
     }
 
     nte->velocity = data->data.value & 0xff;
@@ -1128,19 +1325,16 @@ void _WM_do_control_registered_param_course(struct _mdi *mdi,
 void _WM_do_control_channel_sound_off(struct _mdi *mdi,
                                       struct _event_data *data) {
     struct _note *note_data = mdi->note;
+    struct _note *next;
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(_WM_FUNCTION,ch, data->data.value);
 
-    if (note_data) {
-        do {
-            if ((note_data->noteid >> 8) == ch) {
-                note_data->active = 0;
-                if (note_data->replay) {
-                    note_data->replay = NULL;
-                }
-            }
-            note_data = note_data->next;
-        } while (note_data);
+    while (note_data) {
+        next = note_data->next;
+        if ((note_data->noteid >> 8) == ch) {
+            _WM_RemoveNote(mdi, note_data);
+        }
+        note_data = next;
     }
 }
 
@@ -1303,6 +1497,7 @@ void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event_data *data) {
         mdi->channel[i].balance = 64;
         mdi->channel[i].pan = 64;
         mdi->channel[i].pitch = 0;
+        mdi->channel[i].pitch_adjust = 0;
         mdi->channel[i].pitch_range = 200;
         mdi->channel[i].reg_data = 0xFFFF;
         mdi->channel[i].isdrum = 0;
@@ -1377,7 +1572,11 @@ void _WM_Release_Allowance(struct _mdi *mdi) {
         }
 
         if (release > longest_release) longest_release = release;
-        note->replay = NULL;
+        if (note->replay) {
+            _WM_FreeNote(mdi, note->replay);
+            note->replay = NULL;
+            mdi->note_count--;
+        }
         note = note->next;
     }
 
@@ -1509,7 +1708,7 @@ void _WM_do_meta_text(struct _mdi *mdi, struct _event_data *data) {
     MIDI_EVENT_SDEBUG(_WM_FUNCTION, ch, data->data.string);
 #endif
     if (mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC) {
-        mdi->lyric = data->data.string;
+        _WM_AtomicExchangePtr((void **) &mdi->lyric, data->data.string);
     }
 
     return;
@@ -1562,7 +1761,7 @@ void _WM_do_meta_lyric(struct _mdi *mdi, struct _event_data *data) {
     MIDI_EVENT_SDEBUG(_WM_FUNCTION, ch, data->data.string);
 #endif
     if (!(mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC)) {
-        mdi->lyric = data->data.string;
+        _WM_AtomicExchangePtr((void **) &mdi->lyric, data->data.string);
     }
     return;
 }
@@ -1593,6 +1792,163 @@ void _WM_do_meta_cuepoint(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
+/*
+ * Run one event: a switch on its opcode rather than a call through a
+ * pointer kept in every event. Text events hand their handler the string.
+ */
+void _WM_do_event(struct _mdi *mdi, const struct _event *event) {
+    struct _event_data data;
+
+    data.channel = event->channel;
+    data.data.value = event->value;
+    switch (event->evtype) {
+    case ev_midi_divisions:
+        _WM_do_midi_divisions(mdi, &data);
+        break;
+    case ev_note_off:
+        _WM_do_note_off(mdi, &data);
+        break;
+    case ev_note_on:
+        _WM_do_note_on(mdi, &data);
+        break;
+    case ev_aftertouch:
+        _WM_do_aftertouch(mdi, &data);
+        break;
+    case ev_control_bank_select:
+        _WM_do_control_bank_select(mdi, &data);
+        break;
+    case ev_control_channel_modulation:
+        _WM_do_control_channel_modulation(mdi, &data);
+        break;
+    case ev_control_data_entry_course:
+        _WM_do_control_data_entry_course(mdi, &data);
+        break;
+    case ev_control_channel_volume:
+        _WM_do_control_channel_volume(mdi, &data);
+        break;
+    case ev_control_channel_balance:
+        _WM_do_control_channel_balance(mdi, &data);
+        break;
+    case ev_control_channel_pan:
+        _WM_do_control_channel_pan(mdi, &data);
+        break;
+    case ev_control_channel_expression:
+        _WM_do_control_channel_expression(mdi, &data);
+        break;
+    case ev_control_data_entry_fine:
+        _WM_do_control_data_entry_fine(mdi, &data);
+        break;
+    case ev_control_channel_hold:
+        _WM_do_control_channel_hold(mdi, &data);
+        break;
+    case ev_control_data_increment:
+        _WM_do_control_data_increment(mdi, &data);
+        break;
+    case ev_control_data_decrement:
+        _WM_do_control_data_decrement(mdi, &data);
+        break;
+    case ev_control_non_registered_param_fine:
+        _WM_do_control_non_registered_param_fine(mdi, &data);
+        break;
+    case ev_control_non_registered_param_course:
+        _WM_do_control_non_registered_param_course(mdi, &data);
+        break;
+    case ev_control_registered_param_fine:
+        _WM_do_control_registered_param_fine(mdi, &data);
+        break;
+    case ev_control_registered_param_course:
+        _WM_do_control_registered_param_course(mdi, &data);
+        break;
+    case ev_control_channel_sound_off:
+        _WM_do_control_channel_sound_off(mdi, &data);
+        break;
+    case ev_control_channel_controllers_off:
+        _WM_do_control_channel_controllers_off(mdi, &data);
+        break;
+    case ev_control_channel_notes_off:
+        _WM_do_control_channel_notes_off(mdi, &data);
+        break;
+    case ev_control_dummy:
+        _WM_do_control_dummy(mdi, &data);
+        break;
+    case ev_patch:
+        _WM_do_patch(mdi, &data);
+        break;
+    case ev_channel_pressure:
+        _WM_do_channel_pressure(mdi, &data);
+        break;
+    case ev_pitch:
+        _WM_do_pitch(mdi, &data);
+        break;
+    case ev_sysex_roland_drum_track:
+        _WM_do_sysex_roland_drum_track(mdi, &data);
+        break;
+    case ev_sysex_gm_reset:
+        _WM_do_sysex_gm_reset(mdi, &data);
+        break;
+    case ev_sysex_roland_reset:
+        _WM_do_sysex_roland_reset(mdi, &data);
+        break;
+    case ev_sysex_yamaha_reset:
+        _WM_do_sysex_yamaha_reset(mdi, &data);
+        break;
+    case ev_meta_endoftrack:
+        _WM_do_meta_endoftrack(mdi, &data);
+        break;
+    case ev_meta_tempo:
+        _WM_do_meta_tempo(mdi, &data);
+        break;
+    case ev_meta_timesignature:
+        _WM_do_meta_timesignature(mdi, &data);
+        break;
+    case ev_meta_keysignature:
+        _WM_do_meta_keysignature(mdi, &data);
+        break;
+    case ev_meta_sequenceno:
+        _WM_do_meta_sequenceno(mdi, &data);
+        break;
+    case ev_meta_channelprefix:
+        _WM_do_meta_channelprefix(mdi, &data);
+        break;
+    case ev_meta_portprefix:
+        _WM_do_meta_portprefix(mdi, &data);
+        break;
+    case ev_meta_smpteoffset:
+        _WM_do_meta_smpteoffset(mdi, &data);
+        break;
+    case ev_meta_text:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_text(mdi, &data);
+        break;
+    case ev_meta_copyright:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_copyright(mdi, &data);
+        break;
+    case ev_meta_trackname:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_trackname(mdi, &data);
+        break;
+    case ev_meta_instrumentname:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_instrumentname(mdi, &data);
+        break;
+    case ev_meta_lyric:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_lyric(mdi, &data);
+        break;
+    case ev_meta_marker:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_marker(mdi, &data);
+        break;
+    case ev_meta_cuepoint:
+        data.data.string = &mdi->event_text[event->value];
+        _WM_do_meta_cuepoint(mdi, &data);
+        break;
+    default:
+        break;
+    }
+}
+
 void _WM_ResetToStart(struct _mdi *mdi) {
     struct _event * event = NULL;
 
@@ -1608,12 +1964,11 @@ void _WM_ResetToStart(struct _mdi *mdi) {
     if (mdi->event_count >= mdi->events_size &&
         _WM_CheckEventMemoryPool(mdi) < 0) return; /* void — best we can do */
     mdi->events[mdi->event_count].evtype = ev_null;
-    mdi->events[mdi->event_count].do_event = NULL;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
 
-    if (_WM_MixerOptions & WM_MO_STRIPSILENCE) {
+    if (mdi->ctx->mixer_options & WM_MO_STRIPSILENCE) {
         event = mdi->events;
         /* Scan for first note on removing any samples as we go */
         if (event->evtype != ev_note_on) {
@@ -1642,13 +1997,316 @@ void _WM_ResetToStart(struct _mdi *mdi) {
     }
 }
 
+/*
+ * Record a checkpoint before event runs, if one is due. Every path that runs
+ * events in order (playback and the seeks) calls this, so a backward seek
+ * can start from the nearest checkpoint instead of the top of the song.
+ * Positions are kept as the sum of samples_to_next, as the seeks count
+ * them, rather than playback's count, which end of track release
+ * allowances push on. notes says whether the GUS notes are worth keeping:
+ * FastSeek() never mixes them, so it leaves them stale.
+ */
+void _WM_Checkpoint(struct _mdi *mdi, struct _event *event, int notes) {
+    struct _checkpoint *cp;
+    struct _event *ev;
+    struct _note *nte;
+    uint32_t index = (uint32_t)(event - mdi->events);
+    uint32_t sample = 0;
+    uint32_t count;
+
+    if (mdi->extra_info.current_sample < mdi->checkpoint_next)
+        return;
+    ev = mdi->events;
+    if (mdi->checkpoint_count) {
+        cp = &mdi->checkpoints[mdi->checkpoint_count - 1];
+        if (index <= cp->event)
+            return;
+        ev = &mdi->events[cp->event];
+        sample = cp->sample;
+    }
+    for (; ev != event; ev++)
+        sample += ev->samples_to_next;
+
+    if (mdi->checkpoint_count == mdi->checkpoints_size) {
+        uint32_t new_size = mdi->checkpoints_size + 16;
+        cp = (struct _checkpoint *) realloc(mdi->checkpoints,
+                                            new_size * sizeof(struct _checkpoint));
+        if (cp == NULL) {
+            /* seeks will just replay further */
+            mdi->checkpoint_next = UINT32_MAX;
+            return;
+        }
+        mdi->checkpoints = cp;
+        mdi->checkpoints_size = new_size;
+    }
+    cp = &mdi->checkpoints[mdi->checkpoint_count];
+    cp->synth_state = NULL;
+#ifdef WILDMIDI_SF2
+    if (mdi->sf2_synth) {
+        cp->synth_state = _WM_SF2_SaveState(mdi->sf2_synth);
+        if (cp->synth_state == NULL)
+            return;
+    }
+#endif
+#ifdef WILDMIDI_MAFM
+    if (mdi->mafm_synth) {
+        cp->synth_state = _WM_MAFM_SaveState(mdi->mafm_synth);
+        if (cp->synth_state == NULL)
+            return;
+    }
+#endif
+    cp->notes = NULL;
+    cp->note_count = 0;
+    if ((notes) && (mdi->note)) {
+        count = 0;
+        for (nte = mdi->note; nte != NULL; nte = nte->next)
+            count += (nte->replay) ? 2 : 1;
+        /* without them the seek just starts from silence */
+        cp->notes = (struct _note *) malloc(count * sizeof(struct _note));
+        if (cp->notes != NULL) {
+            for (nte = mdi->note; nte != NULL; nte = nte->next) {
+                cp->notes[cp->note_count++] = *nte;
+                if (nte->replay)
+                    cp->notes[cp->note_count++] = *nte->replay;
+            }
+        }
+    }
+    cp->vib_block_count = mdi->vib_block_count;
+    cp->event = index;
+    cp->sample = sample;
+    cp->lyric = (char *) _WM_AtomicLoadPtr((void **) &mdi->lyric);
+    memcpy(cp->channel, mdi->channel, sizeof(mdi->channel));
+    mdi->checkpoint_count++;
+    mdi->checkpoint_next = mdi->extra_info.current_sample
+                           + (uint32_t)mdi->ctx->sample_rate * WM_CHECKPOINT_SECS;
+    if (mdi->checkpoint_next < mdi->extra_info.current_sample)
+        mdi->checkpoint_next = UINT32_MAX;
+}
+
+/* Take a voice from the pool for a note kept by a checkpoint. */
+static struct _note *restore_note(struct _mdi *mdi, const struct _note *from) {
+    struct _note *nte = _WM_AllocNote(mdi);
+    uint16_t voice;
+
+    if (nte == NULL)
+        return (NULL);
+    voice = nte->voice;
+    *nte = *from;
+    nte->voice = voice;
+    nte->next = NULL;
+    nte->prev = NULL;
+    nte->replay = NULL;
+    return (nte);
+}
+
+/*
+ * Rewind to the last checkpoint at or before both song position sample and
+ * events[event] and return the event to carry on from. No notes are left
+ * playing unless notes is set, when those the checkpoint kept play on.
+ * Falls back to the start of the song, synth included, if there is none.
+ */
+struct _event *_WM_RestoreCheckpoint(struct _mdi *mdi, uint32_t sample,
+                                     uint32_t event, int notes) {
+    struct _checkpoint *cp;
+    struct _note *nte;
+    uint32_t lo = 0, hi = mdi->checkpoint_count, mid;
+    uint32_t i;
+
+    /* checkpoints are in order of both event and sample */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if ((mdi->checkpoints[mid].sample <= sample)
+            && (mdi->checkpoints[mid].event <= event))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    _WM_ClearNotes(mdi);
+    if (lo == 0) {
+        _WM_ResetToStart(mdi);
+        /* as a freshly opened song ticks the vibrato LFO */
+        if (notes)
+            mdi->vib_block_count = 0;
+#ifdef WILDMIDI_SF2
+        if (mdi->sf2_synth) _WM_SF2_Reset(mdi->sf2_synth);
+#endif
+#ifdef WILDMIDI_MAFM
+        if (mdi->mafm_synth) _WM_MAFM_Reset(mdi->mafm_synth);
+#endif
+        return (mdi->events);
+    }
+
+    cp = &mdi->checkpoints[lo - 1];
+    memcpy(mdi->channel, cp->channel, sizeof(mdi->channel));
+    _WM_AtomicExchangePtr((void **) &mdi->lyric, cp->lyric);
+    mdi->current_event = &mdi->events[cp->event];
+    mdi->extra_info.current_sample = cp->sample;
+    mdi->samples_to_mix = 0;
+#ifdef WILDMIDI_SF2
+    if (mdi->sf2_synth) _WM_SF2_LoadState(mdi->sf2_synth, cp->synth_state);
+#endif
+#ifdef WILDMIDI_MAFM
+    if (mdi->mafm_synth) _WM_MAFM_LoadState(mdi->mafm_synth, cp->synth_state);
+#endif
+    if (notes) {
+        mdi->vib_block_count = cp->vib_block_count;
+        for (i = 0; i < cp->note_count; i++) {
+            nte = restore_note(mdi, &cp->notes[i]);
+            if (nte == NULL)
+                break;
+            _WM_AddNote(mdi, nte);
+            if (cp->notes[i].replay) {
+                i++;
+                /* if this fails the note just fades out */
+                nte->replay = restore_note(mdi, &cp->notes[i]);
+                if (nte->replay)
+                    mdi->note_count++;
+            }
+        }
+    }
+    return (mdi->current_event);
+}
+
+/*
+ * The tempo map entry for the parse position: the last one if it is at
+ * this tick already, else a copy of it added here. The first starts at
+ * the MIDI defaults, 120 bpm in 4/4.
+ */
+static struct _tempo_change *tempo_map_entry(struct _mdi *mdi) {
+    struct _tempo_change *tc;
+
+    if ((mdi->tempo_map_count)
+        && (mdi->tempo_map[mdi->tempo_map_count - 1].tick == mdi->parse_tick)) {
+        return (&mdi->tempo_map[mdi->tempo_map_count - 1]);
+    }
+    if (mdi->tempo_map_count == mdi->tempo_map_size) {
+        uint32_t new_size = mdi->tempo_map_size ? mdi->tempo_map_size * 2 : 16;
+        tc = (struct _tempo_change *) realloc(mdi->tempo_map,
+                                              new_size * sizeof(struct _tempo_change));
+        if (tc == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            return (NULL);
+        }
+        mdi->tempo_map = tc;
+        mdi->tempo_map_size = new_size;
+    }
+    tc = &mdi->tempo_map[mdi->tempo_map_count];
+    if (mdi->tempo_map_count) {
+        *tc = tc[-1];
+    } else {
+        tc->tempo = 500000;
+        tc->bar_tick = 0;
+        tc->bar = 0;
+        tc->numerator = 4;
+        tc->denominator = 2;
+    }
+    tc->tick = mdi->parse_tick;
+    tc->sample = mdi->extra_info.approx_total_samples;
+    mdi->tempo_map_count++;
+    return (tc);
+}
+
+/* ticks in a beat and in a bar of tc's time signature, at least 1 */
+static uint32_t beat_ticks(struct _mdi *mdi, const struct _tempo_change *tc) {
+    uint32_t ticks = (mdi->divisions * 4) >> tc->denominator;
+    return (ticks ? ticks : 1);
+}
+
+static uint32_t bar_ticks(struct _mdi *mdi, const struct _tempo_change *tc) {
+    uint32_t ticks = (uint32_t) (((uint64_t) mdi->divisions * 4 * tc->numerator)
+                                 >> tc->denominator);
+    return (ticks ? ticks : 1);
+}
+
+/* the last tempo map entry at or before tick, NULL if the map is empty */
+static const struct _tempo_change *tempo_at_tick(struct _mdi *mdi, uint32_t tick) {
+    uint32_t lo = 0;
+    uint32_t hi = mdi->tempo_map_count;
+    uint32_t mid;
+
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (mdi->tempo_map[mid].tick <= tick) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return ((mdi->tempo_map_count) ? &mdi->tempo_map[lo] : NULL);
+}
+
+static const struct _tempo_change *tempo_at_sample(struct _mdi *mdi, uint32_t sample) {
+    uint32_t lo = 0;
+    uint32_t hi = mdi->tempo_map_count;
+    uint32_t mid;
+
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (mdi->tempo_map[mid].sample <= sample) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return ((mdi->tempo_map_count) ? &mdi->tempo_map[lo] : NULL);
+}
+
+/* the rate the parsers counted the song's samples at */
+static double samples_per_tick(struct _mdi *mdi, const struct _tempo_change *tc) {
+    return ((double) _WM_GetSamplesPerTick(mdi->ctx->sample_rate, mdi->divisions, tc->tempo));
+}
+
+/*
+ * The sample the events at tick play at, and back again the last tick
+ * whose events have played by sample, both rounding down as the parsers
+ * do. Past the last tempo change the song keeps its final tempo, up to
+ * the limit of 32 bits.
+ */
+uint32_t _WM_TickToSample(struct _mdi *mdi, uint32_t tick) {
+    const struct _tempo_change *tc = tempo_at_tick(mdi, tick);
+    double sample;
+
+    if (tc == NULL) return (0);
+    sample = (double) tc->sample + (double) (tick - tc->tick) * samples_per_tick(mdi, tc);
+    return ((sample < 4294967295.0) ? (uint32_t) sample : UINT32_MAX);
+}
+
+uint32_t _WM_SampleToTick(struct _mdi *mdi, uint32_t sample) {
+    const struct _tempo_change *tc = tempo_at_sample(mdi, sample);
+    double tick;
+
+    if (tc == NULL) return (0);
+    tick = (double) tc->tick
+           + ceil((double) (sample - tc->sample + 1) / samples_per_tick(mdi, tc)) - 1.0;
+    return ((tick < 4294967295.0) ? (uint32_t) tick : UINT32_MAX);
+}
+
+/* Bar, beat and the timing in force at tick. */
+void _WM_TickToBarBeat(struct _mdi *mdi, uint32_t tick, struct _WM_BarBeat *pos) {
+    const struct _tempo_change *tc = tempo_at_tick(mdi, tick);
+    uint32_t in_bar;
+
+    memset(pos, 0, sizeof(struct _WM_BarBeat));
+    if (tc == NULL) return;
+    in_bar = tick - tc->bar_tick;
+    pos->bar = tc->bar + in_bar / bar_ticks(mdi, tc);
+    in_bar %= bar_ticks(mdi, tc);
+    pos->beat = in_bar / beat_ticks(mdi, tc);
+    pos->tick = in_bar % beat_ticks(mdi, tc);
+    pos->tempo = tc->tempo;
+    pos->divisions = (uint16_t) mdi->divisions;
+    pos->numerator = tc->numerator;
+    pos->denominator = (uint16_t) (1u << tc->denominator);
+}
+
 int _WM_midi_setup_divisions(struct _mdi *mdi, uint32_t divisions) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0,0);
+    mdi->divisions = divisions ? divisions : 1;
+    if (tempo_map_entry(mdi) == NULL) return (-1);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_midi_divisions;
-    mdi->events[mdi->event_count].do_event = _WM_do_midi_divisions;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = divisions;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = divisions;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1660,9 +2318,8 @@ int _WM_midi_setup_noteoff(struct _mdi *mdi, uint8_t channel,
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     note &= 0x7f; /* silently bound note to 0..127 (github bug #180) */
     mdi->events[mdi->event_count].evtype = ev_note_off;
-    mdi->events[mdi->event_count].do_event = _WM_do_note_off;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = (note << 8) | velocity;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = (note << 8) | velocity;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1674,9 +2331,8 @@ static int midi_setup_noteon(struct _mdi *mdi, uint8_t channel,
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     note &= 0x7f; /* silently bound note to 0..127 (github bug #180) */
     mdi->events[mdi->event_count].evtype = ev_note_on;
-    mdi->events[mdi->event_count].do_event = _WM_do_note_on;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = (note << 8) | velocity;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = (note << 8) | velocity;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
 
@@ -1691,9 +2347,8 @@ static int midi_setup_aftertouch(struct _mdi *mdi, uint8_t channel,
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     note &= 0x7f; /* silently bound note to 0..127 (github bug #180) */
     mdi->events[mdi->event_count].evtype = ev_aftertouch;
-    mdi->events[mdi->event_count].do_event = _WM_do_aftertouch;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = (note << 8) | pressure;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = (note << 8) | pressure;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1701,7 +2356,6 @@ static int midi_setup_aftertouch(struct _mdi *mdi, uint8_t channel,
 
 static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
                               uint8_t controller, uint8_t setting) {
-    void (*tmp_event)(struct _mdi *mdi, struct _event_data *data);
     enum _event_type ev;
 
     MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, controller);
@@ -1716,92 +2370,72 @@ static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
          */
         case 0:
             ev = ev_control_bank_select;
-            tmp_event = _WM_do_control_bank_select;
             mdi->channel[channel].bank = setting;
             break;
         case 1:
             ev = ev_control_channel_modulation;
-            tmp_event = _WM_do_control_channel_modulation;
             break;
         case 6:
             ev = ev_control_data_entry_course;
-            tmp_event = _WM_do_control_data_entry_course;
             break;
         case 7:
             ev = ev_control_channel_volume;
-            tmp_event = _WM_do_control_channel_volume;
             mdi->channel[channel].volume = setting;
             break;
         case 8:
             ev = ev_control_channel_balance;
-            tmp_event = _WM_do_control_channel_balance;
             break;
         case 10:
             ev = ev_control_channel_pan;
-            tmp_event = _WM_do_control_channel_pan;
             break;
         case 11:
             ev = ev_control_channel_expression;
-            tmp_event = _WM_do_control_channel_expression;
             break;
         case 38:
             ev = ev_control_data_entry_fine;
-            tmp_event = _WM_do_control_data_entry_fine;
             break;
         case 64:
             ev = ev_control_channel_hold;
-            tmp_event = _WM_do_control_channel_hold;
             break;
         case 96:
             ev = ev_control_data_increment;
-            tmp_event = _WM_do_control_data_increment;
             break;
         case 97:
             ev = ev_control_data_decrement;
-            tmp_event = _WM_do_control_data_decrement;
             break;
         case 98:
             ev = ev_control_non_registered_param_fine;
-            tmp_event = _WM_do_control_non_registered_param_fine;
             break;
         case 99:
             ev = ev_control_non_registered_param_course;
-            tmp_event = _WM_do_control_non_registered_param_course;
             break;
         case 100:
             ev = ev_control_registered_param_fine;
-            tmp_event = _WM_do_control_registered_param_fine;
             break;
         case 101:
             ev = ev_control_registered_param_course;
-            tmp_event = _WM_do_control_registered_param_course;
             break;
         case 120:
             ev = ev_control_channel_sound_off;
-            tmp_event = _WM_do_control_channel_sound_off;
             break;
         case 121:
             ev = ev_control_channel_controllers_off;
-            tmp_event = _WM_do_control_channel_controllers_off;
             break;
         case 123:
             ev = ev_control_channel_notes_off;
-            tmp_event = _WM_do_control_channel_notes_off;
             break;
         default:
             ev = ev_control_dummy;
-            tmp_event = _WM_do_control_dummy;
             break;
     }
 
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev;
-    mdi->events[mdi->event_count].do_event = tmp_event;
-    mdi->events[mdi->event_count].event_data.channel = channel;
+    mdi->events[mdi->event_count].channel = channel;
     if (ev != ev_control_dummy) {
-        mdi->events[mdi->event_count].event_data.data.value = setting;
+        mdi->events[mdi->event_count].value = setting;
     } else {
-        mdi->events[mdi->event_count].event_data.data.value = (controller << 8) | setting;
+        mdi->events[mdi->event_count].value = (controller << 8) | setting;
     }
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
@@ -1812,9 +2446,8 @@ static int midi_setup_patch(struct _mdi *mdi, uint8_t channel, uint8_t patch) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, patch);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_patch;
-    mdi->events[mdi->event_count].do_event = _WM_do_patch;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = patch;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = patch;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
 
@@ -1833,9 +2466,8 @@ static int midi_setup_channel_pressure(struct _mdi *mdi, uint8_t channel,
     MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, pressure);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_channel_pressure;
-    mdi->events[mdi->event_count].do_event = _WM_do_channel_pressure;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = pressure;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = pressure;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1845,9 +2477,8 @@ static int midi_setup_pitch(struct _mdi *mdi, uint8_t channel, uint16_t pitch) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, pitch);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_pitch;
-    mdi->events[mdi->event_count].do_event = _WM_do_pitch;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = pitch;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = pitch;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1858,9 +2489,8 @@ static int midi_setup_sysex_roland_drum_track(struct _mdi *mdi,
     MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, setting);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_drum_track;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_drum_track;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
 
@@ -1877,9 +2507,8 @@ static int midi_setup_sysex_gm_reset(struct _mdi *mdi) {
 
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_reset;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_reset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1889,9 +2518,8 @@ static int midi_setup_sysex_roland_reset(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0,0);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_reset;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_reset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1901,9 +2529,8 @@ static int midi_setup_sysex_yamaha_reset(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0,0);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_reset;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_reset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1913,33 +2540,45 @@ int _WM_midi_setup_endoftrack(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0,0);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_endoftrack;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_endoftrack;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
 }
 
 int _WM_midi_setup_tempo(struct _mdi *mdi, uint32_t setting) {
+    struct _tempo_change *tc;
+
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0,setting);
+    if ((tc = tempo_map_entry(mdi)) == NULL) return (-1);
+    /* the parsers take a tempo of 0 as the default */
+    tc->tempo = (setting & 0xffffff) ? (setting & 0xffffff) : 500000;
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_tempo;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_tempo;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
 }
 
 static int midi_setup_timesignature(struct _mdi *mdi, uint32_t setting) {
+    struct _tempo_change *tc;
+
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, setting);
+    if ((tc = tempo_map_entry(mdi)) == NULL) return (-1);
+    if (tc->bar_tick != tc->tick) {
+        /* a new time signature starts a bar, cutting short any under way */
+        tc->bar += (tc->tick - tc->bar_tick + bar_ticks(mdi, tc) - 1) / bar_ticks(mdi, tc);
+        tc->bar_tick = tc->tick;
+    }
+    tc->numerator = (setting >> 24) ? (uint8_t) (setting >> 24) : 1;
+    tc->denominator = (((setting >> 16) & 0xff) < 16) ? (uint8_t) ((setting >> 16) & 0xff) : 15;
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_timesignature;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_timesignature;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1949,9 +2588,8 @@ static int midi_setup_keysignature(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, setting);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_keysignature;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_keysignature;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1961,9 +2599,8 @@ static int midi_setup_sequenceno(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, setting);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_sequenceno;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_sequenceno;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1973,9 +2610,8 @@ static int midi_setup_channelprefix(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, setting);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_channelprefix;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_channelprefix;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1985,9 +2621,8 @@ static int midi_setup_portprefix(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, setting);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_portprefix;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_portprefix;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1997,129 +2632,82 @@ static int midi_setup_smpteoffset(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(_WM_FUNCTION,0, setting);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_smpteoffset;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_smpteoffset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
 }
 
 static void strip_text(char * text) {
-    char * ch_loc = NULL;
-
-    ch_loc = strrchr(text, '\n');
-    while (ch_loc != NULL) {
-        *ch_loc = ' ';
-        ch_loc = strrchr(text, '\n');
+    for (; *text != '\0'; text++) {
+        if ((*text == '\n') || (*text == '\r'))
+            *text = ' ';
     }
-    ch_loc = strrchr(text, '\r');
-    while (ch_loc != NULL) {
-        *ch_loc = ' ';
-        ch_loc = strrchr(text, '\r');
-    }
-}
-
-static int midi_setup_text(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
-    strip_text(text);
-    if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_text;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_text;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
 }
 
-static int midi_setup_copyright(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
-    strip_text(text);
-    if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_copyright;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_copyright;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_trackname(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
-    strip_text(text);
-    if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_trackname;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_trackname;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
+/*
+ * Text events keep their string out of the event list, in mdi->event_text,
+ * with its offset as their value. The strings are laid end to end in the
+ * one buffer, doubling as it fills, and freed with it.
+ */
+static int midi_setup_string(struct _mdi *mdi, enum _event_type evtype,
+                             const uint8_t *data, uint32_t len) {
+    uint32_t need = mdi->event_text_len + len + 1;
+    uint32_t new_size;
+    char *new_text;
+    char *text;
 
-static int midi_setup_instrumentname(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
-    strip_text(text);
     if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_instrumentname;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_instrumentname;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_lyric(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
+    if (need < len) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+        return (-1);
+    }
+    if (need > mdi->event_text_size) {
+        new_size = (mdi->event_text_size) ? mdi->event_text_size : 4096;
+        while ((new_size < need) && (new_size < 0x80000000))
+            new_size *= 2;
+        if (new_size < need)
+            new_size = need;
+        new_text = (char *) realloc(mdi->event_text, new_size);
+        if (new_text == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            return (-1);
+        }
+        mdi->event_text = new_text;
+        mdi->event_text_size = new_size;
+    }
+    text = &mdi->event_text[mdi->event_text_len];
+    memcpy(text, data, len);
+    text[len] = '\0';
     strip_text(text);
-    if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_lyric;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_lyric;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_marker(struct _mdi *mdi, char * text) {
     MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
-    strip_text(text);
-    if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_marker;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_marker;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
 
-static int midi_setup_cuepoint(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(_WM_FUNCTION,0, text);
-    strip_text(text);
-    if (_WM_CheckEventMemoryPool(mdi) < 0) return (-1);
-    mdi->events[mdi->event_count].evtype = ev_meta_cuepoint;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_cuepoint;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
+    mdi->events[mdi->event_count].evtype = evtype;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].value = mdi->event_text_len;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
+    mdi->event_text_len = need;
     return (0);
 }
 
 struct _mdi *
-_WM_initMDI(void) {
+_WM_initMDI(struct _WM_Context *ctx, uint8_t probe) {
     struct _mdi *mdi;
+    uint32_t i;
 
     mdi = (struct _mdi *) malloc(sizeof(struct _mdi));
     memset(mdi, 0, (sizeof(struct _mdi)));
+    mdi->ctx = ctx;
+    mdi->probe = probe;
+    for (i = 0; i < WM_CMD_QUEUE; i++) {
+        mdi->cmd[i].seq = i;
+    }
 
     mdi->extra_info.copyright = NULL;
-    mdi->extra_info.mixer_options = _WM_MixerOptions;
+    mdi->extra_info.mixer_options = ctx->mixer_options;
+    mdi->extra_info.max_voices = ctx->max_voices;
 
     _WM_load_patch(mdi, 0x0000);
 
@@ -2143,8 +2731,8 @@ _WM_initMDI(void) {
     mdi->lyric = NULL;
 
 #ifdef WILDMIDI_SF2
-    if (_WM_SF2_Active()) {
-        mdi->sf2_synth = _WM_SF2_NewSynth(_WM_SampleRate);
+    if (_WM_SF2_Active(ctx) && !probe) {
+        mdi->sf2_synth = _WM_SF2_NewSynth(ctx);
     }
 #endif
 
@@ -2157,6 +2745,7 @@ void _WM_freeMDI(struct _mdi *mdi) {
     struct _sample *tmp_sample;
     uint32_t i;
 
+    _WM_load_patches_wait(mdi);
     if (mdi->patch_count != 0) {
         _WM_Lock(&_WM_patch_lock);
         for (i = 0; i < mdi->patch_count; i++) {
@@ -2169,35 +2758,29 @@ void _WM_freeMDI(struct _mdi *mdi) {
                     free(mdi->patches[i]->first_sample);
                     mdi->patches[i]->first_sample = tmp_sample;
                 }
-                mdi->patches[i]->loaded = 0;
+                _WM_AtomicStore(&mdi->patches[i]->loaded, WM_PATCH_UNLOADED);
             }
         }
         _WM_Unlock(&_WM_patch_lock);
         free(mdi->patches);
     }
+    free(mdi->patch_due);
 
-    if (mdi->event_count != 0) {
-        for (i = 0; i < mdi->event_count; i++) {
-            /* Free up the string event storage */
-            switch (mdi->events[i].evtype) {
-            case ev_meta_text:
-            case ev_meta_copyright:
-            case ev_meta_trackname:
-            case ev_meta_instrumentname:
-            case ev_meta_lyric:
-            case ev_meta_marker:
-            case ev_meta_cuepoint:
-                free(mdi->events[i].event_data.data.string);
-                break;
-            default:
-                break;
-            }
-        }
-    }
-
+    _WM_FreeMidiStream(mdi);
+    free(mdi->event_text);
     free(mdi->events);
+    free(mdi->tempo_map);
     _WM_free_reverb(mdi->reverb);
     free(mdi->mix_buffer);
+    for (i = 0; i < mdi->voice_chunks; i++) {
+        free(mdi->voice_chunk[i]);
+    }
+    free(mdi->voice_chunk);
+    for (i = 0; i < mdi->checkpoint_count; i++) {
+        free(mdi->checkpoints[i].synth_state);
+        free(mdi->checkpoints[i].notes);
+    }
+    free(mdi->checkpoints);
 #ifdef WILDMIDI_SF2
     _WM_SF2_FreeSynth(mdi->sf2_synth);
 #endif
@@ -2208,6 +2791,7 @@ void _WM_freeMDI(struct _mdi *mdi) {
         free(mdi->tmp_info->copyright);
         free(mdi->tmp_info);
     }
+    free(mdi->extra_info.copyright);
     free(mdi);
 }
 
@@ -2225,7 +2809,6 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
     uint8_t channel = 0;
     uint8_t data_1 = 0;
     uint8_t data_2 = 0;
-    char *text = NULL;
 
     if (!input_length) goto shortbuf;
 
@@ -2325,10 +2908,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     if (--input_length < tmp_length) goto shortbuf;
                     if (!tmp_length) break;/* broken file? */
 
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_text(mdi, text);
+                    midi_setup_string(mdi, ev_meta_text, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2381,10 +2961,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     }
 
                     /* NOTE: free'd when events are cleared during closure of mdi */
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_copyright(mdi, text);
+                    midi_setup_string(mdi, ev_meta_copyright, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2409,10 +2986,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     if (--input_length < tmp_length) goto shortbuf;
                     if (!tmp_length) break;/* broken file? */
 
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_trackname(mdi, text);
+                    midi_setup_string(mdi, ev_meta_trackname, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2437,10 +3011,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     if (--input_length < tmp_length) goto shortbuf;
                     if (!tmp_length) break;/* broken file? */
 
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_instrumentname(mdi, text);
+                    midi_setup_string(mdi, ev_meta_instrumentname, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2465,10 +3036,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     if (--input_length < tmp_length) goto shortbuf;
                     if (!tmp_length) break;/* broken file? */
 
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_lyric(mdi, text);
+                    midi_setup_string(mdi, ev_meta_lyric, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2493,10 +3061,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     if (--input_length < tmp_length) goto shortbuf;
                     if (!tmp_length) break;/* broken file? */
 
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_marker(mdi, text);
+                    midi_setup_string(mdi, ev_meta_marker, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2521,10 +3086,7 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                     if (--input_length < tmp_length) goto shortbuf;
                     if (!tmp_length) break;/* broken file? */
 
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_cuepoint(mdi, text);
+                    midi_setup_string(mdi, ev_meta_cuepoint, event_data, tmp_length);
 
                     ret_cnt += tmp_length;
 
@@ -2567,12 +3129,11 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32
                      SMPTE Offset
                      We only setting this up here for WM_Event2Midi function
                      */
-                    midi_setup_smpteoffset(mdi, ((event_data[3] << 24) + (event_data[4] << 16) + (event_data[5] << 8) + event_data[6]));
-
                     /*
                      Because this has 5 bytes of data we gonna "hack" it a little
                      */
-                    mdi->events[mdi->events_size - 1].event_data.channel = event_data[2];
+                    if (midi_setup_smpteoffset(mdi, ((event_data[3] << 24) + (event_data[4] << 16) + (event_data[5] << 8) + event_data[6])) == 0)
+                        mdi->events[mdi->event_count - 1].channel = event_data[2];
 
                     ret_cnt += 7;
                 } else if ((event_data[0] == 0x58) && (event_data[1] == 0x04)) {
@@ -1,5 +1,5 @@
 /*
- * lock.c - data locking code for lib
+ * lock.c - data locking, threading and timing code for lib
  *
  * Copyright (C) Chris Ison  2001-2011
  * Copyright (C) Bret Curtis 2013-2016
@@ -24,7 +24,11 @@
 
 #include "config.h"
 
-#if !defined(WM_NO_LOCK)
+#if defined(_WIN32) && defined(WILDMIDI_THREADS) \
+    && (!defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600)
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600 /* SRWLOCK needs Vista */
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
@@ -40,10 +44,145 @@
 #else /* unixish ... */
 #define _GNU_SOURCE
 #include <unistd.h> /* usleep() */
+#include <sched.h>  /* sched_yield() */
 #endif
 
+#include <stdint.h>
 #include "lock.h"
 
+/*
+ * The atomic operations the locks and the songs' command queues are built
+ * on, for the 32 bit values they work on. Loads acquire, stores release
+ * and a successful swap does both. Compilers with none of these builtins
+ * get plain volatile accesses, which is what they had before.
+ */
+#if defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7)))
+#define WM_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WM_ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define WM_ATOMIC_CAS(p, o, v) __atomic_compare_exchange_n((p), &(o), (v), 0, \
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+#define WM_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define WM_ATOMIC_LOAD_PTR(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WM_ATOMIC_XCHG_PTR(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#elif defined(__GNUC__)
+#define WM_ATOMIC_LOAD(p) __sync_fetch_and_add((p), 0)
+#define WM_ATOMIC_STORE(p, v) do { __sync_synchronize(); *(volatile __typeof__(*(p)) *)(p) = (v); } while (0)
+#define WM_ATOMIC_CAS(p, o, v) __sync_bool_compare_and_swap((p), (o), (v))
+#define WM_ATOMIC_FENCE() __sync_synchronize()
+#define WM_ATOMIC_LOAD_PTR(p) __sync_val_compare_and_swap((p), NULL, NULL)
+#elif defined(_WIN32)
+#define WM_ATOMIC_LOAD(p) InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#define WM_ATOMIC_STORE(p, v) InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+#define WM_ATOMIC_CAS(p, o, v) (InterlockedCompareExchange((volatile LONG *)(p), (LONG)(v), (LONG)(o)) \
+                                    == (LONG)(o))
+#define WM_ATOMIC_FENCE() MemoryBarrier()
+#define WM_ATOMIC_LOAD_PTR(p) InterlockedCompareExchangePointer((p), NULL, NULL)
+#define WM_ATOMIC_XCHG_PTR(p, v) InterlockedExchangePointer((p), (v))
+#else
+#define WM_ATOMIC_LOAD(p) (*(volatile uint32_t *)(p))
+#define WM_ATOMIC_STORE(p, v) (*(volatile uint32_t *)(p) = (v))
+#define WM_ATOMIC_CAS(p, o, v) ((*(volatile uint32_t *)(p) == (uint32_t)(o)) \
+                                    ? (*(volatile uint32_t *)(p) = (v), 1) : 0)
+#define WM_ATOMIC_FENCE() do {} while (0)
+#define WM_ATOMIC_LOAD_PTR(p) (*(void * volatile *)(p))
+#endif
+
+uint32_t _WM_AtomicLoad(uint32_t *value) {
+    return ((uint32_t) WM_ATOMIC_LOAD(value));
+}
+
+void _WM_AtomicStore(uint32_t *value, uint32_t set) {
+    WM_ATOMIC_STORE(value, set);
+}
+
+/*
+ _WM_AtomicSwap(value, expect, set)
+
+ returns 1 if value held expect and now holds set, 0 if it held something
+ else and was left alone
+ */
+int _WM_AtomicSwap(uint32_t *value, uint32_t expect, uint32_t set) {
+    return (WM_ATOMIC_CAS(value, expect, set) ? 1 : 0);
+}
+
+/*
+ _WM_AtomicFence()
+
+ Orders everything before it against everything after, stores included:
+ a store followed by a load of something else may otherwise be seen the
+ other way round by another thread doing the same.
+ */
+void _WM_AtomicFence(void) {
+    WM_ATOMIC_FENCE();
+}
+
+void *_WM_AtomicLoadPtr(void **value) {
+    return (WM_ATOMIC_LOAD_PTR(value));
+}
+
+/*
+ _WM_AtomicExchangePtr(value, set)
+
+ stores set in value and returns what value held before, as one step
+ */
+void *_WM_AtomicExchangePtr(void **value, void *set) {
+#if defined(WM_ATOMIC_XCHG_PTR)
+    return (WM_ATOMIC_XCHG_PTR(value, set));
+#elif defined(__GNUC__)
+    void *old;
+
+    do {
+        old = *(void * volatile *) value;
+    } while (!__sync_bool_compare_and_swap(value, old, set));
+    return (old);
+#else
+    void *old = *(void * volatile *) value;
+
+    *(void * volatile *) value = set;
+    return (old);
+#endif
+}
+
+#if !defined(WM_NO_LOCK)
+
+/* turns spent re-reading a held lock before yielding, and yielding before
+   sleeping. A lock is only held for a few copies or one buffer of mixing,
+   so most waits end in the spin. Where there is no yield, sleep. */
+#define WM_LOCK_SPINS 128
+#define WM_LOCK_YIELDS 16
+
+#ifdef _WIN32
+#define WM_LOCK_YIELD() SwitchToThread()
+#define WM_LOCK_SLEEP() Sleep(1)
+#elif defined(__OS2__) || defined(__EMX__)
+#define WM_LOCK_YIELD() DosSleep(0)
+#define WM_LOCK_SLEEP() DosSleep(1)
+#elif defined(WILDMIDI_AMIGA)
+#define WM_LOCK_YIELD() Delay(1)
+#define WM_LOCK_SLEEP() Delay(1)
+#elif defined(__vita__)
+#define WM_LOCK_YIELD() sceKernelDelayThread(100)
+#define WM_LOCK_SLEEP() sceKernelDelayThread(100)
+#elif defined(__SWITCH__)
+#define WM_LOCK_YIELD() svcSleepThread(0)
+#define WM_LOCK_SLEEP() svcSleepThread(100 * 1000)
+#else
+#define WM_LOCK_YIELD() sched_yield()
+#define WM_LOCK_SLEEP() usleep(100)
+#endif
+
+/*
+ _WM_TryLock(wmlock)
+
+ wmlock = a pointer to a value
+
+ returns 1 if it set the lock, 0 if another thread holds it
+ */
+int _WM_TryLock(int *wmlock) {
+    int clear = 0;
+    return (WM_ATOMIC_CAS(wmlock, clear, 1) ? 1 : 0);
+}
+
 /*
  _WM_Lock(wmlock)
 
@@ -53,35 +192,24 @@
 
  Attempts to set a lock on the MDI tree so that
  only 1 library command may access it at any time.
- If lock fails the process retries until successful.
+ If lock fails the process retries until successful,
+ spinning first, then giving up its time slice, and only
+ after that sleeping between tries.
  */
 void _WM_Lock(int * wmlock) {
-    LOCK_START:
-    /* Check if lock is clear, if so set it */
-    if (__builtin_expect(((*wmlock) == 0), 1)) {
-        (*wmlock)++;
-        /* Now that the lock is set, make sure we
-         * don't have a race condition.  If so,
-         * decrement the lock by one and retry.  */
-        if (__builtin_expect(((*wmlock) == 1), 1)) {
-            return; /* Lock cleanly set */
+    unsigned int tries = 0;
+
+    while (__builtin_expect((!_WM_TryLock(wmlock)), 0)) {
+        if (tries < WM_LOCK_SPINS) {
+            /* wait for it to look clear before trying to swap it again */
+            while ((++tries < WM_LOCK_SPINS) && (WM_ATOMIC_LOAD(wmlock) != 0));
+        } else if (tries < WM_LOCK_SPINS + WM_LOCK_YIELDS) {
+            WM_LOCK_YIELD();
+            tries++;
+        } else {
+            WM_LOCK_SLEEP();
         }
-        (*wmlock)--;
     }
-#ifdef _WIN32
-    Sleep(10);
-#elif defined(__OS2__) || defined(__EMX__)
-    DosSleep(10);
-#elif defined(WILDMIDI_AMIGA)
-    Delay(1);
-#elif defined(__vita__)
-    sceKernelDelayThread(500);
-#elif defined(__SWITCH__)
-    svcSleepThread(500 * 1000);
-#else
-    usleep(500);
-#endif
-    goto LOCK_START;
 }
 
 /*
@@ -94,10 +222,415 @@ void _WM_Lock(int * wmlock) {
  Removes a lock previously placed on the MDI tree.
  */
 void _WM_Unlock(int *wmlock) {
-    /* We don't want a -1 lock, so just to make sure */
-    if ((*wmlock) != 0) {
-        (*wmlock)--;
+    WM_ATOMIC_STORE(wmlock, 0);
+}
+
+/*
+ _WM_AtomicWait(value, busy)
+
+ value = a pointer to a value another thread will change
+ busy  = what it holds until then
+
+ returns nothing
+
+ Waits for value to hold something other than busy, backing off as
+ _WM_Lock() does.
+ */
+void _WM_AtomicWait(uint32_t *value, uint32_t busy) {
+    unsigned int tries = 0;
+
+    while (WM_ATOMIC_LOAD(value) == busy) {
+        if (tries < WM_LOCK_SPINS) {
+            tries++;
+        } else if (tries < WM_LOCK_SPINS + WM_LOCK_YIELDS) {
+            WM_LOCK_YIELD();
+            tries++;
+        } else {
+            WM_LOCK_SLEEP();
+        }
     }
 }
 
 #endif /* !WM_NO_LOCK */
+
+#ifdef WILDMIDI_THREADS
+
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h> /* sysconf() */
+#endif
+
+struct _thread_job {
+    void (*func)(void *);
+    void *arg;
+};
+
+#ifdef _WIN32
+static SRWLOCK thread_lock = SRWLOCK_INIT;
+
+static DWORD WINAPI thread_entry(LPVOID data) {
+    struct _thread_job *job = (struct _thread_job *) data;
+    job->func(job->arg);
+    return (0);
+}
+#else
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *thread_entry(void *data) {
+    struct _thread_job *job = (struct _thread_job *) data;
+    job->func(job->arg);
+    return (NULL);
+}
+#endif
+
+/*
+ _WM_ThreadLock()
+
+ Takes the one mutex shared by worker threads and the thread that started
+ them. It guards the little they have in common: work queues and the error
+ string. Unlike _WM_Lock(), a waiting thread sleeps until it is released.
+ */
+void _WM_ThreadLock(void) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&thread_lock);
+#else
+    pthread_mutex_lock(&thread_lock);
+#endif
+}
+
+void _WM_ThreadUnlock(void) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&thread_lock);
+#else
+    pthread_mutex_unlock(&thread_lock);
+#endif
+}
+
+/*
+ _WM_CPUCount()
+
+ returns the number of processors online, at least 1
+ */
+unsigned int _WM_CPUCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return ((info.dwNumberOfProcessors > 0) ? info.dwNumberOfProcessors : 1);
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return ((count > 0) ? (unsigned int) count : 1);
+#else
+    return (1);
+#endif
+}
+
+/*
+ _WM_RunThreads(func, arg, threads)
+
+ func    = the work, called once per thread
+ arg     = passed to every call of func
+ threads = how many threads should run func, the caller's included
+
+ Returns once every call has returned. func has to share its work out
+ itself, under _WM_ThreadLock(). Threads that fail to start are not
+ retried: the ones that did, and the caller, do their share.
+ */
+void _WM_RunThreads(void (*func)(void *), void *arg, unsigned int threads) {
+    struct _thread_job job;
+#ifdef _WIN32
+    HANDLE *thread = NULL;
+#else
+    pthread_t *thread = NULL;
+#endif
+    unsigned int started = 0;
+
+    job.func = func;
+    job.arg = arg;
+    if (threads > 1) {
+        thread = malloc(sizeof(*thread) * (threads - 1));
+    }
+    if (thread != NULL) {
+        for (started = 0; started < threads - 1; started++) {
+#ifdef _WIN32
+            thread[started] = CreateThread(NULL, 0, thread_entry, &job, 0, NULL);
+            if (thread[started] == NULL) break;
+#else
+            if (pthread_create(&thread[started], NULL, thread_entry, &job) != 0) break;
+#endif
+        }
+    }
+
+    func(arg);
+
+    while (started) {
+        started--;
+#ifdef _WIN32
+        WaitForSingleObject(thread[started], INFINITE);
+        CloseHandle(thread[started]);
+#else
+        pthread_join(thread[started], NULL);
+#endif
+    }
+    free(thread);
+}
+
+/*
+ * The worker pool: threads kept waiting between runs, for work that comes
+ * round too often to start threads for each time. Runs wait in a list,
+ * oldest first, for as many workers as they still want, so several can be
+ * under way at once; want is how many workers still have to join a run,
+ * busy how many are in it. A posted job is a run of one worker that
+ * nobody waits for, and frees itself.
+ */
+struct _pool_run {
+    struct _thread_job job;
+    unsigned int want;
+    unsigned int busy;
+    int posted;
+    struct _pool_run *next;
+};
+
+#ifdef _WIN32
+static SRWLOCK pool_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE pool_wake = CONDITION_VARIABLE_INIT;
+static CONDITION_VARIABLE pool_idle = CONDITION_VARIABLE_INIT;
+static HANDLE *pool_thread = NULL;
+#define POOL_LOCK() AcquireSRWLockExclusive(&pool_lock)
+#define POOL_UNLOCK() ReleaseSRWLockExclusive(&pool_lock)
+#define POOL_WAIT(c) SleepConditionVariableSRW(&(c), &pool_lock, INFINITE, 0)
+#define POOL_WAKE(c) WakeAllConditionVariable(&(c))
+#else
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t *pool_thread = NULL;
+#define POOL_LOCK() pthread_mutex_lock(&pool_lock)
+#define POOL_UNLOCK() pthread_mutex_unlock(&pool_lock)
+#define POOL_WAIT(c) pthread_cond_wait(&(c), &pool_lock)
+#define POOL_WAKE(c) pthread_cond_broadcast(&(c))
+#endif
+static unsigned int pool_threads = 0;
+static struct _pool_run *pool_runs = NULL;
+static int pool_quit = 0;
+
+/* under pool_lock */
+static void pool_unlist(struct _pool_run *run) {
+    struct _pool_run **link = &pool_runs;
+
+    while (*link != NULL) {
+        if (*link == run) {
+            *link = run->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    run->want = 0;
+}
+
+static void pool_work(void) {
+    struct _pool_run *run;
+
+    POOL_LOCK();
+    for (;;) {
+        while (pool_runs == NULL && !pool_quit) {
+            POOL_WAIT(pool_wake);
+        }
+        if (pool_runs == NULL) {
+            /* quitting, and nothing is left posted */
+            break;
+        }
+        run = pool_runs;
+        if (!--run->want) {
+            pool_runs = run->next;
+        }
+        run->busy++;
+        POOL_UNLOCK();
+        run->job.func(run->job.arg);
+        POOL_LOCK();
+        if (run->posted) {
+            free(run);
+        } else if (!--run->busy) {
+            POOL_WAKE(pool_idle);
+        }
+    }
+    POOL_UNLOCK();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_entry(LPVOID data) {
+    (void) data;
+    pool_work();
+    return (0);
+}
+#else
+static void *pool_entry(void *data) {
+    (void) data;
+    pool_work();
+    return (NULL);
+}
+#endif
+
+/* under pool_lock: start threads until there are workers of them, or as
+   many as can be had */
+static void pool_grow(unsigned int workers) {
+    if (workers > pool_threads) {
+#ifdef _WIN32
+        HANDLE *grown = realloc(pool_thread, sizeof(*pool_thread) * workers);
+#else
+        pthread_t *grown = realloc(pool_thread, sizeof(*pool_thread) * workers);
+#endif
+        if (grown != NULL) {
+            pool_thread = grown;
+            while (pool_threads < workers) {
+#ifdef _WIN32
+                pool_thread[pool_threads] = CreateThread(NULL, 0, pool_entry, NULL, 0, NULL);
+                if (pool_thread[pool_threads] == NULL) break;
+#else
+                if (pthread_create(&pool_thread[pool_threads], NULL, pool_entry, NULL) != 0) break;
+#endif
+                pool_threads++;
+            }
+        }
+    }
+}
+
+/*
+ _WM_PoolRun(func, arg, threads)
+
+ As _WM_RunThreads(), but on the pool's threads, which it starts the first
+ time it needs them and keeps. func has to be done with all of the work by
+ the time the caller's own call of it returns, bar what other calls are
+ still working on: the workers that have not got to it by then are let
+ off. Runs from other threads go on alongside, sharing the workers.
+ */
+void _WM_PoolRun(void (*func)(void *), void *arg, unsigned int threads) {
+    unsigned int workers = (threads > 1) ? threads - 1 : 0;
+    struct _pool_run run;
+    struct _pool_run **link;
+
+    run.job.func = func;
+    run.job.arg = arg;
+    run.busy = 0;
+    run.posted = 0;
+    run.next = NULL;
+
+    POOL_LOCK();
+    pool_grow(workers);
+    run.want = (workers < pool_threads) ? workers : pool_threads;
+    if (run.want) {
+        for (link = &pool_runs; *link != NULL; link = &(*link)->next);
+        *link = &run;
+        POOL_WAKE(pool_wake);
+    }
+    POOL_UNLOCK();
+
+    func(arg);
+
+    POOL_LOCK();
+    if (run.want) {
+        pool_unlist(&run);
+    }
+    while (run.busy) {
+        POOL_WAIT(pool_idle);
+    }
+    POOL_UNLOCK();
+}
+
+/*
+ _WM_PoolPost(func, arg)
+
+ Hands func(arg) to a pool thread and returns without waiting for it.
+ Returns 1 if it did, 0 if it could not, which leaves the work to the
+ caller.
+ */
+int _WM_PoolPost(void (*func)(void *), void *arg) {
+    struct _pool_run *run;
+    struct _pool_run **link;
+
+    run = malloc(sizeof(*run));
+    if (run == NULL) {
+        return (0);
+    }
+    run->job.func = func;
+    run->job.arg = arg;
+    run->want = 1;
+    run->busy = 0;
+    run->posted = 1;
+    run->next = NULL;
+
+    POOL_LOCK();
+    pool_grow(1);
+    if (pool_quit || !pool_threads) {
+        POOL_UNLOCK();
+        free(run);
+        return (0);
+    }
+    for (link = &pool_runs; *link != NULL; link = &(*link)->next);
+    *link = run;
+    POOL_WAKE(pool_wake);
+    POOL_UNLOCK();
+    return (1);
+}
+
+/*
+ _WM_PoolStop()
+
+ Ends the pool's threads, once what was posted to them is done. Nothing
+ may be run on the pool while it stops.
+ */
+void _WM_PoolStop(void) {
+    POOL_LOCK();
+    pool_quit = 1;
+    POOL_WAKE(pool_wake);
+    POOL_UNLOCK();
+    while (pool_threads) {
+        pool_threads--;
+#ifdef _WIN32
+        WaitForSingleObject(pool_thread[pool_threads], INFINITE);
+        CloseHandle(pool_thread[pool_threads]);
+#else
+        pthread_join(pool_thread[pool_threads], NULL);
+#endif
+    }
+    free(pool_thread);
+    pool_thread = NULL;
+    POOL_LOCK();
+    pool_quit = 0;
+    POOL_UNLOCK();
+}
+
+#endif /* WILDMIDI_THREADS */
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/*
+ _WM_Clock()
+
+ returns a wall clock reading in microseconds, only good for timing
+ */
+uint64_t _WM_Clock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    if (QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&now)) {
+        return ((uint64_t) (now.QuadPart / freq.QuadPart) * 1000000
+                + (uint64_t) (now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+    }
+    return ((uint64_t) GetTickCount() * 1000);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+        return ((uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+    }
+    return ((uint64_t) time(NULL) * 1000000);
+#else
+    return ((uint64_t) clock() * 1000000 / CLOCKS_PER_SEC);
+#endif
+}
@@ -729,6 +729,44 @@ void _WM_MAFM_Reset(void *synth) {
     s->vib_phase = 0.0;
 }
 
+/* Per-channel selection state, as kept for a seek checkpoint. */
+struct mafm_chan_state {
+    uint8_t bank[16];
+    uint8_t program[16];
+    float   volume[16];
+    float   expression[16];
+    int     pitch[16];
+    uint8_t pan[16];
+    uint8_t modulation[16];
+};
+
+void *_WM_MAFM_SaveState(void *synth) {
+    struct mafm_synth *s = (struct mafm_synth *) synth;
+    struct mafm_chan_state *st = malloc(sizeof(*st));
+    if (!st) return NULL;
+    memcpy(st->bank, s->chan_bank, sizeof(st->bank));
+    memcpy(st->program, s->chan_program, sizeof(st->program));
+    memcpy(st->volume, s->chan_volume, sizeof(st->volume));
+    memcpy(st->expression, s->chan_expression, sizeof(st->expression));
+    memcpy(st->pitch, s->chan_pitch, sizeof(st->pitch));
+    memcpy(st->pan, s->chan_pan, sizeof(st->pan));
+    memcpy(st->modulation, s->chan_modulation, sizeof(st->modulation));
+    return st;
+}
+
+void _WM_MAFM_LoadState(void *synth, const void *state) {
+    struct mafm_synth *s = (struct mafm_synth *) synth;
+    const struct mafm_chan_state *st = (const struct mafm_chan_state *) state;
+    _WM_MAFM_Reset(synth);
+    memcpy(s->chan_bank, st->bank, sizeof(st->bank));
+    memcpy(s->chan_program, st->program, sizeof(st->program));
+    memcpy(s->chan_volume, st->volume, sizeof(st->volume));
+    memcpy(s->chan_expression, st->expression, sizeof(st->expression));
+    memcpy(s->chan_pitch, st->pitch, sizeof(st->pitch));
+    memcpy(s->chan_pan, st->pan, sizeof(st->pan));
+    memcpy(s->chan_modulation, st->modulation, sizeof(st->modulation));
+}
+
 void _WM_MAFM_ReleaseAll(void *synth) {
     struct mafm_synth *s = (struct mafm_synth *) synth;
     int i;
@@ -939,7 +977,12 @@ static void mafm_start_pcm(struct mafm_synth *s, int wave) {
 
 /* Advance the ATR trigger schedule and render one PCM sample, summed into
  * *l and *r with each slot's own pan (ownerless ATR triggers stay centred). */
-static void mafm_pcm_tick(struct mafm_synth *s, double *l, double *r) {
+/* Channel's stem bus for _WM_MAFM_Render(), 16 for sound with no channel. */
+#define MAFM_BUS(ch) ((((unsigned) (ch)) < 16) ? (ch) : 16)
+
+/* bus_l/bus_r, when not NULL, get each slot's share per MAFM_BUS() too. */
+static void mafm_pcm_tick(struct mafm_synth *s, double *l, double *r,
+                          double *bus_l, double *bus_r) {
     int i;
     /* fire any triggers whose time has arrived */
     while (s->trig_next < s->trig_count &&
@@ -979,6 +1022,10 @@ static void mafm_pcm_tick(struct mafm_synth *s, double *l, double *r) {
         x = (double) pv->pcm[idx] / 32768.0 * pv->gain * env;
         *l += x * pv->pan_l;
         *r += x * pv->pan_r;
+        if (bus_l) {
+            bus_l[MAFM_BUS(pv->channel)] += x * pv->pan_l;
+            bus_r[MAFM_BUS(pv->channel)] += x * pv->pan_r;
+        }
         pv->pos += pv->step;
     }
     s->cursor++;
@@ -1092,8 +1139,8 @@ static void mafm_clear_vibrato(struct mafm_synth *s, uint8_t ch) {
 
 void _WM_MAFM_Event(void *synth, struct _mdi *mdi, struct _event *event) {
     struct mafm_synth *s = (struct mafm_synth *) synth;
-    uint8_t ch = event->event_data.channel;
-    uint32_t val = event->event_data.data.value;
+    uint8_t ch = event->channel;
+    uint32_t val = event->value;
     (void) mdi;
     if (ch > 15) return;
 
@@ -1188,7 +1235,7 @@ static void mafm_voice_pan_gains(const struct mafm_synth *s,
     *gr = 1.0f + pan;
 }
 
-void _WM_MAFM_Render(void *synth, int32_t *out, uint32_t frames) {
+void _WM_MAFM_Render(void *synth, int32_t *out, uint32_t stride, uint32_t frames) {
     struct mafm_synth *s = (struct mafm_synth *) synth;
     /* Soft peak limiter: a dozen voices summing at full-scale would exceed
      * int16 and get hard-clipped by wildmidi_lib's output stage (which
@@ -1198,6 +1245,10 @@ void _WM_MAFM_Render(void *synth, int32_t *out, uint32_t frames) {
     const double LIM_THRESHOLD = 30000.0;
     const double LIM_RELEASE   = 0.9999;
     uint32_t f, i;
+    /* Stem rendering: each channel's share of l and r (and the PCM voices'
+     * share of pcm_l and pcm_r), scaled by the limiter gain of the whole
+     * mix so the stems still add up to it. */
+    double fm_bus_l[17], fm_bus_r[17], pcm_bus_l[17], pcm_bus_r[17];
     /* Cache per-voice pan gains once per Render call: pan is a mix of the
      * channel's pan CC and the voice's patch pan_default, both of which are
      * set at note-on time and don't change during the callback window. */
@@ -1235,12 +1286,22 @@ void _WM_MAFM_Render(void *synth, int32_t *out, uint32_t frames) {
             }
         }
 
+        if (stride) {
+            memset(fm_bus_l, 0, sizeof(fm_bus_l));
+            memset(fm_bus_r, 0, sizeof(fm_bus_r));
+            memset(pcm_bus_l, 0, sizeof(pcm_bus_l));
+            memset(pcm_bus_r, 0, sizeof(pcm_bus_r));
+        }
         for (i = 0; i < MAFM_POLYPHONY; i++) {
             struct mafm_voice *v = &s->voices[i];
             if (_WM_MAFM_VoiceActive(v)) {
                 double x = _WM_MAFM_VoiceTick(v);
                 l += x * pan_l[i];
                 r += x * pan_r[i];
+                if (stride) {
+                    fm_bus_l[MAFM_BUS(v->channel)] += x * pan_l[i];
+                    fm_bus_r[MAFM_BUS(v->channel)] += x * pan_r[i];
+                }
             }
         }
         /* ATR sampled drums/phrases and note-driven PCM voices play alongside
@@ -1249,7 +1310,8 @@ void _WM_MAFM_Render(void *synth, int32_t *out, uint32_t frames) {
          * voices carry each slot's own L/R gains from its channel's pan CC. */
         {
             double pcm_l = 0.0, pcm_r = 0.0;
-            mafm_pcm_tick(s, &pcm_l, &pcm_r);
+            mafm_pcm_tick(s, &pcm_l, &pcm_r, (stride) ? pcm_bus_l : NULL,
+                          (stride) ? pcm_bus_r : NULL);
             /* Match the reference mixer: 0.32 headroom * int16 range = ~10485
              * per voice at centre pan.  With the (1-pan)/(1+pan) pan law
              * above, each channel receives voice_sum * 0.32 at centre, up to
@@ -1262,13 +1324,23 @@ void _WM_MAFM_Render(void *synth, int32_t *out, uint32_t frames) {
         peak = fabs(l) > fabs(r) ? fabs(l) : fabs(r);
         if (peak > s->lim_env) s->lim_env = peak;
         else s->lim_env *= LIM_RELEASE;
+        gain = 1.0;
         if (s->lim_env > LIM_THRESHOLD) {
             gain = LIM_THRESHOLD / s->lim_env;
             l *= gain;
             r *= gain;
         }
-        out[f * 2]     += (int32_t) l;
-        out[f * 2 + 1] += (int32_t) r;
+        if (stride) {
+            for (i = 0; i < 17; i++) {
+                out[i * stride + f * 2] += (int32_t)
+                    ((fm_bus_l[i] * 10500.0 + pcm_bus_l[i] * 20000.0) * gain);
+                out[i * stride + f * 2 + 1] += (int32_t)
+                    ((fm_bus_r[i] * 10500.0 + pcm_bus_r[i] * 20000.0) * gain);
+            }
+        } else {
+            out[f * 2]     += (int32_t) l;
+            out[f * 2 + 1] += (int32_t) r;
+        }
     }
 }
 
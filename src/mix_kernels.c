@@ -0,0 +1,859 @@
+/*
+ * mix_kernels.c -- SIMD inner loops for the GUS mixers
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mix_kernels.h"
+
+/*
+ * The SSE2 and AVX2 sets are built with per-function target attributes, so
+ * the rest of the library keeps the compiler's baseline instruction set and
+ * the choice is made at run time. Toolchains that can't do that (Watcom,
+ * DJGPP, the OS/2 and Amiga ports) and big endian targets get the C set only.
+ */
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) \
+    && !defined(WORDS_BIGENDIAN) && !defined(WILDMIDI_AMIGA) \
+    && !defined(__DJGPP__) && !defined(__OS2__) && !defined(__WATCOMC__)
+# if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 5))
+#  define WM_MIX_X86 1
+#  define WM_TARGET_SSE2 __attribute__((target("sse2")))
+#  define WM_TARGET_AVX2 __attribute__((target("avx2")))
+# elif defined(_MSC_VER) && (_MSC_VER >= 1800)
+#  define WM_MIX_X86 1
+#  define WM_TARGET_SSE2
+#  define WM_TARGET_AVX2
+# endif
+#endif
+
+/* Advanced SIMD is part of the base AArch64 architecture; 32 bit ARM keeps
+   the C set since NEON is optional there. */
+#if (defined(__aarch64__) || defined(_M_ARM64)) && !defined(WORDS_BIGENDIAN)
+# define WM_MIX_NEON 1
+#endif
+
+#ifdef WM_MIX_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+#ifdef WM_MIX_NEON
+# include <arm_neon.h>
+# if defined(__linux__) && defined(__GLIBC__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+# endif
+#endif
+
+/* must match FPBITS in wildmidi_lib.c */
+#define MIX_FPBITS 10
+#define MIX_FPMASK ((1L << MIX_FPBITS) - 1L)
+
+/*
+ * ==========
+ * C versions
+ * ==========
+ *
+ * These are the reference: the SIMD versions below give bit identical
+ * results for everything but gauss, which sums in a different order, so
+ * it may differ from these in the last bit of the double.
+ */
+
+static void linear_c(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    const int16_t *data = run->data;
+    const int32_t *env_amp = run->env_amp;
+    uint32_t sample_pos = run->sample_pos;
+    uint32_t sample_inc = run->sample_inc;
+    int32_t env_level = run->env_level;
+    int32_t env_inc = run->env_inc;
+    int32_t left_vol = run->left_vol;
+    int32_t right_vol = run->right_vol;
+    uint32_t data_pos;
+    int32_t premix;
+
+    while (count--) {
+        data_pos = sample_pos >> MIX_FPBITS;
+        premix = ((data[data_pos] + (((data[data_pos + 1] - data[data_pos]) * (int32_t)(sample_pos & MIX_FPMASK)) / 1024)) * env_amp[env_level >> 12]) / 1024;
+        *out++ += (premix * left_vol) / 1024;
+        *out++ += (premix * right_vol) / 1024;
+        sample_pos += sample_inc;
+        env_level += env_inc;
+    }
+
+    run->sample_pos = sample_pos;
+    run->env_level = env_level;
+}
+
+static double gauss_c(const int16_t *sptr, const double *gptr, int taps) {
+    double y = 0;
+    do {
+        y += *(sptr++) * *(gptr++);
+    } while (--taps);
+    return (y);
+}
+
+/*
+ * A sinc run: the window dot product is the only part that differs between
+ * the kernel sets. Each set supplies it as dot(sptr, coef, taps) and gets a
+ * copy of this loop per tap count, so the dot product is unrolled.
+ */
+#define SINC_RUN_LOOP(dot, taps) do {                                       \
+        while (count--) {                                                   \
+            y = dot(data + (sample_pos >> MIX_FPBITS) - ((taps) / 2 - 1),   \
+                    coef + (sample_pos & MIX_FPMASK) * (taps), (taps));     \
+            premix = (((y + 8192) >> 14) * env_amp[env_level >> 12]) / 1024; \
+            *out++ += (premix * left_vol) / 1024;                           \
+            *out++ += (premix * right_vol) / 1024;                          \
+            sample_pos += sample_inc;                                       \
+            env_level += env_inc;                                           \
+        }                                                                   \
+    } while (0)
+
+#define SINC_RUN(dot) {                                                     \
+    const int16_t *data = run->data;                                        \
+    const int16_t *coef = run->sinc_coef;                                   \
+    const int32_t *env_amp = run->env_amp;                                  \
+    uint32_t sample_pos = run->sample_pos;                                  \
+    uint32_t sample_inc = run->sample_inc;                                  \
+    int32_t env_level = run->env_level;                                     \
+    int32_t env_inc = run->env_inc;                                         \
+    int32_t left_vol = run->left_vol;                                       \
+    int32_t right_vol = run->right_vol;                                     \
+    int32_t y, premix;                                                      \
+                                                                            \
+    switch (run->sinc_taps) {                                               \
+    case 4: SINC_RUN_LOOP(dot, 4); break;                                   \
+    case 8: SINC_RUN_LOOP(dot, 8); break;                                   \
+    case 16: SINC_RUN_LOOP(dot, 16); break;                                 \
+    default: SINC_RUN_LOOP(dot, 32); break;                                 \
+    }                                                                       \
+    run->sample_pos = sample_pos;                                           \
+    run->env_level = env_level;                                             \
+}
+
+static inline int32_t sinc_dot_c(const int16_t *sptr, const int16_t *coef, int taps) {
+    int32_t y = 0;
+    do {
+        y += *(sptr++) * *(coef++);
+    } while (--taps);
+    return (y);
+}
+
+static void sinc_c(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    SINC_RUN(sinc_dot_c)
+}
+
+static void pack_s16_c(const int32_t *in, int8_t *out, uint32_t samples) {
+    int32_t mix;
+
+    while (samples--) {
+        mix = *in++;
+        /* The packing below only keeps 16 bits: without a clamp, an
+           over-full mix wraps around into full-scale pops. */
+        if (mix > 32767) mix = 32767;
+        else if (mix < -32768) mix = -32768;
+#ifdef WORDS_BIGENDIAN
+        (*out++) = ((mix >> 8) & 0x7f) | ((mix >> 24) & 0x80);
+        (*out++) = mix & 0xff;
+#else
+        (*out++) = mix & 0xff;
+        (*out++) = ((mix >> 8) & 0x7f) | ((mix >> 24) & 0x80);
+#endif
+    }
+}
+
+static void pack_s32_c(const int32_t *in, int32_t *out, uint32_t samples) {
+    int32_t mix;
+
+    while (samples--) {
+        mix = *in++;
+        if (mix > 32767) mix = 32767;
+        else if (mix < -32768) mix = -32768;
+        *out++ = (int32_t)((uint32_t)mix << 16);
+    }
+}
+
+static void pack_f32_c(const int32_t *in, float *out, uint32_t samples) {
+    while (samples--)
+        *out++ = (float)(*in++) * (1.0f / 32768.0f);
+}
+
+/* The scaled sample is held to the int32 range before it is converted,
+   and the add wraps. Every version does the same, bit for bit. */
+#define MIX_S32_MAX 2147483520.0f   /* the largest float below 2^31 */
+#define MIX_S32_MIN (-2147483648.0f)
+
+static void mix_s32_c(const int32_t *in, int32_t *out, uint32_t samples, float gain) {
+    float v;
+
+    while (samples--) {
+        v = (float)(*in++) * gain;
+        if (v > MIX_S32_MAX) v = MIX_S32_MAX;
+        else if (v < MIX_S32_MIN) v = MIX_S32_MIN;
+        *out = (int32_t)((uint32_t)*out + (uint32_t)(int32_t)v);
+        out++;
+    }
+}
+
+static void mix_f32_c(const int32_t *in, float *out, uint32_t samples, float gain) {
+    const float scale = gain * (1.0f / 32768.0f);
+
+    while (samples--)
+        *out++ += (float)(*in++) * scale;
+}
+
+static const struct _WM_MixKernels kernels_c = {
+    "c", linear_c, gauss_c, sinc_c, pack_s16_c, pack_s32_c, pack_f32_c,
+    mix_s32_c, mix_f32_c
+};
+
+#ifdef WM_MIX_X86
+
+/*
+ * ====
+ * SSE2
+ * ====
+ *
+ * The linear mixer works on 4 frames at a time in 16x16->32 bit multiplies
+ * (pmaddwd), which is exact here: the interpolated sample and the premix
+ * stay within 16 bits, and env_amp is at most 1024. The note volumes are
+ * normally around 400, anything that doesn't fit 16 bits goes to the C loop.
+ */
+
+/* x / 1024 rounding towards zero, like C division */
+#define SSE2_DIV1024(x) _mm_srai_epi32(_mm_add_epi32((x), \
+        _mm_and_si128(_mm_srai_epi32((x), 31), _mm_set1_epi32(1023))), 10)
+
+WM_TARGET_SSE2
+static void linear_sse2(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    const int16_t *data = run->data;
+    const int32_t *env_amp = run->env_amp;
+    uint32_t sample_pos = run->sample_pos;
+    uint32_t sample_inc = run->sample_inc;
+    int32_t env_level = run->env_level;
+    int32_t env_inc = run->env_inc;
+    __m128i vol, pair, frac, coef, d0, x, s, amp, premix, lo, hi;
+    int32_t pairs[4], fracs[4], amps[4];
+    int k;
+
+    if ((uint32_t)run->left_vol > 32767 || (uint32_t)run->right_vol > 32767) {
+        linear_c(run, out, count);
+        return;
+    }
+    vol = _mm_set_epi32(run->right_vol, run->left_vol,
+                        run->right_vol, run->left_vol);
+
+    for (; count >= 4; count -= 4, out += 8) {
+        for (k = 0; k < 4; k++) {
+            /* data[n] in the low half, data[n + 1] in the high half */
+            memcpy(&pairs[k], &data[sample_pos >> MIX_FPBITS], 4);
+            fracs[k] = (int32_t)(sample_pos & MIX_FPMASK);
+            amps[k] = env_amp[env_level >> 12];
+            sample_pos += sample_inc;
+            env_level += env_inc;
+        }
+        pair = _mm_loadu_si128((const __m128i *) pairs);
+        frac = _mm_loadu_si128((const __m128i *) fracs);
+        amp = _mm_loadu_si128((const __m128i *) amps);
+
+        /* (data[n + 1] - data[n]) * frac as -frac * data[n] + frac * data[n + 1] */
+        coef = _mm_or_si128(_mm_slli_epi32(frac, 16),
+                            _mm_sub_epi16(_mm_setzero_si128(), frac));
+        d0 = _mm_srai_epi32(_mm_slli_epi32(pair, 16), 16);
+        x = _mm_madd_epi16(pair, coef);
+        s = _mm_add_epi32(d0, SSE2_DIV1024(x));
+
+        /* amp has a zero high half, so this is s * amp */
+        x = _mm_madd_epi16(s, amp);
+        premix = SSE2_DIV1024(x);
+
+        lo = _mm_unpacklo_epi32(premix, premix);
+        hi = _mm_unpackhi_epi32(premix, premix);
+        lo = _mm_madd_epi16(lo, vol);
+        hi = _mm_madd_epi16(hi, vol);
+        _mm_storeu_si128((__m128i *) out, _mm_add_epi32(
+                _mm_loadu_si128((const __m128i *) out), SSE2_DIV1024(lo)));
+        _mm_storeu_si128((__m128i *) (out + 4), _mm_add_epi32(
+                _mm_loadu_si128((const __m128i *) (out + 4)), SSE2_DIV1024(hi)));
+    }
+
+    run->sample_pos = sample_pos;
+    run->env_level = env_level;
+    if (count)
+        linear_c(run, out, count);
+}
+
+WM_TARGET_SSE2
+static double gauss_sse2(const int16_t *sptr, const double *gptr, int taps) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    __m128i s;
+    double sum[2];
+    double y;
+
+    for (; taps >= 4; taps -= 4, sptr += 4, gptr += 4) {
+        s = _mm_loadl_epi64((const __m128i *) sptr);
+        s = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_cvtepi32_pd(s),
+                                           _mm_loadu_pd(gptr)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(s, 0xEE)),
+                                           _mm_loadu_pd(gptr + 2)));
+    }
+    _mm_storeu_pd(sum, _mm_add_pd(acc0, acc1));
+    y = sum[0] + sum[1];
+    while (taps--)
+        y += *(sptr++) * *(gptr++);
+    return (y);
+}
+
+WM_TARGET_SSE2
+static inline int32_t sinc_dot_sse2(const int16_t *sptr, const int16_t *coef, int taps) {
+    __m128i acc = _mm_setzero_si128();
+
+    for (; taps >= 8; taps -= 8, sptr += 8, coef += 8) {
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(
+                _mm_loadu_si128((const __m128i *) sptr),
+                _mm_loadu_si128((const __m128i *) coef)));
+    }
+    if (taps) {
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(
+                _mm_loadl_epi64((const __m128i *) sptr),
+                _mm_loadl_epi64((const __m128i *) coef)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    return (_mm_cvtsi128_si32(acc));
+}
+
+WM_TARGET_SSE2
+static void sinc_sse2(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    SINC_RUN(sinc_dot_sse2)
+}
+
+WM_TARGET_SSE2
+static void pack_s16_sse2(const int32_t *in, int8_t *out, uint32_t samples) {
+    for (; samples >= 8; samples -= 8, in += 8, out += 16) {
+        _mm_storeu_si128((__m128i *) out, _mm_packs_epi32(
+                _mm_loadu_si128((const __m128i *) in),
+                _mm_loadu_si128((const __m128i *) (in + 4))));
+    }
+    if (samples)
+        pack_s16_c(in, out, samples);
+}
+
+WM_TARGET_SSE2
+static void pack_s32_sse2(const int32_t *in, int32_t *out, uint32_t samples) {
+    __m128i p;
+
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        p = _mm_packs_epi32(_mm_loadu_si128((const __m128i *) in),
+                            _mm_loadu_si128((const __m128i *) (in + 4)));
+        /* interleaving zeros below each 16 bit value shifts it up by 16 */
+        _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi16(_mm_setzero_si128(), p));
+        _mm_storeu_si128((__m128i *) (out + 4), _mm_unpackhi_epi16(_mm_setzero_si128(), p));
+    }
+    if (samples)
+        pack_s32_c(in, out, samples);
+}
+
+WM_TARGET_SSE2
+static void pack_f32_sse2(const int32_t *in, float *out, uint32_t samples) {
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(
+                _mm_loadu_si128((const __m128i *) in)), scale));
+    }
+    if (samples)
+        pack_f32_c(in, out, samples);
+}
+
+WM_TARGET_SSE2
+static void mix_s32_sse2(const int32_t *in, int32_t *out, uint32_t samples, float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 hi = _mm_set1_ps(MIX_S32_MAX);
+    const __m128 lo = _mm_set1_ps(MIX_S32_MIN);
+    __m128i v;
+
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        v = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(
+                _mm_loadu_si128((const __m128i *) in)), g), hi), lo));
+        _mm_storeu_si128((__m128i *) out,
+                         _mm_add_epi32(_mm_loadu_si128((const __m128i *) out), v));
+    }
+    if (samples)
+        mix_s32_c(in, out, samples, gain);
+}
+
+WM_TARGET_SSE2
+static void mix_f32_sse2(const int32_t *in, float *out, uint32_t samples, float gain) {
+    const __m128 scale = _mm_set1_ps(gain * (1.0f / 32768.0f));
+
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) in)), scale)));
+    }
+    if (samples)
+        mix_f32_c(in, out, samples, gain);
+}
+
+static const struct _WM_MixKernels kernels_sse2 = {
+    "sse2", linear_sse2, gauss_sse2, sinc_sse2, pack_s16_sse2,
+    pack_s32_sse2, pack_f32_sse2, mix_s32_sse2, mix_f32_sse2
+};
+
+/*
+ * ====
+ * AVX2
+ * ====
+ *
+ * As SSE2, 8 frames at a time, with the sample pairs and envelope
+ * amplitudes fetched by gathers.
+ */
+
+#define AVX2_DIV1024(x) _mm256_srai_epi32(_mm256_add_epi32((x), \
+        _mm256_and_si256(_mm256_srai_epi32((x), 31), _mm256_set1_epi32(1023))), 10)
+
+WM_TARGET_AVX2
+static void linear_avx2(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    uint32_t sample_inc = run->sample_inc;
+    int32_t env_inc = run->env_inc;
+    __m256i step, pos, lvl, pos_inc, lvl_inc, fmask;
+    __m256i vol, pair, frac, coef, d0, x, s, amp, premix, lo, hi;
+
+    if ((uint32_t)run->left_vol > 32767 || (uint32_t)run->right_vol > 32767) {
+        linear_c(run, out, count);
+        return;
+    }
+    if (count < 8) {
+        linear_sse2(run, out, count);
+        return;
+    }
+    vol = _mm256_set_epi32(run->right_vol, run->left_vol,
+                           run->right_vol, run->left_vol,
+                           run->right_vol, run->left_vol,
+                           run->right_vol, run->left_vol);
+    step = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    pos = _mm256_add_epi32(_mm256_set1_epi32((int32_t)run->sample_pos),
+                           _mm256_mullo_epi32(step, _mm256_set1_epi32((int32_t)sample_inc)));
+    lvl = _mm256_add_epi32(_mm256_set1_epi32(run->env_level),
+                           _mm256_mullo_epi32(step, _mm256_set1_epi32(env_inc)));
+    pos_inc = _mm256_set1_epi32((int32_t)(sample_inc * 8));
+    lvl_inc = _mm256_set1_epi32((int32_t)((uint32_t)env_inc * 8));
+    fmask = _mm256_set1_epi32(MIX_FPMASK);
+
+    for (; count >= 8; count -= 8, out += 16) {
+        pair = _mm256_i32gather_epi32((const int *) run->data,
+                                      _mm256_srli_epi32(pos, MIX_FPBITS), 2);
+        amp = _mm256_i32gather_epi32((const int *) run->env_amp,
+                                     _mm256_srai_epi32(lvl, 12), 4);
+        frac = _mm256_and_si256(pos, fmask);
+
+        coef = _mm256_or_si256(_mm256_slli_epi32(frac, 16),
+                               _mm256_sub_epi16(_mm256_setzero_si256(), frac));
+        d0 = _mm256_srai_epi32(_mm256_slli_epi32(pair, 16), 16);
+        x = _mm256_madd_epi16(pair, coef);
+        s = _mm256_add_epi32(d0, AVX2_DIV1024(x));
+        x = _mm256_madd_epi16(s, amp);
+        premix = AVX2_DIV1024(x);
+
+        /* frames 0,1 | 4,5 and 2,3 | 6,7 */
+        lo = _mm256_unpacklo_epi32(premix, premix);
+        hi = _mm256_unpackhi_epi32(premix, premix);
+        lo = AVX2_DIV1024(_mm256_madd_epi16(lo, vol));
+        hi = AVX2_DIV1024(_mm256_madd_epi16(hi, vol));
+        _mm256_storeu_si256((__m256i *) out, _mm256_add_epi32(
+                _mm256_loadu_si256((const __m256i *) out),
+                _mm256_permute2x128_si256(lo, hi, 0x20)));
+        _mm256_storeu_si256((__m256i *) (out + 8), _mm256_add_epi32(
+                _mm256_loadu_si256((const __m256i *) (out + 8)),
+                _mm256_permute2x128_si256(lo, hi, 0x31)));
+
+        pos = _mm256_add_epi32(pos, pos_inc);
+        lvl = _mm256_add_epi32(lvl, lvl_inc);
+    }
+
+    run->sample_pos = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(pos));
+    run->env_level = _mm_cvtsi128_si32(_mm256_castsi256_si128(lvl));
+    if (count)
+        linear_c(run, out, count);
+}
+
+WM_TARGET_AVX2
+static double gauss_avx2(const int16_t *sptr, const double *gptr, int taps) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256i s;
+    __m128d h;
+    double y;
+
+    for (; taps >= 8; taps -= 8, sptr += 8, gptr += 8) {
+        s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) sptr));
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(
+                _mm256_cvtepi32_pd(_mm256_castsi256_si128(s)),
+                _mm256_loadu_pd(gptr)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(
+                _mm256_cvtepi32_pd(_mm256_extracti128_si256(s, 1)),
+                _mm256_loadu_pd(gptr + 4)));
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    h = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    y = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    while (taps--)
+        y += *(sptr++) * *(gptr++);
+    return (y);
+}
+
+WM_TARGET_AVX2
+static inline int32_t sinc_dot_avx2(const int16_t *sptr, const int16_t *coef, int taps) {
+    __m256i acc = _mm256_setzero_si256();
+    __m128i acc4;
+
+    for (; taps >= 16; taps -= 16, sptr += 16, coef += 16) {
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+                _mm256_loadu_si256((const __m256i *) sptr),
+                _mm256_loadu_si256((const __m256i *) coef)));
+    }
+    acc4 = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                         _mm256_extracti128_si256(acc, 1));
+    if (taps >= 8) {
+        acc4 = _mm_add_epi32(acc4, _mm_madd_epi16(
+                _mm_loadu_si128((const __m128i *) sptr),
+                _mm_loadu_si128((const __m128i *) coef)));
+        taps -= 8; sptr += 8; coef += 8;
+    }
+    if (taps) {
+        acc4 = _mm_add_epi32(acc4, _mm_madd_epi16(
+                _mm_loadl_epi64((const __m128i *) sptr),
+                _mm_loadl_epi64((const __m128i *) coef)));
+    }
+    acc4 = _mm_add_epi32(acc4, _mm_shuffle_epi32(acc4, 0x4E));
+    acc4 = _mm_add_epi32(acc4, _mm_shuffle_epi32(acc4, 0xB1));
+    return (_mm_cvtsi128_si32(acc4));
+}
+
+WM_TARGET_AVX2
+static void sinc_avx2(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    SINC_RUN(sinc_dot_avx2)
+}
+
+WM_TARGET_AVX2
+static void pack_s16_avx2(const int32_t *in, int8_t *out, uint32_t samples) {
+    __m256i p;
+
+    for (; samples >= 16; samples -= 16, in += 16, out += 32) {
+        /* packs works per 128 bit lane: put the 4 quarters back in order */
+        p = _mm256_packs_epi32(_mm256_loadu_si256((const __m256i *) in),
+                               _mm256_loadu_si256((const __m256i *) (in + 8)));
+        _mm256_storeu_si256((__m256i *) out, _mm256_permute4x64_epi64(p, 0xD8));
+    }
+    if (samples)
+        pack_s16_sse2(in, out, samples);
+}
+
+WM_TARGET_AVX2
+static void pack_s32_avx2(const int32_t *in, int32_t *out, uint32_t samples) {
+    __m256i p;
+
+    for (; samples >= 16; samples -= 16, in += 16, out += 16) {
+        /* per 128 bit lane, so the unpacks undo the packs' lane order */
+        p = _mm256_packs_epi32(_mm256_loadu_si256((const __m256i *) in),
+                               _mm256_loadu_si256((const __m256i *) (in + 8)));
+        _mm256_storeu_si256((__m256i *) out, _mm256_unpacklo_epi16(_mm256_setzero_si256(), p));
+        _mm256_storeu_si256((__m256i *) (out + 8), _mm256_unpackhi_epi16(_mm256_setzero_si256(), p));
+    }
+    if (samples)
+        pack_s32_sse2(in, out, samples);
+}
+
+WM_TARGET_AVX2
+static void pack_f32_avx2(const int32_t *in, float *out, uint32_t samples) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(
+                _mm256_loadu_si256((const __m256i *) in)), scale));
+    }
+    if (samples)
+        pack_f32_sse2(in, out, samples);
+}
+
+WM_TARGET_AVX2
+static void mix_s32_avx2(const int32_t *in, int32_t *out, uint32_t samples, float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    const __m256 hi = _mm256_set1_ps(MIX_S32_MAX);
+    const __m256 lo = _mm256_set1_ps(MIX_S32_MIN);
+    __m256i v;
+
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        v = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(
+                _mm256_loadu_si256((const __m256i *) in)), g), hi), lo));
+        _mm256_storeu_si256((__m256i *) out,
+                            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) out), v));
+    }
+    if (samples)
+        mix_s32_sse2(in, out, samples, gain);
+}
+
+WM_TARGET_AVX2
+static void mix_f32_avx2(const int32_t *in, float *out, uint32_t samples, float gain) {
+    const __m256 scale = _mm256_set1_ps(gain * (1.0f / 32768.0f));
+
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        _mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) in)), scale)));
+    }
+    if (samples)
+        mix_f32_sse2(in, out, samples, gain);
+}
+
+static const struct _WM_MixKernels kernels_avx2 = {
+    "avx2", linear_avx2, gauss_avx2, sinc_avx2, pack_s16_avx2,
+    pack_s32_avx2, pack_f32_avx2, mix_s32_avx2, mix_f32_avx2
+};
+
+static void cpu_features(int *sse2, int *avx2) {
+#ifdef _MSC_VER
+    int r[4];
+    int max_leaf;
+
+    __cpuid(r, 0);
+    max_leaf = r[0];
+    __cpuid(r, 1);
+    *sse2 = (r[3] >> 26) & 1;
+    *avx2 = 0;
+    /* AVX needs OS support for the YMM state as well (OSXSAVE, XCR0) */
+    if (max_leaf >= 7 && (r[2] & (1 << 27)) && (r[2] & (1 << 28))
+        && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(r, 7, 0);
+        *avx2 = (r[1] >> 5) & 1;
+    }
+#else
+    __builtin_cpu_init();
+    *sse2 = __builtin_cpu_supports("sse2") ? 1 : 0;
+    *avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+}
+
+#endif /* WM_MIX_X86 */
+
+#ifdef WM_MIX_NEON
+
+/*
+ * ====
+ * NEON
+ * ====
+ *
+ * 4 frames at a time in 32 bit lanes, so unlike SSE2 there's no limit on
+ * the note volumes. vld2/vst2 take care of the stereo interleave.
+ */
+
+static inline int32x4_t neon_div1024(int32x4_t x) {
+    return (vshrq_n_s32(vaddq_s32(x, vandq_s32(vshrq_n_s32(x, 31),
+                                               vdupq_n_s32(1023))), 10));
+}
+
+static void linear_neon(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    const int16_t *data = run->data;
+    const int32_t *env_amp = run->env_amp;
+    uint32_t sample_pos = run->sample_pos;
+    uint32_t sample_inc = run->sample_inc;
+    int32_t env_level = run->env_level;
+    int32_t env_inc = run->env_inc;
+    int32_t d0s[4], d1s[4], fracs[4], amps[4];
+    int32x4_t d0, premix;
+    int32x4x2_t mix;
+    uint32_t data_pos;
+    int k;
+
+    for (; count >= 4; count -= 4, out += 8) {
+        for (k = 0; k < 4; k++) {
+            data_pos = sample_pos >> MIX_FPBITS;
+            d0s[k] = data[data_pos];
+            d1s[k] = data[data_pos + 1];
+            fracs[k] = (int32_t)(sample_pos & MIX_FPMASK);
+            amps[k] = env_amp[env_level >> 12];
+            sample_pos += sample_inc;
+            env_level += env_inc;
+        }
+        d0 = vld1q_s32(d0s);
+        premix = vmulq_s32(vsubq_s32(vld1q_s32(d1s), d0), vld1q_s32(fracs));
+        premix = vaddq_s32(d0, neon_div1024(premix));
+        premix = neon_div1024(vmulq_s32(premix, vld1q_s32(amps)));
+
+        mix = vld2q_s32(out);
+        mix.val[0] = vaddq_s32(mix.val[0], neon_div1024(vmulq_n_s32(premix, run->left_vol)));
+        mix.val[1] = vaddq_s32(mix.val[1], neon_div1024(vmulq_n_s32(premix, run->right_vol)));
+        vst2q_s32(out, mix);
+    }
+
+    run->sample_pos = sample_pos;
+    run->env_level = env_level;
+    if (count)
+        linear_c(run, out, count);
+}
+
+static double gauss_neon(const int16_t *sptr, const double *gptr, int taps) {
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    int32x4_t s;
+    double y;
+
+    for (; taps >= 4; taps -= 4, sptr += 4, gptr += 4) {
+        s = vmovl_s16(vld1_s16(sptr));
+        acc0 = vaddq_f64(acc0, vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(s))),
+                                         vld1q_f64(gptr)));
+        acc1 = vaddq_f64(acc1, vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(s))),
+                                         vld1q_f64(gptr + 2)));
+    }
+    y = vaddvq_f64(vaddq_f64(acc0, acc1));
+    while (taps--)
+        y += *(sptr++) * *(gptr++);
+    return (y);
+}
+
+static inline int32_t sinc_dot_neon(const int16_t *sptr, const int16_t *coef, int taps) {
+    int32x4_t acc = vdupq_n_s32(0);
+
+    for (; taps >= 4; taps -= 4, sptr += 4, coef += 4)
+        acc = vmlal_s16(acc, vld1_s16(sptr), vld1_s16(coef));
+    return (vaddvq_s32(acc));
+}
+
+static void sinc_neon(struct _WM_VoiceRun *run, int32_t *out, uint32_t count) {
+    SINC_RUN(sinc_dot_neon)
+}
+
+static void pack_s16_neon(const int32_t *in, int8_t *out, uint32_t samples) {
+    int16x8_t p;
+
+    for (; samples >= 8; samples -= 8, in += 8, out += 16) {
+        p = vcombine_s16(vqmovn_s32(vld1q_s32(in)), vqmovn_s32(vld1q_s32(in + 4)));
+        vst1q_u8((uint8_t *) out, vreinterpretq_u8_s16(p));
+    }
+    if (samples)
+        pack_s16_c(in, out, samples);
+}
+
+static void pack_s32_neon(const int32_t *in, int32_t *out, uint32_t samples) {
+    for (; samples >= 4; samples -= 4, in += 4, out += 4)
+        vst1q_s32(out, vshll_n_s16(vqmovn_s32(vld1q_s32(in)), 16));
+    if (samples)
+        pack_s32_c(in, out, samples);
+}
+
+static void pack_f32_neon(const int32_t *in, float *out, uint32_t samples) {
+    for (; samples >= 4; samples -= 4, in += 4, out += 4)
+        vst1q_f32(out, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in)), 1.0f / 32768.0f));
+    if (samples)
+        pack_f32_c(in, out, samples);
+}
+
+static void mix_s32_neon(const int32_t *in, int32_t *out, uint32_t samples, float gain) {
+    const float32x4_t hi = vdupq_n_f32(MIX_S32_MAX);
+    const float32x4_t lo = vdupq_n_f32(MIX_S32_MIN);
+
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        vst1q_s32(out, vaddq_s32(vld1q_s32(out), vcvtq_s32_f32(vmaxq_f32(vminq_f32(
+                vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in)), gain), hi), lo))));
+    }
+    if (samples)
+        mix_s32_c(in, out, samples, gain);
+}
+
+static void mix_f32_neon(const int32_t *in, float *out, uint32_t samples, float gain) {
+    const float scale = gain * (1.0f / 32768.0f);
+
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        vst1q_f32(out, vaddq_f32(vld1q_f32(out),
+                                 vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in)), scale)));
+    }
+    if (samples)
+        mix_f32_c(in, out, samples, gain);
+}
+
+static const struct _WM_MixKernels kernels_neon = {
+    "neon", linear_neon, gauss_neon, sinc_neon, pack_s16_neon,
+    pack_s32_neon, pack_f32_neon, mix_s32_neon, mix_f32_neon
+};
+
+static int cpu_has_neon(void) {
+#if defined(__linux__) && defined(__GLIBC__) && defined(HWCAP_ASIMD)
+    return ((getauxval(AT_HWCAP) & HWCAP_ASIMD) ? 1 : 0);
+#else
+    return (1);
+#endif
+}
+
+#endif /* WM_MIX_NEON */
+
+/*
+ * ========
+ * Dispatch
+ * ========
+ */
+
+const struct _WM_MixKernels *_WM_mix = &kernels_c;
+
+/* every set this CPU can run, best last */
+static const struct _WM_MixKernels *mix_sets[4] = { &kernels_c };
+static int mix_set_count = 0;
+
+void _WM_InitMixKernels(void) {
+    const struct _WM_MixKernels *sets[4];
+    int count = 0;
+#ifdef WM_MIX_X86
+    int sse2, avx2;
+#endif
+
+    if (mix_set_count)
+        return;
+
+    sets[count++] = &kernels_c;
+#ifdef WM_MIX_X86
+    cpu_features(&sse2, &avx2);
+    if (sse2) {
+        sets[count++] = &kernels_sse2;
+        if (avx2)
+            sets[count++] = &kernels_avx2;
+    }
+#endif
+#ifdef WM_MIX_NEON
+    if (cpu_has_neon())
+        sets[count++] = &kernels_neon;
+#endif
+
+    memcpy(mix_sets, sets, count * sizeof(sets[0]));
+    _WM_mix = sets[count - 1];
+    mix_set_count = count;
+}
+
+const struct _WM_MixKernels *_WM_GetMixKernels(int index) {
+    _WM_InitMixKernels();
+    if (index < 0 || index >= mix_set_count)
+        return (NULL);
+    return (mix_sets[index]);
+}
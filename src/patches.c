@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "wildmidi_lib.h"
@@ -36,15 +37,18 @@
 #include "patches.h"
 #include "sample.h"
 
-struct _patch *_WM_patch[128];
 int _WM_patch_lock = 0;
 
+/* how many threads load a song's patches, the caller's included; 0 for
+   one per CPU. Only the tests change it. */
+unsigned int _WM_load_threads = 0;
+
 static struct _patch *
-_find_matched_patch(uint16_t patchid) {
+_find_matched_patch(struct _WM_Context *ctx, uint16_t patchid) {
     struct _patch *ret = NULL;
     struct _patch *search_patch;
 
-    for (search_patch = _WM_patch[patchid & 0x007F];
+    for (search_patch = ctx->patch[patchid & 0x007F];
             search_patch && !ret; search_patch = search_patch->next) {
         if (search_patch->patchid == patchid) {
             ret = search_patch;
@@ -54,7 +58,7 @@ _find_matched_patch(uint16_t patchid) {
 }
 
 static struct _patch *
-_find_nearest_patch(uint16_t patchid) {
+_find_nearest_patch(struct _WM_Context *ctx, uint16_t patchid) {
     struct _patch *ret = NULL;
     const uint16_t patchid_low = patchid & 0x7F;
     const uint16_t range_down = patchid_low;
@@ -64,39 +68,51 @@ _find_nearest_patch(uint16_t patchid) {
 
     for (step = 0; (!ret) && (step <= step_max); ++step) {
         if (patchid_low - step >= 0) {
-            ret = _find_matched_patch(patchid - step);
+            ret = _find_matched_patch(ctx, patchid - step);
         }
         if ((patchid_low + step <= 0x7F) && !ret) {
-            ret = _find_matched_patch(patchid + step);
+            ret = _find_matched_patch(ctx, patchid + step);
         }
     }
     return ret;
 }
 
+/*
+ * Looks a patch up on every note-on, so it takes no lock. The context's
+ * patch lists are built by its config and only freed with it, after its
+ * songs are closed, so they do not change under a song. And every patch a
+ * song looks up was looked up, counted in inuse_count and loaded when it
+ * was opened (or streamed to), so its samples stay put until it is closed.
+ */
 struct _patch *
 _WM_get_patch_data(struct _mdi *mdi, uint16_t patchid) {
     struct _patch *search_patch;
 
-    WMIDI_UNUSED(mdi);
-
-    _WM_Lock(&_WM_patch_lock);
-    search_patch = _find_nearest_patch(patchid);
+    search_patch = _find_nearest_patch(mdi->ctx, patchid);
     if (search_patch == NULL && (patchid & 0xff00) != 0) {
         /* Nothing at all in the requested bank: fall back to bank 0 rather
          * than play silence, as a hardware synth does for an unknown bank.
          * SMAF needs this - its scores select Yamaha's own voice banks (0x7c
          * and friends), which no GUS/SF2 patch set defines, so without the
          * fallback every SMAF file that has no custom FM voices is mute. */
-        search_patch = _find_nearest_patch(patchid & 0x00ff);
+        search_patch = _find_nearest_patch(mdi->ctx, patchid & 0x00ff);
     }
-    _WM_Unlock(&_WM_patch_lock);
     return (search_patch);
 }
 
+/*
+ * Note a patch the song uses, and from where in it. Nothing is loaded
+ * here: the parser collects them all and _WM_load_patches() loads the lot
+ * once it is done.
+ */
 void _WM_load_patch(struct _mdi *mdi, uint16_t patchid) {
     struct _patch *tmp_patch;
     uint32_t i;
 
+    if (mdi->probe) {
+        /* only the events are wanted */
+        return;
+    }
     for (i = 0; i < mdi->patch_count; i++) {
         if (mdi->patches[i]->patchid == patchid) {
             return;
@@ -109,30 +125,232 @@ void _WM_load_patch(struct _mdi *mdi, uint16_t patchid) {
     }
 
     _WM_Lock(&_WM_patch_lock);
-    if (!tmp_patch->loaded) {
-        if (_WM_load_sample(tmp_patch) == -1) {
-            _WM_Unlock(&_WM_patch_lock);
-            return;
-        }
-    }
-
-    if (tmp_patch->first_sample == NULL) {
-        _WM_Unlock(&_WM_patch_lock);
-        return;
-    }
-
     {
         struct _patch **new_patches = (struct _patch **) realloc(mdi->patches,
                                           sizeof(struct _patch *) * (mdi->patch_count + 1));
+        uint32_t *new_due;
         if (new_patches == NULL) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
             _WM_Unlock(&_WM_patch_lock);
             return;
         }
         mdi->patches = new_patches;
+        new_due = (uint32_t *) realloc(mdi->patch_due,
+                                       sizeof(uint32_t) * (mdi->patch_count + 1));
+        if (new_due == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            _WM_Unlock(&_WM_patch_lock);
+            return;
+        }
+        mdi->patch_due = new_due;
     }
     mdi->patches[mdi->patch_count] = tmp_patch;
+    mdi->patch_due[mdi->patch_count] = mdi->extra_info.approx_total_samples;
     mdi->patch_count++;
     tmp_patch->inuse_count++;
     _WM_Unlock(&_WM_patch_lock);
 }
+
+struct _patch_queue {
+    struct _WM_Context *ctx;
+    /* the patches this load claimed */
+    struct _patch **patch;
+    uint32_t count;
+    uint32_t next;
+    /* the last error a loader reported: errors are kept per thread, and
+       the thread that opened the song is the one to hear of it */
+    struct _WM_Error error;
+};
+
+/* a load handed to the worker pool, which frees it when done */
+struct _patch_job {
+    struct _WM_Context *ctx;
+    uint32_t *jobs;             /* the song's count of them under way */
+    struct _patch **patch;
+    uint32_t count;
+};
+
+/*
+ * Claim, under the patch lock, those of count patches nobody has started
+ * loading, marking them as loading and copying them to claimed, which may
+ * be patches itself. Returns how many it claimed.
+ */
+static uint32_t claim_patches(struct _patch **patches, uint32_t count,
+                              struct _patch **claimed) {
+    uint32_t i;
+    uint32_t n = 0;
+
+    _WM_Lock(&_WM_patch_lock);
+    for (i = 0; i < count; i++) {
+        if (_WM_AtomicLoad(&patches[i]->loaded) == WM_PATCH_UNLOADED) {
+            _WM_AtomicStore(&patches[i]->loaded, WM_PATCH_LOADING);
+            claimed[n++] = patches[i];
+        }
+    }
+    _WM_Unlock(&_WM_patch_lock);
+    return (n);
+}
+
+static void load_claimed(struct _WM_Context *ctx, struct _patch *patch) {
+    _WM_load_sample(ctx, patch);
+    /* tried once, whatever came of it */
+    _WM_AtomicStore(&patch->loaded, WM_PATCH_LOADED);
+}
+
+static void load_patch_queue(void *data) {
+    struct _patch_queue *queue = (struct _patch_queue *) data;
+    struct _patch *tmp_patch;
+    struct _WM_Error *error = _WM_ThreadError();
+    unsigned int errors = error->count;
+
+    for (;;) {
+        tmp_patch = NULL;
+        _WM_ThreadLock();
+        if (queue->next < queue->count) {
+            tmp_patch = queue->patch[queue->next++];
+        } else if (error->count != errors) {
+            queue->error = *error;
+        }
+        _WM_ThreadUnlock();
+        if (tmp_patch == NULL) {
+            return;
+        }
+        load_claimed(queue->ctx, tmp_patch);
+    }
+}
+
+/*
+ * Load the samples of every patch _WM_load_patch() collected that is not
+ * loaded yet. They are claimed under the patch lock and decoded outside
+ * it, shared out over the worker pool, a thread per CPU where the build
+ * has threads. A patch another song, or a load started ahead, is at
+ * meanwhile is waited for. Returns once they are all in. A patch that
+ * fails to load is reported, stays in the list, and plays as silence.
+ */
+void _WM_load_patches(struct _mdi *mdi) {
+    struct _patch_queue queue;
+    struct _WM_Error *error;
+    uint32_t ready = mdi->patches_ready;
+    uint32_t i;
+    unsigned int threads;
+
+    if (ready == mdi->patch_count) {
+        return;
+    }
+    queue.patch = (struct _patch **) malloc(sizeof(struct _patch *)
+                                            * (mdi->patch_count - ready));
+    if (queue.patch == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+        return;
+    }
+    queue.ctx = mdi->ctx;
+    queue.count = claim_patches(&mdi->patches[ready], mdi->patch_count - ready,
+                                queue.patch);
+    queue.next = 0;
+    queue.error.code = WM_ERR_NONE;
+
+    if (queue.count) {
+        threads = (_WM_load_threads) ? _WM_load_threads : _WM_CPUCount();
+        if (threads > queue.count) {
+            threads = queue.count;
+        }
+        _WM_PoolRun(load_patch_queue, &queue, threads);
+        if (queue.error.code != WM_ERR_NONE) {
+            error = _WM_ThreadError();
+            queue.error.count = error->count + 1;
+            *error = queue.error;
+        }
+    }
+    free(queue.patch);
+
+    for (i = ready; i < mdi->patch_count; i++) {
+        _WM_AtomicWait(&mdi->patches[i]->loaded, WM_PATCH_LOADING);
+    }
+    mdi->patches_ready = mdi->patch_count;
+    mdi->patches_ahead = mdi->patch_count;
+}
+
+static void load_patch_job(void *data) {
+    struct _patch_job *job = (struct _patch_job *) data;
+    uint32_t *jobs = job->jobs;
+    uint32_t i, n;
+
+    n = claim_patches(job->patch, job->count, job->patch);
+    for (i = 0; i < n; i++) {
+        load_claimed(job->ctx, job->patch[i]);
+    }
+    free(job);
+    /* the song may be freed from here on */
+    do {
+        n = _WM_AtomicLoad(jobs);
+    } while (!_WM_AtomicSwap(jobs, n, n - 1));
+}
+
+/*
+ * Start loading the patches collected since the last load, on the worker
+ * pool, and return without waiting for them. For the render path, which
+ * is to leave the files alone: it parses a streamed song on ahead of
+ * where it plays, and so has the patches in by the time their notes come
+ * round. Nothing is reported: one that fails plays as silence, as it
+ * would have anyway. Where there is no pool thread to take the load,
+ * _WM_load_patches_due() does it, as late as it can.
+ */
+void _WM_load_patches_ahead(struct _mdi *mdi) {
+    struct _patch_job *job;
+    uint32_t count = mdi->patch_count - mdi->patches_ahead;
+    uint32_t n;
+
+    if (count == 0) {
+        return;
+    }
+    job = (struct _patch_job *) malloc(sizeof(struct _patch_job)
+                                       + sizeof(struct _patch *) * count);
+    if (job != NULL) {
+        job->ctx = mdi->ctx;
+        job->jobs = &mdi->patch_jobs;
+        job->patch = (struct _patch **) &job[1];
+        job->count = count;
+        memcpy(job->patch, &mdi->patches[mdi->patches_ahead],
+               sizeof(struct _patch *) * count);
+        do {
+            n = _WM_AtomicLoad(&mdi->patch_jobs);
+        } while (!_WM_AtomicSwap(&mdi->patch_jobs, n, n + 1));
+        if (!_WM_PoolPost(load_patch_job, job)) {
+            free(job);
+            do {
+                n = _WM_AtomicLoad(&mdi->patch_jobs);
+            } while (!_WM_AtomicSwap(&mdi->patch_jobs, n, n - 1));
+        }
+    }
+    mdi->patches_ahead = mdi->patch_count;
+}
+
+/*
+ * Make sure every patch a note up to sample may play is in, those the
+ * parse came to by then. Most often a load started ahead of them has
+ * seen to that, and this is only a check; one still to be started is
+ * loaded here, and one another thread is at waited for.
+ */
+void _WM_load_patches_due(struct _mdi *mdi, uint32_t sample) {
+    struct _patch *patch;
+
+    while ((mdi->patches_ready < mdi->patch_count)
+           && (mdi->patch_due[mdi->patches_ready] <= sample)) {
+        patch = mdi->patches[mdi->patches_ready++];
+        if (claim_patches(&patch, 1, &patch)) {
+            load_claimed(mdi->ctx, patch);
+        } else {
+            _WM_AtomicWait(&patch->loaded, WM_PATCH_LOADING);
+        }
+    }
+}
+
+/* Wait for the loads _WM_load_patches_ahead() started, before the song's
+   patches are let go of. */
+void _WM_load_patches_wait(struct _mdi *mdi) {
+    uint32_t n;
+
+    while ((n = _WM_AtomicLoad(&mdi->patch_jobs)) != 0) {
+        _WM_AtomicWait(&mdi->patch_jobs, n);
+    }
+}
@@ -260,6 +260,7 @@ static struct option const long_options[] = {
     { "test_bank", 1, NULL, 'k' },
     { "test_patch", 1, NULL, 'p' },
     { "enhanced", 0, NULL, 'e' },
+    { "sinc", 1, NULL, 'I' },
     { "roundtempo", 0, NULL, 'n' },
     { "skipsilentstart", 0, NULL, 's' },
     { "textaslyric", 0, NULL, 'a' },
@@ -307,6 +308,7 @@ static void do_help(void) {
     printf("  -O    --opl3        Use built-in OPL3 FM synth (no cfg/sf2 needed)\n");
     printf("  -m V  --mastervol=V Set the master volume (0..127), default is 100\n");
     printf("  -b    --reverb      Enable final output reverb engine\n");
+    printf("  -I N  --sinc=N      Use N tap (4, 8, 16 or 32) sinc resampling\n");
     printf("Playlist Options:\n");
     printf("  -L    --loop        Loop a single file at end-of-track, or repeat\n");
     printf("                      the playlist when more than one file is given\n");
@@ -400,7 +402,7 @@ int main(int argc, char **argv) {
 
     do_version();
     while (1) {
-        i = getopt_long(argc, argv, "0vho:tx:g:P:f:lr:c:m:btak:p:ed:nsi:j:OLS", long_options,
+        i = getopt_long(argc, argv, "0vho:tx:g:P:f:lr:c:m:btak:p:eI:d:nsi:j:OLS", long_options,
                 &option_index);
         if (i == -1)
             break;
@@ -487,6 +489,18 @@ int main(int argc, char **argv) {
         case 'e': /* Enhanced Resampling */
             mixer_options |= WM_MO_ENHANCED_RESAMPLING;
             break;
+        case 'I': /* Sinc Resampling */
+            mixer_options &= ~WM_MO_SINC_RESAMPLING;
+            switch (atoi(optarg)) {
+            case 4: mixer_options |= WM_MO_SINC_4; break;
+            case 8: mixer_options |= WM_MO_SINC_8; break;
+            case 16: mixer_options |= WM_MO_SINC_16; break;
+            case 32: mixer_options |= WM_MO_SINC_32; break;
+            default:
+                fprintf(stderr, "Error: sinc taps must be 4, 8, 16 or 32.\n");
+                return (1);
+            }
+            break;
         case 'l': /* log volume */
             mixer_options |= WM_MO_LOG_VOLUME;
             break;
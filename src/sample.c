@@ -26,7 +26,6 @@
 #include <stdio.h>
 #include <stdint.h>
 
-#include "lock.h"
 #include "common.h"
 #include "patches.h"
 #include "gus_pat.h"
@@ -78,21 +77,19 @@ uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note)
 }
 
 
+/* No lock, as for _WM_get_patch_data(): a song's patches keep their
+   samples while it is open. */
 struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq) {
     struct _sample *last_sample = NULL;
     struct _sample *return_sample = NULL;
 
-    _WM_Lock(&_WM_patch_lock);
     if (sample_patch == NULL) {
-        _WM_Unlock(&_WM_patch_lock);
         return (NULL);
     }
     if (sample_patch->first_sample == NULL) {
-        _WM_Unlock(&_WM_patch_lock);
         return (NULL);
     }
     if (freq == 0) {
-        _WM_Unlock(&_WM_patch_lock);
         return (sample_patch->first_sample);
     }
 
@@ -101,7 +98,6 @@ struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq)
     while (last_sample) {
         if (freq > last_sample->freq_low) {
             if (freq < last_sample->freq_high) {
-                _WM_Unlock(&_WM_patch_lock);
                 return (last_sample);
             } else {
                 return_sample = last_sample;
@@ -109,31 +105,27 @@ struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq)
         }
         last_sample = last_sample->next;
     }
-    _WM_Unlock(&_WM_patch_lock);
     return (return_sample);
 }
 
 /* sample loading */
 
 int
-_WM_load_sample(struct _patch *sample_patch) {
+_WM_load_sample(struct _WM_Context *ctx, struct _patch *sample_patch) {
     struct _sample *guspat = NULL;
     struct _sample *tmp_sample = NULL;
     uint32_t i = 0;
 
-    /* we only want to try loading the guspat once. */
-    sample_patch->loaded = 1;
-
     if (sample_patch->filename == NULL) {
         /* Emergency-soundbank mode: no file, fabricate a sample. */
-        if ((guspat = _WM_synth_patch(sample_patch->patchid)) == NULL) {
+        if ((guspat = _WM_synth_patch(ctx, sample_patch->patchid)) == NULL) {
             return (-1);
         }
-    } else if ((guspat = _WM_load_gus_pat(sample_patch->filename, _WM_fix_release)) == NULL) {
+    } else if ((guspat = _WM_load_gus_pat(ctx, sample_patch->filename)) == NULL) {
         return (-1);
     }
 
-    if (_WM_auto_amp) {
+    if (ctx->auto_amp) {
         int16_t tmp_max = 0;
         int16_t tmp_min = 0;
         int16_t samp_max = 0;
@@ -154,7 +146,7 @@ _WM_load_sample(struct _patch *sample_patch) {
                 tmp_min = samp_min;
             tmp_sample = tmp_sample->next;
         } while (tmp_sample);
-        if (_WM_auto_amp_with_amp) {
+        if (ctx->auto_amp_with_amp) {
             if (tmp_max >= -tmp_min) {
                 sample_patch->amp = (sample_patch->amp
                                      * ((32767 << 10) / tmp_max)) >> 10;
@@ -224,13 +216,13 @@ _WM_load_sample(struct _patch *sample_patch) {
                 }
                 if (sample_patch->env[i].set & 0x01) {
                     guspat->env_rate[i] = (int32_t) (4194303.0f
-                                                     / ((float) _WM_SampleRate
+                                                     / ((float) ctx->sample_rate
                                                         * (sample_patch->env[i].time / 1000.0f)));
                 }
             } else {
                 guspat->env_target[i] = 4194303;
                 guspat->env_rate[i] = (int32_t) (4194303.0f
-                                                 / ((float) _WM_SampleRate * env_time_table[63]));
+                                                 / ((float) ctx->sample_rate * env_time_table[63]));
             }
         }
 
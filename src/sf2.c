@@ -66,14 +66,13 @@ typedef char tsf_char20[20]; /* no empty source. */
 #include "lock.h"
 #include "sf2.h"
 
-static tsf *WM_sf2 = NULL;
 int _WM_sf2_lock = 0;
 
 int _WM_SF2_Magic(const uint8_t *data, uint32_t size) {
     return (size >= 12 && !memcmp(data, "RIFF", 4) && !memcmp(data + 8, "sfbk", 4));
 }
 
-int _WM_SF2_Load(const uint8_t *data, uint32_t size) {
+int _WM_SF2_Load(struct _WM_Context *ctx, const uint8_t *data, uint32_t size) {
     tsf *f;
     if (size > (uint32_t)INT_MAX) { /* tsf_load_memory takes int; refuse to wrap negative */
         return (-1);
@@ -83,25 +82,25 @@ int _WM_SF2_Load(const uint8_t *data, uint32_t size) {
         return (-1);
     }
     _WM_Lock(&_WM_sf2_lock);
-    if (WM_sf2) {
-        tsf_close(WM_sf2); /* a later soundfont line replaces an earlier one */
+    if (ctx->sf2) {
+        tsf_close((tsf *)ctx->sf2); /* a later soundfont line replaces an earlier one */
     }
-    WM_sf2 = f;
+    ctx->sf2 = f;
     _WM_Unlock(&_WM_sf2_lock);
     return (0);
 }
 
-void _WM_SF2_Unload(void) {
+void _WM_SF2_Unload(struct _WM_Context *ctx) {
     _WM_Lock(&_WM_sf2_lock);
-    if (WM_sf2) {
-        tsf_close(WM_sf2);
-        WM_sf2 = NULL;
+    if (ctx->sf2) {
+        tsf_close((tsf *)ctx->sf2);
+        ctx->sf2 = NULL;
     }
     _WM_Unlock(&_WM_sf2_lock);
 }
 
-int _WM_SF2_Active(void) {
-    return (WM_sf2 != NULL);
+int _WM_SF2_Active(struct _WM_Context *ctx) {
+    return (ctx->sf2 != NULL);
 }
 
 static void WM_SF2_InitChannels(tsf *f) {
@@ -111,15 +110,15 @@ static void WM_SF2_InitChannels(tsf *f) {
     }
 }
 
-void *_WM_SF2_NewSynth(uint16_t rate) {
+void *_WM_SF2_NewSynth(struct _WM_Context *ctx) {
     tsf *f;
     _WM_Lock(&_WM_sf2_lock);
-    f = WM_sf2 ? tsf_copy(WM_sf2) : NULL;
+    f = ctx->sf2 ? tsf_copy((tsf *)ctx->sf2) : NULL;
     _WM_Unlock(&_WM_sf2_lock);
     if (f == NULL) {
         return NULL;
     }
-    tsf_set_output(f, TSF_STEREO_INTERLEAVED, rate, 0.0f);
+    tsf_set_output(f, TSF_STEREO_INTERLEAVED, ctx->sample_rate, 0.0f);
     WM_SF2_InitChannels(f);
     return f;
 }
@@ -140,14 +139,53 @@ void _WM_SF2_Reset(void *synth) {
     WM_SF2_InitChannels(f);
 }
 
+/* The synth's channel state, for a seek checkpoint. free() it when done;
+   NULL if out of memory. */
+void *_WM_SF2_SaveState(void *synth) {
+    tsf *f = (tsf *)synth;
+    struct tsf_channels *state;
+    size_t size;
+    int num = (f->channels) ? f->channels->channelNum : 1;
+
+    size = sizeof(struct tsf_channels) + (num - 1) * sizeof(struct tsf_channel);
+    state = (struct tsf_channels *) malloc(size);
+    if (state == NULL) {
+        return NULL;
+    }
+    if (f->channels) {
+        memcpy(state, f->channels, size);
+    } else {
+        state->channelNum = 0;
+    }
+    return state;
+}
+
+/* Reset the synth, silencing it, and put back saved channel state. */
+void _WM_SF2_LoadState(void *synth, const void *state) {
+    tsf *f = (tsf *)synth;
+    const struct tsf_channels *saved = (const struct tsf_channels *)state;
+    int ch;
+
+    _WM_SF2_Reset(synth);
+    /* channels are created on first use, so the saved ones may be more */
+    if ((saved->channelNum == 0)
+        || (!tsf_channel_init(f, saved->channelNum - 1))) {
+        return;
+    }
+    for (ch = 0; ch < saved->channelNum; ch++) {
+        f->channels->channels[ch] = saved->channels[ch];
+    }
+    f->channels->activeChannel = saved->activeChannel;
+}
+
 int _WM_SF2_ActiveVoices(void *synth) {
     return tsf_active_voice_count((tsf *)synth);
 }
 
 void _WM_SF2_Event(void *synth, struct _mdi *mdi, struct _event *event) {
     tsf *f = (tsf *)synth;
-    uint8_t ch = event->event_data.channel;
-    uint32_t val = event->event_data.data.value;
+    uint8_t ch = event->channel;
+    uint32_t val = event->value;
 
     switch (event->evtype) {
     case ev_note_on:
@@ -233,11 +271,55 @@ void _WM_SF2_Event(void *synth, struct _mdi *mdi, struct _event *event) {
     }
 }
 
-void _WM_SF2_Render(void *synth, int32_t *out, uint32_t frames) {
+/* Mix each channel's voices into its own 16 bit scale bus, stride mix
+   values apart. Blocks of TSF_RENDER_EFFECTSAMPLEBLOCK frames keep the
+   voices' effect updates on the same frames as tsf_render_short(). */
+static void sf2_render_stems(tsf *f, int32_t *out, uint32_t stride, uint32_t frames) {
+    float bus[16][TSF_RENDER_EFFECTSAMPLEBLOCK * 2];
+    int used[16];
+    struct tsf_voice *v, *vEnd = f->voices ? f->voices + f->voiceNum : NULL;
+    uint32_t n, i;
+    int ch;
+    float x;
+
+    while (frames) {
+        n = (frames > TSF_RENDER_EFFECTSAMPLEBLOCK) ? TSF_RENDER_EFFECTSAMPLEBLOCK : frames;
+        memset(used, 0, sizeof(used));
+        for (v = f->voices; v != vEnd; v++) {
+            if (v->playingPreset == -1)
+                continue;
+            ch = v->playingChannel & 15;
+            if (!used[ch]) {
+                memset(bus[ch], 0, n * 2 * sizeof(float));
+                used[ch] = 1;
+            }
+            tsf_voice_render(f, v, bus[ch], (int)n);
+        }
+        for (ch = 0; ch < 16; ch++) {
+            if (!used[ch])
+                continue;
+            /* the same conversion as tsf_render_short() */
+            for (i = 0; i < n * 2; i++) {
+                x = bus[ch][i];
+                out[ch * stride + i] += (x < -1.00004566f) ? -32768
+                                        : (x > 1.00001514f) ? 32767
+                                        : (int32_t)(short)(x * 32767.5f);
+            }
+        }
+        out += n * 2;
+        frames -= n;
+    }
+}
+
+void _WM_SF2_Render(void *synth, int32_t *out, uint32_t stride, uint32_t frames) {
     tsf *f = (tsf *)synth;
     short buf[256 * 2];
     uint32_t n, i;
 
+    if (stride) {
+        sf2_render_stems(f, out, stride, frames);
+        return;
+    }
     while (frames) {
         n = (frames > 256) ? 256 : frames;
         tsf_render_short(f, buf, (int)n, 0);
@@ -34,6 +34,7 @@
 #include "patches.h"
 #include "sample.h"
 #include "internal_midi.h"
+#include "lock.h"
 #include "opl3.h"
 #include "synth.h"
 #include "synth_bank.h"
@@ -83,23 +84,24 @@ typedef struct { int32_t sustain; float attack, decay, release; } mix_env;
 #define OP2_RECSIZE   36
 #define OP2_HDRSIZE   8
 
-static uint8_t op2_bank[OP2_RECORDS * OP2_RECSIZE];
-static int op2_active = 0;
-
 int _WM_OP2_Magic(const uint8_t *data, uint32_t size) {
     return (size >= OP2_HDRSIZE + OP2_RECORDS * OP2_RECSIZE
             && !memcmp(data, "#OPL_II#", 8));
 }
 
-int _WM_OP2_Load(const uint8_t *data, uint32_t size) {
+int _WM_OP2_Load(struct _WM_Context *ctx, const uint8_t *data, uint32_t size) {
     if (!_WM_OP2_Magic(data, size)) return -1;
-    memcpy(op2_bank, data + OP2_HDRSIZE, sizeof(op2_bank));
-    op2_active = 1;
+    if (!ctx->op2_bank) {
+        ctx->op2_bank = (uint8_t *)malloc(OP2_RECORDS * OP2_RECSIZE);
+        if (!ctx->op2_bank) return -1;
+    }
+    memcpy(ctx->op2_bank, data + OP2_HDRSIZE, OP2_RECORDS * OP2_RECSIZE);
     return 0;
 }
 
-void _WM_OP2_Unload(void) {
-    op2_active = 0;
+void _WM_OP2_Unload(struct _WM_Context *ctx) {
+    free(ctx->op2_bank);
+    ctx->op2_bank = NULL;
 }
 
 #define OP2_FLAG_FIXED   0x01
@@ -185,8 +187,9 @@ static void opl_key_on(opl3_chip *c, uint8_t ch, uint16_t fnum, uint8_t block) {
 
 /* Reset the chip and start v1 (and v2 for GENMIDI double-voice instruments)
    on channels 0 and 1; the chip mixes the layers itself. */
-static void opl_boot(opl3_chip *c, const fm_voice *v1, const fm_voice *v2) {
-    OPL3_Reset(c, _WM_SampleRate);
+static void opl_boot(opl3_chip *c, uint16_t rate,
+                     const fm_voice *v1, const fm_voice *v2) {
+    OPL3_Reset(c, rate);
     OPL3_WriteReg(c, 0x105, 0x01);            /* OPL3 "NEW" mode */
     /* NTS=1 (keyboard split point), as DMX programs it: KSR envelope rate
        scaling then matches what GENMIDI banks were tuned against. */
@@ -240,20 +243,20 @@ static double opl_hz(uint16_t fnum, uint8_t block) {
 /* Sample construction                                                */
 /* ------------------------------------------------------------------ */
 
-static int32_t env_rate_for_seconds(float seconds) {
+static int32_t env_rate_for_seconds(uint16_t rate, float seconds) {
     if (seconds <= 0.0f) seconds = 0.001f;
-    return (int32_t)(4194303.0f / ((float)_WM_SampleRate * seconds));
+    return (int32_t)(4194303.0f / ((float)rate * seconds));
 }
 
 static void set_envelope(struct _sample *s, const mix_env *e) {
     const int32_t peak = 4194303;
-    s->env_target[0] = peak;       s->env_rate[0] = env_rate_for_seconds(e->attack);
-    s->env_target[1] = e->sustain; s->env_rate[1] = env_rate_for_seconds(e->decay);
-    s->env_target[2] = e->sustain; s->env_rate[2] = env_rate_for_seconds(0.5f);
-    s->env_target[3] = e->sustain; s->env_rate[3] = env_rate_for_seconds(4.0f);
-    s->env_target[4] = 0;          s->env_rate[4] = env_rate_for_seconds(e->release);
-    s->env_target[5] = 0;          s->env_rate[5] = env_rate_for_seconds(e->release);
-    s->env_target[6] = 0;          s->env_rate[6] = env_rate_for_seconds(0.010f);
+    s->env_target[0] = peak;       s->env_rate[0] = env_rate_for_seconds(s->rate, e->attack);
+    s->env_target[1] = e->sustain; s->env_rate[1] = env_rate_for_seconds(s->rate, e->decay);
+    s->env_target[2] = e->sustain; s->env_rate[2] = env_rate_for_seconds(s->rate, 0.5f);
+    s->env_target[3] = e->sustain; s->env_rate[3] = env_rate_for_seconds(s->rate, 4.0f);
+    s->env_target[4] = 0;          s->env_rate[4] = env_rate_for_seconds(s->rate, e->release);
+    s->env_target[5] = 0;          s->env_rate[5] = env_rate_for_seconds(s->rate, e->release);
+    s->env_target[6] = 0;          s->env_rate[6] = env_rate_for_seconds(s->rate, 0.010f);
 }
 
 static struct _sample *alloc_sample(uint32_t n) {
@@ -303,7 +306,8 @@ static void normalise_to(int16_t *d, uint32_t n, int32_t target, uint32_t tail_f
    time); the sampled-OPL soundfonts we match against start loud. Keeps a
    few ms of ramp before the first sample above peak/8. Returns the new
    length; the two interpolation guard samples move along with the data. */
-static uint32_t trim_onset(int16_t *d, uint32_t n, uint32_t total) {
+static uint32_t trim_onset(int16_t *d, uint32_t n, uint32_t total,
+                           uint16_t rate) {
     int32_t peak = 0, thresh;
     uint32_t i, onset = 0, back;
     for (i = 0; i < n; i++) {
@@ -316,7 +320,7 @@ static uint32_t trim_onset(int16_t *d, uint32_t n, uint32_t total) {
         int32_t a = d[i] < 0 ? -d[i] : d[i];
         if (a >= thresh) { onset = i; break; }
     }
-    back = _WM_SampleRate / 333;   /* ~3 ms of natural ramp */
+    back = rate / 333;   /* ~3 ms of natural ramp */
     onset = (onset > back) ? onset - back : 0;
     if (onset) {
         memmove(d, d + onset, ((size_t)total + 2 - onset) * sizeof(int16_t));
@@ -324,8 +328,9 @@ static uint32_t trim_onset(int16_t *d, uint32_t n, uint32_t total) {
     return n - onset;
 }
 
-static void configure(struct _sample *s, uint32_t n, double root_hz, int looped) {
-    s->rate = _WM_SampleRate;
+static void configure(struct _sample *s, uint16_t rate, uint32_t n,
+                      double root_hz, int looped) {
+    s->rate = rate;
     /* freq_root/freq_low/freq_high are Hz * 1000 (gus_pat convention). */
     s->freq_root = (uint32_t)(root_hz * 1000.0);
     s->freq_low  = 0;
@@ -345,19 +350,20 @@ static void configure(struct _sample *s, uint32_t n, double root_hz, int looped)
     s->loop_start  = 0;
     s->loop_end    = n << 10;
     s->loop_size   = s->loop_end - s->loop_start;
-    s->note_off_decay = _WM_SampleRate;
+    s->note_off_decay = rate;
     s->next = NULL;
 }
 
 static double measure_pitch_ratio(const int16_t *d, uint32_t start,
-                                  uint32_t end, double expected_hz);
+                                  uint32_t end, double expected_hz,
+                                  uint16_t rate);
 
 /* Render one looped, sustained tonal sample. `claimed_hz` is the pitch
    reported to the mixer; it differs from the rendered pitch when a GENMIDI
    voice carries a note offset. `chip` is caller-provided scratch: at ~20 KB+
    an opl3_chip is too big for the stack on the small-stack targets (DJGPP,
    OS/2, Amiga) this library still supports. */
-static struct _sample *render_tonal(opl3_chip *chip,
+static struct _sample *render_tonal(opl3_chip *chip, uint16_t rate,
                                     const fm_voice *v1, const fm_voice *v2,
                                     const mix_env *env, double claimed_hz,
                                     double *ratio_out) {
@@ -390,22 +396,22 @@ static struct _sample *render_tonal(opl3_chip *chip,
            decays deeply: the sampled-OPL soundfonts this mode is matched
            against loop near peak level the same way. */
         hold = (uint32_t)((atk + 0.25 + 1.5 * loop_target)
-                          * (double)_WM_SampleRate);
+                          * (double)rate);
     }
-    hold_min = _WM_SampleRate * 3u / 10u;        /* >= 300 ms into sustain */
+    hold_min = rate * 3u / 10u;        /* >= 300 ms into sustain */
     if (hold < hold_min) hold = hold_min;
 
     s = alloc_sample(hold + SYNTH_END_PAD);
     if (!s) return NULL;
 
-    opl_boot(chip, v1, v2);
+    opl_boot(chip, rate, v1, v2);
     /* Render hold + pad + guards as genuine continuation so interpolator
        reads (including the mixer's pre-wrap overshoot) land on real data. */
     opl_render(chip, s->data, hold + SYNTH_END_PAD + 2);
     normalise_to(s->data, hold + SYNTH_END_PAD + 2, SYNTH_NORM_TARGET, 0);
-    hold = trim_onset(s->data, hold, hold + SYNTH_END_PAD);
+    hold = trim_onset(s->data, hold, hold + SYNTH_END_PAD, rate);
 
-    configure(s, hold, claimed_hz, 1);
+    configure(s, rate, hold, claimed_hz, 1);
 
     /* The voice may sound at a rational multiple of the channel frequency
        (carrier MULT, FM sidebands): measure the true fundamental on the
@@ -413,7 +419,7 @@ static struct _sample *render_tonal(opl3_chip *chip,
        is 2x lands the seam 180 degrees out of phase — a pop per wrap. */
     {
         uint32_t st = (hold > 12000) ? hold - 9000 : hold / 3;
-        corr = measure_pitch_ratio(s->data, st, hold, root_hz);
+        corr = measure_pitch_ratio(s->data, st, hold, root_hz, rate);
     }
     if (ratio_out) *ratio_out = corr;
 
@@ -421,8 +427,8 @@ static struct _sample *render_tonal(opl3_chip *chip,
        <<10 fixed point, so the fractional part of the period is preserved)
        taken from the end of the hold region, past the OPL attack/decay. The
        count is chosen to span ~loop_target seconds so any LFO cycle fits. */
-    period = (double)_WM_SampleRate / (root_hz * corr);
-    loop_len_ref = (uint32_t)(loop_target * (double)_WM_SampleRate / period + 0.5);
+    period = (double)rate / (root_hz * corr);
+    loop_len_ref = (uint32_t)(loop_target * (double)rate / period + 0.5);
     if (loop_len_ref == 0) loop_len_ref = 1;
     loop_len_fp = (uint32_t)(period * (double)loop_len_ref * 1024.0);
     if (loop_len_fp >= (hold << 10)) loop_len_fp = (hold << 10) / 2;
@@ -436,7 +442,7 @@ static struct _sample *render_tonal(opl3_chip *chip,
 
 /* Render a one-shot voice: key held for the whole buffer, the OPL envelope
    (EGT clear) decays naturally, tail faded to kill any residue. */
-static struct _sample *render_oneshot(opl3_chip *chip,
+static struct _sample *render_oneshot(opl3_chip *chip, uint16_t rate,
                                       const fm_voice *v1, const fm_voice *v2,
                                       uint32_t n, double claimed_hz,
                                       float release, double *ratio_out) {
@@ -445,7 +451,7 @@ static struct _sample *render_oneshot(opl3_chip *chip,
 
     if (!s) return NULL;
 
-    opl_boot(chip, v1, v2);
+    opl_boot(chip, rate, v1, v2);
     opl_render(chip, s->data, n + SYNTH_END_PAD + 2);
     /* Fade covers the end pad too, so the mixer's pre-cutoff overshoot
        reads faded real data instead of a step. */
@@ -453,10 +459,10 @@ static struct _sample *render_oneshot(opl3_chip *chip,
 
     if (ratio_out) {
         *ratio_out = measure_pitch_ratio(s->data, n / 6, n / 2,
-                                         opl_hz(v1->fnum, v1->block));
+                                         opl_hz(v1->fnum, v1->block), rate);
     }
 
-    configure(s, n, claimed_hz, 0);
+    configure(s, rate, n, claimed_hz, 0);
     /* Hold the mixer envelope at peak so the sample's own baked-in decay is
        what the listener hears; note-off gets the voice's own release time. */
     e.sustain = 4194303;
@@ -486,7 +492,8 @@ static float voice_release(const fm_patch *fm, const fm_patch *fm2) {
 /* One-shot length for a decaying bank instrument: attack window plus the
    slower of the carrier's decay and release rates; for doubled records the
    longer-lived layer sets the length. */
-static uint32_t voice_oneshot_len(const fm_patch *fm, const fm_patch *fm2) {
+static uint32_t voice_oneshot_len(const fm_patch *fm, const fm_patch *fm2,
+                                  uint16_t rate) {
     uint8_t d = fm->car_ad & 0x0F;
     uint8_t r = fm->car_sr & 0x0F;
     float t = opl_rate_seconds(d < r ? d : r);
@@ -505,7 +512,7 @@ static uint32_t voice_oneshot_len(const fm_patch *fm, const fm_patch *fm2) {
         if (a2 > t2) t2 = a2;
     }
     t += t2 + 0.1f;
-    return (uint32_t)(t * (float)_WM_SampleRate);
+    return (uint32_t)(t * (float)rate);
 }
 
 /* Does this voice's OPL envelope genuinely reach silence quickly? (No held
@@ -526,8 +533,9 @@ static int voice_decays_out(const fm_patch *fm) {
    of the expected pitch to shed measurement noise. Returns the ratio
    sounding_hz / expected_hz. */
 static double measure_pitch_ratio(const int16_t *d, uint32_t start,
-                                  uint32_t end, double expected_hz) {
-    double period = (double)_WM_SampleRate / expected_hz;
+                                  uint32_t end, double expected_hz,
+                                  uint16_t rate) {
+    double period = (double)rate / expected_hz;
     uint32_t min_lag = (uint32_t)(period * 0.45);
     uint32_t max_lag = (uint32_t)(period * 2.2);
     uint32_t span, lag, i, best_lag = 0;
@@ -583,7 +591,8 @@ static double op2_fine_ratio(uint8_t fine) {
     return 1.0 + ((int)fine - 128) * 0.000903;
 }
 
-struct _sample *_WM_synth_patch(uint16_t patchid) {
+struct _sample *_WM_synth_patch(struct _WM_Context *ctx, uint16_t patchid) {
+    const uint16_t rate = ctx->sample_rate;
     /* Chip state is ~20 KB+: heap scratch, one per patch, shared by all
        renders below — never on the stack (DJGPP/OS2/Amiga budgets). */
     opl3_chip *chip = (opl3_chip *)malloc(sizeof(opl3_chip));
@@ -599,7 +608,7 @@ struct _sample *_WM_synth_patch(uint16_t patchid) {
 
         if (key >= 35 && key <= 81) {
             /* GENMIDI percussion record: fixed note + voice note offsets. */
-            const uint8_t *rec = op2_bank + (128 + (key - 35)) * OP2_RECSIZE;
+            const uint8_t *rec = ctx->op2_bank + (128 + (key - 35)) * OP2_RECSIZE;
             uint16_t flags = (uint16_t)(rec[0] | (rec[1] << 8));
             double fixed_hz = note_hz(rec[3] & 0x7F);
             fm_patch fm1, fm2;
@@ -622,8 +631,8 @@ struct _sample *_WM_synth_patch(uint16_t patchid) {
             }
             {
                 const fm_patch *fmB = (flags & OP2_FLAG_DOUBLE) ? &fm2 : NULL;
-                s = render_oneshot(chip, &v1, fmB ? &v2 : NULL,
-                                   voice_oneshot_len(&fm1, fmB), key_hz,
+                s = render_oneshot(chip, rate, &v1, fmB ? &v2 : NULL,
+                                   voice_oneshot_len(&fm1, fmB, rate), key_hz,
                                    voice_release(&fm1, fmB), NULL);
             }
         } else {
@@ -650,7 +659,7 @@ struct _sample *_WM_synth_patch(uint16_t patchid) {
         double roots[3], ratio, pitch_corr = 1.0;
         int i;
 
-        rec = op2_bank + program * OP2_RECSIZE;
+        rec = ctx->op2_bank + program * OP2_RECSIZE;
         flags = (uint16_t)(rec[0] | (rec[1] << 8));
         op2_voice(rec + 4, &fm1, &off1);
         if (flags & OP2_FLAG_DOUBLE) {
@@ -722,12 +731,13 @@ struct _sample *_WM_synth_patch(uint16_t patchid) {
                back sounding/expected; render_tonal also sizes its loop in
                true periods with it. */
             s = oneshot
-                ? render_oneshot(chip, &v1, doubled ? &v2 : NULL,
-                                 voice_oneshot_len(&fm1, doubled ? &fm2 : NULL),
+                ? render_oneshot(chip, rate, &v1, doubled ? &v2 : NULL,
+                                 voice_oneshot_len(&fm1, doubled ? &fm2 : NULL,
+                                                   rate),
                                  claimed,
                                  voice_release(&fm1, doubled ? &fm2 : NULL),
                                  &pitch_corr)
-                : render_tonal(chip, &v1, doubled ? &v2 : NULL, env, claimed,
+                : render_tonal(chip, rate, &v1, doubled ? &v2 : NULL, env, claimed,
                                &pitch_corr);
             if (!s) {
                 free(chip);
@@ -772,42 +782,70 @@ static struct _patch *alloc_patch(uint16_t patchid, uint8_t keep) {
     return p;
 }
 
-static void free_all_patches(void) {
+static void free_all_patches(struct _WM_Context *ctx) {
     uint16_t id;
     for (id = 0; id < 128; id++) {
-        struct _patch *p = _WM_patch[id];
+        struct _patch *p = ctx->patch[id];
         while (p) {
             struct _patch *next = p->next;
             free(p);
             p = next;
         }
-        _WM_patch[id] = NULL;
+        ctx->patch[id] = NULL;
     }
 }
 
-int _WM_opl3_init_patches(void) {
+#if OPL_WF_TABLE_RUNTIME || OPL_ENABLE_STEREOEXT
+/* The chip builds tables at the first reset in the process, which must not
+   race another. Have that done here, once, rather than by whichever loader
+   thread gets to a synth patch first. */
+static int opl_prime_lock = 0;
+static uint32_t opl_primed = 0;
+
+static int opl_prime(void) {
+    opl3_chip *chip;
+
+    if (_WM_AtomicLoad(&opl_primed)) return 0;
+    _WM_Lock(&opl_prime_lock);
+    if (!opl_primed) {
+        chip = (opl3_chip *)malloc(sizeof(opl3_chip));
+        if (!chip) { _WM_Unlock(&opl_prime_lock); return -1; }
+        OPL3_Reset(chip, 44100);
+        free(chip);
+        _WM_AtomicStore(&opl_primed, 1);
+    }
+    _WM_Unlock(&opl_prime_lock);
+    return 0;
+}
+#endif
+
+int _WM_opl3_init_patches(struct _WM_Context *ctx) {
     uint16_t id;
 
+#if OPL_WF_TABLE_RUNTIME || OPL_ENABLE_STEREOEXT
+    if (opl_prime() < 0) return -1;
+#endif
     /* No external .op2 bank loaded: install the embedded DMXOPL bank
        (MIT, see include/synth_bank.h) so --opl3 needs no data files. */
-    if (!op2_active) {
-        memcpy(op2_bank, synth_builtin_bank, sizeof(op2_bank));
-        op2_active = 1;
+    if (!ctx->op2_bank) {
+        ctx->op2_bank = (uint8_t *)malloc(OP2_RECORDS * OP2_RECSIZE);
+        if (!ctx->op2_bank) return -1;
+        memcpy(ctx->op2_bank, synth_builtin_bank, OP2_RECORDS * OP2_RECSIZE);
     }
 
     for (id = 0; id < 128; id++) {
         struct _patch *p = alloc_patch(id, 0);
-        if (!p) { free_all_patches(); return -1; }
-        _WM_patch[id] = p;
+        if (!p) { free_all_patches(ctx); return -1; }
+        ctx->patch[id] = p;
     }
-    /* Drum kit chains onto _WM_patch[note & 0x7F] because _find_matched_patch
+    /* Drum kit chains onto ctx->patch[note & 0x7F] because _find_matched_patch
        keys off patchid&0x7F. keep=SAMPLE_ENVELOPE prevents _WM_load_sample
        from stripping envelope mode on drums (see sample.c). */
     for (id = 35; id <= 81; id++) {   /* GENMIDI percussion key range */
         uint16_t drumid = 0x80u | id;
         struct _patch *p = alloc_patch(drumid, SAMPLE_ENVELOPE);
-        struct _patch *head = _WM_patch[id];
-        if (!p) { free_all_patches(); return -1; }
+        struct _patch *head = ctx->patch[id];
+        if (!p) { free_all_patches(ctx); return -1; }
         while (head->next) head = head->next;
         head->next = p;
     }
@@ -28,6 +28,7 @@
 
 #include <stdint.h>
 #include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -38,6 +39,7 @@
 #include "file_io.h"
 #include "lock.h"
 #include "reverb.h"
+#include "mix_kernels.h"
 #include "gus_pat.h"
 #include "common.h"
 #include "wildmidi_lib.h"
@@ -50,6 +52,7 @@
 #include "f_xmidi.h"
 #include "f_smaf.h"
 #include "patches.h"
+#include "cache.h"
 #include "sample.h"
 #include "synth.h"
 #include "mus2mid.h"
@@ -70,11 +73,19 @@
  * =========================
  */
 
+/* the context the legacy API (WildMidi_Init() and friends) runs on */
+static struct _WM_Context WM_Default;
 static int WM_Initialized = 0;
-uint16_t _WM_MixerOptions = 0;
 
-uint16_t _WM_SampleRate;
-int16_t _WM_MasterVolume;
+/* the contexts alive, the default one included: the tables they share are
+   set up with the first and freed with the last */
+static int WM_Contexts = 0;
+static int WM_Contexts_lock = 0;
+
+/* WildMidi_RenderBatch()'s threads, 0 for one per processor. Batches
+   keep nothing else here, so any number can run at once. */
+static uint16_t WM_BatchThreads = 0;
+static int WM_Batch_lock = 0;
 
 /* when converting files to midi */
 typedef struct _cvt_options {
@@ -86,16 +97,6 @@ typedef struct _cvt_options {
 static _cvt_options WM_ConvertOptions = {0, 0, 0};
 
 
-float _WM_reverb_room_width = 16.875f;
-float _WM_reverb_room_length = 22.5f;
-
-float _WM_reverb_listen_posx = 8.4375f;
-float _WM_reverb_listen_posy = 16.875f;
-
-int _WM_fix_release = 0;
-int _WM_auto_amp = 0;
-int _WM_auto_amp_with_amp = 0;
-
 struct _miditrack {
     uint32_t length;
     uint32_t ptr;
@@ -126,6 +127,7 @@ static double newt_coeffs[58][58];  /* for start/end of samples */
 static double *gauss_table = NULL;  /* *gauss_table[1<<FPBITS] */
 static int gauss_n = MAX_GAUSS_ORDER;
 static int gauss_lock;
+static uint32_t gauss_ready;        /* gauss_table is built, read atomically */
 
 static void init_gauss(void) {
     /* init gauss table */
@@ -168,6 +170,10 @@ static void init_gauss(void) {
             newt_coeffs[i][j] *= sign;
 
     t = (double *) malloc((1<<FPBITS) * (n + 1) * sizeof(double));
+    if (t == NULL) {
+        _WM_Unlock(&gauss_lock);
+        return;
+    }
     x_inc = 1.0 / (1<<FPBITS);
     for (m = 0, x = 0.0; m < (1<<FPBITS); m++, x += x_inc) {
         xz = (x + n_half) / (4 * M_PI);
@@ -187,24 +193,125 @@ static void init_gauss(void) {
     }
 
     gauss_table = t;
+    _WM_AtomicStore(&gauss_ready, 1);
     _WM_Unlock(&gauss_lock);
 }
 
 static void free_gauss(void) {
     _WM_Lock(&gauss_lock);
+    _WM_AtomicStore(&gauss_ready, 0);
     free(gauss_table);
     gauss_table = NULL;
     _WM_Unlock(&gauss_lock);
 }
 
+/*
+ * Windowed sinc interpolation (WM_MO_SINC_n): a Kaiser windowed sinc of
+ * 4, 8, 16 or 32 taps, tabled for each of the 1<<FPBITS sub-sample phases
+ * as Q14 int16 coefficients so the MAC runs in 16 bit integer SIMD. Each
+ * phase is normalised to unity gain. Tables are built on first use, 2 bytes
+ * per tap per phase (8 to 64 KB).
+ */
+#define SINC_SIZES 4                    /* 4, 8, 16 and 32 taps */
+#define SINC_MAX_TAPS 32
+static int16_t *sinc_table[SINC_SIZES] = { NULL, NULL, NULL, NULL };
+static int sinc_lock;
+static uint32_t sinc_ready[SINC_SIZES]; /* as gauss_ready */
+
+/* the shorter filters trade a lower cutoff for less ringing */
+static const struct {
+    double cutoff;      /* of the source sample's nyquist */
+    double beta;        /* Kaiser window shape */
+} sinc_design[SINC_SIZES] = {
+    { 0.85, 3.0 }, { 0.90, 5.0 }, { 0.94, 7.0 }, { 0.97, 9.0 }
+};
+
+/* modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    int k;
+
+    for (k = 1; k < 64; k++) {
+        term *= q / ((double)k * (double)k);
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return (sum);
+}
+
+static void init_sinc(int size) {
+    int taps = 4 << size;
+    int half = taps >> 1;
+    double cutoff = sinc_design[size].cutoff;
+    double beta = sinc_design[size].beta;
+    double c[SINC_MAX_TAPS];
+    double x, r, sum;
+    int16_t *t, *cptr;
+    int phase, k, peak;
+    int32_t total;
+
+    _WM_Lock(&sinc_lock);
+    if (sinc_table[size]) {
+        _WM_Unlock(&sinc_lock);
+        return;
+    }
+
+    t = (int16_t *) malloc((1 << FPBITS) * taps * sizeof(int16_t));
+    if (t == NULL) {
+        _WM_Unlock(&sinc_lock);
+        return;
+    }
+    for (phase = 0; phase < (1 << FPBITS); phase++) {
+        cptr = &t[phase * taps];
+        sum = 0.0;
+        peak = 0;
+        /* tap k sits under sample (sample_pos >> FPBITS) - half + 1 + k */
+        for (k = 0; k < taps; k++) {
+            x = (double)(k - half + 1) - (double)phase / (1 << FPBITS);
+            r = x / half;
+            if (r * r >= 1.0) {
+                c[k] = 0.0;
+                continue;
+            }
+            c[k] = (x == 0.0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            c[k] *= bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+            sum += c[k];
+            if (c[k] > c[peak])
+                peak = k;
+        }
+        total = 0;
+        for (k = 0; k < taps; k++) {
+            cptr[k] = (int16_t) floor(c[k] / sum * 16384.0 + 0.5);
+            total += cptr[k];
+        }
+        /* put the rounding error on the centre tap: exact unity gain */
+        cptr[peak] += (int16_t)(16384 - total);
+    }
+
+    sinc_table[size] = t;
+    _WM_AtomicStore(&sinc_ready[size], 1);
+    _WM_Unlock(&sinc_lock);
+}
+
+static void free_sinc(void) {
+    int i;
+
+    _WM_Lock(&sinc_lock);
+    for (i = 0; i < SINC_SIZES; i++) {
+        _WM_AtomicStore(&sinc_ready[i], 0);
+        free(sinc_table[i]);
+        sinc_table[i] = NULL;
+    }
+    _WM_Unlock(&sinc_lock);
+}
+
 struct _hndl {
     void * handle;
     struct _hndl *next;
     struct _hndl *prev;
 };
 
-static struct _hndl * first_handle = NULL;
-
 #define MAX_AUTO_AMP 2.0
 
 /*
@@ -231,31 +338,31 @@ uint16_t _cvt_get_option (uint16_t tag) {
     return r;
 }
 
-static void WM_InitPatches(void) {
+static void WM_InitPatches(struct _WM_Context *ctx) {
     int i;
     for (i = 0; i < 128; i++) {
-        _WM_patch[i] = NULL;
+        ctx->patch[i] = NULL;
     }
 }
 
-static void WM_FreePatches(void) {
+static void WM_FreePatches(struct _WM_Context *ctx) {
     int i;
     struct _patch * tmp_patch;
     struct _sample * tmp_sample;
 
     _WM_Lock(&_WM_patch_lock);
     for (i = 0; i < 128; i++) {
-        while (_WM_patch[i]) {
-            while (_WM_patch[i]->first_sample) {
-                tmp_sample = _WM_patch[i]->first_sample->next;
-                free(_WM_patch[i]->first_sample->data);
-                free(_WM_patch[i]->first_sample);
-                _WM_patch[i]->first_sample = tmp_sample;
+        while (ctx->patch[i]) {
+            while (ctx->patch[i]->first_sample) {
+                tmp_sample = ctx->patch[i]->first_sample->next;
+                free(ctx->patch[i]->first_sample->data);
+                free(ctx->patch[i]->first_sample);
+                ctx->patch[i]->first_sample = tmp_sample;
             }
-            free(_WM_patch[i]->filename);
-            tmp_patch = _WM_patch[i]->next;
-            free(_WM_patch[i]);
-            _WM_patch[i] = tmp_patch;
+            free(ctx->patch[i]->filename);
+            tmp_patch = ctx->patch[i]->next;
+            free(ctx->patch[i]);
+            ctx->patch[i] = tmp_patch;
         }
     }
     _WM_Unlock(&_WM_patch_lock);
@@ -420,7 +527,8 @@ char** WM_LC_Tokenize_Line(char *line_data) {
     return (token_data);
 }
 
-static int load_config(const char *config_file, const char *conf_dir) {
+static int load_config(struct _WM_Context *ctx, const char *config_file,
+                       const char *conf_dir) {
     uint32_t config_size = 0;
     char *config_buffer = NULL;
     const char *dir_end = NULL;
@@ -432,18 +540,19 @@ static int load_config(const char *config_file, const char *conf_dir) {
     struct _patch * tmp_patch;
     char **line_tokens = NULL;
     int token_count = 0;
+    unsigned int errors;
 
-    config_buffer = (char *) _WM_BufferFile(config_file, &config_size);
+    config_buffer = (char *) ctx->buffer_file(config_file, &config_size);
     if (!config_buffer) {
-        WM_FreePatches();
+        WM_FreePatches(ctx);
         return (-1);
     }
 
     if (conf_dir) {
         if ((config_dir = wm_strdup(conf_dir)) == NULL) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-            WM_FreePatches();
-            _WM_FreeBufferFile(config_buffer);
+            WM_FreePatches(ctx);
+            ctx->free_buffer_file(config_buffer);
             return (-1);
         }
     } else {
@@ -452,7 +561,7 @@ static int load_config(const char *config_file, const char *conf_dir) {
             config_dir = (char *) malloc((dir_end - config_file + 2));
             if (config_dir == NULL) {
                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                WM_FreePatches();
+                WM_FreePatches(ctx);
                 free(config_buffer);
                 return (-1);
             }
@@ -465,7 +574,7 @@ static int load_config(const char *config_file, const char *conf_dir) {
     line_start_ptr = 0;
 
     /* handle files without a newline at the end: this relies on
-     * _WM_BufferFile() allocating the buffer with one extra byte */
+     * ctx->buffer_file() allocating the buffer with one extra byte */
     config_buffer[config_size] = '\n';
 
     while (config_ptr <= config_size) {
@@ -475,22 +584,23 @@ static int load_config(const char *config_file, const char *conf_dir) {
             config_buffer[config_ptr] = '\0';
 
             if (config_ptr != line_start_ptr) {
-                _WM_Global_ErrorI = 0; /* because WM_LC_Tokenize_Line() can legitimately return NULL */
+                /* because WM_LC_Tokenize_Line() can legitimately return NULL */
+                errors = _WM_ThreadError()->count;
                 line_tokens = WM_LC_Tokenize_Line(&config_buffer[line_start_ptr]);
                 if (line_tokens) {
                     if (wm_strcasecmp(line_tokens[0], "dir") == 0) {
                         free(config_dir);
                         if (!line_tokens[1]) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(missing name in dir line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         } else if ((config_dir = wm_strdup(line_tokens[1])) == NULL) {
                             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
                         if (!IS_DIR_SEPARATOR(config_dir[strlen(config_dir) - 1])) {
@@ -501,18 +611,18 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         char *new_config = NULL;
                         if (!line_tokens[1]) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(missing name in source line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         } else if (!IS_ABSOLUTE_PATH(line_tokens[1]) && config_dir) {
                             new_config = (char *) malloc(strlen(config_dir) + strlen(line_tokens[1]) + 1);
                             if (new_config == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(config_dir);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
                             strcpy(new_config, config_dir);
@@ -520,16 +630,16 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         } else {
                             if ((new_config = wm_strdup(line_tokens[1])) == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
                         }
-                        if (load_config(new_config, config_dir) == -1) {
+                        if (load_config(ctx, new_config, config_dir) == -1) {
                             free(new_config);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             free(config_dir);
                             return (-1);
                         }
@@ -541,19 +651,19 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         uint32_t sf2_size = 0;
                         if (!line_tokens[1]) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(missing name in soundfont line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         } else if (!IS_ABSOLUTE_PATH(line_tokens[1]) && config_dir) {
                             sf2_path = (char *) malloc(strlen(config_dir) + strlen(line_tokens[1]) + 1);
                             if (sf2_path == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(config_dir);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
                             strcpy(sf2_path, config_dir);
@@ -561,25 +671,25 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         } else {
                             if ((sf2_path = wm_strdup(line_tokens[1])) == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(config_dir);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
                         }
-                        sf2_buffer = (uint8_t *) _WM_BufferFile(sf2_path, &sf2_size);
-                        if ((sf2_buffer == NULL) || (_WM_SF2_Load(sf2_buffer, sf2_size) < 0)) {
+                        sf2_buffer = (uint8_t *) ctx->buffer_file(sf2_path, &sf2_size);
+                        if ((sf2_buffer == NULL) || (_WM_SF2_Load(ctx, sf2_buffer, sf2_size) < 0)) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(unable to load soundfont)", 0);
-                            _WM_FreeBufferFile(sf2_buffer);
+                            ctx->free_buffer_file(sf2_buffer);
                             free(sf2_path);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
-                        _WM_FreeBufferFile(sf2_buffer);
+                        ctx->free_buffer_file(sf2_buffer);
                         free(sf2_path);
 #else
                         _WM_DEBUG_MSG("%s: soundfont support not compiled in, ignoring %s",
@@ -588,109 +698,125 @@ static int load_config(const char *config_file, const char *conf_dir) {
                     } else if (wm_strcasecmp(line_tokens[0], "bank") == 0) {
                         if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in bank line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
                         patchid = (atoi(line_tokens[1]) & 0xFF) << 8;
                     } else if (wm_strcasecmp(line_tokens[0], "drumset") == 0) {
                         if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in drumset line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
                         patchid = ((atoi(line_tokens[1]) & 0xFF) << 8) | 0x80;
                     } else if (wm_strcasecmp(line_tokens[0], "reverb_room_width") == 0) {
                         if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in reverb_room_width line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
-                        _WM_reverb_room_width = (float) atof(line_tokens[1]);
-                        if (_WM_reverb_room_width < 1.0f) {
+                        ctx->reverb_room_width = (float) atof(line_tokens[1]);
+                        if (ctx->reverb_room_width < 1.0f) {
                             _WM_DEBUG_MSG("%s: reverb_room_width < 1m, setting to 1m", config_file);
-                            _WM_reverb_room_width = 1.0f;
-                        } else if (_WM_reverb_room_width > 100.0f) {
+                            ctx->reverb_room_width = 1.0f;
+                        } else if (ctx->reverb_room_width > 100.0f) {
                             _WM_DEBUG_MSG("%s: reverb_room_width > 100m, setting to 100m", config_file);
-                            _WM_reverb_room_width = 100.0f;
+                            ctx->reverb_room_width = 100.0f;
                         }
                     } else if (wm_strcasecmp(line_tokens[0], "reverb_room_length") == 0) {
                         if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in reverb_room_length line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
-                        _WM_reverb_room_length = (float) atof(line_tokens[1]);
-                        if (_WM_reverb_room_length < 1.0f) {
+                        ctx->reverb_room_length = (float) atof(line_tokens[1]);
+                        if (ctx->reverb_room_length < 1.0f) {
                             _WM_DEBUG_MSG("%s: reverb_room_length < 1m, setting to 1m", config_file);
-                            _WM_reverb_room_length = 1.0f;
-                        } else if (_WM_reverb_room_length > 100.0f) {
+                            ctx->reverb_room_length = 1.0f;
+                        } else if (ctx->reverb_room_length > 100.0f) {
                             _WM_DEBUG_MSG("%s: reverb_room_length > 100m, setting to 100m", config_file);
-                            _WM_reverb_room_length = 100.0f;
+                            ctx->reverb_room_length = 100.0f;
                         }
                     } else if (wm_strcasecmp(line_tokens[0], "reverb_listener_posx") == 0) {
                         if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in reverb_listen_posx line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
-                        _WM_reverb_listen_posx = (float) atof(line_tokens[1]);
-                        if ((_WM_reverb_listen_posx > _WM_reverb_room_width)
-                                || (_WM_reverb_listen_posx < 0.0f)) {
+                        ctx->reverb_listen_posx = (float) atof(line_tokens[1]);
+                        if ((ctx->reverb_listen_posx > ctx->reverb_room_width)
+                                || (ctx->reverb_listen_posx < 0.0f)) {
                             _WM_DEBUG_MSG("%s: reverb_listen_posx set outside of room", config_file);
-                            _WM_reverb_listen_posx = _WM_reverb_room_width / 2.0f;
+                            ctx->reverb_listen_posx = ctx->reverb_room_width / 2.0f;
                         }
                     } else if (wm_strcasecmp(line_tokens[0],
                             "reverb_listener_posy") == 0) {
                         if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in reverb_listen_posy line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         }
-                        _WM_reverb_listen_posy = (float) atof(line_tokens[1]);
-                        if ((_WM_reverb_listen_posy > _WM_reverb_room_length)
-                                || (_WM_reverb_listen_posy < 0.0f)) {
+                        ctx->reverb_listen_posy = (float) atof(line_tokens[1]);
+                        if ((ctx->reverb_listen_posy > ctx->reverb_room_length)
+                                || (ctx->reverb_listen_posy < 0.0f)) {
                             _WM_DEBUG_MSG("%s: reverb_listen_posy set outside of room", config_file);
-                            _WM_reverb_listen_posy = _WM_reverb_room_length * 0.75f;
+                            ctx->reverb_listen_posy = ctx->reverb_room_length * 0.75f;
+                        }
+                    } else if (wm_strcasecmp(line_tokens[0], "max_voices") == 0) {
+                        long max_voices;
+                        if (!line_tokens[1] || !wm_isdigit(line_tokens[1][0])) {
+                            _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(syntax error in max_voices line)", 0);
+                            WM_FreePatches(ctx);
+                            free(config_dir);
+                            free(line_tokens);
+                            ctx->free_buffer_file(config_buffer);
+                            return (-1);
                         }
+                        max_voices = atol(line_tokens[1]);
+                        if (max_voices > 65535) {
+                            _WM_DEBUG_MSG("%s: max_voices > 65535, setting to 65535", config_file);
+                            max_voices = 65535;
+                        }
+                        ctx->max_voices = (uint16_t) max_voices;
                     } else if (wm_strcasecmp(line_tokens[0], "guspat_editor_author_cant_read_so_fix_release_time_for_me") == 0) {
-                        _WM_fix_release = 1;
+                        ctx->fix_release = 1;
                     } else if (wm_strcasecmp(line_tokens[0], "auto_amp") == 0) {
-                        _WM_auto_amp = 1;
+                        ctx->auto_amp = 1;
                     } else if (wm_strcasecmp(line_tokens[0], "auto_amp_with_amp") == 0) {
-                        _WM_auto_amp = 1;
-                        _WM_auto_amp_with_amp = 1;
+                        ctx->auto_amp = 1;
+                        ctx->auto_amp_with_amp = 1;
                     } else if (wm_isdigit(line_tokens[0][0])) {
                         patchid = (patchid & 0xFF80)
                                 | (atoi(line_tokens[0]) & 0x7F);
-                        if (_WM_patch[(patchid & 0x7F)] == NULL) {
-                            _WM_patch[(patchid & 0x7F)] = (struct _patch *) malloc(sizeof(struct _patch));
-                            if (_WM_patch[(patchid & 0x7F)] == NULL) {
+                        if (ctx->patch[(patchid & 0x7F)] == NULL) {
+                            ctx->patch[(patchid & 0x7F)] = (struct _patch *) malloc(sizeof(struct _patch));
+                            if (ctx->patch[(patchid & 0x7F)] == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(config_dir);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
-                            tmp_patch = _WM_patch[(patchid & 0x7F)];
+                            tmp_patch = ctx->patch[(patchid & 0x7F)];
                             tmp_patch->patchid = patchid;
                             tmp_patch->filename = NULL;
                             tmp_patch->amp = 1024;
@@ -700,7 +826,7 @@ static int load_config(const char *config_file, const char *conf_dir) {
                             tmp_patch->loaded = 0;
                             tmp_patch->inuse_count = 0;
                         } else {
-                            tmp_patch = _WM_patch[(patchid & 0x7F)];
+                            tmp_patch = ctx->patch[(patchid & 0x7F)];
                             if (tmp_patch->patchid == patchid) {
                                 free(tmp_patch->filename);
                                 tmp_patch->filename = NULL;
@@ -716,10 +842,10 @@ static int load_config(const char *config_file, const char *conf_dir) {
                                     if (tmp_patch->next == NULL) {
                                         if ((tmp_patch->next = (struct _patch *) malloc(sizeof(struct _patch))) == NULL) {
                                             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-                                            WM_FreePatches();
+                                            WM_FreePatches(ctx);
                                             free(config_dir);
                                             free(line_tokens);
-                                            _WM_FreeBufferFile(config_buffer);
+                                            ctx->free_buffer_file(config_buffer);
                                             return (-1);
                                         }
                                         tmp_patch = tmp_patch->next;
@@ -742,10 +868,10 @@ static int load_config(const char *config_file, const char *conf_dir) {
                                     tmp_patch->next = (struct _patch *) malloc(sizeof(struct _patch));
                                     if (tmp_patch->next == NULL) {
                                         _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-                                        WM_FreePatches();
+                                        WM_FreePatches(ctx);
                                         free(config_dir);
                                         free(line_tokens);
-                                        _WM_FreeBufferFile(config_buffer);
+                                        ctx->free_buffer_file(config_buffer);
                                         return (-1);
                                     }
                                     tmp_patch = tmp_patch->next;
@@ -762,19 +888,19 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         }
                         if (!line_tokens[1]) {
                             _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(missing name in patch line)", 0);
-                            WM_FreePatches();
+                            WM_FreePatches(ctx);
                             free(config_dir);
                             free(line_tokens);
-                            _WM_FreeBufferFile(config_buffer);
+                            ctx->free_buffer_file(config_buffer);
                             return (-1);
                         } else if (!IS_ABSOLUTE_PATH(line_tokens[1]) && config_dir) {
                             tmp_patch->filename = (char *) malloc(strlen(config_dir) + strlen(line_tokens[1]) + 5);
                             if (tmp_patch->filename == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(config_dir);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
                             strcpy(tmp_patch->filename, config_dir);
@@ -782,10 +908,10 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         } else {
                             if ((tmp_patch->filename = wm_strdup(line_tokens[1])) == NULL) {
                                 _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-                                WM_FreePatches();
+                                WM_FreePatches(ctx);
                                 free(config_dir);
                                 free(line_tokens);
-                                _WM_FreeBufferFile(config_buffer);
+                                ctx->free_buffer_file(config_buffer);
                                 return (-1);
                             }
                         }
@@ -869,10 +995,10 @@ static int load_config(const char *config_file, const char *conf_dir) {
                         }
                     }
                 }
-                else if (_WM_Global_ErrorI) { /* malloc() failure in WM_LC_Tokenize_Line() */
-                    WM_FreePatches();
+                else if (_WM_ThreadError()->count != errors) { /* malloc() failure in WM_LC_Tokenize_Line() */
+                    WM_FreePatches(ctx);
                     free(line_tokens);
-                    _WM_FreeBufferFile(config_buffer);
+                    ctx->free_buffer_file(config_buffer);
                     return (-1);
                 }
                 /* free up tokens */
@@ -883,30 +1009,32 @@ static int load_config(const char *config_file, const char *conf_dir) {
         config_ptr++;
     }
 
-    _WM_FreeBufferFile(config_buffer);
+    ctx->free_buffer_file(config_buffer);
     free(config_dir);
 
     return (0);
 }
 
-static int WM_LoadConfig(const char *config_file) {
-    return load_config(config_file, NULL);
+static int WM_LoadConfig(struct _WM_Context *ctx, const char *config_file) {
+    return load_config(ctx, config_file, NULL);
 }
 
-static int add_handle(void * handle) {
+static int add_handle(struct _WM_Context *ctx, void * handle) {
     struct _hndl *tmp_handle = NULL;
 
-    if (first_handle == NULL) {
-        first_handle = (struct _hndl *) malloc(sizeof(struct _hndl));
-        if (first_handle == NULL) {
+    _WM_Lock(&ctx->lock);
+    if (ctx->handles == NULL) {
+        ctx->handles = (struct _hndl *) malloc(sizeof(struct _hndl));
+        if (ctx->handles == NULL) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            _WM_Unlock(&ctx->lock);
             return (-1);
         }
-        first_handle->handle = handle;
-        first_handle->prev = NULL;
-        first_handle->next = NULL;
+        ctx->handles->handle = handle;
+        ctx->handles->prev = NULL;
+        ctx->handles->next = NULL;
     } else {
-        tmp_handle = first_handle;
+        tmp_handle = ctx->handles;
         if (tmp_handle->next) {
             while (tmp_handle->next)
                 tmp_handle = tmp_handle->next;
@@ -914,6 +1042,7 @@ static int add_handle(void * handle) {
         tmp_handle->next = (struct _hndl *) malloc(sizeof(struct _hndl));
         if (tmp_handle->next == NULL) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            _WM_Unlock(&ctx->lock);
             return (-1);
         }
         tmp_handle->next->prev = tmp_handle;
@@ -921,6 +1050,7 @@ static int add_handle(void * handle) {
         tmp_handle->next = NULL;
         tmp_handle->handle = handle;
     }
+    _WM_Unlock(&ctx->lock);
     return (0);
 }
 
@@ -935,413 +1065,977 @@ static int add_handle(void * handle) {
 #define RESAMPLE_DEBUGS(dx)
 #endif
 
+/*
+ * =========================
+ * GUS voice mixing
+ * =========================
+ *
+ * The GUS mixers render voice-major: each note is mixed across the whole
+ * block before moving on to the next one, so its sample data and state stay
+ * in registers and cache instead of the whole note list being walked once
+ * per output sample.
+ *
+ * A note's block is cut into runs at the frames where its state machine has
+ * work to do (loop end, end of data, envelope target). Frames in between go
+ * through a straight-line interpolate-and-accumulate loop; the frames at the
+ * cut points go through gus_mix_note() exactly as the old per-sample mixer
+ * handled them. The mix buffer is plain int32 accumulation so the order the
+ * notes are summed in does not change the output.
+ */
 
-static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
-    uint32_t buffer_used = 0;
-    uint32_t i, env_ptr;
-    struct _mdi *mdi = (struct _mdi *) handle;
-    uint32_t real_samples_to_mix = 0;
-    uint32_t data_pos;
-    int32_t premix, left_mix, right_mix;
-/*  int32_t vol_mul; */
-    struct _note *note_data = NULL;
-    uint32_t count;
-    struct _event *event;
-    int32_t *tmp_buffer;
-    int32_t *out_buffer;
-    int end_encountered;
-
-    _WM_Lock(&mdi->lock);
-    event = mdi->current_event;
+#define GUS_INTERP_LINEAR 0
+#define GUS_INTERP_GAUSS  1
+#define GUS_INTERP_SINC4  2     /* up to GUS_INTERP_SINC4 + SINC_SIZES - 1 */
+#define GUS_SINC_TAPS(interp) (4 << ((interp) - GUS_INTERP_SINC4))
 
-    buffer_used = 0;
-    memset(buffer, 0, size);
+static inline double gauss_interp(const struct _sample *sample, uint32_t sample_pos) {
+    const int16_t *sptr;
+    const double *gptr;
+    double y, xd;
+    int left, right, temp_n;
+    int ii, jj;
 
-    if ( (size / 2) > mdi->mix_buffer_size) {
-        uint32_t new_size = ((size / 2) <= (mdi->mix_buffer_size * 2))
-            ? mdi->mix_buffer_size + MEM_CHUNK : size / 2;
-        int32_t *new_buf;
-        if (new_size > (UINT32_MAX / sizeof(int32_t))) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
-        }
-        new_buf = (int32_t *) realloc(mdi->mix_buffer, new_size * sizeof(int32_t));
-        if (new_buf == NULL) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
+    /* check to see if we're near one of the ends */
+    left = sample_pos >> FPBITS;
+    right = (sample->data_length >> FPBITS) - left - 1;
+    temp_n = (right << 1) - 1;
+    if (temp_n <= 0)
+        temp_n = 1;
+    if (temp_n > (left << 1) + 1)
+        temp_n = (left << 1) + 1;
+
+    /* use Newton if we can't fill the window */
+    if (temp_n < gauss_n) {
+        xd = sample_pos & FPMASK;
+        xd /= (1L << FPBITS);
+        xd += temp_n >> 1;
+        y = 0;
+        sptr = sample->data + (sample_pos >> FPBITS) - (temp_n >> 1);
+        for (ii = temp_n; ii;) {
+            for (jj = 0; jj <= ii; jj++)
+                y += sptr[jj] * newt_coeffs[ii][jj];
+            y *= xd - --ii;
         }
-        mdi->mix_buffer = new_buf;
-        mdi->mix_buffer_size = new_size;
+        y += *sptr;
+    } else { /* otherwise, use Gauss as usual */
+        gptr = &gauss_table[(sample_pos & FPMASK) * (gauss_n + 1)];
+        sptr = sample->data + (sample_pos >> FPBITS) - (gauss_n >> 1);
+        y = _WM_mix->gauss(sptr, gptr, gauss_n + 1);
     }
+    return (y);
+}
 
-    tmp_buffer = mdi->mix_buffer;
-
-    memset(tmp_buffer, 0, ((size / 2) * sizeof(int32_t)));
-    out_buffer = tmp_buffer;
+/* Sinc interpolation at sample_pos for a window that runs off either end
+   of the sample data: the missing taps read as silence. */
+static int32_t sinc_edge(const struct _sample *sample, uint32_t sample_pos,
+                         const int16_t *table, int taps) {
+    const int16_t *coef = &table[(sample_pos & FPMASK) * taps];
+    int32_t first = (int32_t)(sample_pos >> FPBITS) - (taps >> 1) + 1;
+    /* the sample buffers carry 2 guard entries past data_length */
+    int32_t last = (int32_t)(sample->data_length >> FPBITS) + 1;
+    int32_t y = 0;
+    int k;
+
+    for (k = 0; k < taps; k++) {
+        if ((first + k >= 0) && (first + k <= last))
+            y += sample->data[first + k] * coef[k];
+    }
+    return ((y + 8192) >> 14);
+}
 
-    do {
-        if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-            end_encountered = 0;
-            while ((!mdi->samples_to_mix) && (event->do_event)) {
-                event->do_event(mdi, &event->event_data);
-                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack) && !end_encountered) {
-                    end_encountered = 1; /* Avoid an infinite loop. */
-                    _WM_ResetToStart(mdi);
-                    event = mdi->current_event;
-                } else {
-                    /* += : keep any release allowance set by the
-                       end-of-track event (_WM_Release_Allowance). */
-                    mdi->samples_to_mix += event->samples_to_next;
-                    event++;
-                    mdi->current_event = event;
-                }
+/* Straight-line mix of count frames: no loop, end or envelope checks. */
+static void gus_mix_run(struct _note *nte, int32_t *out, uint32_t count, int interp) {
+    uint32_t sample_pos = nte->sample_pos;
+    uint32_t sample_inc = nte->sample_inc;
+    int32_t env_level = nte->env_level;
+    int32_t env_inc = nte->env_inc;
+    int32_t left_vol = (int32_t)nte->left_mix_volume;
+    int32_t right_vol = (int32_t)nte->right_mix_volume;
+    struct _WM_VoiceRun run;
+    int32_t premix;
+
+    if (interp == GUS_INTERP_GAUSS) {
+        do {
+            premix = (int32_t)((gauss_interp(nte->sample, sample_pos)
+                                * ENV_AMP(env_level)) / 1024);
+            *out++ += (premix * left_vol) / 1024;
+            *out++ += (premix * right_vol) / 1024;
+            sample_pos += sample_inc;
+            env_level += env_inc;
+        } while (--count);
+    } else if (interp >= GUS_INTERP_SINC4) {
+        int taps = GUS_SINC_TAPS(interp);
+        int32_t last = (int32_t)(nte->sample->data_length >> FPBITS) + 1;
+        /* sample_pos range where the whole window lies inside the data */
+        uint32_t lo = (uint32_t)((taps >> 1) - 1) << FPBITS;
+        uint32_t hi = (last >= (taps >> 1))
+            ? (uint32_t)(last - (taps >> 1) + 1) << FPBITS : 0;
+        uint32_t frames;
+
+        run.data = nte->sample->data;
+        run.env_amp = env_amp_table;
+        run.sample_inc = sample_inc;
+        run.env_inc = env_inc;
+        run.left_vol = left_vol;
+        run.right_vol = right_vol;
+        run.sinc_coef = sinc_table[interp - GUS_INTERP_SINC4];
+        run.sinc_taps = taps;
+        do {
+            if ((sample_pos >= lo) && (sample_pos < hi)) {
+                frames = (sample_inc) ? (hi - 1 - sample_pos) / sample_inc + 1 : count;
+                if (frames > count)
+                    frames = count;
+                run.sample_pos = sample_pos;
+                run.env_level = env_level;
+                _WM_mix->sinc(&run, out, frames);
+                sample_pos = run.sample_pos;
+                env_level = run.env_level;
+                out += frames * 2;
+                count -= frames;
+            } else {
+                premix = (sinc_edge(nte->sample, sample_pos, run.sinc_coef, taps)
+                          * ENV_AMP(env_level)) / 1024;
+                *out++ += (premix * left_vol) / 1024;
+                *out++ += (premix * right_vol) / 1024;
+                sample_pos += sample_inc;
+                env_level += env_inc;
+                count--;
             }
+        } while (count);
+    } else {
+        run.data = nte->sample->data;
+        run.env_amp = env_amp_table;
+        run.sample_pos = sample_pos;
+        run.sample_inc = sample_inc;
+        run.env_level = env_level;
+        run.env_inc = env_inc;
+        run.left_vol = left_vol;
+        run.right_vol = right_vol;
+        _WM_mix->linear(&run, out, count);
+        sample_pos = run.sample_pos;
+        env_level = run.env_level;
+    }
+
+    nte->sample_pos = sample_pos;
+    nte->env_level = env_level;
+}
 
-            if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-                if (mdi->extra_info.current_sample >= mdi->extra_info.approx_total_samples) {
-                    break;
-                } else if ((mdi->extra_info.approx_total_samples
-                             - mdi->extra_info.current_sample) > (size >> 2)) {
-                    mdi->samples_to_mix = size >> 2;
-                } else {
-                    mdi->samples_to_mix = mdi->extra_info.approx_total_samples
-                                           - mdi->extra_info.current_sample;
-                }
-            }
-        }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
-            real_samples_to_mix = size >> 2;
+/* How many frames, up to max, before the note's envelope reaches its
+   target. */
+static uint32_t gus_env_run(const struct _note *nte, uint32_t max) {
+    uint32_t run = max;
+    uint32_t frames;
+
+    if (nte->env_inc) {
+        int32_t target = nte->sample->env_target[nte->env];
+        if (nte->env_inc < 0) {
+            if (nte->env_level <= target)
+                return (0);
+            frames = (uint32_t)(nte->env_level - target - 1)
+                     / (uint32_t)(-nte->env_inc);
         } else {
-            real_samples_to_mix = mdi->samples_to_mix;
-            if (real_samples_to_mix == 0) {
-                continue;
-            }
+            if (nte->env_level >= target)
+                return (0);
+            frames = (uint32_t)(target - nte->env_level - 1)
+                     / (uint32_t)nte->env_inc;
         }
+        if (frames < run)
+            run = frames;
+    }
 
-        /* do mixing here */
-        count = real_samples_to_mix;
+    return (run);
+}
 
-        do {
-            note_data = mdi->note;
-            left_mix = right_mix = 0;
-            RESAMPLE_DEBUGI("SAMPLES_TO_MIX",count);
-
-            /* Vibrato LFO tick. Runs once per VIB_BLOCK samples and only
-               touches notes that actually have modulation applied. */
-            if (__builtin_expect((++mdi->vib_block_count >= VIB_BLOCK), 0)) {
-                struct _note *vib_note = mdi->note;
-                mdi->vib_block_count = 0;
-                while (vib_note) {
-                    if (vib_note->vib_depth) {
-                        _WM_update_note_vibrato(mdi, vib_note);
-                    }
-                    vib_note = vib_note->next;
-                }
-            }
+/* How many frames, up to max, the note can be mixed before its state machine
+   needs a look: the position checks and the envelope target test. */
+static uint32_t gus_note_run(const struct _note *nte, uint32_t max, int interp) {
+    uint32_t run = max;
+    uint32_t limit, frames;
 
-            if (__builtin_expect((note_data != NULL), 1)) {
-                RESAMPLE_DEBUGS("Processing Notes");
-                while (note_data) {
-                    /*
-                     * ===================
-                     * resample the sample
-                     * ===================
-                     */
-                    data_pos = note_data->sample_pos >> FPBITS;
-                    premix = ((note_data->sample->data[data_pos] + (((note_data->sample->data[data_pos + 1] - note_data->sample->data[data_pos]) * (int32_t)(note_data->sample_pos & FPMASK)) / 1024)) * ENV_AMP(note_data->env_level)) / 1024;
-
-                    left_mix += (premix * (int32_t)note_data->left_mix_volume) / 1024;
-                    right_mix += (premix * (int32_t)note_data->right_mix_volume) / 1024;
-
-                    /*
-                     * ========================
-                     * sample position checking
-                     * ========================
-                     */
-#ifdef DEBUG_RESAMPLE
-                    fprintf(stderr,"\r\n%d -> INC %i, ENV %i, LEVEL %i, TARGET %d, RATE %i, SAMPLE POS %i, SAMPLE LENGTH %i, PREMIX %i (%i:%i)",
-                            (uint32_t)note_data,
-                            note_data->env_inc,
-                            note_data->env, note_data->env_level,
-                            note_data->sample->env_target[note_data->env],
-                            note_data->sample->env_rate[note_data->env],
-                            note_data->sample_pos,
-                            note_data->sample->data_length,
-                            premix, left_mix, right_mix);
-                    if (note_data->modes & SAMPLE_LOOP)
-                        fprintf(stderr,", LOOP %i + %i",
-                                note_data->sample->loop_start,
-                                note_data->sample->loop_size);
-                    fprintf(stderr,"\r\n");
-#endif
+    if (nte->sample_inc) {
+        /* first position that the checks in gus_note_step() act on */
+        if (nte->modes & SAMPLE_LOOP) {
+            limit = nte->sample->loop_end + 1;
+        } else {
+            limit = nte->sample->data_length;
+            /* the Gauss mixer only tests the data end past the loop end */
+            if ((interp == GUS_INTERP_GAUSS) && (limit <= nte->sample->loop_end))
+                limit = nte->sample->loop_end + 1;
+        }
+        if (nte->sample_pos >= limit)
+            return (0);
+        frames = (limit - 1 - nte->sample_pos) / nte->sample_inc;
+        if (frames < run)
+            run = frames;
+    }
 
-                    note_data->sample_pos += note_data->sample_inc;
+    return (gus_env_run(nte, run));
+}
 
-                    if (__builtin_expect((note_data->modes & SAMPLE_LOOP), 1)) {
-                        if (__builtin_expect(
-                                             (note_data->sample_pos > note_data->sample->loop_end),
-                                             0)) {
-                            note_data->sample_pos = note_data->sample->loop_start
-                                + ((note_data->sample_pos
-                                    - note_data->sample->loop_start)
-                                % note_data->sample->loop_size);
-                        }
+/*
+ * The note's state machine, on a frame that may have hit a loop, end or
+ * envelope point, once that frame is mixed. Returns 1 when the frame is
+ * done, 0 when *nte_ptr is to run the same frame again (it moved to release,
+ * or handed its place in the list to its replay), or -1 when the note has
+ * left the list.
+ */
+static int gus_note_step(struct _mdi *mdi, struct _note **nte_ptr, int interp) {
+    struct _note *nte = *nte_ptr;
+    uint32_t env_ptr;
 
-                    } else if (__builtin_expect(
-                                                  (note_data->sample_pos
-                                                   >= note_data->sample->data_length),
-                                                  0)) {
-                        goto _END_THIS_NOTE;
-                    }
+    /*
+     * ========================
+     * sample position checking
+     * ========================
+     */
+    if (interp == GUS_INTERP_GAUSS) {
+        if (__builtin_expect((nte->sample_pos > nte->sample->loop_end), 0)) {
+            if (nte->modes & SAMPLE_LOOP) {
+                nte->sample_pos = nte->sample->loop_start
+                    + ((nte->sample_pos - nte->sample->loop_start)
+                       % nte->sample->loop_size);
+            } else if (nte->sample_pos >= nte->sample->data_length) {
+                goto _END_THIS_NOTE;
+            }
+        }
+    } else if (nte->modes & SAMPLE_LOOP) {
+        if (nte->sample_pos > nte->sample->loop_end) {
+            nte->sample_pos = nte->sample->loop_start
+                + ((nte->sample_pos - nte->sample->loop_start)
+                   % nte->sample->loop_size);
+        }
+    } else if (nte->sample_pos >= nte->sample->data_length) {
+        goto _END_THIS_NOTE;
+    }
+
+    /* the frame has already stepped env_level */
+    if (nte->env_inc == 0)
+        return (1);
+    if (nte->env_inc < 0) {
+        if (nte->env_level > nte->sample->env_target[nte->env])
+            return (1);
+    } else if (nte->env_level < nte->sample->env_target[nte->env]) {
+        return (1);
+    }
+
+    nte->env_level = nte->sample->env_target[nte->env];
+    switch (nte->env) {
+    case 0:
+        if (!(nte->modes & SAMPLE_ENVELOPE)) {
+            nte->env_inc = 0;
+            RESAMPLE_DEBUGS("Next Note: No Envelope");
+            return (1);
+        }
+        break;
+    case 2:
+        if (nte->modes & SAMPLE_SUSTAIN /*|| nte->hold*/) {
+            nte->env_inc = 0;
+            RESAMPLE_DEBUGS("Next Note: SAMPLE_SUSTAIN");
+            return (1);
+        }
+        /* the old mixer re-ran this note on the same frame once it
+           moved to release, so it is mixed again here too */
+        env_ptr = (nte->modes & SAMPLE_CLAMPED)? 5 : 4;
+        nte->env = env_ptr;
+        if (nte->env_level > nte->sample->env_target[env_ptr]) {
+            nte->env_inc = -nte->sample->env_rate[env_ptr];
+        } else {
+            nte->env_inc = nte->sample->env_rate[env_ptr];
+        }
+        return (0);
+    case 5:
+        if (__builtin_expect((nte->env_level == 0), 1)) {
+            goto _END_THIS_NOTE;
+        }
+        /* sample release */
+        if (nte->modes & SAMPLE_LOOP)
+            nte->modes ^= SAMPLE_LOOP;
+        nte->env_inc = 0;
+        RESAMPLE_DEBUGS("Next Note: Sample Release");
+        return (1);
+    case 6:
+    _END_THIS_NOTE:
+        if (__builtin_expect((nte->replay != NULL), 1)) {
+            /* the replay takes the note's place in the list and starts
+               on this same frame */
+            *nte_ptr = nte->replay;
+            _WM_ReplaceNote(mdi, nte, nte->replay);
+            RESAMPLE_DEBUGS("Next Note: Replay");
+            return (0);
+        }
+        _WM_RemoveNote(mdi, nte);
+        RESAMPLE_DEBUGS("Next Note: Killed Off Note");
+        return (-1);
+    }
+    nte->env++;
 
-                    if (__builtin_expect((note_data->env_inc == 0), 0)) {
-                        note_data = note_data->next;
-                        RESAMPLE_DEBUGS("Next Note: 0 env_inc");
-                        continue;
-                    }
+    if (nte->is_off == 1) {
+        _WM_do_note_off_extra(nte);
+    } else if (nte->env_level >= nte->sample->env_target[nte->env]) {
+        nte->env_inc = -nte->sample->env_rate[nte->env];
+    } else {
+        nte->env_inc = nte->sample->env_rate[nte->env];
+    }
+    return (1);
+}
 
-                    note_data->env_level += note_data->env_inc;
+/*
+ * Mix one note over count frames. If it ends, it leaves the note list, or
+ * hands its place to its replay, which mixes on from the same frame.
+ */
+static void gus_mix_note(struct _mdi *mdi, struct _note *nte, int32_t *out,
+                         uint32_t count, int interp) {
+    uint32_t i = 0;
+    uint32_t run;
+    int step;
+
+    while (i < count) {
+        run = gus_note_run(nte, count - i, interp);
+        if (run) {
+            gus_mix_run(nte, &out[i * 2], run, interp);
+            i += run;
+            if (i == count)
+                break;
+        }
 
-                    if (note_data->env_inc < 0) {
-                        if (__builtin_expect((note_data->env_level
-                            > note_data->sample->env_target[note_data->env]), 0)) {
-                            note_data = note_data->next;
-                            RESAMPLE_DEBUGS("Next Note: env_lvl > env_target");
-                            continue;
-                        }
-                    } else if (note_data->env_inc > 0) {
-                        if (__builtin_expect((note_data->env_level
-                            < note_data->sample->env_target[note_data->env]), 0)) {
-                            note_data = note_data->next;
-                            RESAMPLE_DEBUGS("Next Note: env_lvl < env_target");
-                            continue;
-                        }
-                    }
+        /* this frame may hit a loop, end or envelope point */
+        gus_mix_run(nte, &out[i * 2], 1, interp);
+        step = gus_note_step(mdi, &nte, interp);
+        if (step < 0)
+            return;
+        i += step;
+    }
+}
 
-                    /* Yes could have a condition here but
-                       it would create another bottleneck */
-                    note_data->env_level =
-                            note_data->sample->env_target[note_data->env];
-                    switch (note_data->env) {
-                    case 0:
-                        if (!(note_data->modes & SAMPLE_ENVELOPE)) {
-                            note_data->env_inc = 0;
-                            note_data = note_data->next;
-                            RESAMPLE_DEBUGS("Next Note: No Envelope");
-                            continue;
-                        }
-                        break;
-                    case 2:
-                        if (note_data->modes & SAMPLE_SUSTAIN /*|| note_data->hold*/) {
-                            note_data->env_inc = 0;
-                            note_data = note_data->next;
-                            RESAMPLE_DEBUGS("Next Note: SAMPLE_SUSTAIN");
-                        } else {
-                            env_ptr = (note_data->modes & SAMPLE_CLAMPED)? 5 : 4;
-                            note_data->env = env_ptr;
-                            if (note_data->env_level
-                                    > note_data->sample->env_target[env_ptr]) {
-                                note_data->env_inc =
-                                        -note_data->sample->env_rate[env_ptr];
-                            } else {
-                                note_data->env_inc =
-                                        note_data->sample->env_rate[env_ptr];
-                            }
-                        }
-                        continue;
-                    case 5:
-                        if (__builtin_expect((note_data->env_level == 0), 1)) {
-                            goto _END_THIS_NOTE;
-                        }
-                        /* sample release */
-                        if (note_data->modes & SAMPLE_LOOP)
-                            note_data->modes ^= SAMPLE_LOOP;
-                        note_data->env_inc = 0;
-                        note_data = note_data->next;
-                        RESAMPLE_DEBUGS("Next Note: Sample Release");
-
-                        continue;
-                    case 6:
-                        _END_THIS_NOTE:
-                        if (__builtin_expect((note_data->replay != NULL), 1)) {
-                            note_data->active = 0;
-                            {
-                                struct _note *prev_note = NULL;
-                                struct _note *nte_array = mdi->note;
-
-                                if (nte_array != note_data) {
-                                    do {
-                                        prev_note = nte_array;
-                                        nte_array = nte_array->next;
-                                    } while (nte_array != note_data);
-                                }
-                                if (prev_note) {
-                                    prev_note->next = note_data->replay;
-                                } else {
-                                    mdi->note = note_data->replay;
-                                }
-                                note_data->replay->next = note_data->next;
-                                note_data = note_data->replay;
-                                note_data->active = 1;
-                            }
-                        } else {
-                            note_data->active = 0;
-                            {
-                                struct _note *prev_note = NULL;
-                                struct _note *nte_array = mdi->note;
-
-                                if (nte_array != note_data) {
-                                    do {
-                                        prev_note = nte_array;
-                                        nte_array = nte_array->next;
-                                    } while ((nte_array != note_data)
-                                            && (nte_array));
-                                }
-                                if (prev_note) {
-                                    prev_note->next = note_data->next;
-                                } else {
-                                    mdi->note = note_data->next;
-                                }
-                                note_data = note_data->next;
-                            }
-                        }
-                        RESAMPLE_DEBUGS("Next Note: Killed Off Note");
-                        continue;
-                    }
-                    note_data->env++;
+/* Each note mixes into out plus stride times its channel, so a stride of 0
+   mixes them all together. */
+static void gus_mix_notes(struct _mdi *mdi, int32_t *out, uint32_t stride,
+                          uint32_t count, int interp) {
+    struct _note *nte = mdi->note;
+    struct _note *next;
 
-                    if (note_data->is_off == 1) {
-                        _WM_do_note_off_extra(note_data);
-                    } else {
+    while (nte) {
+        /* mixing may unlink nte, never the notes after it */
+        next = nte->next;
+        gus_mix_note(mdi, nte, out + (nte->noteid >> 8) * stride, count, interp);
+        nte = next;
+    }
+}
 
-                        if (note_data->env_level
-                            >= note_data->sample->env_target[note_data->env]) {
-                            note_data->env_inc =
-                                -note_data->sample->env_rate[note_data->env];
-                        } else {
-                            note_data->env_inc =
-                                note_data->sample->env_rate[note_data->env];
-                        }
-                    }
-                    note_data = note_data->next;
-#ifdef DEBUG_RESAMPLE
-                    if (note_data != NULL)
-                        RESAMPLE_DEBUGI("Next Note: Next ENV ", note_data->env);
-                    else
-                        RESAMPLE_DEBUGS("Next Note: Next ENV");
-#endif
-                    continue;
+/*
+ * Mix count frames of every playing note into out, which the caller zeroes,
+ * with stride as for gus_mix_notes().
+ * The vibrato LFO ticks once per VIB_BLOCK frames, so when any note (or a
+ * replay that may start within the block) carries vibrato, the block is
+ * mixed in segments that start on those ticks.
+ */
+static void gus_mix_block(struct _mdi *mdi, int32_t *out, uint32_t stride,
+                          uint32_t count, int interp) {
+    struct _note *nte;
+    uint32_t seg;
+    int vibrato = 0;
+
+    for (nte = mdi->note; nte != NULL; nte = nte->next) {
+        if ((nte->vib_depth) || ((nte->replay) && (nte->replay->vib_depth))) {
+            vibrato = 1;
+            break;
+        }
+    }
+
+    if (!vibrato) {
+        mdi->vib_block_count = (mdi->vib_block_count + count) % VIB_BLOCK;
+        gus_mix_notes(mdi, out, stride, count, interp);
+        return;
+    }
+
+    while (count) {
+        if (mdi->vib_block_count >= (VIB_BLOCK - 1)) {
+            /* the LFO ticks on the first frame of this segment */
+            for (nte = mdi->note; nte != NULL; nte = nte->next) {
+                if (nte->vib_depth) {
+                    _WM_update_note_vibrato(mdi, nte);
                 }
             }
-            *tmp_buffer++ = left_mix;
-            *tmp_buffer++ = right_mix;
-        } while (--count);
+            seg = (count < VIB_BLOCK) ? count : VIB_BLOCK;
+            mdi->vib_block_count = seg - 1;
+        } else {
+            seg = VIB_BLOCK - 1 - mdi->vib_block_count;
+            if (seg > count)
+                seg = count;
+            mdi->vib_block_count += seg;
+        }
+        gus_mix_notes(mdi, out, stride, seg, interp);
+        out += seg * 2;
+        count -= seg;
+    }
+}
 
-        buffer_used += real_samples_to_mix * 4;
-        size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
-    } while (size);
+/*
+ * Seeking: step a note count frames on as gus_mix_run() would, without
+ * mixing. A looping note wraps here with one modulo for however many loops
+ * the stretch covers, so skipping costs the envelope points passed rather
+ * than the frames.
+ */
+static void gus_skip_run(struct _note *nte, uint32_t count) {
+    uint64_t pos = (uint64_t)nte->sample_pos
+                   + (uint64_t)count * nte->sample_inc;
+
+    if ((nte->modes & SAMPLE_LOOP) && (pos > nte->sample->loop_end)) {
+        pos = (pos - nte->sample->loop_start) % nte->sample->loop_size;
+        /* the mixer only wraps past loop_end, so with steps shorter than
+           the loop it lands on loop_end rather than loop_start */
+        if ((pos == 0) && (nte->sample_inc < nte->sample->loop_size))
+            pos = nte->sample->loop_end;
+        else
+            pos += nte->sample->loop_start;
+    }
+    nte->sample_pos = (uint32_t)pos;
+    nte->env_level += (int32_t)count * nte->env_inc;
+}
 
-    tmp_buffer = out_buffer;
+/* As gus_mix_note(), stepping the note on with gus_skip_run(). */
+static void gus_skip_note(struct _mdi *mdi, struct _note *nte, uint32_t count,
+                          int interp) {
+    uint32_t i = 0;
+    uint32_t run;
+    int step;
+
+    while (i < count) {
+        /* looping notes wrap in gus_skip_run(), only their envelope stops them */
+        run = (nte->modes & SAMPLE_LOOP) ? gus_env_run(nte, count - i)
+                                         : gus_note_run(nte, count - i, interp);
+        if (run) {
+            gus_skip_run(nte, run);
+            i += run;
+            if (i == count)
+                break;
+        }
 
-    if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
-        _WM_do_reverb(mdi->reverb, tmp_buffer, (buffer_used / 2));
+        gus_skip_run(nte, 1);
+        step = gus_note_step(mdi, &nte, interp);
+        if (step < 0)
+            return;
+        i += step;
     }
+}
 
-    /* _WM_DynamicVolumeAdjust(mdi, tmp_buffer, (buffer_used/2)); */
-
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
+/*
+ * Step every playing note count frames on, for WildMidi_AccurateSeek().
+ * Ticking the vibrato LFO as gus_mix_block() does would cost a step every
+ * VIB_BLOCK frames, so a note with vibrato moves at its centre pitch
+ * instead, its LFO phase moved on by the ticks in the stretch. It picks up
+ * the LFO again on the next tick once mixing resumes.
+ */
+static void gus_skip_notes(struct _mdi *mdi, uint32_t count, int interp) {
+    struct _note *nte = mdi->note;
+    struct _note *next;
+    uint32_t ticks;
+    uint16_t phase;
+
+    /* events often come at the same time */
+    if (!count)
+        return;
+    ticks = (count / VIB_BLOCK)
+            + ((mdi->vib_block_count + (count % VIB_BLOCK)) / VIB_BLOCK);
+    mdi->vib_block_count = (mdi->vib_block_count + (count % VIB_BLOCK))
+                           % VIB_BLOCK;
+
+    while (nte) {
+        /* skipping may unlink nte, never the notes after it */
+        next = nte->next;
+        if ((nte->vib_depth) && (ticks)) {
+            phase = (uint16_t)((nte->vib_phase + ticks * nte->vib_inc)
+                               & VIB_PHASE_MASK);
+            nte->vib_phase = 0;
+            _WM_update_note_vibrato_at_phase(mdi, nte);
+            nte->vib_phase = phase;
+        }
+        gus_skip_note(mdi, nte, count, interp);
+        nte = next;
+    }
+}
 
-        /* The packing below only keeps 16 bits: without a clamp, an
-           over-full mix wraps around into full-scale pops. */
-        if (left_mix > 32767) left_mix = 32767;
-        else if (left_mix < -32768) left_mix = -32768;
-        if (right_mix > 32767) right_mix = 32767;
-        else if (right_mix < -32768) right_mix = -32768;
 
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
-#ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-#else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-#endif
-    }
+/*
+ * Sample formats for the GetOutput family. Whatever the format, the
+ * renderers below count the request in 16 bit stereo bytes, 4 per frame.
+ * The WM_OUT_MIX_* formats add to what is in the caller's buffer.
+ */
+#define WM_OUT_S16 0
+#define WM_OUT_S32 1
+#define WM_OUT_F32 2
+#define WM_OUT_MIX_S32 3
+#define WM_OUT_MIX_F32 4
+#define WM_OUT_BYTES(format) (((format) == WM_OUT_S16) ? 2 : 4)
+#define WM_OUT_IS_MIX(format) ((format) >= WM_OUT_MIX_S32)
 
-    _WM_Unlock(&mdi->lock);
-    return (buffer_used);
-}
+/*
+ * Stem rendering mixes each MIDI channel into a bus of its own, with one
+ * more bus after them for sound that belongs to no channel. The renderers
+ * lay the buses out stride mix values apart: channel c at out + c * stride
+ * and the rest at out + 16 * stride. A stride of 0 mixes them all together.
+ */
+#define WM_STEM_BUSES 17
+
+/* Where a renderer's output goes: the format, the gain for mixing, and
+   for stem rendering the caller's 16 channel buffers (NULL otherwise). */
+struct _WM_Output {
+    int format;
+    float gain;
+    float **stems;
+};
 
-static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
-    uint32_t buffer_used = 0;
-    uint32_t i, env_ptr;
-    struct _mdi *mdi = (struct _mdi *) handle;
-    uint32_t real_samples_to_mix = 0;
-    uint32_t data_pos;
-    int32_t premix, left_mix, right_mix;
-    struct _note *note_data = NULL;
-    uint32_t count;
-    int16_t *sptr;
-    double y, xd;
-    double *gptr, *gend;
-    int left, right, temp_n;
-    int ii, jj;
-    struct _event *event;
-    int32_t *tmp_buffer;
-    int32_t *out_buffer;
-    int end_encountered;
+/* Zero what rendering left of the caller's buffers: from used to size 16 bit
+   stereo bytes in. The mixing formats keep what is there. */
+static void WM_ClearOutput(void *buffer, uint32_t used, uint32_t size,
+                           const struct _WM_Output *output) {
+    uint32_t from = used / 2;
+    uint32_t samples = (size - used) / 2;
+    int i;
 
-    _WM_Lock(&mdi->lock);
-    event = mdi->current_event;
+    if (!samples)
+        return;
+    if (output->stems) {
+        for (i = 0; i < 16; i++) {
+            if (output->stems[i])
+                memset(&output->stems[i][from], 0, samples * sizeof(float));
+        }
+    }
+    if ((buffer) && (!WM_OUT_IS_MIX(output->format)))
+        memset((int8_t *) buffer + from * WM_OUT_BYTES(output->format), 0,
+               samples * WM_OUT_BYTES(output->format));
+}
 
-    buffer_used = 0;
-    memset(buffer, 0, size);
+/* Grow the mix buffer to hold size 16 bit stereo bytes on every bus the
+   output needs. Returns NULL, with the error set, on failure. The renderer
+   zeroes each stretch just before mixing into it. */
+static int32_t *WM_GetMixBuffer(struct _mdi *mdi, uint32_t size, const struct _WM_Output *output) {
+    uint32_t samples = size / 2;
 
-    if ( (size / 2) > mdi->mix_buffer_size) {
-        uint32_t new_size = ((size / 2) <= (mdi->mix_buffer_size * 2))
-            ? mdi->mix_buffer_size + MEM_CHUNK : size / 2;
+    if (output->stems) {
+        if (samples > (UINT32_MAX / WM_STEM_BUSES)) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+            return (NULL);
+        }
+        samples *= WM_STEM_BUSES;
+    }
+    if (samples > mdi->mix_buffer_size) {
+        uint32_t new_size = (samples <= (mdi->mix_buffer_size * 2))
+            ? mdi->mix_buffer_size + MEM_CHUNK : samples;
         int32_t *new_buf;
+        if (new_size < samples)
+            new_size = samples;
         if (new_size > (UINT32_MAX / sizeof(int32_t))) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
+            return (NULL);
         }
         new_buf = (int32_t *) realloc(mdi->mix_buffer, new_size * sizeof(int32_t));
         if (new_buf == NULL) {
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
+            return (NULL);
         }
         mdi->mix_buffer = new_buf;
         mdi->mix_buffer_size = new_size;
     }
+    return (mdi->mix_buffer);
+}
+
+/*
+ * Mix values WM_WriteOutput() finishes at a time: small enough that a tile
+ * stays in L1 cache from the stem packing through reverb to the output
+ * format, rather than each step sweeping the whole buffer.
+ */
+#define WM_OUT_TILE 512
+
+/*
+ * Final step of every renderer: the int32 mix to the caller's format. For
+ * stem rendering, each wanted channel bus goes out as float and the buses
+ * are then summed into the first one for the master mix, if there is one.
+ */
+static void WM_WriteOutput(struct _mdi *mdi, int32_t *mix, uint32_t stride,
+                           void *buffer, uint32_t samples,
+                           const struct _WM_Output *output) {
+    uint32_t pos, count, i;
+    int32_t *tile;
+    int bus;
+
+    for (pos = 0; pos < samples; pos += count) {
+        count = samples - pos;
+        if (count > WM_OUT_TILE)
+            count = WM_OUT_TILE;
+        tile = &mix[pos];
+
+        if (output->stems) {
+            for (bus = 0; bus < 16; bus++) {
+                if (output->stems[bus])
+                    _WM_mix->pack_f32(&tile[bus * stride], &output->stems[bus][pos], count);
+            }
+            if (!buffer)
+                continue;
+            for (bus = 1; bus < WM_STEM_BUSES; bus++) {
+                for (i = 0; i < count; i++)
+                    tile[i] += tile[bus * stride + i];
+            }
+        }
+
+        if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
+            _WM_do_reverb(mdi->reverb, tile, count);
+        }
+
+        switch (output->format) {
+        case WM_OUT_S32:
+            _WM_mix->pack_s32(tile, (int32_t *) buffer + pos, count);
+            break;
+        case WM_OUT_F32:
+            _WM_mix->pack_f32(tile, (float *) buffer + pos, count);
+            break;
+        case WM_OUT_MIX_S32:
+            _WM_mix->mix_s32(tile, (int32_t *) buffer + pos, count, output->gain);
+            break;
+        case WM_OUT_MIX_F32:
+            _WM_mix->mix_f32(tile, (float *) buffer + pos, count, output->gain);
+            break;
+        default:
+            _WM_mix->pack_s16(tile, (int8_t *) buffer + pos * 2, count);
+            break;
+        }
+    }
+}
+
+/*
+ * A synth backend as WM_Render() drives it: the voice generation stage,
+ * and the hooks the shared event loop calls around it.
+ */
+struct _WM_Backend {
+    /* pass an event to the synth before _WM_do_event() runs it, or NULL */
+    void (*event)(struct _mdi *mdi, struct _event *event);
+    /* rewind the synth when a looping song restarts, or NULL */
+    void (*reset)(struct _mdi *mdi);
+    /* nonzero while voices ring on past the last event, for up to 10
+       seconds; NULL ends the song with its events */
+    int (*active)(struct _mdi *mdi);
+    /* add count frames to out, with buses stride apart */
+    void (*render)(struct _mdi *mdi, int32_t *out, uint32_t stride,
+                   uint32_t count, int interp);
+};
+
+static const struct _WM_Backend gus_backend = {
+    NULL, NULL, NULL, gus_mix_block
+};
+
+#ifdef WILDMIDI_SF2
+static void sf2_event(struct _mdi *mdi, struct _event *event) {
+    _WM_SF2_Event(mdi->sf2_synth, mdi, event);
+}
+
+static void sf2_reset(struct _mdi *mdi) {
+    _WM_SF2_Reset(mdi->sf2_synth);
+}
+
+static int sf2_active(struct _mdi *mdi) {
+    return (_WM_SF2_ActiveVoices(mdi->sf2_synth));
+}
+
+static void sf2_render(struct _mdi *mdi, int32_t *out, uint32_t stride,
+                       uint32_t count, int interp) {
+    WMIDI_UNUSED(interp);
+    _WM_SF2_Render(mdi->sf2_synth, out, stride, count);
+}
+
+static const struct _WM_Backend sf2_backend = {
+    sf2_event, sf2_reset, sf2_active, sf2_render
+};
+#endif /* WILDMIDI_SF2 */
+
+#ifdef WILDMIDI_MAFM
+/* The event list keeps channel/meta state in sync while the Yamaha FM
+   synth generates the sound. */
+static void mafm_event(struct _mdi *mdi, struct _event *event) {
+    _WM_MAFM_Event(mdi->mafm_synth, mdi, event);
+}
+
+static void mafm_reset(struct _mdi *mdi) {
+    _WM_MAFM_Reset(mdi->mafm_synth);
+}
+
+static int mafm_active(struct _mdi *mdi) {
+    return (_WM_MAFM_ActiveVoices(mdi->mafm_synth));
+}
+
+static void mafm_render(struct _mdi *mdi, int32_t *out, uint32_t stride,
+                        uint32_t count, int interp) {
+    WMIDI_UNUSED(interp);
+    _WM_MAFM_Render(mdi->mafm_synth, out, stride, count);
+}
+
+static const struct _WM_Backend mafm_backend = {
+    mafm_event, mafm_reset, mafm_active, mafm_render
+};
+#endif /* WILDMIDI_MAFM */
+
+/*
+ * Control calls on a song. The renderer holds the song's lock for all of
+ * a GetOutput(), so rather than wait for it, a control call posts its
+ * change to the song's queue and applies it only if the lock is free.
+ * Otherwise whoever holds the lock applies it as they let go, see
+ * WM_UnlockSong(). Any number of threads can post; the changes are
+ * applied in order.
+ */
+#define WM_CMD_OPTION     1 /* arg: options, setting */
+#define WM_CMD_MAX_VOICES 2 /* arg: max_voices */
+
+static void WM_ApplyCmd(struct _mdi *mdi, uint16_t type, const uint16_t *arg) {
+    switch (type) {
+    case WM_CMD_OPTION:
+        mdi->extra_info.mixer_options = ((mdi->extra_info.mixer_options & (0x80FF ^ arg[0]))
+                                        | (arg[0] & arg[1]));
+
+        if (arg[0] & WM_MO_LOG_VOLUME) {
+            _WM_AdjustChannelVolumes(mdi, 16);  /* Settings greater than 15
+                                                   adjusts all channels */
+        } else if (arg[0] & WM_MO_REVERB) {
+            _WM_reset_reverb(mdi->reverb);
+        }
+        break;
+    case WM_CMD_MAX_VOICES:
+        mdi->extra_info.max_voices = arg[0];
+        _WM_CapVoices(mdi);
+        break;
+    }
+}
+
+/* returns 0 if the queue is full */
+static int WM_PostCmd(struct _mdi *mdi, uint16_t type, uint16_t arg0, uint16_t arg1) {
+    uint32_t pos = _WM_AtomicLoad(&mdi->cmd_head);
+    struct _cmd *cmd;
+    int32_t turn;
+
+    for (;;) {
+        cmd = &mdi->cmd[pos % WM_CMD_QUEUE];
+        turn = (int32_t) (_WM_AtomicLoad(&cmd->seq) - pos);
+        if (turn == 0) {
+            /* the slot is free, claim it before another poster does */
+            if (_WM_AtomicSwap(&mdi->cmd_head, pos, pos + 1)) break;
+        } else if (turn < 0) {
+            return (0);
+        }
+        pos = _WM_AtomicLoad(&mdi->cmd_head);
+    }
+    cmd->type = type;
+    cmd->arg[0] = arg0;
+    cmd->arg[1] = arg1;
+    _WM_AtomicStore(&cmd->seq, pos + 1);
+    return (1);
+}
+
+/* applies what was posted, with the song's lock held */
+static void WM_TakeCmds(struct _mdi *mdi) {
+    struct _cmd *cmd;
+
+    for (;;) {
+        cmd = &mdi->cmd[mdi->cmd_tail % WM_CMD_QUEUE];
+        if (_WM_AtomicLoad(&cmd->seq) != mdi->cmd_tail + 1) break;
+        WM_ApplyCmd(mdi, cmd->type, cmd->arg);
+        _WM_AtomicStore(&cmd->seq, mdi->cmd_tail + WM_CMD_QUEUE);
+        _WM_AtomicStore(&mdi->cmd_tail, mdi->cmd_tail + 1);
+    }
+}
+
+static void WM_CountWaiting(struct _mdi *mdi, uint32_t add) {
+    uint32_t n;
+
+    do {
+        n = _WM_AtomicLoad(&mdi->lock_waiting);
+    } while (!_WM_AtomicSwap(&mdi->lock_waiting, n, n + add));
+}
+
+/* takes the song's lock and brings it up to date with the control calls */
+static void WM_LockSong(struct _mdi *mdi) {
+    if (!_WM_TryLock(&mdi->lock)) {
+        WM_CountWaiting(mdi, 1);
+        _WM_Lock(&mdi->lock);
+        WM_CountWaiting(mdi, (uint32_t) -1);
+    }
+    WM_TakeCmds(mdi);
+}
+
+/*
+ * Lets go of the song's lock. A poster that found the lock taken leaves
+ * its change to the holder, so after letting go look again: anything
+ * posted before the poster's try is seen here, and is taken if the lock
+ * can be had back. If it can't, the new holder takes it in turn. The
+ * fences, here and in WM_SendCmd(), keep either side from reading before
+ * its own store is seen.
+ */
+static void WM_UnlockSong(struct _mdi *mdi) {
+    uint32_t tail;
+
+    for (;;) {
+        WM_TakeCmds(mdi);
+        _WM_Unlock(&mdi->lock);
+        _WM_AtomicFence();
+        tail = _WM_AtomicLoad(&mdi->cmd_tail);
+        if ((_WM_AtomicLoad(&mdi->cmd[tail % WM_CMD_QUEUE].seq) != tail + 1)
+            || !_WM_TryLock(&mdi->lock)) {
+            break;
+        }
+    }
+}
+
+/*
+ * Takes the song's lock for a control call's lookup, with a streamed song
+ * parsed on to sample and tick first. The parse goes a window of events
+ * at a time, and between windows hands the lock to whoever is waiting on
+ * it, so that a long parse never holds up rendering for more than one
+ * window. The patches it finds load on the worker pool, and a song read to
+ * its end is written to the cache with the lock let go.
+ */
+static void WM_LockStreamed(struct _mdi *mdi, uint32_t sample, uint32_t tick) {
+    uint32_t waiting;
+
+    WM_LockSong(mdi);
+    while (_WM_StreamMidi(mdi, sample, tick)) {
+        waiting = _WM_AtomicLoad(&mdi->lock_waiting);
+        if (waiting != 0) {
+            WM_UnlockSong(mdi);
+            _WM_AtomicWait(&mdi->lock_waiting, waiting);
+            WM_LockSong(mdi);
+        }
+    }
+    if (_WM_AtomicLoadPtr((void **) &mdi->stream_file) != NULL) {
+        WM_UnlockSong(mdi);
+        _WM_StreamMidiStore(mdi);
+        WM_LockSong(mdi);
+    }
+}
+
+static void WM_SendCmd(struct _mdi *mdi, uint16_t type, uint16_t arg0, uint16_t arg1) {
+    uint16_t arg[2];
+    uint32_t tail;
+
+    for (;;) {
+        if (WM_PostCmd(mdi, type, arg0, arg1)) {
+            _WM_AtomicFence();
+            if (_WM_TryLock(&mdi->lock)) {
+                WM_UnlockSong(mdi);
+            }
+            return;
+        }
+        /* a full queue: the lock has been held a long while, so wait for
+           it after all. The change can only skip the queue once the queue
+           is empty, or it could overtake one of this thread's own. */
+        WM_LockSong(mdi);
+        tail = mdi->cmd_tail;
+        if (_WM_AtomicLoad(&mdi->cmd_head) == tail) {
+            arg[0] = arg0;
+            arg[1] = arg1;
+            WM_ApplyCmd(mdi, type, arg);
+            WM_UnlockSong(mdi);
+            return;
+        }
+        WM_UnlockSong(mdi);
+        /* the oldest is a slot another poster has claimed but not filled */
+        _WM_AtomicWait(&mdi->cmd[tail % WM_CMD_QUEUE].seq, tail);
+    }
+}
+
+/*
+ * The synth a song plays on and, for the GUS mixer, the resampler its
+ * options ask for, with the song's lock held so that options set from
+ * another thread apply from a whole buffer on. -1 if the resampler's
+ * table can't be made.
+ */
+static int WM_PickBackend(struct _mdi *mdi, const struct _WM_Backend **synth) {
+    int size_idx;
+
+#ifdef WILDMIDI_MAFM
+    if (mdi->mafm_synth) {
+        *synth = &mafm_backend;
+        return (0);
+    }
+#endif
+#ifdef WILDMIDI_SF2
+    if (mdi->sf2_synth) {
+        *synth = &sf2_backend;
+        return (0);
+    }
+#endif
+    *synth = &gus_backend;
+    if (mdi->extra_info.mixer_options & WM_MO_SINC_RESAMPLING) {
+        size_idx = ((mdi->extra_info.mixer_options & WM_MO_SINC_RESAMPLING) >> 4) - 1;
+        /* another thread may be building the table: the acquire load of
+           its flag is what makes the table it stored visible here */
+        if (!_WM_AtomicLoad(&sinc_ready[size_idx])) init_sinc(size_idx);
+        if (!_WM_AtomicLoad(&sinc_ready[size_idx])) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            return (-1);
+        }
+        return (GUS_INTERP_SINC4 + size_idx);
+    }
+    if (mdi->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
+        if (!_WM_AtomicLoad(&gauss_ready)) init_gauss();
+        if (!_WM_AtomicLoad(&gauss_ready)) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            return (-1);
+        }
+        return (GUS_INTERP_GAUSS);
+    }
+    return (GUS_INTERP_LINEAR);
+}
+
+/*
+ * The render pipeline every backend shares: run the events due, have the
+ * synth mix each stretch between them into the mix buffer, zeroed just
+ * ahead of it, then finish the whole mix in one WM_WriteOutput() pass.
+ */
+static int WM_Render(midi * handle, void *buffer, uint32_t size,
+                     const struct _WM_Output *output) {
+    uint32_t buffer_used = 0;
+    struct _mdi *mdi = (struct _mdi *) handle;
+    uint32_t real_samples_to_mix = 0;
+    uint32_t out_size = size;
+    uint32_t stride, buses;
+    struct _event *event;
+    int32_t *tmp_buffer;
+    int32_t *out_buffer;
+    int end_encountered;
+    const struct _WM_Backend *synth;
+    int interp;
 
-    tmp_buffer = mdi->mix_buffer;
+    WM_LockSong(mdi);
+    interp = WM_PickBackend(mdi, &synth);
+    if (interp < 0) {
+        WM_UnlockSong(mdi);
+        return (-1);
+    }
+    if (mdi->patches_ready < mdi->patch_count || mdi->stream) {
+        /* a streamed song is parsed on past the end of this buffer */
+        _WM_StreamMidiAhead(mdi, mdi->extra_info.current_sample + (size >> 2));
+    }
+    event = mdi->current_event;
 
-    memset(tmp_buffer, 0, ((size / 2) * sizeof(int32_t)));
+    tmp_buffer = WM_GetMixBuffer(mdi, size, output);
+    if (tmp_buffer == NULL) {
+        WM_ClearOutput(buffer, 0, out_size, output);
+        WM_UnlockSong(mdi);
+        return (-1);
+    }
     out_buffer = tmp_buffer;
+    stride = (output->stems) ? size / 2 : 0;
 
     do {
         if (__builtin_expect((!mdi->samples_to_mix), 0)) {
             end_encountered = 0;
-            while ((!mdi->samples_to_mix) && (event->do_event)) {
-                event->do_event(mdi, &event->event_data);
+            while ((!mdi->samples_to_mix) && (event->evtype != ev_null)) {
+                _WM_Checkpoint(mdi, event, (synth == &gus_backend));
+                /* _WM_do_event() keeps channel/meta state in sync, the synth does the sound */
+                if (synth->event)
+                    synth->event(mdi, event);
+                _WM_do_event(mdi, event);
                 if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack) && !end_encountered) {
                     end_encountered = 1; /* Avoid an infinite loop. */
+                    if (synth->reset)
+                        synth->reset(mdi);
                     _WM_ResetToStart(mdi);
                     event = mdi->current_event;
                 } else {
@@ -1353,16 +2047,22 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                 }
             }
 
-            if (!mdi->samples_to_mix) {
-                if (mdi->extra_info.current_sample
-                    >= mdi->extra_info.approx_total_samples) {
-                    break;
+            if (__builtin_expect((!mdi->samples_to_mix), 0)) {
+                if (mdi->extra_info.current_sample >= mdi->extra_info.approx_total_samples) {
+                    /* let release tails ring out past the end of the event list,
+                       capped so a stuck looping voice cannot play forever */
+                    if ((!synth->active) || (!synth->active(mdi))
+                        || ((mdi->extra_info.current_sample - mdi->extra_info.approx_total_samples)
+                             > ((uint32_t)mdi->ctx->sample_rate * 10))) {
+                        break;
+                    }
+                    mdi->samples_to_mix = size >> 2;
                 } else if ((mdi->extra_info.approx_total_samples
-                            - mdi->extra_info.current_sample) > (size >> 2)) {
+                             - mdi->extra_info.current_sample) > (size >> 2)) {
                     mdi->samples_to_mix = size >> 2;
                 } else {
                     mdi->samples_to_mix = mdi->extra_info.approx_total_samples
-                    - mdi->extra_info.current_sample;
+                                           - mdi->extra_info.current_sample;
                 }
             }
         }
@@ -1376,240 +2076,12 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
         }
 
         /* do mixing here */
-        count = real_samples_to_mix;
-        do {
-            note_data = mdi->note;
-            left_mix = right_mix = 0;
-
-            /* Vibrato LFO tick. Runs once per VIB_BLOCK samples and only
-               touches notes that actually have modulation applied. */
-            if (__builtin_expect((++mdi->vib_block_count >= VIB_BLOCK), 0)) {
-                struct _note *vib_note = mdi->note;
-                mdi->vib_block_count = 0;
-                while (vib_note) {
-                    if (vib_note->vib_depth) {
-                        _WM_update_note_vibrato(mdi, vib_note);
-                    }
-                    vib_note = vib_note->next;
-                }
-            }
-
-            if (__builtin_expect((note_data != NULL), 1)) {
-                while (note_data) {
-                    /*
-                     * ===================
-                     * resample the sample
-                     * ===================
-                     */
-                    data_pos = note_data->sample_pos >> FPBITS;
-
-                    /* check to see if we're near one of the ends */
-                    left = data_pos;
-                    right = (note_data->sample->data_length >> FPBITS) - left
-                            - 1;
-                    temp_n = (right << 1) - 1;
-                    if (temp_n <= 0)
-                        temp_n = 1;
-                    if (temp_n > (left << 1) + 1)
-                        temp_n = (left << 1) + 1;
-
-                    /* use Newton if we can't fill the window */
-                    if (temp_n < gauss_n) {
-                        xd = note_data->sample_pos & FPMASK;
-                        xd /= (1L << FPBITS);
-                        xd += temp_n >> 1;
-                        y = 0;
-                        sptr = note_data->sample->data
-                                + (note_data->sample_pos >> FPBITS)
-                                - (temp_n >> 1);
-                        for (ii = temp_n; ii;) {
-                            for (jj = 0; jj <= ii; jj++)
-                                y += sptr[jj] * newt_coeffs[ii][jj];
-                            y *= xd - --ii;
-                        }
-                        y += *sptr;
-                    } else { /* otherwise, use Gauss as usual */
-                        y = 0;
-                        gptr = &gauss_table[(note_data->sample_pos & FPMASK) *
-                                     (gauss_n + 1)];
-                        gend = gptr + gauss_n;
-                        sptr = note_data->sample->data
-                                + (note_data->sample_pos >> FPBITS)
-                                - (gauss_n >> 1);
-                        do {
-                            y += *(sptr++) * *(gptr++);
-                        } while (gptr <= gend);
-                    }
-
-                    premix = (int32_t)((y * ENV_AMP(note_data->env_level)) / 1024);
-
-                    left_mix += (premix * (int32_t)note_data->left_mix_volume) / 1024;
-                    right_mix += (premix * (int32_t)note_data->right_mix_volume) / 1024;
-
-                    /*
-                     * ========================
-                     * sample position checking
-                     * ========================
-                     */
-                    note_data->sample_pos += note_data->sample_inc;
-                    if (__builtin_expect(
-                                         (note_data->sample_pos > note_data->sample->loop_end),
-                                         0)) {
-                        if (note_data->modes & SAMPLE_LOOP) {
-                            note_data->sample_pos =
-                            note_data->sample->loop_start
-                            + ((note_data->sample_pos
-                                - note_data->sample->loop_start)
-                               % note_data->sample->loop_size);
-                        } else if (__builtin_expect(
-                                                    (note_data->sample_pos
-                                                     >= note_data->sample->data_length),
-                                                    0)) {
-                            goto _END_THIS_NOTE;
-                        }
-                    }
-
-                    if (__builtin_expect((note_data->env_inc == 0), 0)) {
-                        /*
-                         fprintf(stderr,"\r\nINC = 0, ENV %i, LEVEL %i, TARGET %d, RATE %i\r\n",
-                                 note_data->env, note_data->env_level,
-                                 note_data->sample->env_target[note_data->env],
-                                 note_data->sample->env_rate[note_data->env]);
-                         */
-                        note_data = note_data->next;
-                        continue;
-                    }
-
-                    note_data->env_level += note_data->env_inc;
-                    /*
-                     fprintf(stderr,"\r\nENV %i, LEVEL %i, TARGET %d, RATE %i, INC %i\r\n",
-                             note_data->env, note_data->env_level,
-                             note_data->sample->env_target[note_data->env],
-                             note_data->sample->env_rate[note_data->env],
-                             note_data->env_inc);
-                     */
-                    if (note_data->env_inc < 0) {
-                        if (note_data->env_level
-                            > note_data->sample->env_target[note_data->env]) {
-                            note_data = note_data->next;
-                            continue;
-                        }
-                    } else if (note_data->env_inc > 0) {
-                        if (note_data->env_level
-                            < note_data->sample->env_target[note_data->env]) {
-                            note_data = note_data->next;
-                            continue;
-                        }
-                    }
-
-                    /* Yes could have a condition here but
-                       it would create another bottleneck */
-
-                    note_data->env_level =
-                    note_data->sample->env_target[note_data->env];
-                    switch (note_data->env) {
-                        case 0:
-                            if (!(note_data->modes & SAMPLE_ENVELOPE)) {
-                                note_data->env_inc = 0;
-                                note_data = note_data->next;
-                                continue;
-                            }
-                            break;
-                        case 2:
-                            if (note_data->modes & SAMPLE_SUSTAIN /*|| note_data->hold*/) {
-                                note_data->env_inc = 0;
-                                note_data = note_data->next;
-                            } else {
-                                env_ptr = (note_data->modes & SAMPLE_CLAMPED)? 5 : 4;
-                                note_data->env = env_ptr;
-                                if (note_data->env_level
-                                        > note_data->sample->env_target[env_ptr]) {
-                                    note_data->env_inc =
-                                        -note_data->sample->env_rate[env_ptr];
-                                } else {
-                                    note_data->env_inc =
-                                        note_data->sample->env_rate[env_ptr];
-                                }
-                            }
-                            continue;
-                        case 5:
-                            if (__builtin_expect((note_data->env_level == 0), 1)) {
-                                goto _END_THIS_NOTE;
-                            }
-                            /* sample release */
-                            if (note_data->modes & SAMPLE_LOOP)
-                                note_data->modes ^= SAMPLE_LOOP;
-                            note_data->env_inc = 0;
-                            note_data = note_data->next;
-                            continue;
-                        case 6:
-                        _END_THIS_NOTE:
-                            if (__builtin_expect((note_data->replay != NULL), 1)) {
-                                note_data->active = 0;
-                                {
-                                    struct _note *prev_note = NULL;
-                                    struct _note *nte_array = mdi->note;
-
-                                    if (nte_array != note_data) {
-                                        do {
-                                            prev_note = nte_array;
-                                            nte_array = nte_array->next;
-                                        } while (nte_array != note_data);
-                                    }
-                                    if (prev_note) {
-                                        prev_note->next = note_data->replay;
-                                    } else {
-                                        mdi->note = note_data->replay;
-                                    }
-                                    note_data->replay->next = note_data->next;
-                                    note_data = note_data->replay;
-                                    note_data->active = 1;
-                                }
-                            } else {
-                                note_data->active = 0;
-                                {
-                                    struct _note *prev_note = NULL;
-                                    struct _note *nte_array = mdi->note;
-
-                                    if (nte_array != note_data) {
-                                        do {
-                                            prev_note = nte_array;
-                                            nte_array = nte_array->next;
-                                        } while ((nte_array != note_data)
-                                                 && (nte_array));
-                                    }
-                                    if (prev_note) {
-                                        prev_note->next = note_data->next;
-                                    } else {
-                                        mdi->note = note_data->next;
-                                    }
-                                    note_data = note_data->next;
-                                }
-                            }
-                            continue;
-                    }
-                    note_data->env++;
-
-                    if (note_data->is_off == 1) {
-                        _WM_do_note_off_extra(note_data);
-                    } else {
-
-                        if (note_data->env_level
-                            >= note_data->sample->env_target[note_data->env]) {
-                            note_data->env_inc =
-                            -note_data->sample->env_rate[note_data->env];
-                        } else {
-                            note_data->env_inc =
-                            note_data->sample->env_rate[note_data->env];
-                        }
-                    }
-                    note_data = note_data->next;
-                    continue;
-                }
-            }
-            *tmp_buffer++ = left_mix;
-            *tmp_buffer++ = right_mix;
-        } while (--count);
+        for (buses = 0; buses < ((stride) ? WM_STEM_BUSES : 1); buses++) {
+            memset(&tmp_buffer[buses * stride], 0,
+                   real_samples_to_mix * 2 * sizeof(int32_t));
+        }
+        synth->render(mdi, tmp_buffer, stride, real_samples_to_mix, interp);
+        tmp_buffer += real_samples_to_mix * 2;
 
         buffer_used += real_samples_to_mix * 4;
         size -= (real_samples_to_mix << 2);
@@ -1619,41 +2091,12 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
 
     tmp_buffer = out_buffer;
 
-    if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
-        _WM_do_reverb(mdi->reverb, tmp_buffer, (buffer_used / 2));
-    }
-
     /* _WM_DynamicVolumeAdjust(mdi, tmp_buffer, (buffer_used/2)); */
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
+    WM_WriteOutput(mdi, tmp_buffer, stride, buffer, buffer_used / 2, output);
+    WM_ClearOutput(buffer, buffer_used, out_size, output);
 
-        /* The packing below only keeps 16 bits: without a clamp, an
-           over-full mix wraps around into full-scale pops. */
-        if (left_mix > 32767) left_mix = 32767;
-        else if (left_mix < -32768) left_mix = -32768;
-        if (right_mix > 32767) right_mix = 32767;
-        else if (right_mix < -32768) right_mix = -32768;
-
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
-#ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-#else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-#endif
-    }
-    _WM_Unlock(&mdi->lock);
+    WM_UnlockSong(mdi);
     return (buffer_used);
 }
 
@@ -1671,12 +2114,22 @@ WM_SYMBOL int WildMidi_ConvertToMidi (const char *file, uint8_t **out, uint32_t
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL filename)", 0);
         return (-1);
     }
-    if ((buf = (uint8_t *) _WM_BufferFile(file, size)) == NULL) {
+    /* read through WildMidi_InitVIO()'s callbacks when there are some */
+    if (WM_Initialized) {
+        buf = (uint8_t *) WM_Default.buffer_file(file, size);
+    } else {
+        buf = (uint8_t *) _WM_BufferFileImpl(file, size);
+    }
+    if (buf == NULL) {
         return (-1);
     }
 
     ret = WildMidi_ConvertBufferToMidi(buf, *size, out, size);
-    _WM_FreeBufferFile(buf);
+    if (WM_Initialized) {
+        WM_Default.free_buffer_file(buf);
+    } else {
+        _WM_FreeBufferFileImpl(buf);
+    }
     return ret;
 }
 
@@ -1757,30 +2210,83 @@ WM_SYMBOL long WildMidi_GetVersion (void) {
     return (LIBWILDMIDI_VERSION);
 }
 
-static int _WM_Init(const struct _WM_VIO *callbacks,
-                    const char *config_file, uint16_t rate, uint16_t mixer_options) {
-    if (WM_Initialized) {
-        _WM_GLOBAL_ERROR(WM_ERR_ALR_INIT, NULL, 0);
-        return (-1);
+/* The tables every context shares are set up with the first one... */
+static void WM_AddContext(void) {
+    _WM_Lock(&WM_Contexts_lock);
+    if (WM_Contexts++ == 0) {
+        int i;
+
+        gauss_lock = 0;
+        sinc_lock = 0;
+        _WM_patch_lock = 0;
+        _WM_InitMixKernels();
+        for (i = 0; i < 1024; i++) {
+            env_amp_table[i] = (int32_t)(1024.0
+                * pow(2.0, ((double)i / 1023.0 - 1.0) * 6.0) + 0.5);
+        }
+    }
+    _WM_Unlock(&WM_Contexts_lock);
+}
+
+/* ... and freed with the last. */
+static void WM_DropContext(void) {
+    _WM_Lock(&WM_Contexts_lock);
+    if (--WM_Contexts == 0) {
+        _WM_CacheSet(NULL, 0);
+        free_gauss();
+        free_sinc();
+        _WM_PoolStop();
     }
+    _WM_Unlock(&WM_Contexts_lock);
+}
+
+/* what a context's config loaded */
+static void WM_FreeContextData(struct _WM_Context *ctx) {
+    WM_FreePatches(ctx);
+#ifdef WILDMIDI_SF2
+    _WM_SF2_Unload(ctx);
+#endif
+    _WM_OP2_Unload(ctx);
+}
 
+static int WM_InitContext(struct _WM_Context *ctx, const struct _WM_VIO *callbacks,
+                          const char *config_file, uint16_t rate, uint16_t mixer_options) {
     if (config_file == NULL) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG,
                 "(NULL config file pointer)", 0);
         return (-1);
     }
+    if ((mixer_options & 0x0780)
+        || ((mixer_options & WM_MO_SINC_RESAMPLING) > WM_MO_SINC_32)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)",
+                0);
+        return (-1);
+    }
+    if (rate < 11025) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG,
+                "(rate out of bounds, range is 11025 - 65535)", 0);
+        return (-1);
+    }
 
-    _WM_BufferFile = callbacks->allocate_file;
-    _WM_FreeBufferFile = callbacks->free_file;
+    memset(ctx, 0, sizeof(struct _WM_Context));
+    ctx->buffer_file = callbacks->allocate_file;
+    ctx->free_buffer_file = callbacks->free_file;
+    ctx->master_volume = 948;
+    ctx->reverb_room_width = 16.875f;
+    ctx->reverb_room_length = 22.5f;
+    ctx->reverb_listen_posx = 8.4375f;
+    ctx->reverb_listen_posy = 16.875f;
+    /* the OPL3 synth renders its patches at the context's rate */
+    ctx->sample_rate = rate;
+    ctx->mixer_options = mixer_options;
 
-    WM_InitPatches();
-    _WM_OP2_Unload(); /* a stale bank from a previous Init must not leak in */
+    WM_InitPatches(ctx);
 
     /* OPL3 soundbank sentinel: skip file loading entirely and populate
-       _WM_patch[] with GM voices rendered by the Nuked OPL3 emulator. */
+       ctx->patch[] with GM voices rendered by the Nuked OPL3 emulator. */
     if (strcmp(config_file, WM_OPL3_CONFIG) == 0) {
-        if (_WM_opl3_init_patches() < 0) {
-            WM_FreePatches();
+        if (_WM_opl3_init_patches(ctx) < 0) {
+            WM_FreeContextData(ctx);
             _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
             return (-1);
         }
@@ -1790,77 +2296,68 @@ static int _WM_Init(const struct _WM_VIO *callbacks,
         /* a soundfont or GENMIDI (.op2) FM bank can be given directly in
            place of a config file */
         uint32_t cfg_size = 0;
-        uint8_t *cfg_buffer = (uint8_t *) _WM_BufferFile(config_file, &cfg_size);
+        uint8_t *cfg_buffer = (uint8_t *) ctx->buffer_file(config_file, &cfg_size);
         if (cfg_buffer == NULL) {
-            WM_FreePatches();
+            WM_FreeContextData(ctx);
             return (-1);
         }
         if (_WM_OP2_Magic(cfg_buffer, cfg_size)) {
-            int res = _WM_OP2_Load(cfg_buffer, cfg_size);
-            _WM_FreeBufferFile(cfg_buffer);
-            if (res < 0 || _WM_opl3_init_patches() < 0) {
+            int res = _WM_OP2_Load(ctx, cfg_buffer, cfg_size);
+            ctx->free_buffer_file(cfg_buffer);
+            if (res < 0 || _WM_opl3_init_patches(ctx) < 0) {
                 _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(unable to load op2 bank)", 0);
-                WM_FreePatches();
+                WM_FreeContextData(ctx);
                 return (-1);
             }
             goto post_config_load;
         }
 #ifdef WILDMIDI_SF2
         if (_WM_SF2_Magic(cfg_buffer, cfg_size)) {
-            int res = _WM_SF2_Load(cfg_buffer, cfg_size);
-            _WM_FreeBufferFile(cfg_buffer);
+            int res = _WM_SF2_Load(ctx, cfg_buffer, cfg_size);
+            ctx->free_buffer_file(cfg_buffer);
             if (res < 0) {
                 _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(unable to load soundfont)", 0);
-                WM_FreePatches();
+                WM_FreeContextData(ctx);
                 return (-1);
             }
         } else
 #endif
         {
-            _WM_FreeBufferFile(cfg_buffer);
-            if (WM_LoadConfig(config_file) < 0) {
-#ifdef WILDMIDI_SF2
+            ctx->free_buffer_file(cfg_buffer);
+            if (WM_LoadConfig(ctx, config_file) < 0) {
                 /* a `soundfont` line may have loaded state before a later
-                   line failed; drop it so the next Init starts clean */
-                _WM_SF2_Unload();
-#endif
+                   line failed */
+                WM_FreeContextData(ctx);
                 return (-1);
             }
         }
     }
 
 post_config_load:
-    if (mixer_options & 0x0FF0) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)",
-                0);
-        WM_FreePatches();
-#ifdef WILDMIDI_SF2
-        _WM_SF2_Unload();
-#endif
-        return (-1);
-    }
-    _WM_MixerOptions = mixer_options;
+    _WM_CachePatchSet(ctx);
+    WM_AddContext();
 
-    if (rate < 11025) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG,
-                "(rate out of bounds, range is 11025 - 65535)", 0);
-        WM_FreePatches();
-#ifdef WILDMIDI_SF2
-        _WM_SF2_Unload();
-#endif
-        return (-1);
-    }
-    _WM_SampleRate = rate;
+    return (0);
+}
 
-    gauss_lock = 0;
-    _WM_patch_lock = 0;
-    _WM_MasterVolume = 948;
-    {
-        int i;
-        for (i = 0; i < 1024; i++) {
-            env_amp_table[i] = (int32_t)(1024.0
-                * pow(2.0, ((double)i / 1023.0 - 1.0) * 6.0) + 0.5);
-        }
+/* Close what is open in a context and free what its config loaded. */
+static void WM_CloseContext(struct _WM_Context *ctx) {
+    while (ctx->handles) {
+        /* closes open handle and rotates the handles list. */
+        WildMidi_Close((struct _mdi *) ctx->handles->handle);
+    }
+    WM_FreeContextData(ctx);
+    WM_DropContext();
+}
+
+static int _WM_Init(const struct _WM_VIO *callbacks,
+                    const char *config_file, uint16_t rate, uint16_t mixer_options) {
+    if (WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_ALR_INIT, NULL, 0);
+        return (-1);
+    }
+    if (WM_InitContext(&WM_Default, callbacks, config_file, rate, mixer_options) < 0) {
+        return (-1);
     }
     WM_Initialized = 1;
 
@@ -1881,9 +2378,64 @@ WM_SYMBOL int WildMidi_InitVIO(struct _WM_VIO *callbacks, const char *config_fil
     return _WM_Init(callbacks, config_file, rate, mixer_options);
 }
 
-WM_SYMBOL int WildMidi_MasterVolume(uint8_t master_volume) {
-    if (!WM_Initialized) {
-        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+/*
+ * A context is a synthesizer of its own: WildMidi_Init()'s config, rate and
+ * options, with its own patches, for the songs opened in it with
+ * WildMidi_OpenCtx(). Several can be in use at once, and alongside the one
+ * WildMidi_Init() sets up.
+ */
+static WildMidi_Context *WM_NewContext(const struct _WM_VIO *callbacks,
+                                       const char *config_file, uint16_t rate,
+                                       uint16_t mixer_options) {
+    struct _WM_Context *ctx;
+
+    ctx = (struct _WM_Context *) malloc(sizeof(struct _WM_Context));
+    if (ctx == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+        return (NULL);
+    }
+    if (WM_InitContext(ctx, callbacks, config_file, rate, mixer_options) < 0) {
+        free(ctx);
+        return (NULL);
+    }
+    return (ctx);
+}
+
+WM_SYMBOL WildMidi_Context *WildMidi_NewContext(const char *config_file, uint16_t rate,
+                                                uint16_t mixer_options) {
+    struct _WM_VIO callbacks_ = { _WM_BufferFileImpl, _WM_FreeBufferFileImpl };
+    return WM_NewContext(&callbacks_, config_file, rate, mixer_options);
+}
+
+WM_SYMBOL WildMidi_Context *WildMidi_NewContextVIO(struct _WM_VIO *callbacks,
+                                                   const char *config_file, uint16_t rate,
+                                                   uint16_t mixer_options) {
+    if (!callbacks || !callbacks->allocate_file || !callbacks->free_file) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL VIO callbacks)", 0);
+        return (NULL);
+    }
+
+    return WM_NewContext(callbacks, config_file, rate, mixer_options);
+}
+
+/* Close the songs open in a context and free it. */
+WM_SYMBOL int WildMidi_FreeContext(WildMidi_Context *context) {
+    if (context == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL context)", 0);
+        return (-1);
+    }
+    if (context == &WM_Default) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(not a context from WildMidi_NewContext)", 0);
+        return (-1);
+    }
+    WM_CloseContext(context);
+    free(context);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_MasterVolumeCtx(WildMidi_Context *context, uint8_t master_volume) {
+    if (context == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL context)", 0);
         return (-1);
     }
     if (master_volume > 127) {
@@ -1892,16 +2444,25 @@ WM_SYMBOL int WildMidi_MasterVolume(uint8_t master_volume) {
         return (-1);
     }
 
-    _WM_MasterVolume = _WM_lin_volume[master_volume];
+    context->master_volume = _WM_lin_volume[master_volume];
 
     return (0);
 }
 
+WM_SYMBOL int WildMidi_MasterVolume(uint8_t master_volume) {
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    return (WildMidi_MasterVolumeCtx(&WM_Default, master_volume));
+}
+
 WM_SYMBOL int WildMidi_Close(midi * handle) {
     struct _mdi *mdi = (struct _mdi *) handle;
+    struct _WM_Context *ctx;
     struct _hndl * tmp_handle;
 
-    if (!WM_Initialized) {
+    if (!WM_Contexts) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
@@ -1909,19 +2470,22 @@ WM_SYMBOL int WildMidi_Close(midi * handle) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
         return (-1);
     }
-    if (first_handle == NULL) {
+    ctx = mdi->ctx;
+    _WM_Lock(&ctx->lock);
+    if (ctx->handles == NULL) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(no midi's open)", 0);
+        _WM_Unlock(&ctx->lock);
         return (-1);
     }
     _WM_Lock(&mdi->lock);
-    if (first_handle->handle == handle) {
-        tmp_handle = first_handle->next;
-        free(first_handle);
-        first_handle = tmp_handle;
-        if (first_handle)
-            first_handle->prev = NULL;
+    if (ctx->handles->handle == handle) {
+        tmp_handle = ctx->handles->next;
+        free(ctx->handles);
+        ctx->handles = tmp_handle;
+        if (ctx->handles)
+            ctx->handles->prev = NULL;
     } else {
-        tmp_handle = first_handle;
+        tmp_handle = ctx->handles;
         while (tmp_handle->handle != handle) {
             tmp_handle = tmp_handle->next;
             if (tmp_handle == NULL) {
@@ -1936,19 +2500,58 @@ WM_SYMBOL int WildMidi_Close(midi * handle) {
             free(tmp_handle);
         }
     }
+    _WM_Unlock(&ctx->lock);
 
+    _WM_StreamMidiStore(mdi);
     _WM_freeMDI(mdi);
 
     return (0);
 }
 
-/* Detects the file format and parses the buffer into an mdi.
- * Requires size >= 18. */
-static midi *parse_midi_buffer(const uint8_t *mididata, uint32_t midisize) {
+/* Detects the file format and parses the buffer into an mdi, or takes it
+ * from the cache if the song was parsed before. Requires size >= 18. */
+/*
+ * Set up the copy of mdi's info WildMidi_GetInfo() hands out. The
+ * copyright is copied in here, once, so that WildMidi_GetInfo() has only
+ * plain fields to copy under the lock; a streamed song's is what the
+ * parse on opening found.
+ */
+static int WM_NewInfo(struct _mdi *mdi) {
+    struct _WM_Info *info;
+
+    info = (struct _WM_Info *) calloc(1, sizeof(struct _WM_Info));
+    if (info == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+        return (-1);
+    }
+    if (mdi->extra_info.copyright) {
+        info->copyright = (char *) malloc(strlen(mdi->extra_info.copyright) + 1);
+        if (info->copyright == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            free(info);
+            return (-1);
+        }
+        strcpy(info->copyright, mdi->extra_info.copyright);
+    }
+    mdi->tmp_info = info;
+    return (0);
+}
+
+static midi *parse_midi_buffer(struct _WM_Context *ctx, const uint8_t *mididata,
+                               uint32_t midisize, uint8_t probe) {
     uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
     uint8_t xmi_hdr[] = { 'F', 'O', 'R', 'M' };
+    /* a SMAF song's FM synth is built from the file itself */
+    int cached = (memcmp(mididata, "MMMD", 4) != 0);
     midi * ret = NULL;
 
+    if (cached && ((ret = (void *) _WM_CacheLoad(ctx, mididata, midisize, probe)) != NULL)) {
+        if (!probe) {
+            _WM_load_patches((struct _mdi *) ret);
+        }
+        return (ret);
+    }
+
     if (_WM_IsMangled(mididata, midisize)) {
         /* Gremlin games ship their HMP files compressed */
         uint8_t *unmangled = NULL;
@@ -1956,36 +2559,45 @@ static midi *parse_midi_buffer(const uint8_t *mididata, uint32_t midisize) {
 
         if (_WM_Unmangle(mididata, midisize, &unmangled, &unmangled_size) == 0) {
             if (unmangled_size >= 18 && memcmp(unmangled, "HMI-MIDISONG061595", 18) == 0) {
-                ret = (void *) _WM_ParseNewHmi(unmangled, unmangled_size);
+                ret = (void *) _WM_ParseNewHmi(ctx, unmangled, unmangled_size, probe);
             } else {
-                ret = (void *) _WM_ParseNewHmp(unmangled, unmangled_size);
+                ret = (void *) _WM_ParseNewHmp(ctx, unmangled, unmangled_size, probe);
             }
             free(unmangled);
         }
     } else if (memcmp(mididata,"HMIMIDIP", 8) == 0) {
-        ret = (void *) _WM_ParseNewHmp(mididata, midisize);
+        ret = (void *) _WM_ParseNewHmp(ctx, mididata, midisize, probe);
     } else if (memcmp(mididata, "HMI-MIDISONG061595", 18) == 0) {
-        ret = (void *) _WM_ParseNewHmi(mididata, midisize);
+        ret = (void *) _WM_ParseNewHmi(ctx, mididata, midisize, probe);
     } else if (memcmp(mididata, mus_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewMus(mididata, midisize);
+        ret = (void *) _WM_ParseNewMus(ctx, mididata, midisize, probe);
     } else if (memcmp(mididata, xmi_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewXmi(mididata, midisize);
+        ret = (void *) _WM_ParseNewXmi(ctx, mididata, midisize, probe);
     } else if (memcmp(mididata, "MMMD", 4) == 0) {
-        ret = (void *) _WM_ParseNewSmaf(mididata, midisize);
+        ret = (void *) _WM_ParseNewSmaf(ctx, mididata, midisize, probe);
     } else {
-        ret = (void *) _WM_ParseNewMidi(mididata, midisize);
+        ret = (void *) _WM_ParseNewMidi(ctx, mididata, midisize, probe);
+    }
+
+    if (ret != NULL && !probe) {
+        /* a streamed song is stored once it has all been parsed */
+        if (cached && !((struct _mdi *) ret)->stream) {
+            _WM_CacheStore((struct _mdi *) ret, mididata, midisize);
+        }
+        _WM_load_patches((struct _mdi *) ret);
     }
 
     return (ret);
 }
 
-WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
+WM_SYMBOL midi *WildMidi_OpenCtx(WildMidi_Context *context, const char *midifile) {
     uint8_t *mididata = NULL;
     uint32_t midisize = 0;
     midi * ret = NULL;
+    uint64_t start = _WM_Clock();
 
-    if (!WM_Initialized) {
-        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+    if (context == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL context)", 0);
         return (NULL);
     }
     if (midifile == NULL) {
@@ -1993,19 +2605,21 @@ WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
         return (NULL);
     }
 
-    if ((mididata = (uint8_t *) _WM_BufferFile(midifile, &midisize)) == NULL) {
+    if ((mididata = (uint8_t *) context->buffer_file(midifile, &midisize)) == NULL) {
         return (NULL);
     }
     if (midisize < 18) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
         return (NULL);
     }
-    ret = parse_midi_buffer(mididata, midisize);
-    _WM_FreeBufferFile(mididata);
+    ret = parse_midi_buffer(context, mididata, midisize, 0);
+    context->free_buffer_file(mididata);
 
     if (ret) {
-        if (add_handle(ret) != 0) {
-            WildMidi_Close(ret);
+        ((struct _mdi *) ret)->extra_info.open_time = (uint32_t) (_WM_Clock() - start);
+        if ((WM_NewInfo((struct _mdi *) ret) != 0)
+            || (add_handle(context, ret) != 0)) {
+            _WM_freeMDI((struct _mdi *) ret);
             ret = NULL;
         }
     }
@@ -2013,13 +2627,23 @@ WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
     return (ret);
 }
 
-WM_SYMBOL midi *WildMidi_OpenBuffer(const uint8_t *midibuffer, uint32_t size) {
-    midi * ret = NULL;
-
+WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
     if (!WM_Initialized) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (NULL);
     }
+    return (WildMidi_OpenCtx(&WM_Default, midifile));
+}
+
+WM_SYMBOL midi *WildMidi_OpenBufferCtx(WildMidi_Context *context,
+                                       const uint8_t *midibuffer, uint32_t size) {
+    midi * ret = NULL;
+    uint64_t start = _WM_Clock();
+
+    if (context == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL context)", 0);
+        return (NULL);
+    }
     if (midibuffer == NULL) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL midi data buffer)", 0);
         return (NULL);
@@ -2033,11 +2657,13 @@ WM_SYMBOL midi *WildMidi_OpenBuffer(const uint8_t *midibuffer, uint32_t size) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
         return (NULL);
     }
-    ret = parse_midi_buffer(midibuffer, size);
+    ret = parse_midi_buffer(context, midibuffer, size, 0);
 
     if (ret) {
-        if (add_handle(ret) != 0) {
-            WildMidi_Close(ret);
+        ((struct _mdi *) ret)->extra_info.open_time = (uint32_t) (_WM_Clock() - start);
+        if ((WM_NewInfo((struct _mdi *) ret) != 0)
+            || (add_handle(context, ret) != 0)) {
+            _WM_freeMDI((struct _mdi *) ret);
             ret = NULL;
         }
     }
@@ -2045,15 +2671,123 @@ WM_SYMBOL midi *WildMidi_OpenBuffer(const uint8_t *midibuffer, uint32_t size) {
     return (ret);
 }
 
-WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
+WM_SYMBOL midi *WildMidi_OpenBuffer(const uint8_t *midibuffer, uint32_t size) {
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (NULL);
+    }
+    return (WildMidi_OpenBufferCtx(&WM_Default, midibuffer, size));
+}
+
+/*
+ * Parse a song for its length and text alone: the patches aren't loaded and
+ * no synth or reverb is set up, so it costs little more than the event scan.
+ */
+WM_SYMBOL int WildMidi_ProbeCtx(WildMidi_Context *context, const uint8_t *midibuffer,
+                                uint32_t size, struct _WM_ProbeInfo *info) {
     struct _mdi *mdi;
-    struct _event *event;
-    struct _note *note_data;
+    const char *name;
+    char *names;
+    size_t names_len = 0;
+    size_t len;
+    uint32_t songs = 0;
+    uint32_t i;
+
+    if (context == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL context)", 0);
+        return (-1);
+    }
+    if (midibuffer == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL midi data buffer)", 0);
+        return (-1);
+    }
+    if (info == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL info pointer)", 0);
+        return (-1);
+    }
+    if (size > WM_MAXFILESIZE) {
+        _WM_GLOBAL_ERROR(WM_ERR_LONGFIL, NULL, 0);
+        return (-1);
+    }
+    if (size < 18) {
+        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
+        return (-1);
+    }
+    memset(info, 0, sizeof(struct _WM_ProbeInfo));
+
+    mdi = (struct _mdi *) parse_midi_buffer(context, midibuffer, size, 1);
+    if (mdi == NULL) {
+        return (-1);
+    }
+
+    for (i = 0; i < mdi->event_count; i++) {
+        if (mdi->events[i].evtype == ev_meta_trackname) {
+            names_len += strlen(&mdi->event_text[mdi->events[i].value]) + 1;
+        } else if (mdi->events[i].evtype == ev_meta_endoftrack) {
+            songs++;
+        }
+    }
+    if (names_len) {
+        names = (char *) malloc(names_len);
+        if (names == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            _WM_freeMDI(mdi);
+            return (-1);
+        }
+        info->track_names = names;
+        for (i = 0; i < mdi->event_count; i++) {
+            if (mdi->events[i].evtype != ev_meta_trackname)
+                continue;
+            name = &mdi->event_text[mdi->events[i].value];
+            len = strlen(name);
+            memcpy(names, name, len);
+            names += len;
+            *names++ = '\n';
+        }
+        names[-1] = '\0';
+    }
+
+    info->copyright = mdi->extra_info.copyright;
+    mdi->extra_info.copyright = NULL;
+    info->approx_total_samples = mdi->extra_info.approx_total_samples;
+    info->total_midi_time = (uint32_t)(((uint64_t)info->approx_total_samples * 1000)
+                                       / context->sample_rate);
+    if ((mdi->is_type2) && (songs > 1)) {
+        info->songs = (songs > 0xffff) ? 0xffff : (uint16_t)songs;
+    } else {
+        info->songs = 1;
+    }
+
+    _WM_freeMDI(mdi);
+    return (0);
+}
 
+WM_SYMBOL int WildMidi_Probe(const uint8_t *midibuffer, uint32_t size,
+                             struct _WM_ProbeInfo *info) {
     if (!WM_Initialized) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
+    return (WildMidi_ProbeCtx(&WM_Default, midibuffer, size, info));
+}
+
+/*
+ * Move to song position *sample_pos by running the events up to it without
+ * rendering. A fast seek drops whatever was playing. An accurate seek keeps
+ * the GUS notes, stepping them on with gus_skip_notes() between events and
+ * starting from the notes a checkpoint kept, so the position sounds as if
+ * it had been played up to.
+ */
+static int WM_Seek(midi * handle, unsigned long int *sample_pos, int accurate) {
+    struct _mdi *mdi;
+    struct _event *event;
+    uint32_t skip, target;
+    int interp;
+
+    if (!WM_Contexts) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
     if (handle == NULL) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
         return (-1);
@@ -2064,9 +2798,27 @@ WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
     }
 
     mdi = (struct _mdi *) handle;
-    _WM_Lock(&mdi->lock);
+    /* a streamed song is parsed up to where the seek lands, and the
+       patches it plays on the way there loaded */
+    target = (*sample_pos < UINT32_MAX) ? (uint32_t) *sample_pos : UINT32_MAX;
+    WM_LockStreamed(mdi, target, 0);
+    if (mdi->patches_ready < mdi->patch_count) {
+        _WM_load_patches_due(mdi, target);
+    }
     event = mdi->current_event;
 
+#ifdef WILDMIDI_SF2
+    /* the synths keep their own voices, which can't be stepped on */
+    if (mdi->sf2_synth) accurate = 0;
+#endif
+#ifdef WILDMIDI_MAFM
+    if (mdi->mafm_synth) accurate = 0;
+#endif
+    /* of the GUS mixers only the Gauss one checks positions its own way */
+    interp = ((mdi->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING)
+              && !(mdi->extra_info.mixer_options & WM_MO_SINC_RESAMPLING))
+             ? GUS_INTERP_GAUSS : GUS_INTERP_LINEAR;
+
     /* make sure we haven't asked for a positions beyond the end of the song. */
     if (*sample_pos > mdi->extra_info.approx_total_samples) {
         /* if so set the position to the end of the song */
@@ -2076,39 +2828,33 @@ WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
     /* was end of song requested and are we are there? */
     if (*sample_pos == mdi->extra_info.approx_total_samples) {
         /* yes */
-        _WM_Unlock(&mdi->lock);
+        WM_UnlockSong(mdi);
         return (0);
     }
 
     /* did we want to fast forward? */
     if (mdi->extra_info.current_sample > *sample_pos) {
-        /* no - reset some stuff */
-        event = mdi->events;
-        _WM_ResetToStart((struct _mdi *) handle);
-        mdi->extra_info.current_sample = 0;
-        mdi->samples_to_mix = 0;
-#ifdef WILDMIDI_SF2
-        /* Rewind TSF too so replayed events rebuild its state from scratch. */
-        if (mdi->sf2_synth) {
-            _WM_SF2_Reset(mdi->sf2_synth);
-        }
-#endif
-#ifdef WILDMIDI_MAFM
-        if (mdi->mafm_synth) {
-            _WM_MAFM_Reset(mdi->mafm_synth);
-        }
-#endif
+        /* no - go back to the nearest checkpoint, synth state included, and
+           replay from there */
+        event = _WM_RestoreCheckpoint(mdi, (uint32_t) *sample_pos, UINT32_MAX,
+                                      accurate);
     }
 
     if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > *sample_pos) {
-        mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - *sample_pos;
+        skip = (uint32_t) *sample_pos - mdi->extra_info.current_sample;
+        mdi->samples_to_mix -= skip;
         mdi->extra_info.current_sample = *sample_pos;
+        if (accurate)
+            gus_skip_notes(mdi, skip, interp);
     } else {
         mdi->extra_info.current_sample += mdi->samples_to_mix;
+        if (accurate)
+            gus_skip_notes(mdi, mdi->samples_to_mix, interp);
         mdi->samples_to_mix = 0;
-        while ((!mdi->samples_to_mix) && (event->do_event)) {
+        while ((!mdi->samples_to_mix) && (event->evtype != ev_null)) {
+            _WM_Checkpoint(mdi, event, accurate);
 #ifdef WILDMIDI_SF2
-            /* Mirror GetOutput_SF2: the TSF synth keeps its own voice/channel
+            /* Mirror WM_Render(): the TSF synth keeps its own voice/channel
                state, so seek must feed it too — otherwise voices from before
                the seek get no note-off (hang) and later note-ons pile on. */
             if (mdi->sf2_synth) {
@@ -2123,54 +2869,50 @@ WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
                 _WM_MAFM_Event(mdi->mafm_synth, mdi, event);
             }
 #endif
-            event->do_event(mdi, &event->event_data);
+            _WM_do_event(mdi, event);
             mdi->samples_to_mix = event->samples_to_next;
 
             if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > *sample_pos) {
-                mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - *sample_pos;
+                skip = (uint32_t) *sample_pos - mdi->extra_info.current_sample;
+                mdi->samples_to_mix -= skip;
                 mdi->extra_info.current_sample = *sample_pos;
             } else {
+                skip = mdi->samples_to_mix;
                 mdi->extra_info.current_sample += mdi->samples_to_mix;
                 mdi->samples_to_mix = 0;
             }
+            if (accurate)
+                gus_skip_notes(mdi, skip, interp);
             event++;
         }
         mdi->current_event = event;
     }
 
-    /*
-     * Clear notes as this is a fast seek so we only care
-     * about new notes.
-     *
-     * NOTE: This function is for performance only.
-     * Might need a WildMidi_SlowSeek if we need better accuracy.
-     */
-    note_data = mdi->note;
-    if (note_data) {
-        do {
-            note_data->active = 0;
-            if (note_data->replay) {
-                note_data->replay = NULL;
-            }
-            note_data = note_data->next;
-        } while (note_data);
-    }
-    mdi->note = NULL;
+    /* a fast seek only cares about new notes */
+    if (!accurate)
+        _WM_ClearNotes(mdi);
 
     /* clear the reverb buffers since we not gonna be using them here */
     _WM_reset_reverb(mdi->reverb);
 
-    _WM_Unlock(&mdi->lock);
+    WM_UnlockSong(mdi);
     return (0);
 }
 
+WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
+    return (WM_Seek(handle, sample_pos, 0));
+}
+
+WM_SYMBOL int WildMidi_AccurateSeek(midi * handle, unsigned long int *sample_pos) {
+    return (WM_Seek(handle, sample_pos, 1));
+}
+
 WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
     struct _mdi *mdi;
     struct _event *event;
     struct _event *event_new;
-    struct _note *note_data;
 
-    if (!WM_Initialized) {
+    if (!WM_Contexts) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
@@ -2179,16 +2921,16 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
         return (-1);
     }
     mdi = (struct _mdi *) handle;
-    _WM_Lock(&mdi->lock);
+    WM_LockSong(mdi);
 
     if ((!mdi->is_type2) && (nextsong != 0)) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(Illegal use. Only usable with files detected to be type 2 compatible.", 0);
-        _WM_Unlock(&mdi->lock);
+        WM_UnlockSong(mdi);
         return (-1);
     }
     if ((nextsong > 1) || (nextsong < -1)) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(Invalid nextsong: -1 is previous song, 0 is start of current song, 1 is next song)", 0);
-        _WM_Unlock(&mdi->lock);
+        WM_UnlockSong(mdi);
         return (-1);
     }
 
@@ -2214,14 +2956,8 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
             event--;
         }
         event_new = event;
-        event = mdi->events;
-        _WM_ResetToStart((struct _mdi *) handle);
-#ifdef WILDMIDI_SF2
-        if (mdi->sf2_synth) _WM_SF2_Reset(mdi->sf2_synth);
-#endif
-#ifdef WILDMIDI_MAFM
-        if (mdi->mafm_synth) _WM_MAFM_Reset(mdi->mafm_synth);
-#endif
+        event = _WM_RestoreCheckpoint(mdi, UINT32_MAX,
+                                      (uint32_t)(event_new - mdi->events), 0);
 
     } else if (nextsong == 1) {
         /* goto start of next song */
@@ -2251,355 +2987,355 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
             event--;
         }
         event_new = event;
-        event = mdi->events;
-        _WM_ResetToStart((struct _mdi *) handle);
-#ifdef WILDMIDI_SF2
-        if (mdi->sf2_synth) _WM_SF2_Reset(mdi->sf2_synth);
-#endif
-#ifdef WILDMIDI_MAFM
-        if (mdi->mafm_synth) _WM_MAFM_Reset(mdi->mafm_synth);
-#endif
+        event = _WM_RestoreCheckpoint(mdi, UINT32_MAX,
+                                      (uint32_t)(event_new - mdi->events), 0);
     }
 
     while (event != event_new) {
+        _WM_Checkpoint(mdi, event, 0);
 #ifdef WILDMIDI_SF2
         if (mdi->sf2_synth) _WM_SF2_Event(mdi->sf2_synth, mdi, event);
 #endif
 #ifdef WILDMIDI_MAFM
         if (mdi->mafm_synth) _WM_MAFM_Event(mdi->mafm_synth, mdi, event);
 #endif
-        event->do_event(mdi, &event->event_data);
+        _WM_do_event(mdi, event);
         mdi->extra_info.current_sample += event->samples_to_next;
         event++;
     }
 
     mdi->current_event = event;
 
-    note_data = mdi->note;
-    if (note_data) {
-        do {
-            note_data->active = 0;
-            if (note_data->replay) {
-                note_data->replay = NULL;
-            }
-            note_data = note_data->next;
-        } while (note_data);
-    }
-    mdi->note = NULL;
+    _WM_ClearNotes(mdi);
 
-    _WM_Unlock(&mdi->lock);
+    WM_UnlockSong(mdi);
     return (0);
 }
 
-#ifdef WILDMIDI_SF2
-static int WM_GetOutput_SF2(midi * handle, int8_t *buffer, uint32_t size) {
-    uint32_t buffer_used = 0;
-    uint32_t i;
-    struct _mdi *mdi = (struct _mdi *) handle;
-    uint32_t real_samples_to_mix = 0;
-    int32_t left_mix, right_mix;
-    struct _event *event;
-    int32_t *tmp_buffer;
-    int32_t *out_buffer;
-    int end_encountered;
-
-    _WM_Lock(&mdi->lock);
-    event = mdi->current_event;
-
-    memset(buffer, 0, size);
+/*
+ * The song's tempo map: every tempo and time signature change, with the
+ * tick and sample it falls on, kept from the parse. These look the nearest
+ * change up by binary search.
+ */
+WM_SYMBOL int WildMidi_TickToSample (midi * handle, uint32_t tick, uint32_t *sample) {
+    struct _mdi *mdi;
 
-    if ( (size / 2) > mdi->mix_buffer_size) {
-        uint32_t new_size = ((size / 2) <= (mdi->mix_buffer_size * 2))
-            ? mdi->mix_buffer_size + MEM_CHUNK : size / 2;
-        int32_t *new_buf;
-        if (new_size > (UINT32_MAX / sizeof(int32_t))) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
-        }
-        new_buf = (int32_t *) realloc(mdi->mix_buffer, new_size * sizeof(int32_t));
-        if (new_buf == NULL) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
-        }
-        mdi->mix_buffer = new_buf;
-        mdi->mix_buffer_size = new_size;
+    if (!WM_Contexts) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
     }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (sample == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL sample)", 0);
+        return (-1);
+    }
+    mdi = (struct _mdi *) handle;
+    WM_LockStreamed(mdi, 0, tick);
+    *sample = _WM_TickToSample(mdi, tick);
+    WM_UnlockSong(mdi);
+    return (0);
+}
 
-    tmp_buffer = mdi->mix_buffer;
-
-    memset(tmp_buffer, 0, ((size / 2) * sizeof(int32_t)));
-    out_buffer = tmp_buffer;
-
-    do {
-        if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-            end_encountered = 0;
-            while ((!mdi->samples_to_mix) && (event->do_event)) {
-                /* do_event keeps channel/meta state in sync, the synth does the sound */
-                _WM_SF2_Event(mdi->sf2_synth, mdi, event);
-                event->do_event(mdi, &event->event_data);
-                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack) && !end_encountered) {
-                    end_encountered = 1; /* Avoid an infinite loop. */
-                    _WM_SF2_Reset(mdi->sf2_synth);
-                    _WM_ResetToStart(mdi);
-                    event = mdi->current_event;
-                } else {
-                    /* += : keep any release allowance set by the
-                       end-of-track event (_WM_Release_Allowance). */
-                    mdi->samples_to_mix += event->samples_to_next;
-                    event++;
-                    mdi->current_event = event;
-                }
-            }
-
-            if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-                if (mdi->extra_info.current_sample >= mdi->extra_info.approx_total_samples) {
-                    /* let release tails ring out past the end of the event list,
-                       capped so a stuck looping voice cannot play forever */
-                    if ((!_WM_SF2_ActiveVoices(mdi->sf2_synth))
-                        || ((mdi->extra_info.current_sample - mdi->extra_info.approx_total_samples)
-                             > ((uint32_t)_WM_SampleRate * 10))) {
-                        break;
-                    }
-                    mdi->samples_to_mix = size >> 2;
-                } else if ((mdi->extra_info.approx_total_samples
-                             - mdi->extra_info.current_sample) > (size >> 2)) {
-                    mdi->samples_to_mix = size >> 2;
-                } else {
-                    mdi->samples_to_mix = mdi->extra_info.approx_total_samples
-                                           - mdi->extra_info.current_sample;
-                }
-            }
-        }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
-            real_samples_to_mix = size >> 2;
-        } else {
-            real_samples_to_mix = mdi->samples_to_mix;
-            if (real_samples_to_mix == 0) {
-                continue;
-            }
-        }
-
-        _WM_SF2_Render(mdi->sf2_synth, tmp_buffer, real_samples_to_mix);
-        tmp_buffer += real_samples_to_mix * 2;
+WM_SYMBOL int WildMidi_SampleToTick (midi * handle, uint32_t sample, uint32_t *tick) {
+    struct _mdi *mdi;
 
-        buffer_used += real_samples_to_mix * 4;
-        size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
-    } while (size);
+    if (!WM_Contexts) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (tick == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL tick)", 0);
+        return (-1);
+    }
+    mdi = (struct _mdi *) handle;
+    WM_LockStreamed(mdi, sample, 0);
+    *tick = _WM_SampleToTick(mdi, sample);
+    WM_UnlockSong(mdi);
+    return (0);
+}
 
-    tmp_buffer = out_buffer;
+WM_SYMBOL int WildMidi_GetBarBeat (midi * handle, uint32_t tick, struct _WM_BarBeat *pos) {
+    struct _mdi *mdi;
 
-    if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
-        _WM_do_reverb(mdi->reverb, tmp_buffer, (buffer_used / 2));
+    if (!WM_Contexts) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
     }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (pos == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL pos)", 0);
+        return (-1);
+    }
+    mdi = (struct _mdi *) handle;
+    WM_LockStreamed(mdi, 0, tick);
+    _WM_TickToBarBeat(mdi, tick, pos);
+    WM_UnlockSong(mdi);
+    return (0);
+}
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
-
-        /* The packing below only keeps 16 bits: without a clamp, an
-           over-full mix wraps around into full-scale pops. */
-        if (left_mix > 32767) left_mix = 32767;
-        else if (left_mix < -32768) left_mix = -32768;
-        if (right_mix > 32767) right_mix = 32767;
-        else if (right_mix < -32768) right_mix = -32768;
+/* size is in bytes of the caller's format */
+static int WM_GetOutput(midi * handle, void *buffer, uint32_t size,
+                        const struct _WM_Output *output) {
+    int format = output->format;
+    int res;
 
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
-#ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-#else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-#endif
+    if (__builtin_expect((!WM_Contexts), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
     }
+    if (__builtin_expect((handle == NULL), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    /* stem rendering may leave out the master mix */
+    if (__builtin_expect(((buffer == NULL) && (output->stems == NULL)), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
+        return (-1);
+    }
+    if (__builtin_expect((size == 0), 0)) {
+        return (0);
+    }
+    if (__builtin_expect((!!(size % (2 * WM_OUT_BYTES(format)))), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, (format == WM_OUT_S16)
+                         ? "(size not a multiple of 4)"
+                         : "(size not a multiple of 8)", 0);
+        return (-1);
+    }
+    /* the renderers count in 16 bit stereo bytes */
+    size = (size / WM_OUT_BYTES(format)) * 2;
 
-    _WM_Unlock(&mdi->lock);
-    return (buffer_used);
+    res = WM_Render(handle, buffer, size, output);
+    if (res <= 0)
+        return (res);
+    return ((res / 2) * WM_OUT_BYTES(format));
 }
-#endif /* WILDMIDI_SF2 */
 
-#ifdef WILDMIDI_MAFM
-/* Yamaha FM output path.  Structurally identical to WM_GetOutput_SF2: the
- * event list keeps channel/meta state in sync while the FM synth generates the
- * sound and renders PCM into the mix buffer. */
-static int WM_GetOutput_MAFM(midi * handle, int8_t *buffer, uint32_t size) {
-    uint32_t buffer_used = 0;
-    uint32_t i;
-    struct _mdi *mdi = (struct _mdi *) handle;
-    uint32_t real_samples_to_mix = 0;
-    int32_t left_mix, right_mix;
-    struct _event *event;
-    int32_t *tmp_buffer;
-    int32_t *out_buffer;
-    int end_encountered;
+WM_SYMBOL int WildMidi_GetOutput(midi * handle, int8_t *buffer, uint32_t size) {
+    struct _WM_Output output = { WM_OUT_S16, 1.0f, NULL };
+    return (WM_GetOutput(handle, buffer, size, &output));
+}
 
-    _WM_Lock(&mdi->lock);
-    event = mdi->current_event;
+WM_SYMBOL int WildMidi_GetOutputS32(midi * handle, int32_t *buffer, uint32_t size) {
+    struct _WM_Output output = { WM_OUT_S32, 1.0f, NULL };
+    return (WM_GetOutput(handle, buffer, size, &output));
+}
 
-    memset(buffer, 0, size);
+WM_SYMBOL int WildMidi_GetOutputFloat(midi * handle, float *buffer, uint32_t size) {
+    struct _WM_Output output = { WM_OUT_F32, 1.0f, NULL };
+    return (WM_GetOutput(handle, buffer, size, &output));
+}
 
-    if ( (size / 2) > mdi->mix_buffer_size) {
-        uint32_t new_size = ((size / 2) <= (mdi->mix_buffer_size * 2))
-            ? mdi->mix_buffer_size + MEM_CHUNK : size / 2;
-        int32_t *new_buf;
-        if (new_size > (UINT32_MAX / sizeof(int32_t))) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
-        }
-        new_buf = (int32_t *) realloc(mdi->mix_buffer, new_size * sizeof(int32_t));
-        if (new_buf == NULL) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
-            _WM_Unlock(&mdi->lock);
-            return (-1);
-        }
-        mdi->mix_buffer = new_buf;
-        mdi->mix_buffer_size = new_size;
+/* a gain to mix by is a finite number, 0 or more */
+static int WM_BadGain(float gain) {
+    if (__builtin_expect((!WM_Contexts), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (1);
+    }
+    if (__builtin_expect((!((gain >= 0.0f) && (gain <= FLT_MAX))), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(gain not a finite, positive number)", 0);
+        return (1);
     }
+    return (0);
+}
 
-    tmp_buffer = mdi->mix_buffer;
+WM_SYMBOL int WildMidi_MixOutputS32(midi * handle, int32_t *buffer, uint32_t size, float gain) {
+    struct _WM_Output output;
+    if (WM_BadGain(gain)) {
+        return (-1);
+    }
+    output.format = WM_OUT_MIX_S32;
+    output.gain = gain;
+    output.stems = NULL;
+    return (WM_GetOutput(handle, buffer, size, &output));
+}
 
-    memset(tmp_buffer, 0, ((size / 2) * sizeof(int32_t)));
-    out_buffer = tmp_buffer;
+WM_SYMBOL int WildMidi_MixOutputFloat(midi * handle, float *buffer, uint32_t size, float gain) {
+    struct _WM_Output output;
+    if (WM_BadGain(gain)) {
+        return (-1);
+    }
+    output.format = WM_OUT_MIX_F32;
+    output.gain = gain;
+    output.stems = NULL;
+    return (WM_GetOutput(handle, buffer, size, &output));
+}
 
-    do {
-        if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-            end_encountered = 0;
-            while ((!mdi->samples_to_mix) && (event->do_event)) {
-                _WM_MAFM_Event(mdi->mafm_synth, mdi, event);
-                event->do_event(mdi, &event->event_data);
-                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack) && !end_encountered) {
-                    end_encountered = 1;
-                    _WM_MAFM_Reset(mdi->mafm_synth);
-                    _WM_ResetToStart(mdi);
-                    event = mdi->current_event;
-                } else {
-                    mdi->samples_to_mix += event->samples_to_next;
-                    event++;
-                    mdi->current_event = event;
-                }
-            }
+WM_SYMBOL int WildMidi_GetOutputStems(midi * handle, float **stems, float *master, uint32_t size) {
+    struct _WM_Output output = { WM_OUT_F32, 1.0f, NULL };
 
-            if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-                if (mdi->extra_info.current_sample >= mdi->extra_info.approx_total_samples) {
-                    if ((!_WM_MAFM_ActiveVoices(mdi->mafm_synth))
-                        || ((mdi->extra_info.current_sample - mdi->extra_info.approx_total_samples)
-                             > ((uint32_t)_WM_SampleRate * 10))) {
-                        break;
-                    }
-                    mdi->samples_to_mix = size >> 2;
-                } else if ((mdi->extra_info.approx_total_samples
-                             - mdi->extra_info.current_sample) > (size >> 2)) {
-                    mdi->samples_to_mix = size >> 2;
-                } else {
-                    mdi->samples_to_mix = mdi->extra_info.approx_total_samples
-                                           - mdi->extra_info.current_sample;
-                }
-            }
-        }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
-            real_samples_to_mix = size >> 2;
-        } else {
-            real_samples_to_mix = mdi->samples_to_mix;
-            if (real_samples_to_mix == 0) {
-                continue;
-            }
-        }
+    if (__builtin_expect((!WM_Contexts), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (__builtin_expect((stems == NULL), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL stems pointer)", 0);
+        return (-1);
+    }
+    output.stems = stems;
+    return (WM_GetOutput(handle, master, size, &output));
+}
 
-        _WM_MAFM_Render(mdi->mafm_synth, tmp_buffer, real_samples_to_mix);
-        tmp_buffer += real_samples_to_mix * 2;
+/* a song of a batch, and what it took, in microseconds: the previous
+   batch's as it is scheduled, then this one's */
+struct _batch_slot {
+    uint32_t usecs;
+    uint32_t index;
+};
 
-        buffer_used += real_samples_to_mix * 4;
-        size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
-    } while (size);
+struct _batch {
+    midi **handles;
+    int8_t **buffers;
+    const uint32_t *sizes;
+    int *results;
+    struct _batch_slot *order; /* the schedule */
+    uint32_t count;
+    uint32_t next;          /* the next of order to claim */
+    struct _WM_Error error; /* the last a worker reported */
+};
 
-    tmp_buffer = out_buffer;
+/* the slowest songs first, so that no thread is left with a long one at
+   the end while the others wait */
+static int batch_slower(const void *a, const void *b) {
+    const struct _batch_slot *sa = (const struct _batch_slot *) a;
+    const struct _batch_slot *sb = (const struct _batch_slot *) b;
 
-    if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
-        _WM_do_reverb(mdi->reverb, tmp_buffer, (buffer_used / 2));
+    if (sa->usecs != sb->usecs) {
+        return ((sa->usecs > sb->usecs) ? -1 : 1);
     }
+    return ((sa->index > sb->index) - (sa->index < sb->index));
+}
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
-
-        if (left_mix > 32767) left_mix = 32767;
-        else if (left_mix < -32768) left_mix = -32768;
-        if (right_mix > 32767) right_mix = 32767;
-        else if (right_mix < -32768) right_mix = -32768;
-
-#ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-#else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-#endif
+/* every thread of a batch claims songs from the schedule until none are
+   left, so a thread that draws short ones just takes more */
+static void batch_render(void *data) {
+    struct _batch *batch = (struct _batch *) data;
+    struct _WM_Error *error = _WM_ThreadError();
+    unsigned int errors = error->count;
+    uint64_t start, took;
+    uint32_t n, i;
+
+    for (;;) {
+        n = _WM_AtomicLoad(&batch->next);
+        if (n >= batch->count) {
+            break;
+        }
+        if (!_WM_AtomicSwap(&batch->next, n, n + 1)) {
+            continue;
+        }
+        i = batch->order[n].index;
+        start = _WM_Clock();
+        batch->results[i] = WildMidi_GetOutput(batch->handles[i], batch->buffers[i],
+                                               batch->sizes[i]);
+        took = _WM_Clock() - start;
+        batch->order[n].usecs = (took > UINT32_MAX) ? UINT32_MAX : (uint32_t) took;
+    }
+    if (error->count != errors) {
+        _WM_ThreadLock();
+        batch->error = *error;
+        _WM_ThreadUnlock();
     }
-
-    _WM_Unlock(&mdi->lock);
-    return (buffer_used);
 }
-#endif /* WILDMIDI_MAFM */
 
-WM_SYMBOL int WildMidi_GetOutput(midi * handle, int8_t *buffer, uint32_t size) {
-    if (__builtin_expect((!WM_Initialized), 0)) {
+/*
+ * Renders one buffer of each of count songs, as WildMidi_GetOutput() would,
+ * spread over the worker pool. results[] gets what each call returned and
+ * usecs[], if not NULL, how long it took. What usecs[] held coming in, the
+ * times of the caller's previous batch, orders this one, slowest first.
+ * Returns -1 if any of them failed.
+ */
+WM_SYMBOL int WildMidi_RenderBatch(midi **handles, int8_t **buffers, const uint32_t *sizes,
+                                   uint32_t count, int *results, uint32_t *usecs) {
+    struct _batch batch;
+    struct _batch_slot *order;
+    struct _WM_Error *error;
+    unsigned int threads;
+    uint32_t i;
+    int ret = 0;
+
+    if (!WM_Contexts) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
-    if (__builtin_expect((handle == NULL), 0)) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+    if ((handles == NULL) || (buffers == NULL) || (sizes == NULL) || (results == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL array)", 0);
         return (-1);
     }
-    if (__builtin_expect((buffer == NULL), 0)) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
-        return (-1);
-    }
-    if (__builtin_expect((size == 0), 0)) {
+    if (count == 0) {
         return (0);
     }
-    if (__builtin_expect((!!(size % 4)), 0)) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(size not a multiple of 4)", 0);
+
+    order = (struct _batch_slot *) malloc(sizeof(struct _batch_slot) * count);
+    if (order == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
         return (-1);
     }
-
-#ifdef WILDMIDI_MAFM
-    if (((struct _mdi *) handle)->mafm_synth) {
-        return (WM_GetOutput_MAFM(handle, buffer, size));
+    for (i = 0; i < count; i++) {
+        order[i].usecs = (usecs != NULL) ? usecs[i] : 0;
+        order[i].index = i;
+    }
+    if (usecs != NULL) {
+        qsort(order, count, sizeof(struct _batch_slot), batch_slower);
+    }
+
+    batch.handles = handles;
+    batch.buffers = buffers;
+    batch.sizes = sizes;
+    batch.results = results;
+    batch.order = order;
+    batch.count = count;
+    batch.next = 0;
+    batch.error.code = WM_ERR_NONE;
+    _WM_Lock(&WM_Batch_lock);
+    threads = (WM_BatchThreads) ? WM_BatchThreads : _WM_CPUCount();
+    _WM_Unlock(&WM_Batch_lock);
+    if (threads > count) {
+        threads = count;
+    }
+    _WM_PoolRun(batch_render, &batch, threads);
+
+    if (usecs != NULL) {
+        for (i = 0; i < count; i++) {
+            usecs[order[i].index] = order[i].usecs;
+        }
     }
-#endif
-#ifdef WILDMIDI_SF2
-    if (((struct _mdi *) handle)->sf2_synth) {
-        return (WM_GetOutput_SF2(handle, buffer, size));
+    free(order);
+
+    if (batch.error.code != WM_ERR_NONE) {
+        error = _WM_ThreadError();
+        batch.error.count = error->count + 1;
+        *error = batch.error;
     }
-#endif
-    if (((struct _mdi *) handle)->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
-        if (!gauss_table) init_gauss();
-        return (WM_GetOutput_Gauss(handle, buffer, size));
+    for (i = 0; i < count; i++) {
+        if (results[i] < 0) {
+            ret = -1;
+        }
     }
-    return (WM_GetOutput_Linear(handle, buffer, size));
+    return (ret);
+}
+
+/*
+ * How many threads WildMidi_RenderBatch() renders on, the caller's
+ * included. 0, the default, is one per processor.
+ */
+WM_SYMBOL int WildMidi_SetBatchThreads(uint16_t threads) {
+    _WM_Lock(&WM_Batch_lock);
+    WM_BatchThreads = threads;
+    _WM_Unlock(&WM_Batch_lock);
+    return (0);
 }
 
 WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *size) {
-    if (__builtin_expect((!WM_Initialized), 0)) {
+    if (__builtin_expect((!WM_Contexts), 0)) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
@@ -2611,6 +3347,11 @@ WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *s
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
         return (-1);
     }
+    if (((struct _mdi *)handle)->stream) {
+        /* the conversion needs the whole song */
+        WM_LockStreamed((struct _mdi *)handle, UINT32_MAX, UINT32_MAX);
+        WM_UnlockSong((struct _mdi *)handle);
+    }
     return _WM_Event2Midi((struct _mdi *)handle, (uint8_t **)buffer, size);
 }
 
@@ -2618,7 +3359,7 @@ WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *s
 WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setting) {
     struct _mdi *mdi;
 
-    if (!WM_Initialized) {
+    if (!WM_Contexts) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
@@ -2628,29 +3369,36 @@ WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setti
     }
 
     mdi = (struct _mdi *) handle;
-    _WM_Lock(&mdi->lock);
-    if ((!(options & 0x800F)) || (options & 0x7FF0)) {
+    if ((!(options & 0x807F)) || (options & 0x7F80)
+        || ((options & WM_MO_SINC_RESAMPLING)
+            && ((options & WM_MO_SINC_RESAMPLING) != WM_MO_SINC_RESAMPLING))) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)", 0);
-        _WM_Unlock(&mdi->lock);
         return (-1);
     }
-    if (setting & 0x7FF0) {
+    if ((setting & 0x7F80)
+        || ((options & setting & WM_MO_SINC_RESAMPLING) > WM_MO_SINC_32)) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid setting)", 0);
-        _WM_Unlock(&mdi->lock);
         return (-1);
     }
 
-    mdi->extra_info.mixer_options = ((mdi->extra_info.mixer_options & (0x80FF ^ options))
-                                    | (options & setting));
+    WM_SendCmd(mdi, WM_CMD_OPTION, options, setting);
+    return (0);
+}
 
-    if (options & WM_MO_LOG_VOLUME) {
-            _WM_AdjustChannelVolumes(mdi, 16);  /* Settings greater than 15
-                                                   adjusts all channels */
-    } else if (options & WM_MO_REVERB) {
-        _WM_reset_reverb(mdi->reverb);
+WM_SYMBOL int WildMidi_SetMaxVoices(midi * handle, uint16_t max_voices) {
+    struct _mdi *mdi;
+
+    if (!WM_Contexts) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
     }
 
-    _WM_Unlock(&mdi->lock);
+    mdi = (struct _mdi *) handle;
+    WM_SendCmd(mdi, WM_CMD_MAX_VOICES, max_voices, 0);
     return (0);
 }
 
@@ -2672,10 +3420,23 @@ WM_SYMBOL int WildMidi_SetCvtOption(uint16_t tag, uint16_t setting) {
     return (0);
 }
 
+/*
+ * Keep the songs opened from now on in dir, at most max_kb of them, so that
+ * opening one again reads back its event list instead of parsing it. A dir
+ * of NULL stops.
+ */
+WM_SYMBOL int WildMidi_SetCache(const char *dir, uint32_t max_kb) {
+    if (!WM_Contexts) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    return (_WM_CacheSet(dir, max_kb));
+}
+
 WM_SYMBOL struct _WM_Info *
 WildMidi_GetInfo(midi * handle) {
     struct _mdi *mdi = (struct _mdi *) handle;
-    if (!WM_Initialized) {
+    if (!WM_Contexts) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (NULL);
     }
@@ -2683,36 +3444,20 @@ WildMidi_GetInfo(midi * handle) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
         return (NULL);
     }
-    _WM_Lock(&mdi->lock);
-    if (mdi->tmp_info == NULL) {
-        mdi->tmp_info = (struct _WM_Info *) malloc(sizeof(struct _WM_Info));
-        if (mdi->tmp_info == NULL) {
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_Unlock(&mdi->lock);
-            return (NULL);
-        }
-        mdi->tmp_info->copyright = NULL;
-    }
+    /* the copyright was copied in on opening, see WM_NewInfo() */
+    WM_LockSong(mdi);
     mdi->tmp_info->current_sample = mdi->extra_info.current_sample;
-    mdi->tmp_info->approx_total_samples = mdi->extra_info.approx_total_samples;
+    /* a streamed song's length is a guess until the parse reaches its end */
+    mdi->tmp_info->approx_total_samples = (mdi->stream) ? _WM_StreamMidiLength(mdi)
+                                          : mdi->extra_info.approx_total_samples;
     mdi->tmp_info->mixer_options = mdi->extra_info.mixer_options;
-    mdi->tmp_info->total_midi_time = (mdi->tmp_info->approx_total_samples * 1000) / _WM_SampleRate;
-    if (mdi->extra_info.copyright) {
-        free(mdi->tmp_info->copyright);
-        mdi->tmp_info->copyright = (char *) malloc(strlen(mdi->extra_info.copyright) + 1);
-        if (mdi->tmp_info->copyright == NULL) {
-            free(mdi->tmp_info);
-            mdi->tmp_info = NULL;
-            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
-            _WM_Unlock(&mdi->lock);
-            return (NULL);
-        } else {
-            strcpy(mdi->tmp_info->copyright, mdi->extra_info.copyright);
-        }
-    } else {
-        mdi->tmp_info->copyright = NULL;
-    }
-    _WM_Unlock(&mdi->lock);
+    mdi->tmp_info->max_voices = mdi->extra_info.max_voices;
+    mdi->tmp_info->peak_voices = mdi->extra_info.peak_voices;
+    mdi->tmp_info->stolen_voices = mdi->extra_info.stolen_voices;
+    mdi->tmp_info->open_time = mdi->extra_info.open_time;
+    mdi->tmp_info->total_midi_time = (uint32_t)(((uint64_t)mdi->tmp_info->approx_total_samples * 1000)
+                                                / mdi->ctx->sample_rate);
+    WM_UnlockSong(mdi);
     return ((struct _WM_Info *)mdi->tmp_info);
 }
 
@@ -2721,37 +3466,14 @@ WM_SYMBOL int WildMidi_Shutdown(void) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
-    while (first_handle) {
-        /* closes open handle and rotates the handles list. */
-        WildMidi_Close((struct _mdi *) first_handle->handle);
-    }
-    WM_FreePatches();
-#ifdef WILDMIDI_SF2
-    _WM_SF2_Unload();
-#endif
-    free_gauss();
+    WM_CloseContext(&WM_Default);
 
     /* reset the globals */
     _cvt_reset_options ();
-    _WM_MasterVolume = 948;
-    _WM_MixerOptions = 0;
-    _WM_fix_release = 0;
-    _WM_auto_amp = 0;
-    _WM_auto_amp_with_amp = 0;
-    _WM_reverb_room_width = 16.875f;
-    _WM_reverb_room_length = 22.5f;
-    _WM_reverb_listen_posx = 8.4375f;
-    _WM_reverb_listen_posy = 16.875f;
 
     WM_Initialized = 0;
 
-    if (_WM_Global_ErrorS != NULL) {
-        free(_WM_Global_ErrorS);
-        _WM_Global_ErrorS = NULL;
-    }
-
-    _WM_BufferFile = _WM_BufferFileImpl;
-    _WM_FreeBufferFile = _WM_FreeBufferFileImpl;
+    WildMidi_ClearError();
 
     return (0);
 }
@@ -2777,7 +3499,7 @@ WM_SYMBOL char * WildMidi_GetLyric (midi * handle) {
     struct _mdi *mdi = (struct _mdi *) handle;
     char * lyric = NULL;
 
-    if (!WM_Initialized) {
+    if (!WM_Contexts) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (NULL);
     }
@@ -2785,29 +3507,33 @@ WM_SYMBOL char * WildMidi_GetLyric (midi * handle) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
         return (NULL);
     }
-    _WM_Lock(&mdi->lock);
-    lyric = mdi->lyric;
-    mdi->lyric = NULL;
-    _WM_Unlock(&mdi->lock);
+    /* taken as the mixer may set the next, without waiting on its lock */
+    lyric = (char *) _WM_AtomicExchangePtr((void **) &mdi->lyric, NULL);
     return (lyric);
 }
 
 /*
- * Return Last Error Message
+ * Return Last Error Message, of the calling thread
  */
 WM_SYMBOL char * WildMidi_GetError (void) {
-    return (_WM_Global_ErrorS);
+    struct _WM_Error *err = _WM_ThreadError();
+    return ((err->code != WM_ERR_NONE) ? err->string : NULL);
 }
 
 /*
- * Clear any error message
+ * The kind of the calling thread's last error, one of the WM_ERR_ codes
+ */
+WM_SYMBOL int WildMidi_GetErrorCode (void) {
+    return (_WM_ThreadError()->code);
+}
+
+/*
+ * Clear any error message, of the calling thread
  */
 WM_SYMBOL void WildMidi_ClearError (void) {
-    _WM_Global_ErrorI = 0;
-    if (_WM_Global_ErrorS != NULL) {
-        free(_WM_Global_ErrorS);
-        _WM_Global_ErrorS = NULL;
-    }
+    struct _WM_Error *err = _WM_ThreadError();
+    err->code = WM_ERR_NONE;
+    err->string[0] = 0;
     return;
 }
 
@@ -23,12 +23,17 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
-#include <stdlib.h>
 #include "wm_error.h"
 
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+#define snprintf _snprintf
+#define vsnprintf _vsnprintf
+#endif
+
 void _WM_DEBUG_MSG(const char * wmfmt, ...) {
     va_list args;
     fprintf(stderr, "\r");
@@ -60,57 +65,67 @@ static const char *errors[WM_ERR_MAX+1] = {
     "Not an xmi file",
     "Not a smaf file",
 
-    "Invalid error code"
+    "Invalid error code" /* WM_ERR_OTHER */
 };
 
-#define MAX_ERROR_LEN 255
-
-char * _WM_Global_ErrorS = NULL;
-int _WM_Global_ErrorI = 0;
+/*
+ * Every thread keeps its own last error, in a fixed buffer, so reporting
+ * one neither allocates nor waits for another thread, and
+ * WildMidi_GetError() tells a thread about its own calls and not about
+ * whichever failed last. Compilers with no thread locals share one.
+ */
+#if defined(_MSC_VER)
+#define WM_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define WM_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define WM_THREAD_LOCAL __thread
+#else
+#define WM_THREAD_LOCAL
+#endif
+
+static WM_THREAD_LOCAL struct _WM_Error thread_error;
+
+struct _WM_Error *_WM_ThreadError(void) {
+    return (&thread_error);
+}
 
 void _WM_GLOBAL_ERROR_INTERNAL(const char *func, int lne, int wmerno, const char *wmfor, int error) {
-
-    char *errorstring;
+    struct _WM_Error *err = &thread_error;
 
     if (wmerno < 0 || wmerno >= WM_ERR_MAX)
          wmerno = WM_ERR_MAX; /* set to invalid error code. */
 
-    _WM_Global_ErrorI = wmerno;
-
-    if (_WM_Global_ErrorS != NULL) free(_WM_Global_ErrorS);
-
-    errorstring = (char *) malloc(MAX_ERROR_LEN+1);
-
     if (error == 0) {
         if (wmfor == NULL) {
-            sprintf(errorstring,"Error (%s:%i) %s",
-                    func, lne, errors[wmerno]);
+            snprintf(err->string, sizeof(err->string), "Error (%s:%i) %s",
+                     func, lne, errors[wmerno]);
         } else {
-            sprintf(errorstring,"Error (%s:%i) %s (%s)",
-                    func, lne, wmfor, errors[wmerno]);
+            snprintf(err->string, sizeof(err->string), "Error (%s:%i) %s (%s)",
+                     func, lne, wmfor, errors[wmerno]);
         }
     } else {
         if (wmfor == NULL) {
-            sprintf(errorstring,"System Error (%s:%i) %s : %s",
-                    func, lne, errors[wmerno], strerror(error));
+            snprintf(err->string, sizeof(err->string), "System Error (%s:%i) %s : %s",
+                     func, lne, errors[wmerno], strerror(error));
         } else {
-            sprintf(errorstring,"System Error (%s:%i) %s (%s) : %s",
-                    func, lne, wmfor, errors[wmerno], strerror(error));
+            snprintf(err->string, sizeof(err->string), "System Error (%s:%i) %s (%s) : %s",
+                     func, lne, wmfor, errors[wmerno], strerror(error));
         }
     }
 
-    errorstring[MAX_ERROR_LEN] = 0;
-    _WM_Global_ErrorS = errorstring;
+    err->string[WM_ERROR_LEN] = 0;
+    err->code = wmerno;
+    err->count++;
 }
 
 void _WM_ERROR_NEW(const char * wmfmt, ...) {
-    char *errorstring;
+    struct _WM_Error *err = &thread_error;
     va_list args;
     va_start(args, wmfmt);
-    errorstring = (char *) malloc(MAX_ERROR_LEN+1);
-    vsprintf(errorstring, wmfmt, args);
+    vsnprintf(err->string, sizeof(err->string), wmfmt, args);
     va_end(args);
-    errorstring[MAX_ERROR_LEN] = 0;
-    _WM_Global_ErrorS = errorstring;
-    _WM_Global_ErrorI = WM_ERR_MAX;/* well, it's a custom error message */
+    err->string[WM_ERROR_LEN] = 0;
+    err->code = WM_ERR_MAX;/* well, it's a custom error message */
+    err->count++;
 }
@@ -0,0 +1,1026 @@
+/* wildmidi-bench: throughput benchmarks for libWildMidi.
+ *
+ * Everything runs against the built-in OPL3 patch set ("@opl3") and songs
+ * generated in memory, so no patch files are needed and the numbers are
+ * comparable between builds on the same machine.
+ *
+ *   wildmidi-bench [test ...]      (no arguments runs every test)
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "config.h"
+#include "wildmidi_lib.h"
+#include "mix_kernels.h"
+#include "lock.h"
+
+#define RATE 44100
+
+/* wall clock, in seconds */
+static double bench_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return ((double)now.QuadPart / (double)freq.QuadPart);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec + (double)tv.tv_usec / 1000000.0);
+#endif
+}
+
+/*
+ * ====================
+ * Synthetic MIDI files
+ * ====================
+ */
+
+struct song {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t alloc;
+};
+
+static void put(struct song *s, uint8_t b) {
+    if (s->size == s->alloc) {
+        s->alloc = s->alloc ? s->alloc * 2 : 4096;
+        s->data = (uint8_t *) realloc(s->data, s->alloc);
+        if (s->data == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    s->data[s->size++] = b;
+}
+
+static void put32(struct song *s, uint32_t v) {
+    put(s, (uint8_t)(v >> 24));
+    put(s, (uint8_t)(v >> 16));
+    put(s, (uint8_t)(v >> 8));
+    put(s, (uint8_t)v);
+}
+
+static void put_vlq(struct song *s, uint32_t v) {
+    uint8_t b[5];
+    int n = 0;
+    b[n++] = v & 0x7f;
+    while (v >>= 7)
+        b[n++] = 0x80 | (v & 0x7f);
+    while (n--)
+        put(s, b[n]);
+}
+
+static void put_event(struct song *s, uint32_t delta, uint8_t status,
+                      uint8_t d1, uint8_t d2) {
+    put_vlq(s, delta);
+    put(s, status);
+    put(s, d1);
+    if (((status & 0xf0) != 0xc0) && ((status & 0xf0) != 0xd0))
+        put(s, d2);
+}
+
+static void begin_file(struct song *s, uint16_t tracks) {
+    memset(s, 0, sizeof(*s));
+    put32(s, 0x4d546864);           /* MThd */
+    put32(s, 6);
+    put(s, 0); put(s, 1);           /* type 1 */
+    put(s, (uint8_t)(tracks >> 8)); put(s, (uint8_t)tracks);
+    put(s, 0); put(s, 96);          /* 96 ticks per quarter note */
+}
+
+static uint32_t begin_track(struct song *s) {
+    put32(s, 0x4d54726b);           /* MTrk */
+    put32(s, 0);
+    return (s->size);
+}
+
+static void end_track(struct song *s, uint32_t start, uint32_t delta) {
+    uint32_t len;
+    put_vlq(s, delta);
+    put(s, 0xff); put(s, 0x2f); put(s, 0x00);
+    len = s->size - start;
+    s->data[start - 4] = (uint8_t)(len >> 24);
+    s->data[start - 3] = (uint8_t)(len >> 16);
+    s->data[start - 2] = (uint8_t)(len >> 8);
+    s->data[start - 1] = (uint8_t)len;
+}
+
+static uint32_t lcg = 12345;
+static uint32_t rnd(uint32_t n) {
+    lcg = lcg * 1103515245 + 12345;
+    return ((lcg >> 16) % n);
+}
+
+/* rnd() for n past 65536 */
+static uint32_t rnd_wide(uint32_t n) {
+    return (((rnd(65536) << 16) | rnd(65536)) % n);
+}
+
+/*
+ * A dense arrangement: one track per channel, each playing overlapping
+ * chords for the given number of beats. Half the channels use the
+ * modulation wheel so vibrato is exercised as well.
+ */
+static void make_dense_song(struct song *s, uint32_t beats, uint8_t chord) {
+    uint8_t ch;
+    uint32_t b, start;
+    uint8_t i;
+
+    lcg = 12345;
+    begin_file(s, 16);
+    for (ch = 0; ch < 16; ch++) {
+        start = begin_track(s);
+        put_event(s, 0, 0xc0 | ch, (uint8_t)((ch * 8) & 0x7f), 0);
+        put_event(s, 0, 0xb0 | ch, 10, (uint8_t)(ch * 8));
+        put_event(s, 0, 0xb0 | ch, 1, (ch & 1) ? 64 : 0);
+        for (b = 0; b < beats; b++) {
+            uint8_t root = (uint8_t)(36 + rnd(48));
+            if (ch == 9) root = (uint8_t)(35 + rnd(46));
+            for (i = 0; i < chord; i++)
+                put_event(s, 0, 0x90 | ch, (uint8_t)(root + i * 4), (uint8_t)(64 + rnd(63)));
+            for (i = 0; i < chord; i++)
+                put_event(s, i ? 0 : 96, 0x80 | ch, (uint8_t)(root + i * 4), 64);
+        }
+        end_track(s, start, 0);
+    }
+}
+
+/*
+ * Note churn: every channel starts a short note each tick, so thousands of
+ * notes overlap in their release tails and join and leave the note list on
+ * almost every frame.
+ */
+static void make_churn_song(struct song *s, uint32_t notes) {
+    uint8_t ch, key;
+    uint32_t n, start;
+
+    lcg = 12345;
+    begin_file(s, 16);
+    for (ch = 0; ch < 16; ch++) {
+        start = begin_track(s);
+        put_event(s, 0, 0xc0 | ch, (uint8_t)((ch * 8) & 0x7f), 0);
+        for (n = 0; n < notes; n++) {
+            key = (uint8_t)(24 + rnd(84));
+            put_event(s, 1, 0x90 | ch, key, (uint8_t)(32 + rnd(95)));
+            put_event(s, 1, 0x80 | ch, key, 64);
+        }
+        end_track(s, start, 0);
+    }
+}
+
+/*
+ * The same number of notes spread over a type 1 file of the given number of
+ * tracks, each track spanning about 1 << 17 ticks with notes of random
+ * length, so the more tracks there are the sparser they get and the fewer
+ * of them have an event on any one tick, as in a DAW export.
+ */
+static void make_track_song(struct song *s, uint16_t tracks, uint32_t notes) {
+    uint32_t gap = (1 << 17) / (notes / tracks) / 2;
+    uint32_t n, start;
+    uint16_t t;
+    uint8_t ch, key;
+
+    lcg = 12345;
+    begin_file(s, tracks);
+    for (t = 0; t < tracks; t++) {
+        ch = (uint8_t)(t & 0x0f);
+        start = begin_track(s);
+        put_event(s, 0, 0xc0 | ch, (uint8_t)((t * 8) & 0x7f), 0);
+        for (n = 0; n < notes / tracks; n++) {
+            key = (uint8_t)(36 + rnd(48));
+            put_event(s, 1 + rnd(gap), 0x90 | ch, key, 100);
+            put_event(s, 1 + rnd(gap), 0x80 | ch, key, 64);
+        }
+        end_track(s, start, 0);
+    }
+}
+
+/*
+ * A karaoke file: one melody track with a lyric meta event before every
+ * note, a syllable of a few letters each.
+ */
+static void make_lyric_song(struct song *s, uint32_t syllables) {
+    uint32_t n, start;
+    uint8_t key, len, i;
+
+    lcg = 12345;
+    begin_file(s, 1);
+    start = begin_track(s);
+    put_event(s, 0, 0xc0, 0, 0);
+    for (n = 0; n < syllables; n++) {
+        len = (uint8_t)(2 + rnd(6));
+        put_vlq(s, 0);
+        put(s, 0xff); put(s, 0x05); put(s, len);
+        for (i = 0; i < len; i++)
+            put(s, (uint8_t)('a' + rnd(26)));
+        key = (uint8_t)(48 + rnd(24));
+        put_event(s, 0, 0x90, key, 100);
+        put_event(s, 24, 0x80, key, 64);
+    }
+    end_track(s, start, 0);
+}
+
+/*
+ * A conductor track that changes tempo every beat, and its time signature
+ * every 16 bars, the way tempo-mapped recordings of live playing do.
+ */
+static void make_tempo_song(struct song *s, uint32_t beats) {
+    uint32_t n, start, tempo;
+
+    lcg = 12345;
+    begin_file(s, 1);
+    start = begin_track(s);
+    for (n = 0; n < beats; n++) {
+        tempo = 400000 + rnd(200000);
+        put_vlq(s, n ? 96 : 0);
+        put(s, 0xff); put(s, 0x51); put(s, 3);
+        put(s, (uint8_t)(tempo >> 16)); put(s, (uint8_t)(tempo >> 8)); put(s, (uint8_t)tempo);
+        if ((n % 64) == 0) {
+            put_vlq(s, 0);
+            put(s, 0xff); put(s, 0x58); put(s, 4);
+            put(s, (uint8_t)(((n / 64) & 1) ? 3 : 4)); put(s, 2); put(s, 24); put(s, 8);
+        }
+    }
+    end_track(s, start, 96);
+}
+
+/*
+ * =====
+ * Tests
+ * =====
+ */
+
+static double render_seconds(midi *handle, uint32_t *frames) {
+    static int8_t buf[16384];
+    double start = bench_now();
+    int res;
+
+    *frames = 0;
+    while ((res = WildMidi_GetOutput(handle, buf, sizeof(buf))) > 0)
+        *frames += (uint32_t)res / 4;
+    return (bench_now() - start);
+}
+
+/* GUS mixer throughput, in multiples of realtime. */
+static int bench_render(void) {
+    static const struct {
+        const char *name;
+        uint16_t options;
+    } modes[] = {
+        { "linear", 0 },
+        { "gauss", WM_MO_ENHANCED_RESAMPLING },
+        { "sinc8", WM_MO_SINC_8 },
+        { "sinc32", WM_MO_SINC_32 },
+        { "linear+reverb", WM_MO_REVERB },
+    };
+    struct song s;
+    unsigned int m;
+
+    make_dense_song(&s, 240, 4);
+    printf("render: 16 channels x 4 note chords, %u byte song\n", s.size);
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        midi *handle = WildMidi_OpenBuffer(s.data, s.size);
+        uint32_t frames;
+        double secs;
+        if (handle == NULL) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            free(s.data);
+            return (-1);
+        }
+        WildMidi_SetOption(handle, WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB
+                           | WM_MO_SINC_RESAMPLING, modes[m].options);
+        secs = render_seconds(handle, &frames);
+        printf("  %-16s %8.3f s  %8.1fx realtime\n", modes[m].name, secs,
+               ((double)frames / RATE) / (secs > 0.0 ? secs : 1e-9));
+        WildMidi_Close(handle);
+    }
+    free(s.data);
+    return (0);
+}
+
+/* Render time for the note churn song, and how many notes played at once. */
+static int bench_notes(void) {
+    struct song s;
+    midi *handle;
+    uint32_t frames;
+    double secs;
+
+    make_churn_song(&s, 4000);
+    handle = WildMidi_OpenBuffer(s.data, s.size);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        free(s.data);
+        return (-1);
+    }
+    secs = render_seconds(handle, &frames);
+    printf("notes: 16 channels x 4000 short notes, %u byte song\n", s.size);
+    printf("  %-16s %8.3f s  %8.1fx realtime, %u notes at peak\n", "churn", secs,
+           ((double)frames / RATE) / (secs > 0.0 ? secs : 1e-9),
+           WildMidi_GetInfo(handle)->peak_voices);
+    WildMidi_Close(handle);
+    free(s.data);
+    return (0);
+}
+
+/* Backward seeks across an hour long song, once a forward pass has left
+   its checkpoints behind, with FastSeek and with AccurateSeek. */
+static int bench_seek(void) {
+    static const struct {
+        const char *name;
+        int (*seek)(midi *handle, unsigned long int *sample_pos);
+    } modes[] = {
+        { "fast", WildMidi_FastSeek },
+        { "accurate", WildMidi_AccurateSeek },
+    };
+    struct song s;
+    midi *handle;
+    unsigned long pos, end;
+    double start, fwd, back;
+    unsigned int m;
+    int i, seeks = 200;
+
+    make_dense_song(&s, 7200, 4);
+    printf("seek: %u byte song\n", s.size);
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        handle = WildMidi_OpenBuffer(s.data, s.size);
+        if (handle == NULL) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            free(s.data);
+            return (-1);
+        }
+        end = WildMidi_GetInfo(handle)->approx_total_samples - RATE;
+
+        pos = end;
+        start = bench_now();
+        modes[m].seek(handle, &pos);
+        fwd = bench_now() - start;
+
+        lcg = 12345;
+        back = 0.0;
+        for (i = 0; i < seeks; i++) {
+            /* from near the end back to anywhere */
+            pos = end;
+            modes[m].seek(handle, &pos);
+            pos = rnd((uint32_t)(end / RATE)) * (unsigned long)RATE;
+            start = bench_now();
+            modes[m].seek(handle, &pos);
+            back += bench_now() - start;
+        }
+        printf("  %-8s to the %lu s end %8.3f ms, backward %8.3f ms per seek\n",
+               modes[m].name, end / RATE + 1, fwd * 1000.0,
+               back * 1000.0 / seeks);
+        WildMidi_Close(handle);
+    }
+    free(s.data);
+    return (0);
+}
+
+/* Event list cost: loading a long note churn song, a FastSeek from the
+   top to the end, which runs every event without mixing, and opening and
+   closing a karaoke file. */
+static int bench_events(void) {
+    struct song s;
+    midi *handle, *keep;
+    unsigned long pos, end;
+    double start, load, scan, best = 0.0;
+    uint32_t events;
+    int i;
+
+    make_churn_song(&s, 50000);
+    /* a program change and an end of track per channel, besides the notes */
+    events = 16 * (2 * 50000 + 2);
+    /* the first open also generates the patches */
+    keep = WildMidi_OpenBuffer(s.data, s.size);
+    start = bench_now();
+    handle = WildMidi_OpenBuffer(s.data, s.size);
+    load = bench_now() - start;
+    if (keep != NULL)
+        WildMidi_Close(keep);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        free(s.data);
+        return (-1);
+    }
+    end = WildMidi_GetInfo(handle)->approx_total_samples - 1;
+    for (i = 0; i < 5; i++) {
+        pos = 0;
+        WildMidi_FastSeek(handle, &pos);
+        pos = end;
+        start = bench_now();
+        WildMidi_FastSeek(handle, &pos);
+        scan = bench_now() - start;
+        if ((i == 0) || (scan < best))
+            best = scan;
+    }
+    printf("events: %u events, %u byte song\n", events, s.size);
+    printf("  %-16s %8.3f ms\n", "load", load * 1000.0);
+    printf("  %-16s %8.3f ms  %8.1f M events/s\n", "scan", best * 1000.0,
+           (double)events / 1e6 / (best > 0.0 ? best : 1e-9));
+    WildMidi_Close(handle);
+    free(s.data);
+
+    make_lyric_song(&s, 100000);
+    keep = WildMidi_OpenBuffer(s.data, s.size);
+    for (i = 0; i < 5; i++) {
+        start = bench_now();
+        handle = WildMidi_OpenBuffer(s.data, s.size);
+        if (handle != NULL)
+            WildMidi_Close(handle);
+        scan = bench_now() - start;
+        if ((i == 0) || (scan < best))
+            best = scan;
+    }
+    if (keep != NULL)
+        WildMidi_Close(keep);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        free(s.data);
+        return (-1);
+    }
+    printf("  %-16s %8.3f ms  100000 lyrics, %u byte song\n", "open+close",
+           best * 1000.0, s.size);
+    free(s.data);
+    return (0);
+}
+
+/* Type 1 parse throughput: 262144 notes in 16, 256 and 4096 tracks. */
+static int bench_tracks(void) {
+    static const uint16_t counts[] = { 16, 256, 4096 };
+    struct song s;
+    midi *handle, *keep;
+    double start, secs, best = 0.0;
+    uint32_t events;
+    size_t m;
+    int i;
+
+    printf("tracks: 262144 notes per file\n");
+    for (m = 0; m < sizeof(counts) / sizeof(counts[0]); m++) {
+        make_track_song(&s, counts[m], 262144);
+        /* notes, a program change and an end of track per track */
+        events = 2 * 262144 + 2 * counts[m];
+        /* the first open also generates the patches */
+        keep = WildMidi_OpenBuffer(s.data, s.size);
+        for (i = 0; i < 3; i++) {
+            start = bench_now();
+            handle = WildMidi_OpenBuffer(s.data, s.size);
+            secs = bench_now() - start;
+            if (handle == NULL)
+                break;
+            WildMidi_Close(handle);
+            if ((i == 0) || (secs < best))
+                best = secs;
+        }
+        if (keep != NULL)
+            WildMidi_Close(keep);
+        free(s.data);
+        if (handle == NULL) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            return (-1);
+        }
+        printf("  %5u tracks     %8.3f ms  %8.2f M events/s\n", counts[m],
+               best * 1000.0, (double)events / 1e6 / (best > 0.0 ? best : 1e-9));
+    }
+    return (0);
+}
+
+/* What indexing a song costs: opening and closing it, which loads its
+   patches, against probing it for its length and text. */
+static int bench_probe(void) {
+    struct song s;
+    struct _WM_ProbeInfo info;
+    midi *handle;
+    double start, open = 0.0, probe = 0.0, secs;
+    int i;
+
+    make_dense_song(&s, 2000, 3);
+    for (i = 0; i < 5; i++) {
+        start = bench_now();
+        handle = WildMidi_OpenBuffer(s.data, s.size);
+        if (handle == NULL) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            free(s.data);
+            return (-1);
+        }
+        WildMidi_Close(handle);
+        secs = bench_now() - start;
+        if ((i == 0) || (secs < open))
+            open = secs;
+
+        start = bench_now();
+        if (WildMidi_Probe(s.data, s.size, &info) != 0) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            free(s.data);
+            return (-1);
+        }
+        secs = bench_now() - start;
+        free(info.copyright);
+        free(info.track_names);
+        if ((i == 0) || (secs < probe))
+            probe = secs;
+    }
+    printf("probe: 16 channels x 2000 chords, %u byte song\n", s.size);
+    printf("  %-16s %8.3f ms\n", "open+close", open * 1000.0);
+    printf("  %-16s %8.3f ms\n", "probe", probe * 1000.0);
+    free(s.data);
+    return (0);
+}
+
+/* 40 instruments: every fourth General MIDI program and 8 drums. */
+static void make_program_song(struct song *s) {
+    uint32_t start;
+    uint8_t ch, key;
+    int program;
+
+    begin_file(s, 1);
+    start = begin_track(s);
+    for (program = 0; program < 128; program += 4) {
+        ch = (uint8_t)((program / 4) % 15);
+        if (ch >= 9) ch++;
+        put_event(s, 0, 0xc0 | ch, (uint8_t)program, 0);
+        put_event(s, 0, 0x90 | ch, 60, 100);
+        put_event(s, 48, 0x80 | ch, 60, 64);
+    }
+    for (key = 35; key < 43; key++) {
+        put_event(s, 0, 0x99, key, 100);
+        put_event(s, 48, 0x89, key, 64);
+    }
+    end_track(s, start, 0);
+}
+
+/* Cold opens of a song that needs 40 patches, so the time is almost all
+   patch loading. "library" is the open time WildMidi_GetInfo() reports. */
+static int bench_open(void) {
+    struct song s;
+    struct _WM_Info *info;
+    midi *handle;
+    double start, secs, best = 0.0;
+    uint32_t reported = 0;
+    int i;
+
+    make_program_song(&s);
+    for (i = 0; i < 3; i++) {
+        start = bench_now();
+        handle = WildMidi_OpenBuffer(s.data, s.size);
+        secs = bench_now() - start;
+        if (handle == NULL) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            free(s.data);
+            return (-1);
+        }
+        info = WildMidi_GetInfo(handle);
+        if ((i == 0) || (secs < best)) {
+            best = secs;
+            reported = (info != NULL) ? info->open_time : 0;
+        }
+        WildMidi_Close(handle);
+    }
+    printf("open: 32 programs and 8 drums, cold\n");
+    printf("  %-16s %8.3f ms\n", "measured", best * 1000.0);
+    printf("  %-16s %8.3f ms\n", "library", reported / 1000.0);
+    free(s.data);
+    return (0);
+}
+
+/* Tempo map lookups on a song with 100000 tempo changes, in millions
+   per second. */
+static int bench_tempo(void) {
+    struct song s;
+    struct _WM_BarBeat pos;
+    midi *handle;
+    double start, secs[3];
+    uint32_t total, ticks, value, sink = 0;
+    int i;
+
+    make_tempo_song(&s, 100000);
+    handle = WildMidi_OpenBuffer(s.data, s.size);
+    free(s.data);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (-1);
+    }
+    total = WildMidi_GetInfo(handle)->approx_total_samples;
+    ticks = 100001 * 96;
+
+    start = bench_now();
+    for (i = 0; i < 1000000; i++) {
+        WildMidi_TickToSample(handle, rnd_wide(ticks), &value);
+        sink += value;
+    }
+    secs[0] = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < 1000000; i++) {
+        WildMidi_SampleToTick(handle, rnd_wide(total), &value);
+        sink += value;
+    }
+    secs[1] = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < 1000000; i++) {
+        WildMidi_GetBarBeat(handle, rnd_wide(ticks), &pos);
+        sink += pos.bar;
+    }
+    secs[2] = bench_now() - start;
+
+    WildMidi_Close(handle);
+    printf("tempo: 100000 tempo changes, M lookups/s\n");
+    printf("  %-16s %8.2f\n", "tick to sample", 1.0 / (secs[0] > 0.0 ? secs[0] : 1e-9));
+    printf("  %-16s %8.2f\n", "sample to tick", 1.0 / (secs[1] > 0.0 ? secs[1] : 1e-9));
+    printf("  %-16s %8.2f\n", "bar and beat", 1.0 / (secs[2] > 0.0 ? secs[2] : 1e-9));
+    /* keep the lookups live */
+    return ((sink == 1) ? 1 : 0);
+}
+
+/* Opening a song of 2 million events parsed and from the cache, in ms.
+   The cache goes in $TMPDIR, or the current directory. */
+static int bench_cache(void) {
+    struct song s;
+    midi *keep, *handle;
+    const char *dir = getenv("TMPDIR");
+    double start, secs, best[2] = { 0.0, 0.0 };
+    int pass, i;
+
+    if (dir == NULL)
+        dir = ".";
+    make_dense_song(&s, 16000, 4);
+    /* holds the patches, so that only the parse or the read is timed */
+    keep = WildMidi_OpenBuffer(s.data, s.size);
+    if (keep == NULL) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        free(s.data);
+        return (-1);
+    }
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            WildMidi_SetCache(dir, 0);
+            /* the first open of it stores it */
+            WildMidi_Close(WildMidi_OpenBuffer(s.data, s.size));
+        }
+        for (i = 0; i < 3; i++) {
+            start = bench_now();
+            handle = WildMidi_OpenBuffer(s.data, s.size);
+            secs = bench_now() - start;
+            if (handle == NULL) {
+                fprintf(stderr, "%s\n", WildMidi_GetError());
+                break;
+            }
+            WildMidi_Close(handle);
+            if ((i == 0) || (secs < best[pass]))
+                best[pass] = secs;
+        }
+    }
+    /* a 1 KB limit clears it out again */
+    WildMidi_SetCache(dir, 1);
+    WildMidi_SetCache(NULL, 0);
+    WildMidi_Close(keep);
+    free(s.data);
+
+    printf("cache: open a song of 2M events\n");
+    printf("  %-16s %8.3f ms\n", "parsed", best[0] * 1000.0);
+    printf("  %-16s %8.3f ms\n", "cached", best[1] * 1000.0);
+    return (0);
+}
+
+/* Opening a song of 2 million events parsed whole and streamed
+   (WM_MO_STREAM), in ms, and the time a seek to its end then takes the
+   streamed one to parse the rest. Inits the library again for each. */
+static int bench_stream(void) {
+    struct song s;
+    midi *keep, *handle;
+    unsigned long pos;
+    double start, secs, best[3] = { 0.0, 0.0, 0.0 };
+    int pass, i, ret = 0;
+
+    make_dense_song(&s, 16000, 4);
+    for (pass = 0; (pass < 2) && (ret == 0); pass++) {
+        WildMidi_Shutdown();
+        if (WildMidi_Init("@opl3", RATE, (pass) ? WM_MO_STREAM : 0) != 0) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            ret = -1;
+            break;
+        }
+        /* holds the patches, so that only the parse is timed */
+        keep = WildMidi_OpenBuffer(s.data, s.size);
+        if (keep == NULL) {
+            fprintf(stderr, "%s\n", WildMidi_GetError());
+            ret = -1;
+            break;
+        }
+        for (i = 0; i < 3; i++) {
+            start = bench_now();
+            handle = WildMidi_OpenBuffer(s.data, s.size);
+            secs = bench_now() - start;
+            if (handle == NULL) {
+                fprintf(stderr, "%s\n", WildMidi_GetError());
+                ret = -1;
+                break;
+            }
+            if ((i == 0) || (secs < best[pass]))
+                best[pass] = secs;
+            if (pass == 1) {
+                pos = 0xffffffffUL;
+                start = bench_now();
+                WildMidi_FastSeek(handle, &pos);
+                secs = bench_now() - start;
+                if ((i == 0) || (secs < best[2]))
+                    best[2] = secs;
+            }
+            WildMidi_Close(handle);
+        }
+        WildMidi_Close(keep);
+    }
+    free(s.data);
+    WildMidi_Shutdown();
+    if (WildMidi_Init("@opl3", RATE, 0) != 0) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (-1);
+    }
+    WildMidi_MasterVolume(100);
+    if (ret != 0)
+        return (ret);
+
+    printf("stream: open a song of 2M events\n");
+    printf("  %-16s %8.3f ms\n", "parsed", best[0] * 1000.0);
+    printf("  %-16s %8.3f ms\n", "streamed", best[1] * 1000.0);
+    printf("  %-16s %8.3f ms\n", "seek to end", best[2] * 1000.0);
+    return (0);
+}
+
+struct render_jobs {
+    midi **handle;
+    unsigned int count;
+    unsigned int next;
+    uint32_t frames;
+};
+
+/* renders songs from jobs until there are none left, on each thread */
+static void render_jobs(void *data) {
+    struct render_jobs *jobs = (struct render_jobs *) data;
+    int8_t buf[16384];
+    midi *handle;
+    uint32_t frames;
+    int res;
+
+    for (;;) {
+        _WM_ThreadLock();
+        handle = (jobs->next < jobs->count) ? jobs->handle[jobs->next++] : NULL;
+        _WM_ThreadUnlock();
+        if (handle == NULL)
+            return;
+        frames = 0;
+        while ((res = WildMidi_GetOutput(handle, buf, sizeof(buf))) > 0)
+            frames += (uint32_t)res / 4;
+        _WM_ThreadLock();
+        jobs->frames += frames;
+        _WM_ThreadUnlock();
+    }
+}
+
+/* The note churn song rendered once per thread, all at the same time, in
+   multiples of realtime summed over the threads and against one thread.
+   Runs up to the CPU count, and at least to 4. Every note-on looks its
+   patch and sample up, so any lock on that path shows here. Only 1 thread
+   where the build has none. */
+static int bench_threads(void) {
+    struct song s;
+    struct render_jobs jobs;
+    midi *handle[64];
+    unsigned int cpus = _WM_CPUCount();
+    unsigned int threads, i;
+    double start, secs, rt, one = 0.0;
+    char name[32];
+
+    make_churn_song(&s, 1000);
+    printf("threads: 16 channels x 1000 short notes a song, %u CPUs\n", cpus);
+    for (threads = 1; (threads <= 64) && ((threads <= cpus) || (threads <= 4)); threads *= 2) {
+        for (i = 0; i < threads; i++) {
+            handle[i] = WildMidi_OpenBuffer(s.data, s.size);
+            if (handle[i] == NULL) {
+                fprintf(stderr, "%s\n", WildMidi_GetError());
+                while (i--)
+                    WildMidi_Close(handle[i]);
+                free(s.data);
+                return (-1);
+            }
+        }
+        jobs.handle = handle;
+        jobs.count = threads;
+        jobs.next = 0;
+        jobs.frames = 0;
+        start = bench_now();
+        _WM_RunThreads(render_jobs, &jobs, threads);
+        secs = bench_now() - start;
+        for (i = 0; i < threads; i++)
+            WildMidi_Close(handle[i]);
+
+        rt = ((double)jobs.frames / RATE) / (secs > 0.0 ? secs : 1e-9);
+        if (threads == 1)
+            one = rt;
+        sprintf(name, "%u thread%s", threads, (threads == 1) ? "" : "s");
+        printf("  %-16s %8.3f s  %8.1fx realtime  %5.2fx one\n", name, secs, rt,
+               rt / (one > 0.0 ? one : 1e-9));
+#ifndef WILDMIDI_THREADS
+        break;
+#endif
+    }
+    free(s.data);
+    return (0);
+}
+
+/* 16 songs, a quarter of them 8 times longer than the rest, rendered a
+   4096 byte period each at a time through WildMidi_RenderBatch() until
+   all have ended, in multiples of realtime summed over the songs. */
+static int bench_batch(void) {
+    struct song s[2];
+    midi *handle[16];
+    int8_t *buf[16];
+    uint32_t sizes[16];
+    uint32_t usecs[16];  /* the last batch's, which schedule the next */
+    int results[16];
+    unsigned int cpus = _WM_CPUCount();
+    unsigned int threads, i, playing;
+    uint64_t frames;
+    double start, secs, rt, one = 0.0;
+    char name[32];
+    int ret = 0;
+
+    make_churn_song(&s[0], 100);
+    make_churn_song(&s[1], 800);
+    for (i = 0; i < 16; i++) {
+        buf[i] = (int8_t *) malloc(4096);
+        sizes[i] = 4096;
+    }
+    printf("batch: 16 songs of 100 or 800 notes a channel, %u CPUs\n", cpus);
+    for (threads = 1; (threads <= 16) && ((threads <= cpus) || (threads <= 4)); threads *= 2) {
+        for (i = 0; i < 16; i++) {
+            handle[i] = WildMidi_OpenBuffer(s[(i % 4) == 0].data, s[(i % 4) == 0].size);
+            if (handle[i] == NULL) {
+                fprintf(stderr, "%s\n", WildMidi_GetError());
+                while (i--)
+                    WildMidi_Close(handle[i]);
+                ret = -1;
+                goto done;
+            }
+        }
+        WildMidi_SetBatchThreads((uint16_t)threads);
+        memset(usecs, 0, sizeof(usecs));
+        frames = 0;
+        start = bench_now();
+        do {
+            if (WildMidi_RenderBatch(handle, buf, sizes, 16, results, usecs) < 0) {
+                fprintf(stderr, "%s\n", WildMidi_GetError());
+                ret = -1;
+                break;
+            }
+            playing = 0;
+            for (i = 0; i < 16; i++) {
+                frames += (uint32_t)results[i] / 4;
+                playing += (results[i] > 0);
+            }
+        } while (playing);
+        secs = bench_now() - start;
+        for (i = 0; i < 16; i++)
+            WildMidi_Close(handle[i]);
+        if (ret != 0)
+            break;
+
+        rt = ((double)frames / RATE) / (secs > 0.0 ? secs : 1e-9);
+        if (threads == 1)
+            one = rt;
+        sprintf(name, "%u thread%s", threads, (threads == 1) ? "" : "s");
+        printf("  %-16s %8.3f s  %8.1fx realtime  %5.2fx one\n", name, secs, rt,
+               rt / (one > 0.0 ? one : 1e-9));
+#ifndef WILDMIDI_THREADS
+        break;
+#endif
+    }
+done:
+    WildMidi_SetBatchThreads(0);
+    for (i = 0; i < 16; i++)
+        free(buf[i]);
+    free(s[0].data);
+    free(s[1].data);
+    return (ret);
+}
+
+/* Inner loop throughput of each mixer kernel set this CPU can run, in
+   millions of frames (linear, gauss, sinc) or samples (pack_s16) per
+   second. */
+static int bench_kernels(void) {
+    static int16_t data[65537];
+    static int32_t env_amp[1024];
+    static int32_t mix[2 * 4096];
+    static int8_t pcm[4 * 4096];
+    static double coeffs[35 * 64];
+    static int16_t sinc_coef[1024 * 16];
+    const struct _WM_MixKernels *k;
+    struct _WM_VoiceRun run;
+    double start, secs[4], sink = 0.0;
+    int i, n;
+
+    for (i = 0; i < 65537; i++)
+        data[i] = (int16_t)(rnd(65536) - 32768);
+    for (i = 0; i < 1024; i++)
+        env_amp[i] = (int32_t)i + 1;
+    for (i = 0; i < 35 * 64; i++)
+        coeffs[i] = (double)rnd(1000) / 1000.0;
+    for (i = 0; i < 1024 * 16; i++)
+        sinc_coef[i] = (int16_t)(rnd(2048) - 1024);
+
+    printf("kernels: Mframes/s linear, gauss, sinc16; Msamples/s pack_s16\n");
+    for (n = 0; (k = _WM_GetMixKernels(n)) != NULL; n++) {
+        memset(mix, 0, sizeof(mix));
+        run.data = data;
+        run.env_amp = env_amp;
+        run.sample_inc = 1437;
+        run.env_inc = 1;
+        run.left_vol = 300;
+        run.right_vol = 200;
+        start = bench_now();
+        for (i = 0; i < 4000; i++) {
+            run.sample_pos = 0;
+            run.env_level = 1 << 20;
+            k->linear(&run, mix, 4096);
+        }
+        secs[0] = bench_now() - start;
+
+        start = bench_now();
+        for (i = 0; i < 4000000; i++)
+            sink += k->gauss(&data[i & 0xffff], &coeffs[35 * (i & 63)], 35);
+        secs[1] = bench_now() - start;
+
+        run.sinc_coef = sinc_coef;
+        run.sinc_taps = 16;
+        start = bench_now();
+        for (i = 0; i < 1000; i++) {
+            run.sample_pos = 16 << 10;
+            run.env_level = 1 << 20;
+            k->sinc(&run, mix, 4096);
+        }
+        secs[2] = bench_now() - start;
+
+        start = bench_now();
+        for (i = 0; i < 8000; i++)
+            k->pack_s16(mix, pcm, 2 * 4096);
+        secs[3] = bench_now() - start;
+
+        printf("  %-16s %8.1f %8.1f %8.1f %8.1f\n", k->name,
+               4000.0 * 4096 / 1e6 / (secs[0] > 0.0 ? secs[0] : 1e-9),
+               4000000.0 / 1e6 / (secs[1] > 0.0 ? secs[1] : 1e-9),
+               1000.0 * 4096 / 1e6 / (secs[2] > 0.0 ? secs[2] : 1e-9),
+               8000.0 * 2 * 4096 / 1e6 / (secs[3] > 0.0 ? secs[3] : 1e-9));
+    }
+    /* keep the gauss results live */
+    return ((sink == 0.5) ? 1 : 0);
+}
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} tests[] = {
+    { "render", bench_render },
+    { "notes", bench_notes },
+    { "seek", bench_seek },
+    { "events", bench_events },
+    { "tracks", bench_tracks },
+    { "probe", bench_probe },
+    { "open", bench_open },
+    { "tempo", bench_tempo },
+    { "cache", bench_cache },
+    { "stream", bench_stream },
+    { "threads", bench_threads },
+    { "batch", bench_batch },
+    { "kernels", bench_kernels },
+};
+
+int main(int argc, char **argv) {
+    unsigned int t;
+    int i, ret = 0;
+
+    if (WildMidi_Init("@opl3", RATE, 0) != 0) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (1);
+    }
+    WildMidi_MasterVolume(100);
+
+    for (t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        int wanted = (argc < 2);
+        for (i = 1; i < argc; i++) {
+            if (strcmp(argv[i], tests[t].name) == 0)
+                wanted = 1;
+        }
+        if (wanted && tests[t].run() != 0)
+            ret = 1;
+    }
+
+    WildMidi_Shutdown();
+    return (ret);
+}
@@ -0,0 +1,189 @@
+/* assert-based check of the queue control calls post to while a song's
+ * lock is held ("@opl3" patches). A change posted while another thread
+ * holds the lock is applied as that thread lets go, whichever call it
+ * was, and with threads setting options and the voice cap while another
+ * renders, each change lands in order and none is left behind. */
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wildmidi_lib.h"
+#include "common.h"
+#include "lock.h"
+#include "internal_midi.h"
+
+#define RATE 44100
+#define POSTERS 4   /* the threads posting; one more renders */
+#define POSTS 20001 /* odd, so each option ends up set */
+
+static uint8_t song[1 << 12];
+static uint32_t song_size;
+
+static void put(uint8_t b) {
+    assert(song_size < sizeof(song));
+    song[song_size++] = b;
+}
+
+/* a chord held across a few seconds, retriggered */
+static void make_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    uint32_t len;
+    int i, j;
+
+    song_size = 0;
+    for (i = 0; i < (int) sizeof(header); i++)
+        put(header[i]);
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < 3; j++) {
+            put(0); put(0x90); put((uint8_t) (60 + j * 4)); put(100);
+        }
+        put(0x60); put(0x80); put(60); put(0);
+        put(0); put(0x80); put(64); put(0);
+        put(0); put(0x80); put(68); put(0);
+    }
+    put(0); put(0xff); put(0x2f); put(0);
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t) (len >> 24);
+    song[19] = (uint8_t) (len >> 16);
+    song[20] = (uint8_t) (len >> 8);
+    song[21] = (uint8_t) len;
+}
+
+static midi *handle;
+static uint32_t next_thread = 0;
+static uint32_t posting = POSTERS;
+
+/* the option each poster toggles; the last one sets the voice cap */
+static const uint16_t toggled[POSTERS - 1] = {
+    WM_MO_LOG_VOLUME, WM_MO_REVERB, WM_MO_ENHANCED_RESAMPLING
+};
+
+/* one role, the next not taken: a build without threads runs them all
+   here in turn, the renderer last */
+static int take_role(void) {
+    uint32_t me;
+
+    do {
+        me = _WM_AtomicLoad(&next_thread);
+        if (me > POSTERS)
+            return (-1);
+    } while (!_WM_AtomicSwap(&next_thread, me, me + 1));
+    return ((int) me);
+}
+
+static void play(int me) {
+    int i, res;
+    uint32_t left;
+
+    if (me == POSTERS) {
+        /* the renderer, until the posters are done */
+        int8_t buf[4096];
+        int rounds = 0;
+
+        while ((_WM_AtomicLoad(&posting) != 0) || (rounds < 8)) {
+            res = WildMidi_GetOutput(handle, buf, sizeof(buf));
+            assert(res >= 0);
+            if (res == 0) {
+                unsigned long int pos = 0;
+                res = WildMidi_FastSeek(handle, &pos);
+                assert(res == 0);
+            }
+            rounds++;
+        }
+        return;
+    }
+    for (i = 0; i < POSTS; i++) {
+        if (me < POSTERS - 1) {
+            res = WildMidi_SetOption(handle, toggled[me],
+                                     (i & 1) ? 0 : toggled[me]);
+        } else {
+            res = WildMidi_SetMaxVoices(handle, (uint16_t) (i % 64 + 1));
+        }
+        assert(res == 0);
+    }
+    do {
+        left = _WM_AtomicLoad(&posting);
+    } while (!_WM_AtomicSwap(&posting, left, left - 1));
+    (void) res;
+}
+
+static void run(void *arg) {
+    int me;
+
+    (void) arg;
+    while ((me = take_role()) >= 0)
+        play(me);
+}
+
+int main(void) {
+    struct _mdi *mdi;
+    uint32_t sample;
+    struct _WM_BarBeat pos;
+    uint16_t want;
+    int res;
+
+    res = WildMidi_Init("@opl3", RATE, 0);
+    assert(res == 0);
+    make_song();
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    mdi = (struct _mdi *) handle;
+
+    /* posted while the lock is held, as by a renderer, then applied by
+       whichever call takes the lock next */
+    _WM_Lock(&mdi->lock);
+    res = WildMidi_SetOption(handle, WM_MO_REVERB, WM_MO_REVERB);
+    assert(res == 0);
+    _WM_Unlock(&mdi->lock);
+    assert(!(mdi->extra_info.mixer_options & WM_MO_REVERB));
+    res = WildMidi_TickToSample(handle, 96, &sample);
+    assert(res == 0);
+    assert(mdi->extra_info.mixer_options & WM_MO_REVERB);
+
+    _WM_Lock(&mdi->lock);
+    res = WildMidi_SetMaxVoices(handle, 5);
+    assert(res == 0);
+    _WM_Unlock(&mdi->lock);
+    res = WildMidi_GetBarBeat(handle, 96, &pos);
+    assert(res == 0);
+    assert(mdi->extra_info.max_voices == 5);
+
+    _WM_Lock(&mdi->lock);
+    res = WildMidi_SetOption(handle, WM_MO_REVERB, 0);
+    assert(res == 0);
+    _WM_Unlock(&mdi->lock);
+    res = WildMidi_SampleToTick(handle, RATE, &sample);
+    assert(res == 0);
+    assert(!(mdi->extra_info.mixer_options & WM_MO_REVERB));
+
+    _WM_Lock(&mdi->lock);
+    res = WildMidi_SetOption(handle, WM_MO_LOOP, WM_MO_LOOP);
+    assert(res == 0);
+    _WM_Unlock(&mdi->lock);
+    assert(WildMidi_GetInfo(handle)->mixer_options & WM_MO_LOOP);
+    assert(mdi->extra_info.mixer_options & WM_MO_LOOP);
+    res = WildMidi_SetOption(handle, WM_MO_LOOP, 0);
+    assert(res == 0);
+
+    /* the renderer and posters together: once they are done, every change
+       has been applied, with no call after them to pick up the last */
+    _WM_PoolRun(run, NULL, POSTERS + 1);
+    want = WM_MO_LOG_VOLUME | WM_MO_REVERB | WM_MO_ENHANCED_RESAMPLING;
+    assert((mdi->extra_info.mixer_options & want) == want);
+    assert(mdi->extra_info.max_voices == (POSTS - 1) % 64 + 1);
+    assert(_WM_AtomicLoad(&mdi->cmd_tail) == _WM_AtomicLoad(&mdi->cmd_head));
+
+    WildMidi_Close(handle);
+    res = WildMidi_Shutdown();
+    assert(res == 0);
+    (void) res;
+    (void) want;
+    (void) mdi;
+    return (0);
+}
@@ -0,0 +1,79 @@
+/* assert-based check that errors are kept per thread. A thread that
+ * reports one error while another thread holds a different one sees only
+ * its own, by message and by code, and so does the other. */
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wildmidi_lib.h"
+#include "lock.h"
+
+#define RATE 44100
+
+static const uint8_t junk[] = "not a song, at any rate";
+static uint32_t threads_ran = 0;
+
+/* the opening thread comes in holding its error and leaves it; another
+   starts with none and reports its own */
+static void report(void *arg) {
+    midi *handle;
+    char *err;
+    int i;
+
+    (void) arg;
+    if (WildMidi_GetErrorCode() == WM_ERR_INVALID_ARG)
+        return;
+    assert(WildMidi_GetErrorCode() == WM_ERR_NONE);
+    assert(WildMidi_GetError() == NULL);
+    for (i = 0; i < 1000; i++) {
+        handle = WildMidi_OpenBuffer(junk, sizeof(junk));
+        assert(handle == NULL);
+        assert(WildMidi_GetErrorCode() == WM_ERR_NOT_MIDI);
+        err = WildMidi_GetError();
+        assert(err != NULL && strstr(err, "Not a midi file") != NULL);
+        WildMidi_ClearError();
+        assert(WildMidi_GetErrorCode() == WM_ERR_NONE);
+        (void) handle;
+        (void) err;
+    }
+    handle = WildMidi_OpenBuffer(junk, sizeof(junk));
+    assert(WildMidi_GetErrorCode() == WM_ERR_NOT_MIDI);
+    (void) handle;
+    do {
+        i = (int) _WM_AtomicLoad(&threads_ran);
+    } while (!_WM_AtomicSwap(&threads_ran, (uint32_t) i, (uint32_t) i + 1));
+}
+
+int main(void) {
+    static char err[256];
+    midi *handle;
+    int res;
+
+    res = WildMidi_Init("@opl3", RATE, 0);
+    assert(res == 0);
+
+    handle = WildMidi_OpenBuffer(NULL, 0);
+    assert(handle == NULL);
+    assert(WildMidi_GetErrorCode() == WM_ERR_INVALID_ARG);
+    assert(WildMidi_GetError() != NULL);
+    strcpy(err, WildMidi_GetError());
+
+    /* a build without threads runs it here alone */
+    _WM_RunThreads(report, NULL, 4);
+    assert(WildMidi_GetErrorCode() == WM_ERR_INVALID_ARG);
+    assert(strcmp(WildMidi_GetError(), err) == 0);
+#ifdef WILDMIDI_THREADS
+    assert(_WM_AtomicLoad(&threads_ran) == 3);
+#endif
+
+    WildMidi_ClearError();
+    assert(WildMidi_GetErrorCode() == WM_ERR_NONE);
+    res = WildMidi_Shutdown();
+    assert(res == 0);
+    (void) res;
+    (void) handle;
+    return (0);
+}
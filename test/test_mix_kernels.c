@@ -0,0 +1,246 @@
+/* assert-based check of the SIMD mixer kernels against the C ones.
+ * Every kernel set this CPU can run is fed the same random input: gauss
+ * and float mixing must match the C set to within rounding, everything
+ * else exactly. */
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mix_kernels.h"
+
+#define DATA_LEN 4096
+
+static int16_t data[DATA_LEN + 1];
+static int32_t env_amp[1024];
+static int16_t sinc_coef[1024 * 32];
+
+static uint32_t seed = 1;
+static uint32_t rnd(uint32_t n) {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) % n);
+}
+
+static void random_run(struct _WM_VoiceRun *run, uint32_t count) {
+    uint32_t span;
+
+    run->data = data;
+    run->env_amp = env_amp;
+    run->sinc_coef = NULL;
+    run->sinc_taps = 0;
+    run->sample_inc = 1 + rnd(8 << 10);
+    span = run->sample_inc * count;
+    /* room for a 32 tap sinc window either side */
+    run->sample_pos = rnd(((DATA_LEN - 64) << 10) - span);
+    /* keep the envelope inside the table for the whole run */
+    run->env_level = (int32_t)rnd(1024 << 12);
+    run->env_inc = (int32_t)rnd(1 << 14) - (1 << 13);
+    if (run->env_level + run->env_inc * (int32_t)count < 0
+        || run->env_level + run->env_inc * (int32_t)count >= (1024 << 12))
+        run->env_inc = 0;
+    run->left_vol = (int32_t)rnd(600);
+    run->right_vol = (int32_t)rnd(600);
+    if (rnd(8) == 0)
+        run->right_vol = 40000;     /* beyond the 16 bit paths */
+}
+
+static void check_linear(const struct _WM_MixKernels *ref,
+                         const struct _WM_MixKernels *k) {
+    struct _WM_VoiceRun a, b;
+    int32_t out_a[2 * 300], out_b[2 * 300];
+    uint32_t count, i;
+    int t;
+
+    for (t = 0; t < 2000; t++) {
+        count = 1 + rnd(300);
+        random_run(&a, count);
+        b = a;
+        for (i = 0; i < 2 * count; i++)
+            out_a[i] = out_b[i] = (int32_t)rnd(200000) - 100000;
+        ref->linear(&a, out_a, count);
+        k->linear(&b, out_b, count);
+        assert(memcmp(out_a, out_b, 2 * count * sizeof(int32_t)) == 0);
+        assert(a.sample_pos == b.sample_pos);
+        assert(a.env_level == b.env_level);
+    }
+}
+
+static void check_sinc(const struct _WM_MixKernels *ref,
+                       const struct _WM_MixKernels *k) {
+    struct _WM_VoiceRun a, b;
+    int32_t out_a[2 * 300], out_b[2 * 300];
+    uint32_t count, i;
+    int t;
+
+    for (t = 0; t < 2000; t++) {
+        count = 1 + rnd(300);
+        random_run(&a, count);
+        a.sinc_coef = sinc_coef;
+        a.sinc_taps = 4 << (t & 3);
+        /* the window has to stay inside data */
+        if (a.sample_pos < (uint32_t)(a.sinc_taps << 10))
+            a.sample_pos += a.sinc_taps << 10;
+        b = a;
+        for (i = 0; i < 2 * count; i++)
+            out_a[i] = out_b[i] = (int32_t)rnd(200000) - 100000;
+        ref->sinc(&a, out_a, count);
+        k->sinc(&b, out_b, count);
+        assert(memcmp(out_a, out_b, 2 * count * sizeof(int32_t)) == 0);
+        assert(a.sample_pos == b.sample_pos);
+        assert(a.env_level == b.env_level);
+    }
+}
+
+static void check_gauss(const struct _WM_MixKernels *ref,
+                        const struct _WM_MixKernels *k) {
+    double coeffs[64];
+    double ya, yb;
+    int t, i, taps;
+
+    for (t = 0; t < 2000; t++) {
+        taps = 1 + (int)rnd(40);
+        if (t & 1) taps = 35;
+        for (i = 0; i < taps; i++)
+            coeffs[i] = ((double)rnd(2000001) - 1000000.0) / 1000000.0;
+        i = (int)rnd(DATA_LEN - taps);
+        ya = ref->gauss(&data[i], coeffs, taps);
+        yb = k->gauss(&data[i], coeffs, taps);
+        assert(fabs(ya - yb) <= 1e-9 * (1.0 + fabs(ya)));
+        (void) ya; (void) yb;
+    }
+}
+
+static void check_pack(const struct _WM_MixKernels *ref,
+                       const struct _WM_MixKernels *k) {
+    int32_t in[100];
+    int8_t out_a[200], out_b[200];
+    int32_t s32_a[100], s32_b[100];
+    float f32_a[100], f32_b[100];
+    uint32_t samples, i;
+    int t;
+
+    for (t = 0; t < 2000; t++) {
+        samples = rnd(100);
+        for (i = 0; i < samples; i++)
+            in[i] = (int32_t)rnd(140000) - 70000;
+        if (samples) {
+            in[0] = INT32_MIN;
+            in[samples - 1] = INT32_MAX;
+        }
+        memset(out_a, 0x55, sizeof(out_a));
+        memset(out_b, 0x55, sizeof(out_b));
+        ref->pack_s16(in, out_a, samples);
+        k->pack_s16(in, out_b, samples);
+        assert(memcmp(out_a, out_b, sizeof(out_a)) == 0);
+
+        memset(s32_a, 0x55, sizeof(s32_a));
+        memset(s32_b, 0x55, sizeof(s32_b));
+        ref->pack_s32(in, s32_a, samples);
+        k->pack_s32(in, s32_b, samples);
+        assert(memcmp(s32_a, s32_b, sizeof(s32_a)) == 0);
+
+        memset(f32_a, 0x55, sizeof(f32_a));
+        memset(f32_b, 0x55, sizeof(f32_b));
+        ref->pack_f32(in, f32_a, samples);
+        k->pack_f32(in, f32_b, samples);
+        assert(memcmp(f32_a, f32_b, sizeof(f32_a)) == 0);
+    }
+
+    /* s32 is s16 shifted up, f32 is unclamped */
+    in[0] = -40000; in[1] = -32768; in[2] = 1; in[3] = 32767; in[4] = 40000;
+    ref->pack_s32(in, s32_a, 5);
+    assert(s32_a[0] == INT32_MIN && s32_a[1] == INT32_MIN);
+    assert(s32_a[2] == 65536 && s32_a[3] == 32767 * 65536 && s32_a[4] == 32767 * 65536);
+    ref->pack_f32(in, f32_a, 5);
+    assert(f32_a[1] == -1.0f && f32_a[4] > 1.2f);
+}
+
+static void check_mix(const struct _WM_MixKernels *ref,
+                      const struct _WM_MixKernels *k) {
+    int32_t in[100];
+    int32_t s32_a[100], s32_b[100];
+    float f32_a[100], f32_b[100];
+    uint32_t samples, i;
+    float gain;
+    int t;
+
+    for (t = 0; t < 2000; t++) {
+        samples = rnd(100);
+        gain = (float)rnd(3000) / 1000.0f;
+        for (i = 0; i < 100; i++) {
+            in[i] = (int32_t)rnd(140000) - 70000;
+            s32_a[i] = s32_b[i] = (int32_t)rnd(2000000) - 1000000;
+            f32_a[i] = f32_b[i] = (float)s32_a[i] / 32768.0f;
+        }
+        ref->mix_s32(in, s32_a, samples, gain);
+        k->mix_s32(in, s32_b, samples, gain);
+        assert(memcmp(s32_a, s32_b, sizeof(s32_a)) == 0);
+
+        /* the C loop may be contracted into fused multiply-adds */
+        ref->mix_f32(in, f32_a, samples, gain);
+        k->mix_f32(in, f32_b, samples, gain);
+        for (i = 0; i < 100; i++)
+            assert(fabsf(f32_a[i] - f32_b[i]) <= 1e-6f * (1.0f + fabsf(f32_a[i])));
+    }
+
+    /* unity gain adds the mix as it is, 1/32768 per step for float */
+    in[0] = -40000; in[1] = 3; in[2] = 40000;
+    s32_a[0] = s32_a[1] = s32_a[2] = 10;
+    f32_a[0] = f32_a[1] = f32_a[2] = 0.5f;
+    ref->mix_s32(in, s32_a, 3, 1.0f);
+    assert(s32_a[0] == -39990 && s32_a[1] == 13 && s32_a[2] == 40010);
+    ref->mix_f32(in, f32_a, 3, 2.0f);
+    assert(f32_a[1] == 0.5f + 6.0f / 32768.0f && f32_a[2] > 2.9f);
+
+    /* near full scale the scaled sample is held to the int32 range and
+       the sum wraps, the same in every version */
+    for (t = 0; t < 2000; t++) {
+        samples = rnd(100);
+        gain = (float)rnd(4000) / 1000.0f;
+        for (i = 0; i < 100; i++) {
+            in[i] = (int32_t)(rnd(0x10000) << 16) + (int32_t)rnd(0x10000);
+            s32_a[i] = s32_b[i] = (int32_t)(rnd(0x10000) << 16) + (int32_t)rnd(0x10000);
+        }
+        in[0] = INT32_MAX; in[1] = INT32_MIN;
+        ref->mix_s32(in, s32_a, samples, gain);
+        k->mix_s32(in, s32_b, samples, gain);
+        assert(memcmp(s32_a, s32_b, sizeof(s32_a)) == 0);
+    }
+    in[0] = INT32_MAX; in[1] = INT32_MIN; in[2] = 1; in[3] = -1;
+    s32_a[0] = s32_a[1] = 0;
+    s32_a[2] = INT32_MAX; s32_a[3] = INT32_MIN;
+    ref->mix_s32(in, s32_a, 4, 2.0f);
+    assert(s32_a[0] == 2147483520 && s32_a[1] == INT32_MIN);
+    assert(s32_a[2] == INT32_MIN + 1 && s32_a[3] == INT32_MAX - 1);
+}
+
+int main(void) {
+    const struct _WM_MixKernels *ref, *k;
+    int i;
+
+    for (i = 0; i <= DATA_LEN; i++)
+        data[i] = (int16_t)((int32_t)rnd(65536) - 32768);
+    data[10] = 32767; data[11] = -32768;
+    data[12] = -32768; data[13] = 32767;
+    for (i = 0; i < 1024; i++)
+        env_amp[i] = (int32_t)(1024.0 * pow(2.0, ((double)i / 1023.0 - 1.0) * 6.0) + 0.5);
+    /* small enough that a 32 tap window can't overflow */
+    for (i = 0; i < 1024 * 32; i++)
+        sinc_coef[i] = (int16_t)((int32_t)rnd(769) - 256);
+
+    _WM_InitMixKernels();
+    assert(_WM_mix != NULL);
+    ref = _WM_GetMixKernels(0);
+    assert(ref != NULL);
+    for (i = 0; (k = _WM_GetMixKernels(i)) != NULL; i++) {
+        printf("%s%s\n", k->name, (k == _WM_mix) ? " (selected)" : "");
+        check_linear(ref, k);
+        check_sinc(ref, k);
+        check_gauss(ref, k);
+        check_pack(ref, k);
+        check_mix(ref, k);
+    }
+    assert(i >= 1);
+    return (0);
+}
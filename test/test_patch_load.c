@@ -0,0 +1,143 @@
+/* assert-based check of patch loading against the built-in OPL3 patch set
+ * ("@opl3"). A song that uses a couple of dozen patches sounds the same
+ * whether they are loaded by the opening thread alone or shared out over
+ * the worker pool, and a second song opened while the first holds the
+ * same patches finds them loaded. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wildmidi_lib.h"
+#include "patches.h"
+
+#define RATE 44100
+
+static uint8_t song[1 << 14];
+static uint32_t song_size;
+
+static void put(uint8_t b) {
+    assert(song_size < sizeof(song));
+    song[song_size++] = b;
+}
+
+static void put_event(uint8_t delta, uint8_t status, uint8_t d1, uint8_t d2) {
+    put(delta);                     /* deltas are kept below 0x80 */
+    put(status);
+    put(d1);
+    if ((status & 0xf0) != 0xc0)
+        put(d2);
+}
+
+/* programs in turn on the melodic channels, then drums. Each OPL3 patch
+   takes a while to render, so not all of them. */
+static void make_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    uint32_t len;
+    uint8_t ch;
+    int i;
+
+    song_size = 0;
+    for (i = 0; i < (int) sizeof(header); i++)
+        put(header[i]);
+    for (i = 0; i < 128; i += 8) {
+        ch = (uint8_t) (i % 15);
+        if (ch >= 9)
+            ch++;
+        put_event(0, 0xc0 | ch, (uint8_t) i, 0);
+        put_event(0, 0x90 | ch, 60, 100);
+        put_event(12, 0x80 | ch, 60, 0);
+    }
+    for (i = 35; i <= 81; i += 6) {
+        put_event(0, 0x99, (uint8_t) i, 100);
+        put_event(12, 0x89, (uint8_t) i, 0);
+    }
+    put(0); put(0xff); put(0x2f); put(0);
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t) (len >> 24);
+    song[19] = (uint8_t) (len >> 16);
+    song[20] = (uint8_t) (len >> 8);
+    song[21] = (uint8_t) len;
+}
+
+/* renders all of handle; returns the byte count, the bytes in *out */
+static uint32_t render(midi *handle, uint8_t **out) {
+    uint8_t *buf = NULL;
+    uint32_t size = 0;
+    int res;
+
+    for (;;) {
+        buf = realloc(buf, size + 4096);
+        assert(buf != NULL);
+        res = WildMidi_GetOutput(handle, (int8_t *) buf + size, 4096);
+        assert(res >= 0);
+        if (res == 0)
+            break;
+        size += (uint32_t) res;
+    }
+    *out = buf;
+    return (size);
+}
+
+static uint32_t open_render(unsigned int threads, uint8_t **out) {
+    midi *handle;
+    uint32_t size;
+
+    _WM_load_threads = threads;
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    size = render(handle, out);
+    WildMidi_Close(handle);
+    return (size);
+}
+
+int main(void) {
+    static const unsigned int threads[] = { 2, 8, 0 };
+    uint8_t *alone, *shared, *second;
+    uint32_t alone_size, size;
+    midi *first;
+    uint32_t i;
+    int res;
+
+    res = WildMidi_Init("@opl3", RATE, 0);
+    assert(res == 0);
+    make_song();
+
+    alone_size = open_render(1, &alone);
+    assert(alone_size > 0);
+    for (i = 0; i < alone_size && alone[i] == 0; i++);
+    assert(i < alone_size); /* not silence */
+
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        size = open_render(threads[i], &shared);
+        assert(size == alone_size);
+        assert(memcmp(shared, alone, size) == 0);
+        free(shared);
+    }
+
+    /* opened while another song holds its patches, nothing is left to
+       load, and the first song still plays as it did */
+    _WM_load_threads = 8;
+    first = WildMidi_OpenBuffer(song, song_size);
+    assert(first != NULL);
+    size = open_render(1, &second);
+    assert(size == alone_size);
+    assert(memcmp(second, alone, size) == 0);
+    free(second);
+    size = render(first, &shared);
+    assert(size == alone_size);
+    assert(memcmp(shared, alone, size) == 0);
+    free(shared);
+    WildMidi_Close(first);
+
+    free(alone);
+    res = WildMidi_Shutdown();
+    assert(res == 0);
+    (void) res;
+    (void) size;
+    (void) alone_size;
+    return (0);
+}
@@ -0,0 +1,1535 @@
+/* assert-based render test against the built-in OPL3 patch set ("@opl3"),
+ * on small generated songs (vibrato, pitch bends, sustain, retriggers).
+ * It checks:
+ *  - the same output however the caller slices the output buffer
+ *  - every output format, mixing into the caller's buffer, and stems
+ *  - that the output doesn't depend on what was in the caller's buffers
+ *  - the voice cap, and the voice pool growing to a big chord and reused
+ *  - backward seeks against a replay from the top, and accurate seeks
+ *  - every kind of event written back out as it was read
+ *  - thousands of lyrics, each whole and in turn
+ *  - a type 1 song's track merge against a linear merge
+ *  - a probe against opening the song
+ *  - the tempo map's tick, sample and bar lookups
+ *  - the cache: playback, lost and broken entries, the size limit, MUS keys
+ *  - the sinc resampling option's validation
+ *  - error messages: length, code and clearing
+ *  - streamed songs: playback, seeks, conversion, tick maps, caching
+ *  - WildMidi_RenderBatch() against rendering each song alone
+ *  - contexts at different rates playing at the same time
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wildmidi_lib.h"
+
+#define RATE 44100
+
+static uint8_t song[1 << 18];
+static uint32_t song_size;
+
+static void put(uint8_t b) {
+    assert(song_size < sizeof(song));
+    song[song_size++] = b;
+}
+
+static void put_event(uint8_t delta, uint8_t status, uint8_t d1, uint8_t d2) {
+    put(delta);                     /* deltas are kept below 0x80 */
+    put(status);
+    put(d1);
+    if (((status & 0xf0) != 0xc0) && ((status & 0xf0) != 0xd0))
+        put(d2);
+}
+
+/* tempo is in microseconds per quarter note, 0 for the default; vibrato
+   is the modulation the odd channels get */
+static void make_song(uint32_t tempo, uint8_t vibrato) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    uint32_t seed = 1;
+    uint32_t len;
+    int i;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+
+    if (tempo) {
+        put(0); put(0xff); put(0x51); put(3);
+        put((uint8_t)(tempo >> 16)); put((uint8_t)(tempo >> 8)); put((uint8_t)tempo);
+    }
+    for (i = 0; i < 8; i++) {
+        put_event(0, 0xc0 | i, (uint8_t)(i * 9), 0);
+        put_event(0, 0xb0 | i, 1, (i & 1) ? vibrato : 0);
+        put_event(0, 0xb0 | i, 10, (uint8_t)(i * 16));
+    }
+    for (i = 0; i < 200; i++) {
+        uint8_t ch, delta;
+        seed = seed * 1103515245 + 12345;
+        ch = (seed >> 16) & 7;
+        if (((seed >> 20) & 3) == 0) ch = 9;
+        delta = (uint8_t)((seed >> 8) % 24);
+        switch ((seed >> 24) & 7) {
+        case 0:
+            put_event(delta, 0xe0 | ch, 0, (uint8_t)((seed >> 3) & 0x7f));
+            break;
+        case 1:
+            put_event(delta, 0xb0 | ch, 64, ((seed >> 5) & 1) ? 127 : 0);
+            break;
+        case 2:
+            put_event(delta, 0x80 | ch, (uint8_t)(48 + ((seed >> 4) % 24)), 64);
+            break;
+        default:
+            put_event(delta, 0x90 | ch, (uint8_t)(48 + ((seed >> 4) % 24)),
+                      (uint8_t)(1 + ((seed >> 2) % 127)));
+            break;
+        }
+    }
+    for (i = 0; i < 16; i++)
+        put_event(i ? 0 : 96, 0xb0 | i, 123, 0);
+    put(0); put(0xff); put(0x2f); put(0);
+
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t)(len >> 24);
+    song[19] = (uint8_t)(len >> 16);
+    song[20] = (uint8_t)(len >> 8);
+    song[21] = (uint8_t)len;
+}
+
+/* Render up to limit bytes of the song (0 for all of it), cycling the
+   request size through sizes[], and return the output. */
+static int8_t *render(uint16_t options, const uint32_t *sizes, int nsizes,
+                      uint32_t limit, uint32_t *total) {
+    midi *handle = WildMidi_OpenBuffer(song, song_size);
+    int8_t *out = NULL;
+    uint32_t alloc = 0;
+    int res, n = 0;
+
+    assert(handle != NULL);
+    res = WildMidi_SetOption(handle, WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB
+                             | WM_MO_SINC_RESAMPLING, options);
+    assert(res == 0);
+
+    *total = 0;
+    do {
+        uint32_t size = sizes[n++ % nsizes];
+        if (*total + size > alloc) {
+            alloc = (alloc + size) * 2;
+            out = (int8_t *) realloc(out, alloc);
+            assert(out != NULL);
+        }
+        res = WildMidi_GetOutput(handle, out + *total, size);
+        assert(res >= 0);
+        *total += (uint32_t)res;
+    } while ((res > 0) && ((limit == 0) || (*total < limit)));
+
+    res = WildMidi_Close(handle);
+    assert(res == 0);
+    return (out);
+}
+
+static void check_slicing(uint16_t options, uint32_t seconds) {
+    static const uint32_t whole[] = { 16384 };
+    static const uint32_t odd[] = { 4, 252, 1000, 256, 8, 4096, 60 };
+    uint32_t total_a, total_b, i;
+    int8_t *a, *b;
+    int loud = 0;
+
+    a = render(options, whole, 1, seconds * RATE * 4, &total_a);
+    b = render(options, odd, 7, seconds * RATE * 4, &total_b);
+    if (seconds) {
+        /* the last request may overshoot the limit by different amounts */
+        if (total_a > seconds * RATE * 4) total_a = seconds * RATE * 4;
+        if (total_b > seconds * RATE * 4) total_b = seconds * RATE * 4;
+    }
+    assert(total_a == total_b);
+    assert(total_a >= RATE * 4);
+    assert(memcmp(a, b, total_a) == 0);
+    for (i = 0; i < total_a && !loud; i++)
+        loud = (a[i] != 0);
+    assert(loud);
+    free(a);
+    free(b);
+}
+
+/* WildMidi_GetOutputS32 and WildMidi_GetOutputFloat give the 16 bit
+   output's samples, except that float is not clamped. */
+static void check_formats(uint16_t options) {
+    static int16_t s16[4096];
+    static int32_t s32[4096];
+    static float f32[4096];
+    midi *h16 = WildMidi_OpenBuffer(song, song_size);
+    midi *h32 = WildMidi_OpenBuffer(song, song_size);
+    midi *hf = WildMidi_OpenBuffer(song, song_size);
+    int r16, r32, rf, i, n;
+    float v;
+
+    assert(h16 != NULL && h32 != NULL && hf != NULL);
+    WildMidi_SetOption(h16, WM_MO_REVERB, options);
+    WildMidi_SetOption(h32, WM_MO_REVERB, options);
+    WildMidi_SetOption(hf, WM_MO_REVERB, options);
+    /* odd sizes: the float and s32 calls must reject them */
+    rf = WildMidi_GetOutputFloat(hf, f32, 12);
+    assert(rf == -1);
+    r32 = WildMidi_GetOutputS32(h32, s32, 4);
+    assert(r32 == -1);
+    for (n = 0; n < RATE; n += r16 / 4) {
+        r16 = WildMidi_GetOutput(h16, (int8_t *) s16, sizeof(s16));
+        r32 = WildMidi_GetOutputS32(h32, s32, sizeof(s32));
+        rf = WildMidi_GetOutputFloat(hf, f32, sizeof(f32));
+        assert(r16 == sizeof(s16) && r32 == sizeof(s32) && rf == sizeof(f32));
+        for (i = 0; i < 4096; i++) {
+            assert(s32[i] == (int32_t)s16[i] * 65536);
+            v = f32[i] * 32768.0f;
+            if (v > 32767.0f) v = 32767.0f;
+            if (v < -32768.0f) v = -32768.0f;
+            assert(v == (float)s16[i]);
+        }
+    }
+    (void) r32; (void) rf;
+    WildMidi_Close(h16);
+    WildMidi_Close(h32);
+    WildMidi_Close(hf);
+}
+
+/* WildMidi_MixOutputFloat and WildMidi_MixOutputS32 add the float and
+   unclamped 16 bit scale output, times the gain, to the buffer. */
+static void check_mixing(uint16_t options) {
+    static float f32[4096], mf32[4096];
+    static int32_t ms32[4096];
+    midi *hf = WildMidi_OpenBuffer(song, song_size);
+    midi *hmf = WildMidi_OpenBuffer(song, song_size);
+    midi *hms = WildMidi_OpenBuffer(song, song_size);
+    int rf, rmf, rms, i, n;
+
+    assert(hf != NULL && hmf != NULL && hms != NULL);
+    WildMidi_SetOption(hf, WM_MO_REVERB, options);
+    WildMidi_SetOption(hmf, WM_MO_REVERB, options);
+    WildMidi_SetOption(hms, WM_MO_REVERB, options);
+    rmf = WildMidi_MixOutputFloat(hmf, mf32, 12, 1.0f);
+    assert(rmf == -1);
+    /* the gain is a finite number, 0 or more */
+    rmf = WildMidi_MixOutputFloat(hmf, mf32, sizeof(mf32), -0.5f);
+    assert(rmf == -1);
+    rmf = WildMidi_MixOutputFloat(hmf, mf32, sizeof(mf32), NAN);
+    assert(rmf == -1);
+    rms = WildMidi_MixOutputS32(hms, ms32, sizeof(ms32), INFINITY);
+    assert(rms == -1);
+    for (n = 0; n < RATE; n += rf / 8) {
+        for (i = 0; i < 4096; i++) {
+            mf32[i] = (float)(i - 2048) / 4096.0f;
+            ms32[i] = i - 2048;
+        }
+        rf = WildMidi_GetOutputFloat(hf, f32, sizeof(f32));
+        rmf = WildMidi_MixOutputFloat(hmf, mf32, sizeof(mf32), 0.5f);
+        rms = WildMidi_MixOutputS32(hms, ms32, sizeof(ms32), 1.0f);
+        assert(rf == sizeof(f32) && rmf == sizeof(mf32) && rms == sizeof(ms32));
+        for (i = 0; i < 4096; i++) {
+            assert(fabsf(mf32[i] - ((float)(i - 2048) / 4096.0f + f32[i] * 0.5f)) < 1e-6f);
+            assert(ms32[i] == (i - 2048) + (int32_t)(f32[i] * 32768.0f));
+        }
+    }
+    (void) rmf; (void) rms;
+    WildMidi_Close(hf);
+    WildMidi_Close(hmf);
+    WildMidi_Close(hms);
+}
+
+/* WildMidi_GetOutputStems: the master is the float output and, without
+   reverb, the sum of the 16 stems; a stem comes out the same whether or
+   not the others and the master are asked for. */
+static void check_stems(uint16_t options) {
+    static float f32[4096], master[4096], stem[16][4096], lone[4096];
+    float *all[16], *one[16];
+    midi *hf = WildMidi_OpenBuffer(song, song_size);
+    midi *hs = WildMidi_OpenBuffer(song, song_size);
+    midi *h1 = WildMidi_OpenBuffer(song, song_size);
+    int rf, rs, r1, i, ch, n, loud = 0;
+    int used[16] = { 0 };
+    float sum;
+
+    assert(hf != NULL && hs != NULL && h1 != NULL);
+    WildMidi_SetOption(hf, WM_MO_REVERB, options);
+    WildMidi_SetOption(hs, WM_MO_REVERB, options);
+    WildMidi_SetOption(h1, WM_MO_REVERB, options);
+    for (ch = 0; ch < 16; ch++) {
+        all[ch] = stem[ch];
+        one[ch] = NULL;
+    }
+    one[9] = lone;
+    rs = WildMidi_GetOutputStems(hs, NULL, master, sizeof(master));
+    assert(rs == -1);
+    rs = WildMidi_GetOutputStems(hs, one, NULL, 12);
+    assert(rs == -1);
+    for (n = 0; n < RATE; n += rf / 8) {
+        rf = WildMidi_GetOutputFloat(hf, f32, sizeof(f32));
+        rs = WildMidi_GetOutputStems(hs, all, master, sizeof(master));
+        r1 = WildMidi_GetOutputStems(h1, one, NULL, sizeof(lone));
+        assert(rf == sizeof(f32) && rs == sizeof(master) && r1 == sizeof(lone));
+        assert(memcmp(f32, master, sizeof(f32)) == 0);
+        assert(memcmp(stem[9], lone, sizeof(lone)) == 0);
+        for (i = 0; i < 4096; i++) {
+            for (sum = 0.0f, ch = 0; ch < 16; ch++) {
+                sum += stem[ch][i];
+                used[ch] |= (stem[ch][i] != 0.0f);
+            }
+            if (!(options & WM_MO_REVERB))
+                assert(sum == master[i]);
+        }
+    }
+    /* the drums and at least one other channel play in the first second */
+    for (ch = 0; ch < 16; ch++)
+        loud += used[ch];
+    assert(used[9] && loud >= 2);
+    (void) rs; (void) r1; (void) sum; (void) loud;
+    WildMidi_Close(hf);
+    WildMidi_Close(hs);
+    WildMidi_Close(h1);
+}
+
+/* The output overwrites the caller's buffers, which are not cleared
+   first: what was in them makes no difference, over the whole size asked
+   for, through silence and past the end of the song. */
+static void check_overwrite(uint16_t options) {
+    static const uint32_t odd[] = { 4096, 8, 16384, 1000, 256 };
+    static int8_t dirty[16384], clean[16384];
+    static float master[2][8192], stem[2][16][8192];
+    float *stems[2][16];
+    midi *hd = WildMidi_OpenBuffer(song, song_size);
+    midi *hc = WildMidi_OpenBuffer(song, song_size);
+    midi *sd = WildMidi_OpenBuffer(song, song_size);
+    midi *sc = WildMidi_OpenBuffer(song, song_size);
+    uint32_t size, i;
+    int rd, rc, n = 0, ch;
+
+    assert(hd != NULL && hc != NULL && sd != NULL && sc != NULL);
+    WildMidi_SetOption(hd, WM_MO_REVERB, options);
+    WildMidi_SetOption(hc, WM_MO_REVERB, options);
+    WildMidi_SetOption(sd, WM_MO_REVERB, options);
+    WildMidi_SetOption(sc, WM_MO_REVERB, options);
+    for (ch = 0; ch < 16; ch++) {
+        stems[0][ch] = stem[0][ch];
+        stems[1][ch] = stem[1][ch];
+    }
+    do {
+        size = odd[n++ % 5];
+        memset(dirty, 0x5a, sizeof(dirty));
+        memset(clean, 0, sizeof(clean));
+        rd = WildMidi_GetOutput(hd, dirty, size);
+        rc = WildMidi_GetOutput(hc, clean, size);
+        assert(rd == rc && rd >= 0);
+        assert(memcmp(dirty, clean, size) == 0);
+        for (i = (uint32_t) rc; i < size; i++)
+            assert(clean[i] == 0);
+
+        /* all ones is a NaN */
+        memset(master[0], 0xff, sizeof(master[0]));
+        memset(stem[0], 0xff, sizeof(stem[0]));
+        memset(master[1], 0, sizeof(master[1]));
+        memset(stem[1], 0, sizeof(stem[1]));
+        rd = WildMidi_GetOutputStems(sd, stems[0], master[0], size * 2);
+        rc = WildMidi_GetOutputStems(sc, stems[1], master[1], size * 2);
+        assert(rd == rc && rd >= 0);
+        assert(memcmp(master[0], master[1], size * 2) == 0);
+        for (ch = 0; ch < 16; ch++)
+            assert(memcmp(stem[0][ch], stem[1][ch], size * 2) == 0);
+    } while (rc > 0);
+    (void) rd; (void) i;
+    WildMidi_Close(hd);
+    WildMidi_Close(hc);
+    WildMidi_Close(sd);
+    WildMidi_Close(sc);
+}
+
+/* one key struck again each time it is let go, so the new note waits in
+   a voice of its own while the last fades */
+static void make_retrigger_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    uint32_t len;
+    int i;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    put_event(0, 0x90, 60, 100);
+    for (i = 0; i < 16; i++) {
+        put_event(24, 0x80, 60, 64);
+        put_event(0, 0x90, 60, 100);
+    }
+    put_event(24, 0x80, 60, 64);
+    put(0); put(0xff); put(0x2f); put(0);
+
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t)(len >> 24);
+    song[19] = (uint8_t)(len >> 16);
+    song[20] = (uint8_t)(len >> 8);
+    song[21] = (uint8_t)len;
+}
+
+/* Under a voice cap no more notes play at once than the cap, a retriggered
+   note's fading voice included, and the notes cut to keep it there are
+   counted. */
+static void check_voice_cap(void) {
+    static int8_t out[16384];
+    midi *free_h = WildMidi_OpenBuffer(song, song_size);
+    midi *capped = WildMidi_OpenBuffer(song, song_size);
+    struct _WM_Info *info;
+    int res;
+
+    assert(free_h != NULL && capped != NULL);
+    res = WildMidi_SetMaxVoices(NULL, 4);
+    assert(res == -1);
+    res = WildMidi_SetMaxVoices(capped, 4);
+    assert(res == 0);
+    while (WildMidi_GetOutput(free_h, out, sizeof(out)) > 0)
+        ;
+    while (WildMidi_GetOutput(capped, out, sizeof(out)) > 0)
+        ;
+    info = WildMidi_GetInfo(free_h);
+    assert(info->max_voices == 0 && info->stolen_voices == 0);
+    assert(info->peak_voices > 4);
+    info = WildMidi_GetInfo(capped);
+    assert(info->max_voices == 4 && info->peak_voices == 4);
+    assert(info->stolen_voices > 0);
+    WildMidi_Close(free_h);
+    WildMidi_Close(capped);
+
+    make_retrigger_song();
+    free_h = WildMidi_OpenBuffer(song, song_size);
+    capped = WildMidi_OpenBuffer(song, song_size);
+    assert(free_h != NULL && capped != NULL);
+    res = WildMidi_SetMaxVoices(capped, 1);
+    assert(res == 0);
+    while (WildMidi_GetOutput(free_h, out, sizeof(out)) > 0)
+        ;
+    while (WildMidi_GetOutput(capped, out, sizeof(out)) > 0)
+        ;
+    info = WildMidi_GetInfo(free_h);
+    assert(info->peak_voices == 2);
+    info = WildMidi_GetInfo(capped);
+    assert(info->peak_voices == 1 && info->stolen_voices > 0);
+    (void) res; (void) info;
+    WildMidi_Close(free_h);
+    WildMidi_Close(capped);
+}
+
+/* 8 channels of 12 keys struck at once, more than 3 of the voice pool's
+   32 voice chunks, held, let go, then a smaller chord. Nothing sounds at
+   tick 0, which a fast seek there would skip. */
+static void make_chord_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    uint32_t len;
+    int ch, key;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    for (ch = 0; ch < 8; ch++)
+        put_event(0, 0xc0 | ch, (uint8_t)(ch * 9), 0);
+    for (ch = 0; ch < 8; ch++)
+        for (key = 0; key < 12; key++)
+            put_event((ch || key) ? 0 : 24, 0x90 | ch, (uint8_t)(48 + key * 2),
+                      (uint8_t)(60 + key));
+    for (ch = 0; ch < 8; ch++)
+        for (key = 0; key < 12; key++)
+            put_event((ch || key) ? 0 : 96, 0x80 | ch, (uint8_t)(48 + key * 2), 64);
+    for (ch = 0; ch < 4; ch++)
+        for (key = 0; key < 5; key++)
+            put_event((ch || key) ? 0 : 120, 0x90 | ch, (uint8_t)(50 + key * 3), 90);
+    for (ch = 0; ch < 4; ch++)
+        for (key = 0; key < 5; key++)
+            put_event((ch || key) ? 0 : 96, 0x80 | ch, (uint8_t)(50 + key * 3), 64);
+    put(0); put(0xff); put(0x2f); put(0);
+
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t)(len >> 24);
+    song[19] = (uint8_t)(len >> 16);
+    song[20] = (uint8_t)(len >> 8);
+    song[21] = (uint8_t)len;
+}
+
+/* The voice pool grows to hold every note of the big chord, and voices
+   handed back to it play the song again just as new ones did. */
+static void check_voice_pool(void) {
+    static const uint32_t whole[] = { 16384 };
+    static int8_t buf[16384];
+    int8_t *first;
+    uint32_t total, at;
+    unsigned long pos;
+    midi *handle;
+    int res;
+
+    make_chord_song();
+    first = render(0, whole, 1, 0, &total);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    while (WildMidi_GetOutput(handle, buf, sizeof(buf)) > 0)
+        ;
+    assert(WildMidi_GetInfo(handle)->peak_voices >= 96);
+    pos = 0;
+    res = WildMidi_FastSeek(handle, &pos);
+    assert(res == 0);
+    for (at = 0; (res = WildMidi_GetOutput(handle, buf, sizeof(buf))) > 0; at += (uint32_t)res) {
+        assert(at + (uint32_t)res <= total);
+        assert(memcmp(buf, first + at, (size_t)res) == 0);
+    }
+    assert(res == 0 && at == total);
+    WildMidi_Close(handle);
+    free(first);
+    make_song(0, 100);
+    (void) res;
+}
+
+/* A backward seek, which starts from the nearest checkpoint, lands in the
+   same state as replaying the song from the top to the same place. */
+static void check_seek(void) {
+    static const double secs[] = { 75.0, 40.0, 31.0, 61.5, 2.0 };
+    static int8_t a[RATE * 4], b[RATE * 4];
+    midi *back, *replay;
+    unsigned long pos;
+    int i, res;
+
+    make_song(4000000, 100);    /* 8 times slower, a little over 90 s */
+    back = WildMidi_OpenBuffer(song, song_size);
+    replay = WildMidi_OpenBuffer(song, song_size);
+    assert(back != NULL && replay != NULL);
+    assert(WildMidi_GetInfo(back)->approx_total_samples > RATE * 80);
+    /* playing to the end records the checkpoints, and leaves both with the
+       same vibrato phase */
+    while (WildMidi_GetOutput(back, a, sizeof(a)) > 0)
+        ;
+    while (WildMidi_GetOutput(replay, b, sizeof(b)) > 0)
+        ;
+    for (i = 0; i < (int)(sizeof(secs) / sizeof(secs[0])); i++) {
+        pos = (unsigned long)(secs[i] * RATE);
+        res = WildMidi_FastSeek(back, &pos);
+        assert(res == 0);
+        /* from the top: with nothing earlier to restore, only replay */
+        pos = 0;
+        res = WildMidi_FastSeek(replay, &pos);
+        assert(res == 0);
+        pos = (unsigned long)(secs[i] * RATE);
+        res = WildMidi_FastSeek(replay, &pos);
+        assert(res == 0);
+        assert(WildMidi_GetInfo(back)->current_sample
+               == WildMidi_GetInfo(replay)->current_sample);
+        res = WildMidi_GetOutput(back, a, sizeof(a));
+        assert(res == (int) sizeof(a));
+        res = WildMidi_GetOutput(replay, b, sizeof(b));
+        assert(res == (int) sizeof(b));
+        assert(memcmp(a, b, sizeof(a)) == 0);
+    }
+    (void) res;
+    WildMidi_Close(back);
+    WildMidi_Close(replay);
+    make_song(0, 100);
+}
+
+/* An accurate seek, forward or back, sounds just like playing up to the
+   position. Skipping over vibrato is only close, so the song has none. */
+static void check_accurate_seek(void) {
+    static const double secs[] = { 2.0, 31.0, 40.0, 61.5, 75.0 };
+    static int8_t ref[5][8192 * 4];
+    static int8_t buf[8192 * 4];
+    midi *play, *seek;
+    unsigned long pos;
+    uint32_t at = 0, n;
+    int i, res;
+
+    make_song(4000000, 0);
+    play = WildMidi_OpenBuffer(song, song_size);
+    seek = WildMidi_OpenBuffer(song, song_size);
+    assert(play != NULL && seek != NULL);
+    for (i = 0; i < 5; i++) {
+        pos = (unsigned long)(secs[i] * RATE);
+        while (at < pos) {
+            n = (pos - at < 8192) ? (uint32_t)(pos - at) : 8192;
+            res = WildMidi_GetOutput(play, buf, n * 4);
+            assert(res == (int)(n * 4));
+            at += n;
+        }
+        res = WildMidi_GetOutput(play, ref[i], sizeof(ref[i]));
+        assert(res == (int) sizeof(ref[i]));
+        at += 8192;
+
+        res = WildMidi_AccurateSeek(seek, &pos);
+        assert(res == 0);
+        res = WildMidi_GetOutput(seek, buf, sizeof(buf));
+        assert(res == (int) sizeof(buf));
+        assert(memcmp(ref[i], buf, sizeof(buf)) == 0);
+    }
+    /* back again, from checkpoints that kept the notes */
+    while (WildMidi_GetOutput(seek, buf, sizeof(buf)) > 0)
+        ;
+    for (i = 4; i >= 0; i--) {
+        pos = (unsigned long)(secs[i] * RATE);
+        res = WildMidi_AccurateSeek(seek, &pos);
+        assert(res == 0);
+        res = WildMidi_GetOutput(seek, buf, sizeof(buf));
+        assert(res == (int) sizeof(buf));
+        assert(memcmp(ref[i], buf, sizeof(buf)) == 0);
+    }
+    /* a fast seek starts from silence */
+    pos = (unsigned long)(secs[3] * RATE);
+    res = WildMidi_FastSeek(seek, &pos);
+    assert(res == 0);
+    res = WildMidi_GetOutput(seek, buf, sizeof(buf));
+    assert(res == (int) sizeof(buf));
+    assert(memcmp(ref[3], buf, sizeof(buf)) != 0);
+    (void) res;
+    WildMidi_Close(play);
+    WildMidi_Close(seek);
+    make_song(0, 100);
+}
+
+/* two tracks, named, one with a copyright notice, as type 1 or type 2 */
+static void make_named_song(uint8_t type) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 2, 0, 96
+    };
+    static const uint8_t lead[] = {
+        0, 0xff, 0x03, 4, 'L', 'e', 'a', 'd',
+        0, 0xff, 0x02, 5, '(', 'c', ')', ' ', 'x',
+        0, 0x90, 60, 100, 96, 0x80, 60, 64, 0, 0xff, 0x2f, 0
+    };
+    static const uint8_t bass[] = {
+        0, 0xff, 0x03, 4, 'B', 'a', 's', 's',
+        0, 0xc1, 32, 0, 0x91, 36, 100, 0x7f, 0x81, 36, 64, 0, 0xff, 0x2f, 0
+    };
+    const uint8_t *tracks[2];
+    uint32_t sizes[2];
+    uint32_t i, j;
+
+    tracks[0] = lead; sizes[0] = sizeof(lead);
+    tracks[1] = bass; sizes[1] = sizeof(bass);
+    memcpy(song, header, sizeof(header));
+    song[9] = type;
+    song_size = sizeof(header);
+    for (i = 0; i < 2; i++) {
+        put('M'); put('T'); put('r'); put('k');
+        put(0); put(0); put(0); put((uint8_t)sizes[i]);
+        for (j = 0; j < sizes[i]; j++)
+            put(tracks[i][j]);
+    }
+}
+
+/* every kind of event a song keeps, with the values at the edges of what
+   the packed events hold: the largest tempo, SMPTE offset with an hour,
+   flat minor key, the full pitch bend, and the text kinds */
+static void make_meta_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    static const uint8_t metas[] = {
+        0, 0xff, 0x00, 2, 0x12, 0x34,                       /* sequence */
+        0, 0xff, 0x01, 4, 't', 'e', 'x', 't',
+        0, 0xff, 0x02, 3, '(', 'c', ')',
+        0, 0xff, 0x03, 5, 't', 'r', 'a', 'c', 'k',
+        0, 0xff, 0x04, 4, 'i', 'n', 's', 't',
+        0, 0xff, 0x05, 5, 'l', 'y', 'r', 'i', 'c',
+        0, 0xff, 0x06, 6, 'm', 'a', 'r', 'k', 'e', 'r',
+        0, 0xff, 0x07, 3, 'c', 'u', 'e',
+        0, 0xff, 0x20, 1, 0x05,                             /* channel */
+        0, 0xff, 0x21, 1, 0x03,                             /* port */
+        0, 0xff, 0x54, 5, 0x61, 0x3b, 0x3a, 0x1d, 0x63,     /* SMPTE */
+        0, 0xff, 0x51, 3, 0xff, 0xff, 0xff,                 /* tempo */
+        0, 0xff, 0x58, 4, 7, 3, 24, 8,                      /* 7/8 */
+        0, 0xff, 0x59, 2, 0xf9, 0x01,                       /* 7 flats minor */
+        0, 0xf0, 0x0a, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7f, 0x00, 0x41, 0xf7
+    };
+    uint32_t i, len;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    for (i = 0; i < sizeof(metas); i++)
+        put(metas[i]);
+    put_event(0, 0xc3, 0x7f, 0);
+    put_event(0, 0xb3, 7, 0x7f);
+    put_event(0, 0xe3, 0x7f, 0x7f);
+    put_event(0, 0x93, 0x7f, 0x7f);
+    put_event(5, 0xa3, 0x7f, 0x40);
+    put_event(5, 0xd3, 0x7f, 0);
+    put_event(5, 0xe3, 0, 0);
+    put_event(5, 0x83, 0x7f, 0);
+    put(0); put(0xff); put(0x2f); put(0);
+
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t)(len >> 24);
+    song[19] = (uint8_t)(len >> 16);
+    song[20] = (uint8_t)(len >> 8);
+    song[21] = (uint8_t)len;
+}
+
+/* every event survives being packed: written back out, the song is the
+   bytes it was read from, and so is that read again */
+static void check_events(void) {
+    int8_t *out, *again;
+    uint32_t size, again_size;
+    midi *handle;
+    int res;
+
+    make_meta_song();
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    res = WildMidi_GetMidiOutput(handle, &out, &size);
+    assert(res == 0 && size == song_size && memcmp(out, song, size) == 0);
+    WildMidi_Close(handle);
+    handle = WildMidi_OpenBuffer((uint8_t *) out, size);
+    assert(handle != NULL);
+    res = WildMidi_GetMidiOutput(handle, &again, &again_size);
+    assert(res == 0 && again_size == size && memcmp(again, out, size) == 0);
+    WildMidi_Close(handle);
+    free(out);
+    free(again);
+    make_song(0, 100);
+    (void) res;
+}
+
+/* the i-th of the lyric song's lyrics, of 4 to 40 characters */
+static void lyric_text(uint32_t i, char *text) {
+    uint32_t len;
+
+    sprintf(text, "%u:", i);
+    len = (uint32_t) strlen(text);
+    while (len < 4 + i % 37) {
+        text[len] = (char)('a' + (i + len) % 26);
+        len++;
+    }
+    text[len] = '\0';
+}
+
+/* a note and then 2000 lyrics, one a tick */
+#define LYRICS 2000
+static void make_lyric_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    char text[64];
+    uint32_t i, j, len;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    put_event(0, 0x90, 60, 100);
+    for (i = 0; i < LYRICS; i++) {
+        lyric_text(i, text);
+        len = (uint32_t) strlen(text);
+        put(1); put(0xff); put(0x05); put((uint8_t) len);
+        for (j = 0; j < len; j++)
+            put((uint8_t) text[j]);
+    }
+    put_event(1, 0x80, 60, 64);
+    put(0); put(0xff); put(0x2f); put(0);
+
+    len = song_size - sizeof(header);
+    song[18] = (uint8_t)(len >> 24);
+    song[19] = (uint8_t)(len >> 16);
+    song[20] = (uint8_t)(len >> 8);
+    song[21] = (uint8_t)len;
+}
+
+/* every lyric comes out of the shared string pool whole and in turn,
+   rendering less than a tick at a time so none is missed */
+static void check_lyrics(void) {
+    static int8_t buf[64 * 4];
+    char text[64];
+    const char *lyric;
+    uint32_t seen = 0;
+    midi *handle;
+
+    make_lyric_song();
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    while (WildMidi_GetOutput(handle, buf, sizeof(buf)) > 0) {
+        if ((lyric = WildMidi_GetLyric(handle)) == NULL)
+            continue;
+        assert(seen < LYRICS);
+        lyric_text(seen++, text);
+        assert(strcmp(lyric, text) == 0);
+    }
+    assert(seen == LYRICS);
+    WildMidi_Close(handle);
+    make_song(0, 100);
+}
+
+/* The type 1 merge song's track t event i: a delta of 0 to 3 ticks, so
+   tracks often have events on the same tick, and a controller naming its
+   track and place. */
+#define MERGE_TRACKS 40
+#define MERGE_EVENTS 60
+static void merge_event(uint32_t t, uint32_t i, uint8_t *delta, uint8_t *ev) {
+    uint32_t seed = t * 7919 + i * 104729 + 1;
+
+    seed = seed * 1103515245 + 12345;
+    *delta = (uint8_t)((seed >> 16) & 3);
+    ev[0] = (uint8_t)(0xb0 | (t & 15));
+    ev[1] = (uint8_t)(20 + t / 16);
+    ev[2] = (uint8_t)(i & 0x7f);
+}
+
+static void put_track_length(uint32_t start) {
+    uint32_t len = song_size - start - 4;
+
+    song[start] = (uint8_t)(len >> 24);
+    song[start + 1] = (uint8_t)(len >> 16);
+    song[start + 2] = (uint8_t)(len >> 8);
+    song[start + 3] = (uint8_t)len;
+}
+
+/* The merge song as type 1, or as the type 0 song merging its tracks the
+   way the parser did before it used a heap: tick by tick, each track's
+   events of the tick in track order. */
+static void make_merge_song(uint8_t type) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 0, 0, 96
+    };
+    uint32_t next[MERGE_TRACKS], done[MERGE_TRACKS];
+    uint32_t t, tick = 0, last = 0, left, start;
+    uint8_t delta, ev[3];
+
+    memcpy(song, header, sizeof(header));
+    song[9] = type;
+    song[11] = (type) ? MERGE_TRACKS : 1;
+    song_size = sizeof(header);
+    if (type) {
+        for (t = 0; t < MERGE_TRACKS; t++) {
+            put('M'); put('T'); put('r'); put('k');
+            start = song_size;
+            put(0); put(0); put(0); put(0);
+            for (left = 0; left < MERGE_EVENTS; left++) {
+                merge_event(t, left, &delta, ev);
+                put(delta); put(ev[0]); put(ev[1]); put(ev[2]);
+            }
+            put(0); put(0xff); put(0x2f); put(0);
+            put_track_length(start);
+        }
+        return;
+    }
+
+    put('M'); put('T'); put('r'); put('k');
+    start = song_size;
+    put(0); put(0); put(0); put(0);
+    for (t = 0; t < MERGE_TRACKS; t++) {
+        merge_event(t, 0, &delta, ev);
+        next[t] = delta;
+        done[t] = 0;
+    }
+    for (left = MERGE_TRACKS * MERGE_EVENTS; left; tick++) {
+        for (t = 0; t < MERGE_TRACKS; t++) {
+            while ((done[t] < MERGE_EVENTS) && (next[t] == tick)) {
+                merge_event(t, done[t], &delta, ev);
+                put((uint8_t)(tick - last)); put(ev[0]); put(ev[1]); put(ev[2]);
+                last = tick;
+                left--;
+                if (++done[t] < MERGE_EVENTS) {
+                    merge_event(t, done[t], &delta, ev);
+                    next[t] += delta;
+                }
+            }
+        }
+    }
+    put(0); put(0xff); put(0x2f); put(0);
+    put_track_length(start);
+}
+
+/* the type 1 tracks merge in the order the linear merge put them in */
+static void check_merge(void) {
+    int8_t *merged, *linear;
+    uint32_t merged_size, linear_size;
+    midi *handle;
+    int res;
+
+    make_merge_song(1);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    res = WildMidi_GetMidiOutput(handle, &merged, &merged_size);
+    assert(res == 0);
+    WildMidi_Close(handle);
+    make_merge_song(0);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    res = WildMidi_GetMidiOutput(handle, &linear, &linear_size);
+    assert(res == 0);
+    WildMidi_Close(handle);
+    assert(merged_size == linear_size && memcmp(merged, linear, merged_size) == 0);
+    free(merged);
+    free(linear);
+    make_song(0, 100);
+    (void) res;
+}
+
+/* a probe reports what opening the song does, and its text */
+static void check_probe(void) {
+    struct _WM_ProbeInfo info;
+    midi *handle;
+    uint32_t samples;
+    int res;
+
+    make_song(0, 100);
+    res = WildMidi_Probe(song, song_size, &info);
+    assert(res == 0);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    samples = WildMidi_GetInfo(handle)->approx_total_samples;
+    assert(info.approx_total_samples == samples);
+    assert(info.total_midi_time == WildMidi_GetInfo(handle)->total_midi_time);
+    assert(info.copyright == NULL && info.track_names == NULL);
+    assert(info.songs == 1);
+    WildMidi_Close(handle);
+
+    make_named_song(1);
+    res = WildMidi_Probe(song, song_size, &info);
+    assert(res == 0);
+    assert(info.copyright != NULL && strcmp(info.copyright, "(c) x") == 0);
+    assert(info.track_names != NULL && strcmp(info.track_names, "Lead\nBass") == 0);
+    assert(info.songs == 1);
+    assert(info.total_midi_time == 1000 * 127 / 192);
+    free(info.copyright);
+    free(info.track_names);
+
+    make_named_song(2);
+    res = WildMidi_Probe(song, song_size, &info);
+    assert(res == 0);
+    assert(info.songs == 2);
+    free(info.copyright);
+    free(info.track_names);
+
+    res = WildMidi_Probe(song, 10, &info);
+    assert(res == -1);
+    res = WildMidi_Probe(song, song_size, NULL);
+    assert(res == -1);
+    (void) res; (void) samples;
+}
+
+/* a conductor track changing tempo and time signature, one bar of it
+   mid-bar, and a track holding a note over it all */
+static void make_tempo_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 96
+    };
+    static const uint8_t conductor[] = {
+        0, 0xff, 0x51, 3, 0x07, 0xa1, 0x20,         /* 120 bpm */
+        0, 0xff, 0x58, 4, 4, 2, 24, 8,              /* 4/4 */
+        0x83, 0x00, 0xff, 0x51, 3, 0x03, 0xd0, 0x90, /* 384: 240 bpm */
+        0x83, 0x00, 0xff, 0x58, 4, 3, 2, 24, 8,     /* 768: 3/4 */
+        0x82, 0x4c, 0xff, 0x58, 4, 2, 2, 24, 8,     /* 1100: 2/4 */
+        0x82, 0x2c, 0xff, 0x2f, 0                   /* 1400 */
+    };
+    static const uint8_t notes[] = {
+        0, 0x90, 60, 100, 0x8a, 0x78, 0x80, 60, 64, 0, 0xff, 0x2f, 0
+    };
+    uint32_t i;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    put('M'); put('T'); put('r'); put('k');
+    put(0); put(0); put(0); put(sizeof(conductor));
+    for (i = 0; i < sizeof(conductor); i++)
+        put(conductor[i]);
+    put('M'); put('T'); put('r'); put('k');
+    put(0); put(0); put(0); put(sizeof(notes));
+    for (i = 0; i < sizeof(notes); i++)
+        put(notes[i]);
+}
+
+/* ticks map to the samples the song plays them at and back, and to bars
+   and beats across the time signature changes */
+static void check_tempo_map(void) {
+    struct _WM_BarBeat pos;
+    midi *handle;
+    uint32_t sample, tick, t;
+    int res;
+
+    make_tempo_song();
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    /* 229.6875 samples a tick, then 114.84375 from tick 384 */
+    assert(WildMidi_GetInfo(handle)->approx_total_samples == 204881);
+    res = WildMidi_TickToSample(handle, 384, &sample);
+    assert(res == 0 && sample == 88200);
+    res = WildMidi_TickToSample(handle, 768, &sample);
+    assert(res == 0 && sample == 132300);
+    res = WildMidi_TickToSample(handle, 1400, &sample);
+    assert(res == 0 && sample == 204881);
+    res = WildMidi_SampleToTick(handle, 88199, &tick);
+    assert(res == 0 && tick == 383);
+    res = WildMidi_SampleToTick(handle, 110250, &tick);
+    assert(res == 0 && tick == 576);
+    for (t = 0; t < 1500; t += 7) {
+        WildMidi_TickToSample(handle, t, &sample);
+        WildMidi_SampleToTick(handle, sample, &tick);
+        assert(tick == t);
+    }
+
+    res = WildMidi_GetBarBeat(handle, 0, &pos);
+    assert(res == 0 && pos.bar == 0 && pos.beat == 0 && pos.tick == 0);
+    assert(pos.tempo == 500000 && pos.divisions == 96);
+    assert(pos.numerator == 4 && pos.denominator == 4);
+    WildMidi_GetBarBeat(handle, 500, &pos);
+    assert(pos.bar == 1 && pos.beat == 1 && pos.tick == 20 && pos.tempo == 250000);
+    WildMidi_GetBarBeat(handle, 1066, &pos);
+    assert(pos.bar == 3 && pos.beat == 0 && pos.tick == 10 && pos.numerator == 3);
+    /* 2/4 came 44 ticks into bar 3, starting bar 4 */
+    WildMidi_GetBarBeat(handle, 1100, &pos);
+    assert(pos.bar == 4 && pos.beat == 0 && pos.tick == 0 && pos.numerator == 2);
+    WildMidi_GetBarBeat(handle, 1297, &pos);
+    assert(pos.bar == 5 && pos.beat == 0 && pos.tick == 5);
+
+    res = WildMidi_TickToSample(handle, 0, NULL);
+    assert(res == -1);
+    res = WildMidi_GetBarBeat(NULL, 0, &pos);
+    assert(res == -1);
+    WildMidi_Close(handle);
+    (void) res;
+}
+
+static uint8_t *read_file(const char *path, uint32_t *size) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *data;
+    long len;
+
+    if (f == NULL)
+        return (NULL);
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = (uint8_t *) malloc(len + 1);
+    assert(data != NULL);
+    *size = (uint32_t) fread(data, 1, (size_t) len, f);
+    fclose(f);
+    return (data);
+}
+
+static void write_file(const char *path, const uint8_t *data, uint32_t size) {
+    FILE *f = fopen(path, "wb");
+    size_t written;
+
+    assert(f != NULL);
+    written = fwrite(data, 1, size, f);
+    assert(written == size);
+    fclose(f);
+    (void) written;
+}
+
+/* the number of entries in the cache's index, and the path of the newest */
+static int cache_entries(const char *dir, char *newest) {
+    char path[1024];
+    unsigned long name, size;
+    int count = 0;
+    FILE *f;
+
+    sprintf(path, "%s/wildmidi.idx", dir);
+    if ((f = fopen(path, "r")) == NULL)
+        return (0);
+    while (fscanf(f, "%lx %lu", &name, &size) == 2) {
+        sprintf(newest, "%s/%08lx.wmc", dir, name);
+        count++;
+    }
+    fclose(f);
+    return (count);
+}
+
+/* a MUS song of 200 notes, each held for 7 ticks of the converter
+   frequency: enough events that the cache's 1 KB limit holds none of it */
+static void make_mus_song(void) {
+    static const uint8_t header[] = {
+        'M', 'U', 'S', 0x1a, 0, 0, 16, 0, 1, 0, 0, 0, 0, 0, 0, 0
+    };
+    uint32_t len;
+    int i;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    put(0x40); put(0); put(0);          /* program 0 */
+    for (i = 0; i < 200; i++) {
+        put(0x90); put(0x80 | (uint8_t)(48 + i % 24)); put(100); put(7);
+        put(0x80); put((uint8_t)(48 + i % 24)); put(3);
+    }
+    put(0x60);                          /* score end */
+    len = song_size - sizeof(header);
+    song[4] = (uint8_t) len;
+    song[5] = (uint8_t)(len >> 8);
+}
+
+static void check_cache(const char *dir) {
+    static const uint32_t whole[] = { 16384 };
+    struct _WM_ProbeInfo info;
+    char path[1024], other[1024];
+    uint8_t *good, *entry;
+    uint32_t good_size, size, total, plain_total;
+    int8_t *plain, *out;
+    midi *handle;
+    int res, entries;
+
+    make_song(0, 100);
+    plain = render(0, whole, 1, 0, &plain_total);
+
+    /* 1 KB holds nothing, so this clears what an earlier run left, and
+       then the song's entry is too big to keep */
+    res = WildMidi_SetCache(dir, 1);
+    entries = cache_entries(dir, path);
+    assert(res == 0 && entries == 0);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    WildMidi_Close(handle);
+    entries = cache_entries(dir, path);
+    assert(entries == 0);
+
+    /* parsed and kept, then read back */
+    res = WildMidi_SetCache(dir, 0);
+    assert(res == 0);
+    out = render(0, whole, 1, 0, &total);
+    assert(total == plain_total && memcmp(out, plain, total) == 0);
+    free(out);
+    entries = cache_entries(dir, path);
+    assert(entries == 1);
+    good = read_file(path, &good_size);
+    assert(good != NULL && good_size > 0);
+    out = render(0, whole, 1, 0, &total);
+    assert(total == plain_total && memcmp(out, plain, total) == 0);
+    free(out);
+
+    /* an entry the index lost, as to another program's index write, is
+       swept out when the cache is set, and the listed one kept */
+    sprintf(other, "%s/0badcafe.wmc", dir);
+    write_file(other, good, good_size);
+    res = WildMidi_SetCache(dir, 0);
+    assert(res == 0);
+    entry = read_file(other, &size);
+    assert(entry == NULL);
+    entries = cache_entries(dir, other);
+    assert(entries == 1 && strcmp(path, other) == 0);
+    entry = read_file(path, &size);
+    assert(entry != NULL && size == good_size);
+    free(entry);
+
+    /* a damaged or cut short entry is parsed over */
+    entry = (uint8_t *) malloc(good_size);
+    assert(entry != NULL);
+    memcpy(entry, good, good_size);
+    entry[good_size / 2] ^= 0x10;
+    write_file(path, entry, good_size);
+    out = render(0, whole, 1, 0, &total);
+    assert(total == plain_total && memcmp(out, plain, total) == 0);
+    free(out);
+    free(entry);
+    entry = read_file(path, &size);
+    assert(entry != NULL && size == good_size && memcmp(entry, good, size) == 0);
+    free(entry);
+    write_file(path, good, good_size / 2);
+    out = render(0, whole, 1, 0, &total);
+    assert(total == plain_total && memcmp(out, plain, total) == 0);
+    free(out);
+    entry = read_file(path, &size);
+    assert(entry != NULL && size == good_size && memcmp(entry, good, size) == 0);
+    free(entry);
+
+    /* room for one song: the next one pushes it out */
+    res = WildMidi_SetCache(dir, good_size / 1024 + 1);
+    assert(res == 0);
+    make_song(0, 50);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    total = WildMidi_GetInfo(handle)->approx_total_samples;
+    WildMidi_Close(handle);
+    entries = cache_entries(dir, other);
+    assert(entries == 1 && strcmp(path, other) != 0);
+    entry = read_file(path, &size);
+    assert(entry == NULL);
+    /* a probe takes it from the cache too */
+    res = WildMidi_Probe(song, song_size, &info);
+    assert(res == 0 && info.approx_total_samples == total);
+
+    /* a MUS song opened at another converter frequency is parsed again,
+       and the first frequency's entry still found */
+    res = WildMidi_SetCache(dir, 0);
+    assert(res == 0);
+    make_mus_song();
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    total = WildMidi_GetInfo(handle)->approx_total_samples;
+    WildMidi_Close(handle);
+    entries = cache_entries(dir, path);
+    res = WildMidi_SetCvtOption(WM_CO_FREQUENCY, 70);
+    assert(res == 0);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    /* half the frequency, twice as long */
+    size = WildMidi_GetInfo(handle)->approx_total_samples;
+    assert(size > total / 2 * 3 && size < total / 2 * 5);
+    WildMidi_Close(handle);
+    assert(cache_entries(dir, other) == entries + 1);
+    res = WildMidi_SetCvtOption(WM_CO_FREQUENCY, 0);
+    assert(res == 0);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    assert(WildMidi_GetInfo(handle)->approx_total_samples == total);
+    WildMidi_Close(handle);
+    assert(cache_entries(dir, other) == entries + 1);
+
+    res = WildMidi_SetCache("", 0);
+    assert(res == -1);
+    res = WildMidi_SetCache(dir, 1);
+    entries = cache_entries(dir, path);
+    assert(res == 0 && entries == 0);
+    res = WildMidi_SetCache(NULL, 0);
+    assert(res == 0);
+    free(good);
+    free(plain);
+    make_song(0, 100);
+    (void) res; (void) entries;
+}
+
+/* a type 1 song of two tracks, 40000 events in all, more than a streamed
+   open parses at once, with a program change late in each track */
+static void make_long_song(void) {
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0x03, 0xc0  /* 960 */
+    };
+    uint32_t start, len;
+    uint8_t ch, note;
+    int i;
+
+    memcpy(song, header, sizeof(header));
+    song_size = sizeof(header);
+    for (ch = 0; ch < 2; ch++) {
+        put('M'); put('T'); put('r'); put('k');
+        start = song_size;
+        put(0); put(0); put(0); put(0);
+        put_event(0, 0xc0 | ch, (uint8_t)(ch * 40), 0);
+        note = 60;
+        for (i = 0; i < 5000; i++) {
+            if (i == 3750)
+                put_event(0, 0xc0 | ch, (uint8_t)(80 + ch), 0);
+            put_event(4, 0x80 | ch, note, 64);
+            note = (uint8_t)(36 + ch * 12 + (i * 7) % 24);
+            put_event(0, 0x90 | ch, note, (uint8_t)(40 + i % 80));
+            put_event(0, 0xb0 | ch, 11, (uint8_t)(i % 128));
+            put_event(0, 0xe0 | ch, 0, (uint8_t)(32 + i % 64));
+        }
+        put_event(4, 0x80 | ch, note, 64);
+        put(0); put(0xff); put(0x2f); put(0);
+        len = song_size - start - 4;
+        song[start] = (uint8_t)(len >> 24);
+        song[start + 1] = (uint8_t)(len >> 16);
+        song[start + 2] = (uint8_t)(len >> 8);
+        song[start + 3] = (uint8_t)len;
+    }
+}
+
+/* Opened with WM_MO_STREAM, the song is parsed as it plays: it guesses its
+   length until it is all read, and otherwise behaves just as the whole
+   parse does. Inits the library itself, with and without the option. */
+static void check_stream(const char *dir) {
+    static const uint32_t whole[] = { 16384 };
+    static const uint32_t odd[] = { 4, 252, 1000, 256, 8, 4096, 60 };
+    static int8_t buf[8192 * 4];
+    const unsigned long at = RATE * 6;
+    int8_t *plain, *out, *plain_midi, *midi_out;
+    uint32_t plain_total, total, plain_midi_size, midi_size;
+    uint32_t length, guess, plain_sample, sample;
+    unsigned long pos;
+    char path[1024];
+    midi *handle;
+    int res, entries;
+
+    make_long_song();
+    res = WildMidi_Init("@opl3", RATE, 0);
+    assert(res == 0);
+    plain = render(0, whole, 1, 0, &plain_total);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    length = WildMidi_GetInfo(handle)->approx_total_samples;
+    res = WildMidi_TickToSample(handle, 18000, &plain_sample);
+    assert(res == 0);
+    res = WildMidi_GetMidiOutput(handle, &plain_midi, &plain_midi_size);
+    assert(res == 0);
+    WildMidi_Close(handle);
+    res = WildMidi_Shutdown();
+    assert(res == 0);
+
+    res = WildMidi_Init("@opl3", RATE, WM_MO_STREAM);
+    assert(res == 0);
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    guess = WildMidi_GetInfo(handle)->approx_total_samples;
+    assert(guess > length / 10 * 9 && guess < length / 10 * 11);
+    WildMidi_Close(handle);
+
+    out = render(0, odd, 7, 0, &total);
+    assert(total == plain_total && memcmp(out, plain, total) == 0);
+    free(out);
+
+    /* playing writes no cache entry, even played to its end: the close
+       does */
+    if (dir != NULL) {
+        res = WildMidi_SetCache(dir, 1);
+        assert(res == 0);
+        res = WildMidi_SetCache(dir, 0);
+        assert(res == 0);
+        handle = WildMidi_OpenBuffer(song, song_size);
+        assert(handle != NULL);
+        total = 0;
+        while ((res = WildMidi_GetOutput(handle, buf, sizeof(buf))) > 0)
+            total += (uint32_t) res;
+        assert(res == 0 && total == plain_total);
+        entries = cache_entries(dir, path);
+        assert(entries == 0);
+        WildMidi_Close(handle);
+        entries = cache_entries(dir, path);
+        assert(entries == 1);
+        res = WildMidi_SetCache(dir, 1);
+        assert(res == 0);
+        res = WildMidi_SetCache(NULL, 0);
+        assert(res == 0);
+    }
+
+    /* a seek reads on to where it lands, and knows the length once there */
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    pos = at;
+    res = WildMidi_AccurateSeek(handle, &pos);
+    assert(res == 0 && pos == at);
+    res = WildMidi_GetOutput(handle, buf, sizeof(buf));
+    assert(res == (int) sizeof(buf));
+    assert(memcmp(buf, plain + at * 4, sizeof(buf)) == 0);
+    pos = 0xffffffffUL;
+    res = WildMidi_FastSeek(handle, &pos);
+    assert(res == 0 && pos == length);
+    assert(WildMidi_GetInfo(handle)->approx_total_samples == length);
+    WildMidi_Close(handle);
+
+    handle = WildMidi_OpenBuffer(song, song_size);
+    assert(handle != NULL);
+    res = WildMidi_TickToSample(handle, 18000, &sample);
+    assert(res == 0 && sample == plain_sample);
+    res = WildMidi_GetMidiOutput(handle, &midi_out, &midi_size);
+    assert(res == 0 && midi_size == plain_midi_size
+           && memcmp(midi_out, plain_midi, midi_size) == 0);
+    WildMidi_Close(handle);
+
+    res = WildMidi_Shutdown();
+    assert(res == 0);
+    free(midi_out);
+    free(plain_midi);
+    free(plain);
+    (void) res; (void) length; (void) guess; (void) sample; (void) entries;
+}
+
+/* Plays the song in two contexts at different rates at once, turn about,
+   and checks each against WildMidi_Init() at its rate. Inits the library
+   itself. */
+static void check_contexts(void) {
+    static const uint32_t whole[] = { 16384 };
+    static const uint16_t rates[2] = { RATE, 22050 };
+    WildMidi_Context *ctx[2];
+    midi *handle[2], *handle_none;
+    int8_t *plain[2], *out[2];
+    uint32_t plain_total[2], total[2];
+    struct _WM_ProbeInfo info;
+    int res, i, playing;
+
+    make_song(0, 100);
+    for (i = 0; i < 2; i++) {
+        res = WildMidi_Init("@opl3", rates[i], 0);
+        assert(res == 0);
+        plain[i] = render(WM_MO_REVERB, whole, 1, 0, &plain_total[i]);
+        res = WildMidi_Shutdown();
+        assert(res == 0);
+    }
+    assert(plain_total[1] < plain_total[0]);
+
+    for (i = 0; i < 2; i++) {
+        ctx[i] = WildMidi_NewContext("@opl3", rates[i], 0);
+        assert(ctx[i] != NULL);
+        handle[i] = WildMidi_OpenBufferCtx(ctx[i], song, song_size);
+        assert(handle[i] != NULL);
+        res = WildMidi_SetOption(handle[i], WM_MO_REVERB, WM_MO_REVERB);
+        assert(res == 0);
+        out[i] = (int8_t *) malloc(plain_total[i] + 16384);
+        assert(out[i] != NULL);
+        total[i] = 0;
+    }
+    /* the legacy API still wants WildMidi_Init() */
+    handle_none = WildMidi_OpenBuffer(song, song_size);
+    assert(handle_none == NULL);
+
+    do {
+        playing = 0;
+        for (i = 0; i < 2; i++) {
+            res = WildMidi_GetOutput(handle[i], out[i] + total[i], 16384);
+            assert(res >= 0 && total[i] + (uint32_t) res <= plain_total[i]);
+            total[i] += (uint32_t) res;
+            playing |= (res > 0);
+        }
+    } while (playing);
+    for (i = 0; i < 2; i++) {
+        assert(total[i] == plain_total[i]);
+        assert(memcmp(out[i], plain[i], total[i]) == 0);
+    }
+
+    res = WildMidi_ProbeCtx(ctx[1], song, song_size, &info);
+    assert(res == 0 && info.approx_total_samples
+           == WildMidi_GetInfo(handle[1])->approx_total_samples);
+    free(info.copyright);
+    free(info.track_names);
+
+    /* freeing a context closes what is open in it */
+    for (i = 0; i < 2; i++) {
+        res = WildMidi_FreeContext(ctx[i]);
+        assert(res == 0);
+        free(out[i]);
+        free(plain[i]);
+    }
+    (void) res; (void) handle_none;
+}
+
+/* Renders the song with different options and request sizes in batches
+   on 3 threads, and checks each against rendering it alone. */
+#define BATCH 5
+static void check_batch(void) {
+    static const uint16_t options[BATCH] = {
+        0, WM_MO_REVERB, WM_MO_ENHANCED_RESAMPLING, WM_MO_SINC_8, 0
+    };
+    static const uint32_t sizes[BATCH] = { 16384, 4096, 8192, 1000, 16384 };
+    static const uint32_t whole[] = { 16384 };
+    midi *handles[BATCH];
+    int8_t *plain[BATCH], *out[BATCH], *buffers[BATCH];
+    uint32_t plain_total[BATCH], total[BATCH], usecs[BATCH];
+    int results[BATCH];
+    int res, i, playing;
+
+    for (i = 0; i < BATCH; i++) {
+        plain[i] = render(options[i], whole, 1, 0, &plain_total[i]);
+        handles[i] = WildMidi_OpenBuffer(song, song_size);
+        assert(handles[i] != NULL);
+        res = WildMidi_SetOption(handles[i], WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB
+                                 | WM_MO_SINC_RESAMPLING, options[i]);
+        assert(res == 0);
+        out[i] = (int8_t *) malloc(plain_total[i] + 16384);
+        assert(out[i] != NULL);
+        total[i] = 0;
+    }
+
+    res = WildMidi_SetBatchThreads(3);
+    assert(res == 0);
+    memset(usecs, 0, sizeof(usecs));
+    do {
+        for (i = 0; i < BATCH; i++)
+            buffers[i] = out[i] + total[i];
+        res = WildMidi_RenderBatch(handles, buffers, sizes, BATCH, results, usecs);
+        assert(res == 0);
+        playing = 0;
+        for (i = 0; i < BATCH; i++) {
+            assert(results[i] >= 0 && total[i] + (uint32_t) results[i] <= plain_total[i]);
+            total[i] += (uint32_t) results[i];
+            playing |= (results[i] > 0);
+        }
+    } while (playing);
+    for (i = 0; i < BATCH; i++) {
+        assert(total[i] == plain_total[i]);
+        assert(memcmp(out[i], plain[i], total[i]) == 0);
+        res = WildMidi_Close(handles[i]);
+        assert(res == 0);
+        free(out[i]);
+        free(plain[i]);
+    }
+
+    res = WildMidi_RenderBatch(NULL, buffers, sizes, BATCH, results, usecs);
+    assert(res == -1);
+    res = WildMidi_SetBatchThreads(0);
+    assert(res == 0);
+    (void) res;
+}
+
+/* argv[1], if given, is a directory the cache check can use */
+int main(int argc, char **argv) {
+    midi *keep;
+    int res;
+
+    res = WildMidi_Init("@opl3", RATE, 0);
+    assert(res == 0);
+    make_song(0, 100);
+    /* holds the song's patches loaded, so they are only generated once */
+    keep = WildMidi_OpenBuffer(song, song_size);
+    assert(keep != NULL);
+
+    check_slicing(0, 0);
+    check_slicing(WM_MO_ENHANCED_RESAMPLING, 1);
+    check_slicing(WM_MO_REVERB, 2);
+    check_slicing(WM_MO_SINC_8, 1);
+    check_slicing(WM_MO_SINC_32, 1);
+    check_formats(0);
+    check_formats(WM_MO_REVERB);
+    check_mixing(0);
+    check_mixing(WM_MO_SINC_8);
+    check_stems(0);
+    check_stems(WM_MO_REVERB | WM_MO_ENHANCED_RESAMPLING);
+    check_overwrite(0);
+    check_overwrite(WM_MO_REVERB);
+    check_voice_cap();
+    check_voice_pool();
+    check_seek();
+    check_accurate_seek();
+    check_events();
+    check_lyrics();
+    check_merge();
+    check_probe();
+    check_tempo_map();
+    check_batch();
+    if (argc > 1)
+        check_cache(argv[1]);
+
+    /* the sinc field only takes WM_MO_SINC_4 to WM_MO_SINC_32, set whole */
+    res = WildMidi_SetOption(keep, WM_MO_SINC_RESAMPLING, 0x0050);
+    assert(res == -1);
+    res = WildMidi_SetOption(keep, WM_MO_SINC_4, WM_MO_SINC_4);
+    assert(res == -1);
+    res = WildMidi_SetOption(keep, WM_MO_SINC_RESAMPLING, WM_MO_SINC_16);
+    assert(res == 0);
+    assert(WildMidi_GetInfo(keep)->mixer_options & WM_MO_SINC_16);
+
+    {
+        static char path[4096];
+        const char *err;
+        midi *handle;
+
+        WildMidi_ClearError();
+        assert(WildMidi_GetError() == NULL);
+        assert(WildMidi_GetErrorCode() == WM_ERR_NONE);
+        res = WildMidi_SetOption(NULL, WM_MO_REVERB, 0);
+        assert(res == -1);
+        err = WildMidi_GetError();
+        assert(err != NULL && strstr(err, "NULL handle") != NULL);
+        assert(WildMidi_GetErrorCode() == WM_ERR_INVALID_ARG);
+        /* the path goes into the message, cut short */
+        memset(path, 'x', sizeof(path) - 1);
+        handle = WildMidi_Open(path);
+        assert(handle == NULL);
+        err = WildMidi_GetError();
+        assert(err != NULL && strlen(err) <= 255);
+        assert(WildMidi_GetErrorCode() != WM_ERR_NONE);
+        WildMidi_ClearError();
+        assert(WildMidi_GetError() == NULL);
+        assert(WildMidi_GetErrorCode() == WM_ERR_NONE);
+        (void) err; (void) handle;
+    }
+
+    WildMidi_Close(keep);
+    res = WildMidi_Shutdown();
+    assert(res == 0);
+
+    check_stream((argc > 1) ? argv[1] : NULL);
+    check_contexts();
+    return (res);
+}